@@ -2,9 +2,10 @@
 #define EMA_CORE_DEVICE_H
 
 #include "device.user.h"
-#include "overflow.h"
 
+typedef struct OverflowData OverflowData;
 typedef struct Plugin Plugin;
+typedef struct ReadGuard ReadGuard;
 
 typedef struct Device
 {
@@ -13,7 +14,9 @@ typedef struct Device
     const char *type;
     const char *uid;
     void *data;
-    OverflowData overflow;
+    OverflowData* overflow;
+    ReadGuard* guard;  // NULL unless the plugin has a read deadline
+    size_t guard_index;  // in the devices of the guard
 } Device;
 
 #endif
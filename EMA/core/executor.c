@@ -0,0 +1,219 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <EMA/utils/error.h>
+
+#include "device.h"
+#include "executor.h"
+#include "guard.h"
+#include "overflow.h"
+#include "plugin.h"
+
+/* Read of one run of devices of the same plugin. Lives on the stack of the
+ * thread that requested the read. */
+typedef struct ReadJob
+{
+    const Device** devices;
+    size_t n;
+    unsigned long long* energy;
+    uint64_t* time;
+    unsigned char* stale;
+    int err;
+    sem_t* done;
+    struct ReadJob* next;
+} ReadJob;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    ReadJob* head;
+    ReadJob* tail;
+    pthread_t* threads;
+    size_t size;
+    int stop;
+    atomic_int running;
+} ReadExecutor;
+
+static ReadExecutor executor = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .head = NULL,
+    .tail = NULL,
+    .threads = NULL,
+    .size = 0,
+    .stop = 0,
+    .running = 0
+};
+
+static
+void run_job(ReadJob* job)
+{
+    /* Devices of a plugin are either all guarded or none is. */
+    if( job->devices[0]->guard )
+    {
+        job->err = EMA_guard_read(
+            job->devices, job->n, job->energy, job->time, job->stale);
+        return;
+    }
+
+    job->err = EMA_get_handled_energy_uj_batch(
+        job->devices, job->n, job->energy, job->time);
+    if( job->stale )
+        memset(job->stale, 0, job->n);
+}
+
+static
+void* read_worker(void* args)
+{
+    ReadExecutor* ex = args;
+
+    while( 1 )
+    {
+        pthread_mutex_lock(&ex->mutex);
+        while( !ex->head && !ex->stop )
+            pthread_cond_wait(&ex->cond, &ex->mutex);
+
+        if( !ex->head )
+        {
+            pthread_mutex_unlock(&ex->mutex);
+            return NULL;
+        }
+
+        ReadJob* job = ex->head;
+        ex->head = job->next;
+        if( !ex->head )
+            ex->tail = NULL;
+        pthread_mutex_unlock(&ex->mutex);
+
+        run_job(job);
+        sem_post(job->done);
+    }
+}
+
+int EMA_executor_start(size_t workers)
+{
+    ReadExecutor* ex = &executor;
+
+    if( workers == 0 || atomic_load(&ex->running) )
+        return 0;
+
+    ex->threads = malloc(sizeof(pthread_t) * workers);
+    ASSERT_MSG_OR_1(ex->threads, "Failed to allocate read workers.");
+
+    ex->stop = 0;
+    for(ex->size = 0; ex->size < workers; ++ex->size)
+    {
+        int ret = pthread_create(
+            ex->threads + ex->size, NULL, read_worker, ex);
+        if( ret != 0 )
+        {
+            ERROR_MSG("Failed to start read worker %zu.", ex->size);
+            EMA_executor_stop();
+            return 1;
+        }
+    }
+
+    atomic_store(&ex->running, 1);
+    return 0;
+}
+
+int EMA_executor_stop(void)
+{
+    ReadExecutor* ex = &executor;
+
+    atomic_store(&ex->running, 0);
+
+    pthread_mutex_lock(&ex->mutex);
+    ex->stop = 1;
+    pthread_cond_broadcast(&ex->cond);
+    pthread_mutex_unlock(&ex->mutex);
+
+    for(size_t i = 0; i < ex->size; ++i)
+        pthread_join(ex->threads[i], NULL);
+
+    free(ex->threads);
+    ex->threads = NULL;
+    ex->size = 0;
+
+    return 0;
+}
+
+/**
+ * Read devices with one batch per run of devices of the same plugin. With
+ * running workers, all runs but the first are read concurrently by the
+ * workers while the caller reads the first one. `stale` may be NULL,
+ * otherwise it receives per device whether a guarded read fell back to the
+ * last good sample.
+ */
+int EMA_executor_read_batch(
+    const Device** devices, size_t n, unsigned long long* energy,
+    uint64_t* time, unsigned char* stale)
+{
+    ReadExecutor* ex = &executor;
+    ReadJob jobs[n ? n : 1];
+    size_t num_jobs = 0;
+
+    for(size_t begin = 0; begin < n; )
+    {
+        size_t end = begin + 1;
+        while( end < n && devices[end]->plugin == devices[begin]->plugin )
+            ++end;
+
+        jobs[num_jobs++] = (ReadJob) {
+            .devices = devices + begin,
+            .n = end - begin,
+            .energy = energy + begin,
+            .time = time + begin,
+            .stale = stale ? stale + begin : NULL,
+            .err = 0,
+            .done = NULL,
+            .next = NULL
+        };
+        begin = end;
+    }
+
+    if( num_jobs > 1 && atomic_load_explicit(
+        &ex->running, memory_order_relaxed) )
+    {
+        sem_t done;
+        sem_init(&done, 0, 0);
+
+        pthread_mutex_lock(&ex->mutex);
+        for(size_t i = 1; i < num_jobs; ++i)
+        {
+            jobs[i].done = &done;
+            if( ex->tail )
+                ex->tail->next = jobs + i;
+            else
+                ex->head = jobs + i;
+            ex->tail = jobs + i;
+        }
+        pthread_cond_broadcast(&ex->cond);
+        pthread_mutex_unlock(&ex->mutex);
+
+        run_job(jobs);
+
+        for(size_t i = 1; i < num_jobs; ++i)
+            while( sem_wait(&done) != 0 && errno == EINTR )
+                ;
+        sem_destroy(&done);
+    }
+    else
+    {
+        for(size_t i = 0; i < num_jobs; ++i)
+            run_job(jobs + i);
+    }
+
+    int err = 0;
+    for(size_t i = 0; i < num_jobs; ++i)
+        if( jobs[i].err != 0 )
+            err = jobs[i].err;
+
+    return err;
+}
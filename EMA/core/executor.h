@@ -0,0 +1,18 @@
+#ifndef EMA_CORE_EXECUTOR_H
+#define EMA_CORE_EXECUTOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "device.h"
+
+/* Environment variable with the number of read workers (0: disabled). */
+#define EMA_READ_WORKERS "EMA_READ_WORKERS"
+
+int EMA_executor_start(size_t workers);
+int EMA_executor_stop(void);
+int EMA_executor_read_batch(
+    const Device** devices, size_t n, unsigned long long* energy,
+    uint64_t* time, unsigned char* stale);
+
+#endif
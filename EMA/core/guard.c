@@ -0,0 +1,307 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <EMA/utils/error.h>
+#include <EMA/utils/time.h>
+
+#include "guard.h"
+#include "overflow.h"
+#include "plugin.h"
+
+#define DEFAULT_FAILURE_LIMIT 3
+#define DEFAULT_PROBE_MS 1000
+
+static
+unsigned long long env_or(const char* name, unsigned long long fallback)
+{
+    const char* value = getenv(name);
+    if( !value || !*value )
+        return fallback;
+    return strtoull(value, NULL, 10);
+}
+
+static
+struct timespec deadline_in_us(uint64_t us)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += us / 1000000;
+    ts.tv_nsec += (us % 1000000) * 1000;
+    if( ts.tv_nsec >= 1000000000 )
+    {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000;
+    }
+    return ts;
+}
+
+/* Called with the mutex held. Counts read `read` as missed once. */
+static
+void count_failure(ReadGuard* guard, unsigned long long read)
+{
+    if( guard->missed == read )
+        return;
+
+    guard->missed = read;
+    if( ++guard->failures >= guard->failure_limit )
+        atomic_store(&guard->open, 1);
+}
+
+/* Only called by the reader, or before it runs. */
+static
+void publish(
+    ReadGuard* guard, const unsigned long long* energy, const uint64_t* time)
+{
+    EMA_seqlock_write_begin(&guard->seq);
+    for(size_t i = 0; i < guard->n; ++i)
+    {
+        atomic_store_explicit(
+            guard->energy + i, energy[i], memory_order_relaxed);
+        atomic_store_explicit(guard->time + i, time[i], memory_order_relaxed);
+    }
+    EMA_seqlock_write_end(&guard->seq);
+}
+
+static
+void* guard_reader(void* args)
+{
+    ReadGuard* guard = args;
+    unsigned long long energy[guard->n];
+    uint64_t time[guard->n];
+
+    pthread_mutex_lock(&guard->mutex);
+    while( 1 )
+    {
+        int probe = 0;
+        while( !guard->stop && !guard->requested && !probe )
+        {
+            if( atomic_load(&guard->open) )
+            {
+                struct timespec ts = deadline_in_us(guard->probe_ms * 1000);
+                if( pthread_cond_timedwait(
+                    &guard->cond, &guard->mutex, &ts) == ETIMEDOUT )
+                    probe = 1;
+            }
+            else
+                pthread_cond_wait(&guard->cond, &guard->mutex);
+        }
+
+        if( guard->stop )
+            break;
+
+        unsigned long long read = ++guard->reads;
+        guard->requested = 0;
+        guard->in_flight = 1;
+        guard->read_deadline = deadline_in_us(guard->deadline_us);
+        pthread_mutex_unlock(&guard->mutex);
+
+        uint64_t start = EMA_get_time_in_us();
+        int err = EMA_get_handled_energy_uj_batch(
+            guard->devices, guard->n, energy, time);
+        uint64_t elapsed = EMA_get_time_in_us() - start;
+
+        for(size_t i = 0; !err && i < guard->n; ++i)
+            err = energy[i] < atomic_load_explicit(
+                guard->energy + i, memory_order_relaxed);
+        if( !err )
+            publish(guard, energy, time);
+
+        pthread_mutex_lock(&guard->mutex);
+        if( !err )
+            ++guard->generation;
+
+        if( err || elapsed > guard->deadline_us )
+            count_failure(guard, read);
+        else
+        {
+            guard->failures = 0;
+            atomic_store(&guard->open, 0);
+        }
+
+        guard->in_flight = 0;
+        pthread_cond_broadcast(&guard->done);
+    }
+    pthread_mutex_unlock(&guard->mutex);
+
+    return NULL;
+}
+
+static
+void free_guard(ReadGuard* guard)
+{
+    pthread_mutex_destroy(&guard->mutex);
+    pthread_cond_destroy(&guard->cond);
+    pthread_cond_destroy(&guard->done);
+    free(guard->devices);
+    free(guard->energy);
+    free(guard->time);
+    free(guard);
+}
+
+/**
+ * Guard the reads of `devices`, all of the same plugin, by one reader.
+ */
+int EMA_guard_create(Device** devices, size_t n, uint64_t deadline_us)
+{
+    ReadGuard* guard = calloc(1, sizeof(ReadGuard));
+    ASSERT_MSG_OR_1(guard, "Failed to allocate read guard.");
+
+    guard->devices = malloc(sizeof(Device*) * n);
+    guard->energy = malloc(sizeof(*guard->energy) * n);
+    guard->time = malloc(sizeof(*guard->time) * n);
+    guard->n = n;
+    guard->deadline_us = deadline_us;
+    guard->failure_limit = env_or(EMA_READ_FAILURES, DEFAULT_FAILURE_LIMIT);
+    guard->probe_ms = env_or(EMA_READ_PROBE_MS, DEFAULT_PROBE_MS);
+    if( guard->failure_limit == 0 )
+        guard->failure_limit = 1;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&guard->mutex, NULL);
+    pthread_cond_init(&guard->cond, &attr);
+    pthread_cond_init(&guard->done, &attr);
+    pthread_condattr_destroy(&attr);
+    atomic_init(&guard->open, 0);
+    atomic_init(&guard->seq, 0);
+
+    if( !guard->devices || !guard->energy || !guard->time )
+    {
+        free_guard(guard);
+        ERROR_MSG("Failed to allocate read guard.");
+        return 1;
+    }
+
+    for(size_t i = 0; i < n; ++i)
+        guard->devices[i] = devices[i];
+
+    /* The first sample is taken synchronously, there is nothing to fall
+     * back to yet. */
+    unsigned long long energy[n];
+    uint64_t time[n];
+    memset(energy, 0, sizeof(energy));
+    memset(time, 0, sizeof(time));
+    if( EMA_get_handled_energy_uj_batch(guard->devices, n, energy, time) != 0 )
+        ERROR_MSG("Initial read of plugin '%s' failed.",
+            devices[0]->plugin->name);
+    publish(guard, energy, time);
+
+    if( pthread_create(&guard->thread, NULL, guard_reader, guard) != 0 )
+    {
+        ERROR_MSG("Failed to start the reader of plugin '%s'.",
+            devices[0]->plugin->name);
+        free_guard(guard);
+        return 1;
+    }
+
+    for(size_t i = 0; i < n; ++i)
+    {
+        devices[i]->guard = guard;
+        devices[i]->guard_index = i;
+    }
+    return 0;
+}
+
+/**
+ * Stop the guard of `device` and of the other devices of its plugin.
+ */
+void EMA_guard_destroy(Device* device)
+{
+    ReadGuard* guard = device->guard;
+    if( !guard )
+        return;
+
+    pthread_mutex_lock(&guard->mutex);
+    guard->stop = 1;
+    pthread_cond_signal(&guard->cond);
+    pthread_mutex_unlock(&guard->mutex);
+    pthread_join(guard->thread, NULL);
+
+    for(size_t i = 0; i < guard->n; ++i)
+        ((Device*) guard->devices[i])->guard = NULL;
+    free_guard(guard);
+}
+
+/**
+ * Read guarded devices of the same plugin within one deadline. Sets `stale`
+ * per device if the returned sample is the last good one instead of a fresh
+ * read. A caller only waits for a read in flight until that read is late.
+ */
+int EMA_guard_read(
+    const Device** devices, size_t n, unsigned long long* energy,
+    uint64_t* time, unsigned char* stale)
+{
+    ReadGuard* guard = devices[0]->guard;
+    int fresh = 0;
+
+    if( !atomic_load_explicit(&guard->open, memory_order_relaxed) )
+    {
+        pthread_mutex_lock(&guard->mutex);
+        unsigned long long generation = guard->generation;
+        if( !guard->in_flight && !guard->requested )
+        {
+            guard->requested = 1;
+            pthread_cond_signal(&guard->cond);
+        }
+
+        struct timespec ts = guard->in_flight
+            ? guard->read_deadline : deadline_in_us(guard->deadline_us);
+        while( generation == guard->generation
+            && (guard->requested || guard->in_flight) )
+        {
+            if( pthread_cond_timedwait(
+                &guard->done, &guard->mutex, &ts) == ETIMEDOUT )
+            {
+                if( generation == guard->generation
+                    && (guard->requested || guard->in_flight) )
+                    count_failure(guard, guard->reads + !guard->in_flight);
+                break;
+            }
+        }
+        fresh = generation != guard->generation;
+        pthread_mutex_unlock(&guard->mutex);
+    }
+
+    unsigned int seq;
+    do
+    {
+        seq = EMA_seqlock_read_begin(&guard->seq);
+        for(size_t i = 0; i < n; ++i)
+        {
+            size_t k = devices[i]->guard_index;
+            energy[i] = atomic_load_explicit(
+                guard->energy + k, memory_order_relaxed);
+            time[i] = atomic_load_explicit(
+                guard->time + k, memory_order_relaxed);
+        }
+    } while( EMA_seqlock_read_retry(&guard->seq, seq) );
+
+    if( stale )
+        memset(stale, !fresh, n);
+
+    return 0;
+}
+
+/**
+ * Deadline in us for `plugin` from a list like "MQTT:200000,NVML:5000".
+ * Returns 0 (no deadline) if the plugin is not listed.
+ */
+uint64_t EMA_guard_parse_deadline(const char* config, const char* plugin)
+{
+    size_t len = strlen(plugin);
+
+    while( config && *config )
+    {
+        if( strncmp(config, plugin, len) == 0 && config[len] == ':' )
+            return strtoull(config + len + 1, NULL, 10);
+
+        config = strchr(config, ',');
+        if( config )
+            ++config;
+    }
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+#ifndef EMA_CORE_GUARD_H
+#define EMA_CORE_GUARD_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include "device.h"
+#include "seqlock.h"
+
+/* Environment variables configuring guarded reads. */
+#define EMA_READ_DEADLINE_US "EMA_READ_DEADLINE_US"  // <plugin>:<us>[,...]
+#define EMA_READ_FAILURES "EMA_READ_FAILURES"
+#define EMA_READ_PROBE_MS "EMA_READ_PROBE_MS"
+
+/*
+ * Deadline-bounded reads of the devices of one plugin. A reader thread owned
+ * by the guard reads all devices in one batch, so a caller never waits longer
+ * than one deadline per plugin. Late or failed reads fall back to the last
+ * good sample, which callers load without a lock. A read counts as one
+ * failure however many callers missed it. After `failure_limit` consecutive
+ * failures the breaker opens: callers get the last good sample without
+ * waiting and the reader probes the devices every `probe_ms` until a read
+ * succeeds within the deadline.
+ */
+typedef struct ReadGuard
+{
+    const Device** devices;  // all devices of the plugin
+    size_t n;
+    uint64_t deadline_us;
+    unsigned int failure_limit;
+    uint64_t probe_ms;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;  // caller -> reader: read requested
+    pthread_cond_t done;  // reader -> callers: read finished
+    pthread_t thread;
+    int requested;
+    int in_flight;
+    int stop;
+    struct timespec read_deadline;  // of the read in flight
+    unsigned long long reads;  // started by the reader
+    unsigned long long missed;  // last read counted as a failure
+    unsigned int failures;
+    unsigned long long generation;
+    atomic_int open;
+
+    /* Last good sample per device, published by the reader. */
+    EMA_seqlock seq;
+    _Atomic unsigned long long* energy;
+    _Atomic uint64_t* time;
+} ReadGuard;
+
+int EMA_guard_create(Device** devices, size_t n, uint64_t deadline_us);
+void EMA_guard_destroy(Device* device);
+int EMA_guard_read(
+    const Device** devices, size_t n, unsigned long long* energy,
+    uint64_t* time, unsigned char* stale);
+uint64_t EMA_guard_parse_deadline(const char* config, const char* plugin);
+
+#endif
@@ -1,96 +1,327 @@
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <poll.h>
 #include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
+#include <EMA/utils/time.h>
+
 #include "device.h"
+#include "overflow.h"
 #include "plugin.h"
 #include "registry.h"
 
 #define ASSERT_1(expr, msg) if (!(expr)) { perror(msg); return 1; }
 
-pthread_t overflow_handler;
+/* Sample each device this many times per wrap interval. */
+#define OVERFLOW_SAFETY_FACTOR 2
+#define NS_PER_MS 1000000ULL
+#define NS_PER_S 1000000000ULL
+
+typedef struct
+{
+    uint64_t deadline_ns;
+    uint64_t period_ns;
+    Device* device;
+} OverflowTimer;
 
+/* Min-heap of per-device deadlines, owned by the overflow thread. */
+typedef struct
+{
+    OverflowTimer* heap;
+    size_t size;
+    int timer_fd;
+    int stop_fd;
+    pthread_t thread;
+    int running;
+} OverflowScheduler;
+
+static OverflowScheduler scheduler = {
+    .heap = NULL,
+    .size = 0,
+    .timer_fd = -1,
+    .stop_fd = -1,
+    .running = 0
+};
+
+/* Single writer: only called from the overflow thread. */
 static
-int init_mutex(pthread_mutex_t *mutex)
+void publish_overflow(
+    OverflowData* ofd, unsigned long long count, unsigned long long old)
 {
-    int ret;
+    EMA_seqlock_write_begin(&ofd->seq);
+    atomic_store_explicit(&ofd->count, count, memory_order_relaxed);
+    atomic_store_explicit(&ofd->old, old, memory_order_relaxed);
+    EMA_seqlock_write_end(&ofd->seq);
+}
 
-    ret = pthread_mutex_init(mutex, NULL);
-    ASSERT_1(!ret, "Failed to run `pthread_mutex_init()`.");
+static
+void read_overflow(
+    const OverflowData* ofd,
+    unsigned long long* count,
+    unsigned long long* old)
+{
+    OverflowData* data = (OverflowData*) ofd;
+    unsigned int seq;
 
-    return 0;
+    do
+    {
+        seq = EMA_seqlock_read_begin(&data->seq);
+        *count = atomic_load_explicit(&data->count, memory_order_relaxed);
+        *old = atomic_load_explicit(&data->old, memory_order_relaxed);
+    } while( EMA_seqlock_read_retry(&data->seq, seq) );
 }
 
+/**
+ * Read raw values of devices that all belong to the same plugin. Falls back
+ * to single reads for plugins without a batch callback.
+ */
 static
-int destroy_mutex(pthread_mutex_t *mutex)
+int read_energy_uj_batch(
+    const Device** devices, size_t n, unsigned long long* energy,
+    uint64_t* time)
 {
-    int ret;
+    const PluginCallbacks* cbs = &devices[0]->plugin->cbs;
 
-    ret = pthread_mutex_destroy(mutex);
-    ASSERT_1(!ret, "Failed to run `pthread_mutex_destroy()`.");
+    if( cbs->get_energy_uj_batch )
+        return cbs->get_energy_uj_batch(devices, n, energy, time);
 
+    for(size_t i = 0; i < n; ++i)
+    {
+        time[i] = EMA_get_time_in_us();
+        energy[i] = cbs->get_energy_uj(devices[i]);
+    }
     return 0;
 }
 
 static
-void* track_overflows(void* args)
+uint64_t now_ns(void)
 {
-    DevicePtrArray* dev_ptrs = args;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
 
-    uint64_t min_interval = UINT64_MAX;
-    for(int i = 0; i < dev_ptrs->size; i++)
+static
+void heap_sift_down(OverflowTimer* heap, size_t size, size_t i)
+{
+    while( 1 )
     {
-        Device* device = dev_ptrs->array[i];
-        uint64_t interval =
-            device->plugin->cbs.get_energy_update_interval(device);
+        size_t min = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+
+        if( left < size && heap[left].deadline_ns < heap[min].deadline_ns )
+            min = left;
+        if( right < size && heap[right].deadline_ns < heap[min].deadline_ns )
+            min = right;
+        if( min == i )
+            return;
 
-        if( interval > 0 && interval < min_interval )
-                min_interval = interval;
+        OverflowTimer tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
     }
+}
+
+/**
+ * Sample devices of the same plugin with one batch read and publish their
+ * wrap state.
+ */
+static
+void update_overflow_batch(const Device** devices, size_t n)
+{
+    unsigned long long count[n], old[n], cur_e[n];
+    uint64_t time[n];
+
+    for(size_t i = 0; i < n; ++i)
+        read_overflow(devices[i]->overflow, count + i, old + i);
+
+    if( read_energy_uj_batch(devices, n, cur_e, time) != 0 )
+        return;
+
+    for(size_t i = 0; i < n; ++i)
+    {
+        if( old[i] > cur_e[i] )
+            count[i]++;
+        publish_overflow(devices[i]->overflow, count[i], cur_e[i]);
+    }
+}
+
+static
+int compare_plugins(const void* a, const void* b)
+{
+    uintptr_t lhs = (uintptr_t) (*(const Device**) a)->plugin;
+    uintptr_t rhs = (uintptr_t) (*(const Device**) b)->plugin;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+/**
+ * Sample the due devices grouped by plugin.
+ */
+static
+void update_overflows(const Device** due, size_t n)
+{
+    qsort(due, n, sizeof(Device*), compare_plugins);
+
+    size_t begin = 0;
+    while( begin < n )
+    {
+        size_t end = begin + 1;
+        while( end < n && due[end]->plugin == due[begin]->plugin )
+            ++end;
+        update_overflow_batch(due + begin, end - begin);
+        begin = end;
+    }
+}
+
+static
+int arm_timer(int timer_fd, uint64_t deadline_ns)
+{
+    struct itimerspec its = {
+        .it_interval = { 0, 0 },
+        .it_value = {
+            .tv_sec = deadline_ns / NS_PER_S,
+            .tv_nsec = deadline_ns % NS_PER_S
+        }
+    };
+    return timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static
+void* track_overflows(void* args)
+{
+    OverflowScheduler* sched = args;
+    OverflowTimer* heap = sched->heap;
+    const Device** due = malloc(sizeof(Device*) * sched->size);
+
+    struct pollfd fds[2] = {
+        { .fd = sched->timer_fd, .events = POLLIN },
+        { .fd = sched->stop_fd, .events = POLLIN }
+    };
 
     while( 1 )
     {
-        for(int i = 0; i < dev_ptrs->size; i++)
+        if( arm_timer(sched->timer_fd, heap[0].deadline_ns) != 0 )
         {
-            Device* device = dev_ptrs->array[i];
-            uint64_t interval =
-                device->plugin->cbs.get_energy_update_interval(device);
-
-            if( interval == 0 )
-                continue;
-
-            unsigned long long cur_e;
-            OverflowData* ofd = &device->overflow;
-
-            /* Thread safe! Only single writer, no readers allowed. */
-            pthread_mutex_lock(&ofd->mutex);
-            cur_e = device->plugin->cbs.get_energy_uj(device);
-            if( device->overflow.old > cur_e )
-                ofd->count++;
-            ofd->old = cur_e;
-            pthread_mutex_unlock(&ofd->mutex);
+            perror("Failed to arm overflow timer");
+            break;
         }
-        usleep((uint64_t) min_interval * 1000);
+
+        if( poll(fds, 2, -1) < 0 )
+            continue;
+
+        if( fds[1].revents & POLLIN )
+            break;
+
+        uint64_t expirations;
+        if( read(sched->timer_fd, &expirations, sizeof(expirations)) < 0 )
+            continue;
+
+        /* Collect and reschedule every device that is due. */
+        size_t num_due = 0;
+        uint64_t now = now_ns();
+        while( heap[0].deadline_ns <= now && num_due < sched->size )
+        {
+            due[num_due++] = heap[0].device;
+
+            heap[0].deadline_ns += heap[0].period_ns;
+            if( heap[0].deadline_ns <= now )
+                heap[0].deadline_ns = now + heap[0].period_ns;
+            heap_sift_down(heap, sched->size, 0);
+        }
+
+        update_overflows(due, num_due);
     }
+
+    free(due);
+    return NULL;
 }
 
 int start_overflow_tracking(DevicePtrArray* dev_ptrs)
 {
+    OverflowScheduler* sched = &scheduler;
+
+    sched->heap = malloc(sizeof(OverflowTimer) * dev_ptrs->size);
+    ASSERT_1(sched->heap || dev_ptrs->size == 0, "Failed to allocate heap.");
+
+    /* Only devices that can wrap get a deadline. */
+    uint64_t now = now_ns();
+    sched->size = 0;
+    for(size_t i = 0; i < dev_ptrs->size; i++)
+    {
+        Device* device = dev_ptrs->array[i];
+        uint64_t interval =
+            device->plugin->cbs.get_energy_update_interval(device);
+        if( interval == 0 )
+            continue;
+
+        uint64_t period_ns = interval * NS_PER_MS / OVERFLOW_SAFETY_FACTOR;
+        if( period_ns == 0 )
+            period_ns = 1;
+
+        OverflowTimer* timer = sched->heap + sched->size++;
+        timer->device = device;
+        timer->period_ns = period_ns;
+        timer->deadline_ns = now + period_ns;
+    }
+
+    /* Nothing can wrap: no thread at all. */
+    if( sched->size == 0 )
+    {
+        free(sched->heap);
+        sched->heap = NULL;
+        return 0;
+    }
+
+    for(size_t i = sched->size / 2; i-- > 0; )
+        heap_sift_down(sched->heap, sched->size, i);
+
+    sched->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    ASSERT_1(sched->timer_fd >= 0, "Failed to create overflow timer.");
+
+    sched->stop_fd = eventfd(0, EFD_CLOEXEC);
+    ASSERT_1(sched->stop_fd >= 0, "Failed to create overflow eventfd.");
+
     int ret = pthread_create(
-        &overflow_handler, NULL, &track_overflows, (void *) dev_ptrs);
+        &sched->thread, NULL, &track_overflows, (void *) sched);
     ASSERT_1(!ret, "Failed to start overflow_tracking.");
+    sched->running = 1;
+
+    return 0;
 }
 
 int stop_overflow_tracking(void)
 {
-    int ret = pthread_cancel(overflow_handler);
-    ASSERT_1(!ret, "Failed to cancel overflow thread.");
+    OverflowScheduler* sched = &scheduler;
 
-    ret = pthread_join(overflow_handler, NULL);
-    ASSERT_1(!ret, "Failed to join overflow thread.");
+    if( sched->running )
+    {
+        uint64_t one = 1;
+        ssize_t ret = write(sched->stop_fd, &one, sizeof(one));
+        ASSERT_1(ret == sizeof(one), "Failed to stop overflow thread.");
+
+        int err = pthread_join(sched->thread, NULL);
+        ASSERT_1(!err, "Failed to join overflow thread.");
+        sched->running = 0;
+    }
+
+    if( sched->timer_fd >= 0 )
+        close(sched->timer_fd);
+    if( sched->stop_fd >= 0 )
+        close(sched->stop_fd);
+    sched->timer_fd = -1;
+    sched->stop_fd = -1;
+
+    free(sched->heap);
+    sched->heap = NULL;
+    sched->size = 0;
 
     return 0;
 }
@@ -98,14 +329,13 @@ int stop_overflow_tracking(void)
 unsigned long long EMA_get_handled_energy_uj(const Device* device)
 {
     PluginCallbacks cbs = device->plugin->cbs;
-    const OverflowData* ofd = &device->overflow;
+    unsigned long long old, count;
 
-    /* Thread safe! Multiple readers allowed, no writers. */
-    pthread_mutex_lock((pthread_mutex_t*)&ofd->mutex);
-    unsigned long long old = ofd->old;
-    unsigned long long count = ofd->count;
+    /* Take the published wrap state first, then read the hardware outside
+     * of any lock. A wrap since the last publication shows up as a value
+     * below `old`. */
+    read_overflow(device->overflow, &count, &old);
     unsigned long long cur_energy = cbs.get_energy_uj(device);
-    pthread_mutex_unlock((pthread_mutex_t*)&ofd->mutex);
 
     if( old > cur_energy )
         count++;
@@ -113,19 +343,56 @@ unsigned long long EMA_get_handled_energy_uj(const Device* device)
     return count * cbs.get_energy_max(device) + cur_energy;
 }
 
+int EMA_get_handled_energy_uj_batch(
+    const Device** devices, size_t n, unsigned long long* energy,
+    uint64_t* time)
+{
+    if( n == 0 )
+        return 0;
+
+    /* All devices belong to the same plugin. */
+    const PluginCallbacks* cbs = &devices[0]->plugin->cbs;
+    unsigned long long count[n], old[n];
+
+    for(size_t i = 0; i < n; ++i)
+        read_overflow(devices[i]->overflow, count + i, old + i);
+
+    int err = read_energy_uj_batch(devices, n, energy, time);
+
+    for(size_t i = 0; i < n; ++i)
+    {
+        if( old[i] > energy[i] )
+            count[i]++;
+        energy[i] += count[i] * cbs->get_energy_max(devices[i]);
+    }
+
+    return err;
+}
+
 int EMA_init_overflow(Device* device)
 {
-    EMA_plugin_cb_get_energy_uj get_energy = device->plugin->cbs.get_energy_uj;
-    device->overflow.count = 0;
-    device->overflow.old = get_energy(device);
-    int ret = init_mutex(&device->overflow.mutex);
-    ASSERT_1(!ret, "Failed to run `init_mutex()`.");
+    const PluginCallbacks* cbs = &device->plugin->cbs;
+
+    OverflowData* ofd = aligned_alloc(
+        EMA_CACHE_LINE_SIZE, sizeof(OverflowData));
+    ASSERT_1(ofd, "Failed to allocate overflow data.");
+
+    /* A device that cannot wrap is never sampled, so it needs no first
+     * reading, which may block until the device has a value. */
+    unsigned long long old = 0;
+    if( cbs->get_energy_update_interval(device) != 0 )
+        old = cbs->get_energy_uj(device);
+
+    atomic_init(&ofd->seq, 0);
+    atomic_init(&ofd->count, 0);
+    atomic_init(&ofd->old, old);
+    device->overflow = ofd;
     return 0;
 }
 
 int EMA_finalize_overflow(Device* device)
 {
-    int ret = destroy_mutex(&device->overflow.mutex);
-    ASSERT_1(!ret, "Failed to run `destroy_mutex()`.");
+    free(device->overflow);
+    device->overflow = NULL;
     return 0;
 }
@@ -1,23 +1,34 @@
 #ifndef EMA_CORE_OVERFLOW_H
 #define EMA_CORE_OVERFLOW_H
 
+#include <stdatomic.h>
 #include <stdint.h>
 
 #include <pthread.h>
 
 #include "plugin.h"
 #include "registry.h"
+#include "seqlock.h"
+#include "utils.h"
 
+/*
+ * Wrap state of a device published by the overflow thread (single writer)
+ * with a sequence lock. Readers never block and never write. Each instance
+ * occupies its own cache line.
+ */
 typedef struct OverflowData
 {
-    unsigned long long count;
-    unsigned long long old;
-    pthread_mutex_t mutex;
+    _Alignas(EMA_CACHE_LINE_SIZE) EMA_seqlock seq;
+    _Atomic unsigned long long count;
+    _Atomic unsigned long long old;
 } OverflowData;
 
 int start_overflow_tracking(DevicePtrArray* dev_ptrs);
 int stop_overflow_tracking(void);
 unsigned long long EMA_get_handled_energy_uj(const Device* device);
+int EMA_get_handled_energy_uj_batch(
+    const Device** devices, size_t n, unsigned long long* energy,
+    uint64_t* time);
 int EMA_init_overflow(Device* device);
 int EMA_finalize_overflow(Device* device);
 
@@ -2,6 +2,7 @@
 #define EMA_CORE_PLUGIN_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "device.h"
 #include "plugin.user.h"
@@ -14,6 +15,10 @@ typedef unsigned long long
     (*EMA_plugin_cb_get_energy_update_interval)(const Device*);  // in ms
 typedef unsigned long long (*EMA_plugin_cb_get_energy_max)(const Device*);
 typedef unsigned long long (*EMA_plugin_cb_get_energy_uj)(const Device*);
+/* Optional: read `n` devices of the plugin at once. Stores energy in uJ and
+ * the sample time in us per device. Returns 0 on success. */
+typedef int (*EMA_plugin_cb_get_energy_uj_batch)(
+    const Device**, size_t n, unsigned long long *out, uint64_t *ts);
 typedef int (*EMA_plugin_cb_finalize)(Plugin*);
 
 typedef struct
@@ -23,6 +28,7 @@ typedef struct
     EMA_plugin_cb_get_energy_update_interval get_energy_update_interval;
     EMA_plugin_cb_get_energy_max get_energy_max;
     EMA_plugin_cb_get_energy_uj get_energy_uj;
+    EMA_plugin_cb_get_energy_uj_batch get_energy_uj_batch;  // may be NULL
     EMA_plugin_cb_finalize finalize;
 } PluginCallbacks;
 
@@ -0,0 +1,50 @@
+#ifndef EMA_CORE_SEQLOCK_H
+#define EMA_CORE_SEQLOCK_H
+
+#include <stdatomic.h>
+
+/*
+ * Sequence lock for single-writer data. Protected fields must be atomics
+ * accessed with relaxed ordering. Readers retry instead of blocking:
+ *
+ *     do {
+ *         seq = EMA_seqlock_read_begin(&lock);
+ *         ... relaxed loads ...
+ *     } while( EMA_seqlock_read_retry(&lock, seq) );
+ */
+typedef atomic_uint EMA_seqlock;
+
+static inline
+void EMA_seqlock_write_begin(EMA_seqlock* lock)
+{
+    unsigned int seq = atomic_load_explicit(lock, memory_order_relaxed);
+    atomic_store_explicit(lock, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline
+void EMA_seqlock_write_end(EMA_seqlock* lock)
+{
+    unsigned int seq = atomic_load_explicit(lock, memory_order_relaxed);
+    atomic_store_explicit(lock, seq + 1, memory_order_release);
+}
+
+static inline
+unsigned int EMA_seqlock_read_begin(const EMA_seqlock* lock)
+{
+    unsigned int seq;
+    while( (seq = atomic_load_explicit(
+        (EMA_seqlock*) lock, memory_order_acquire)) & 1 )
+        ;
+    return seq;
+}
+
+static inline
+int EMA_seqlock_read_retry(const EMA_seqlock* lock, unsigned int seq)
+{
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(
+        (EMA_seqlock*) lock, memory_order_relaxed) != seq;
+}
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <stdlib.h>
 
+#define EMA_CACHE_LINE_SIZE 64
+
 void* realloc_s(void* ptr, size_t size);
 
 #endif
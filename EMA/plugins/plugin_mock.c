@@ -0,0 +1,276 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include <EMA/core/device.h>
+#include <EMA/core/overflow.h>
+#include <EMA/core/plugin.h>
+#include <EMA/core/registry.h>
+#include <EMA/utils/error.h>
+#include <EMA/utils/time.h>
+
+#include <EMA/plugins/plugin_mock.user.h>
+
+#define DEVICE_TYPE "misc"
+#define DEVICE_NAME_SIZE 32
+
+/* ****************************************************************************
+**** Typedefs
+**************************************************************************** */
+typedef struct
+{
+    char name[DEVICE_NAME_SIZE];
+    char uid[DEVICE_NAME_SIZE];
+
+    /* Random power model: energy integrated over the reads. */
+    pthread_mutex_t mutex;
+    unsigned long long energy;
+    uint64_t time;
+    uint64_t rng;
+} MockDeviceData;
+
+typedef struct
+{
+    MockPluginConfig config;
+    DeviceArray devices;
+    uint64_t start_us;
+} MockPluginData;
+
+/* ****************************************************************************
+**** Utils
+**************************************************************************** */
+static
+uint64_t xorshift64(uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static
+void wait_latency(const MockPluginConfig* config)
+{
+    if( config->read_latency_us == 0 )
+        return;
+
+    if( config->latency_mode == MOCK_LATENCY_SLEEP )
+    {
+        struct timespec ts = {
+            .tv_sec = config->read_latency_us / 1000000,
+            .tv_nsec = (config->read_latency_us % 1000000) * 1000L
+        };
+        nanosleep(&ts, NULL);
+        return;
+    }
+
+    uint64_t end = EMA_get_time_in_us() + config->read_latency_us;
+    while( EMA_get_time_in_us() < end )
+        ;
+}
+
+/* Total energy of a device in uJ at `now` (us), before wrapping. */
+static
+unsigned long long total_energy(
+    const MockPluginData* p_data, MockDeviceData* d_data, uint64_t now)
+{
+    const MockPluginConfig* config = &p_data->config;
+
+    /* W * us = uJ */
+    if( config->power_model == MOCK_POWER_RAMP )
+        return (unsigned long long) (
+            config->power_w * (now - p_data->start_us));
+
+    pthread_mutex_lock(&d_data->mutex);
+    if( now > d_data->time )
+    {
+        double u = (double) (xorshift64(&d_data->rng) >> 11) / (1ULL << 53);
+        double power = config->power_w + config->noise_w * (2 * u - 1);
+        if( power > 0 )
+            d_data->energy += (unsigned long long) (
+                power * (now - d_data->time));
+        d_data->time = now;
+    }
+    unsigned long long energy = d_data->energy;
+    pthread_mutex_unlock(&d_data->mutex);
+
+    return energy;
+}
+
+static
+unsigned long long read_device(const Device* device, uint64_t now)
+{
+    const MockPluginData* p_data = device->plugin->data;
+    unsigned long long energy = total_energy(p_data, device->data, now);
+
+    if( p_data->config.max_range_uj )
+        return energy % p_data->config.max_range_uj;
+    return energy;
+}
+
+/* ****************************************************************************
+**** Plugin interface
+**************************************************************************** */
+static
+int mock_plugin_init(Plugin* plugin)
+{
+    MockPluginData* p_data = plugin->data;
+    size_t n = p_data->config.num_devices;
+
+    p_data->start_us = EMA_get_time_in_us();
+    p_data->devices.array = malloc(sizeof(Device) * n);
+    ASSERT_MSG_OR_1(p_data->devices.array, "Failed to allocate devices.");
+
+    for(size_t i = 0; i < n; ++i)
+    {
+        Device* device = p_data->devices.array + i;
+        MockDeviceData* d_data = malloc(sizeof(MockDeviceData));
+        ASSERT_MSG_OR_1(d_data, "Failed to allocate device data.");
+
+        snprintf(d_data->name, DEVICE_NAME_SIZE, "mock-%zu", i);
+        snprintf(d_data->uid, DEVICE_NAME_SIZE, "%zu", i);
+        pthread_mutex_init(&d_data->mutex, NULL);
+        d_data->energy = 0;
+        d_data->time = p_data->start_us;
+        d_data->rng = 0x9e3779b97f4a7c15ULL ^ (p_data->config.seed + i + 1);
+
+        device->plugin = plugin;
+        device->name = d_data->name;
+        device->type = DEVICE_TYPE;
+        device->uid = d_data->uid;
+        device->data = d_data;
+        ++p_data->devices.size;
+
+        int ret = EMA_init_overflow(device);
+        ASSERT_MSG_OR_1(!ret, "Failed to register overflow handling.");
+    }
+
+    return 0;
+}
+
+static
+DeviceArray mock_plugin_get_devices(const Plugin* plugin)
+{
+    MockPluginData* p_data = plugin->data;
+    return p_data->devices;
+}
+
+static
+unsigned long long mock_plugin_get_energy_update_interval(const Device* device)
+{
+    const MockPluginConfig* config =
+        &((MockPluginData*) device->plugin->data)->config;
+
+    if( config->update_interval_ms )
+        return config->update_interval_ms;
+    if( !config->max_range_uj )
+        return 0;
+
+    /* Time to wrap at the highest power: uJ / W = us. */
+    double power = config->power_w;
+    if( config->power_model == MOCK_POWER_RANDOM )
+        power += config->noise_w;
+    if( power <= 0 )
+        return 0;
+
+    unsigned long long ms = config->max_range_uj / power / 1000;
+    return ms ? ms : 1;
+}
+
+static
+unsigned long long mock_plugin_get_energy_max(const Device* device)
+{
+    const MockPluginData* p_data = device->plugin->data;
+    if( p_data->config.max_range_uj )
+        return p_data->config.max_range_uj;
+    return ULLONG_MAX;
+}
+
+static
+unsigned long long mock_plugin_get_energy_uj(const Device* device)
+{
+    wait_latency(&((MockPluginData*) device->plugin->data)->config);
+    return read_device(device, EMA_get_time_in_us());
+}
+
+static
+int mock_plugin_get_energy_uj_batch(
+    const Device** devices, size_t n, unsigned long long* out, uint64_t* ts)
+{
+    wait_latency(&((MockPluginData*) devices[0]->plugin->data)->config);
+
+    uint64_t now = EMA_get_time_in_us();
+    for(size_t i = 0; i < n; ++i)
+    {
+        ts[i] = now;
+        out[i] = read_device(devices[i], now);
+    }
+
+    return 0;
+}
+
+static
+int mock_plugin_finalize(Plugin* plugin)
+{
+    MockPluginData* p_data = plugin->data;
+    DeviceArray devices = p_data->devices;
+
+    for(size_t i = 0; i < devices.size; ++i)
+    {
+        MockDeviceData* d_data = devices.array[i].data;
+        EMA_finalize_overflow(&devices.array[i]);
+        pthread_mutex_destroy(&d_data->mutex);
+        free(d_data);
+    }
+
+    free(devices.array);
+    free(p_data);
+    return 0;
+}
+
+/* ****************************************************************************
+**** Extern
+**************************************************************************** */
+
+Plugin* create_mock_plugin(const char* name, const MockPluginConfig* config)
+{
+    MockPluginData* p_data = malloc(sizeof(MockPluginData));
+    ASSERT_OR_NULL(p_data);
+
+    p_data->config = *config;
+    p_data->devices.array = NULL;
+    p_data->devices.size = 0;
+    p_data->start_us = 0;
+
+    Plugin* plugin = malloc(sizeof(Plugin));
+    if( !plugin )
+    {
+        free(p_data);
+        return NULL;
+    }
+
+    plugin->cbs.init = mock_plugin_init;
+    plugin->cbs.get_devices = mock_plugin_get_devices;
+    plugin->cbs.get_energy_update_interval =
+        mock_plugin_get_energy_update_interval;
+    plugin->cbs.get_energy_max = mock_plugin_get_energy_max;
+    plugin->cbs.get_energy_uj = mock_plugin_get_energy_uj;
+    plugin->cbs.get_energy_uj_batch = mock_plugin_get_energy_uj_batch;
+    plugin->cbs.finalize = mock_plugin_finalize;
+    plugin->data = p_data;
+    plugin->name = name;
+
+    return plugin;
+}
+
+int register_mock_plugin(const char* name, const MockPluginConfig* config)
+{
+    Plugin *plugin = create_mock_plugin(name, config);
+    ASSERT_OR_1(plugin);
+    return EMA_register_plugin(plugin);
+}
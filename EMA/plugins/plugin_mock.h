@@ -0,0 +1 @@
+#include "plugin_mock.user.h"
@@ -0,0 +1,32 @@
+#include <stdint.h>
+
+#include <EMA/core/plugin.user.h>
+
+typedef enum
+{
+    MOCK_LATENCY_BUSY,  // spin for the read latency
+    MOCK_LATENCY_SLEEP,  // sleep for the read latency
+} MockLatencyMode;
+
+typedef enum
+{
+    MOCK_POWER_RAMP,  // constant power, energy is a deterministic ramp
+    MOCK_POWER_RANDOM,  // power drawn uniformly from power_w +/- noise_w
+} MockPowerModel;
+
+typedef struct
+{
+    unsigned int num_devices;
+    unsigned int read_latency_us;  // per read (or batched read) call
+    MockLatencyMode latency_mode;
+    MockPowerModel power_model;
+    double power_w;
+    double noise_w;
+    unsigned long long max_range_uj;  // counter wraps here, 0: no wraps
+    unsigned long long update_interval_ms;  // 0: derived from max_range_uj
+    unsigned int seed;
+} MockPluginConfig;
+
+Plugin* create_mock_plugin(const char* name, const MockPluginConfig* config);
+
+int register_mock_plugin(const char* name, const MockPluginConfig* config);
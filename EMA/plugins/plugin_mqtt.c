@@ -1,4 +1,5 @@
 #include <limits.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,7 +12,10 @@
 #include <EMA/core/overflow.h>
 #include <EMA/core/plugin.h>
 #include <EMA/core/registry.h>
+#include <EMA/core/seqlock.h>
+#include <EMA/ext/c-hashmap/map.h>
 #include <EMA/utils/error.h>
+#include <EMA/utils/time.h>
 
 #include <EMA/plugins/plugin_mqtt.user.h>
 
@@ -40,6 +44,9 @@
 #define DEVICE_TYPE "misc"
 #define EMA_MQTT_CREDS "EMA_MQTT_CREDS"
 
+#define MQTT_KEEPALIVE_SEC 5
+#define MQTT_WAIT_POLL_US 1000
+
 /* ****************************************************************************
 **** Typedefs
 **************************************************************************** */
@@ -68,8 +75,19 @@ typedef struct
     DeviceArray devices;
     MqttPluginConfig* config;
     MqttCreds* creds;
+    struct mosquitto* mqtt;  // Persistent subscriber connection.
+    hashmap* topics;  // topic -> MqttDeviceData*
 } MqttPluginData;
 
+/* Last received reading, written by the mosquitto network thread only. */
+typedef struct
+{
+    EMA_seqlock seq;
+    _Atomic uint64_t value;
+    _Atomic uint64_t time;
+    _Atomic uint64_t received_us;  // 0 until the first reading arrives
+} MqttValueCache;
+
 typedef struct
 {
     char* name;
@@ -77,6 +95,7 @@ typedef struct
     char* topic;
     uint8_t type;
     MqttPluginConfig* config;
+    MqttValueCache cache;
 } MqttDeviceData;
 
 /* ****************************************************************************
@@ -224,7 +243,10 @@ uint8_t* read_devices(MqttPluginData* data)
 
     MqttPluginConfig* config = data->config;
 
-    struct mosquitto *mqtt = mosquitto_new(data->name, 1, &bytes);
+    /* A fixed client ID would make processes with the same plugin name take
+     * over each other's connection; mosquitto generates a random one. */
+    struct mosquitto *mqtt = mosquitto_new(NULL, 1, &bytes);
+    MQTT_HANDLE_ERR_RET_NULL(!mqtt, "Failed to create mosquitto client.\n");
 
     mosquitto_message_callback_set(mqtt, on_message_read_bytes);
 
@@ -245,37 +267,243 @@ uint8_t* read_devices(MqttPluginData* data)
     return bytes.bytes;
 }
 
+/* ****************************************************************************
+**** Subscriber
+**************************************************************************** */
+
 static
-uint64_t read_energy(MqttDeviceData* device, MqttPluginData* data)
+void store_value(MqttValueCache* cache, const MsrValues* msr)
 {
-    ByteArray bytes;
-    bytes.size = 0;
-    bytes.bytes = NULL;
-    bytes.message_received = 0;
+    EMA_seqlock_write_begin(&cache->seq);
+    atomic_store_explicit(&cache->value, msr->value, memory_order_relaxed);
+    atomic_store_explicit(&cache->time, msr->time, memory_order_relaxed);
+    atomic_store_explicit(
+        &cache->received_us, EMA_get_time_in_us(), memory_order_relaxed);
+    EMA_seqlock_write_end(&cache->seq);
+}
 
-    struct mosquitto *mqtt = mosquitto_new(data->name, 1, &bytes);
-    mosquitto_message_callback_set(mqtt, on_message_read_bytes);
+static
+void load_value(
+    const MqttValueCache* cache, MsrValues* msr, uint64_t* received_us)
+{
+    MqttValueCache* c = (MqttValueCache*) cache;
+    unsigned int seq;
 
-    const int timeout_sec = device->config->read_energy_timeout_sec;
+    do
+    {
+        seq = EMA_seqlock_read_begin(&c->seq);
+        msr->value = atomic_load_explicit(&c->value, memory_order_relaxed);
+        msr->time = atomic_load_explicit(&c->time, memory_order_relaxed);
+        *received_us = atomic_load_explicit(
+            &c->received_us, memory_order_relaxed);
+    } while( EMA_seqlock_read_retry(&c->seq, seq) );
+}
 
-    int err = read_byte_message(
-        mqtt,
-        device->config->host,
-        device->topic,
-        device->config->port,
-        data->creds,
-        timeout_sec
-    );
-    if (err) mosquitto_destroy(mqtt);
-    MQTT_HANDLE_ERR_RET_1(err, "Failed to read byte message.\n");
+static
+void on_message_cache_value(
+    struct mosquitto *mqtt, void *obj, const struct mosquitto_message *msg)
+{
+    MqttPluginData* p_data = obj;
+    uintptr_t value;
 
-    mosquitto_destroy(mqtt);
+    if( msg->payloadlen < (int) (2 * sizeof(uint64_t)) )
+        return;
+
+    if( !hashmap_get(p_data->topics, msg->topic, strlen(msg->topic), &value) )
+        return;
 
     MsrValues msr;
-    bytes_to_msr_values(bytes.bytes, &msr);
+    bytes_to_msr_values(msg->payload, &msr);
+    store_value(&((MqttDeviceData*) value)->cache, &msr);
+}
 
-    free(bytes.bytes);
-    return msr.value;
+/**
+ * Return the topic filter `<parent>/+` if all device topics are siblings
+ * (and more than one), NULL otherwise.
+ */
+static
+char* common_topic_filter(const DeviceArray* devices)
+{
+    if( devices->size < 2 )
+        return NULL;
+
+    const MqttDeviceData* first = devices->array[0].data;
+    const char* last_level = strrchr(first->topic, '/');
+    if( !last_level || strpbrk(first->topic, "+#") )
+        return NULL;
+
+    ptrdiff_t len = last_level - first->topic;
+    for(size_t i = 1; i < devices->size; ++i)
+    {
+        const MqttDeviceData* d_data = devices->array[i].data;
+        const char* level = strrchr(d_data->topic, '/');
+        if( !level || level - d_data->topic != len
+            || strncmp(d_data->topic, first->topic, len) != 0
+            || strpbrk(d_data->topic, "+#") )
+            return NULL;
+    }
+
+    char* filter = NULL;
+    if( asprintf(&filter, "%.*s/+", (int) len, first->topic) == -1 )
+        return NULL;
+    return filter;
+}
+
+static
+int subscribe_devices(struct mosquitto *mqtt, const MqttPluginData* p_data)
+{
+    int ret;
+    char* filter = common_topic_filter(&p_data->devices);
+
+    if( filter )
+    {
+        ret = mosquitto_subscribe(mqtt, NULL, filter, 0);
+        free(filter);
+        return ret;
+    }
+
+    for(size_t i = 0; i < p_data->devices.size; ++i)
+    {
+        const MqttDeviceData* d_data = p_data->devices.array[i].data;
+        ret = mosquitto_subscribe(mqtt, NULL, d_data->topic, 0);
+        if( ret != MOSQ_ERR_SUCCESS )
+            return ret;
+    }
+    return MOSQ_ERR_SUCCESS;
+}
+
+/* Also called on every automatic reconnect of the network thread. */
+static
+void on_connect_subscribe(struct mosquitto *mqtt, void *obj, int rc)
+{
+    if( rc != 0 )
+    {
+        fprintf(stderr, "MQTT connection refused: %d\n", rc);
+        return;
+    }
+
+    int ret = subscribe_devices(mqtt, obj);
+    if( ret != MOSQ_ERR_SUCCESS )
+        fprintf(
+            stderr, "Failed to subscribe to device topics: %s\n",
+            mosquitto_strerror(ret));
+}
+
+static
+int start_subscriber(MqttPluginData* p_data)
+{
+    MqttPluginConfig* config = p_data->config;
+
+    p_data->topics = hashmap_create();
+    MQTT_HANDLE_ERR_RET_1(!p_data->topics, "Failed to create topic map.\n");
+
+    for(size_t i = 0; i < p_data->devices.size; ++i)
+    {
+        MqttDeviceData* d_data = p_data->devices.array[i].data;
+        hashmap_set(
+            p_data->topics, d_data->topic, strlen(d_data->topic),
+            (uintptr_t) d_data);
+    }
+
+    /* Random client ID, see `read_devices`. */
+    struct mosquitto *mqtt = mosquitto_new(NULL, 1, p_data);
+    MQTT_HANDLE_ERR_RET_1(!mqtt, "Failed to create mosquitto client.\n");
+
+    mosquitto_connect_callback_set(mqtt, on_connect_subscribe);
+    mosquitto_message_callback_set(mqtt, on_message_cache_value);
+
+    int ret;
+    if( p_data->creds )
+    {
+        ret = mosquitto_username_pw_set(
+            mqtt, p_data->creds->username, p_data->creds->password);
+        if( ret != MOSQ_ERR_SUCCESS )
+        {
+            mosquitto_destroy(mqtt);
+            MQTT_HANDLE_ERR_RET_1(
+                1, "Failed to set username and password: %s\n",
+                mosquitto_strerror(ret));
+        }
+    }
+
+    ret = mosquitto_connect(
+        mqtt, config->host, config->port, MQTT_KEEPALIVE_SEC);
+    if( ret != MOSQ_ERR_SUCCESS )
+    {
+        mosquitto_destroy(mqtt);
+        MQTT_HANDLE_ERR_RET_1(
+            1, "Failed to connect to mosquitto: %s\n",
+            mosquitto_strerror(ret));
+    }
+
+    ret = mosquitto_loop_start(mqtt);
+    if( ret != MOSQ_ERR_SUCCESS )
+    {
+        mosquitto_disconnect(mqtt);
+        mosquitto_destroy(mqtt);
+        MQTT_HANDLE_ERR_RET_1(
+            1, "Failed to start mosquitto loop: %s\n",
+            mosquitto_strerror(ret));
+    }
+
+    p_data->mqtt = mqtt;
+    return 0;
+}
+
+static
+void stop_subscriber(MqttPluginData* p_data)
+{
+    if( p_data->mqtt )
+    {
+        mosquitto_disconnect(p_data->mqtt);
+        mosquitto_loop_stop(p_data->mqtt, false);
+        mosquitto_destroy(p_data->mqtt);
+        p_data->mqtt = NULL;
+    }
+
+    if( p_data->topics )
+    {
+        hashmap_free(p_data->topics);
+        p_data->topics = NULL;
+    }
+}
+
+/**
+ * Read the cached value of a device. Only waits (up to
+ * `read_energy_timeout_sec`) until the very first reading arrived.
+ * Return 1 if no value is available or it is older than
+ * `max_value_age_ms`.
+ */
+static
+int read_energy(const MqttDeviceData* device, uint64_t* value)
+{
+    MsrValues msr;
+    uint64_t received_us;
+    const MqttPluginConfig* config = device->config;
+
+    load_value(&device->cache, &msr, &received_us);
+    if( received_us == 0 )
+    {
+        uint64_t deadline =
+            EMA_get_time_in_us() + config->read_energy_timeout_sec * 1000000ULL;
+        while( received_us == 0 && EMA_get_time_in_us() < deadline )
+        {
+            usleep(MQTT_WAIT_POLL_US);
+            load_value(&device->cache, &msr, &received_us);
+        }
+        MQTT_HANDLE_ERR_RET_1(
+            received_us == 0, "No MQTT reading received for %s (%d sec)\n",
+            device->name, config->read_energy_timeout_sec);
+    }
+
+    *value = msr.value;
+
+    uint64_t age_us = EMA_get_time_in_us() - received_us;
+    if( config->max_value_age_ms > 0
+        && age_us > config->max_value_age_ms * 1000ULL )
+        return 1;
+
+    return 0;
 }
 
 static
@@ -367,6 +595,10 @@ int mqtt_plugin_init(Plugin* plugin)
     {
         MqttDeviceData* d_data = malloc(sizeof(MqttDeviceData));
         d_data->config = config;
+        atomic_init(&d_data->cache.seq, 0);
+        atomic_init(&d_data->cache.value, 0);
+        atomic_init(&d_data->cache.time, 0);
+        atomic_init(&d_data->cache.received_us, 0);
         buf += bytes_to_mqtt_device_data(buf, d_data);
 
         /* Set device array. */
@@ -386,7 +618,8 @@ int mqtt_plugin_init(Plugin* plugin)
     /* Set plugin data devices. */
     p_data->devices = devices;
 
-    return 0;
+    /* One long-lived connection for all device topics. */
+    return start_subscriber(p_data);
 }
 
 static
@@ -411,7 +644,27 @@ unsigned long long mqtt_plugin_get_energy_max(const Device* device)
 static
 unsigned long long mqtt_plugin_get_energy_uj(const Device* device)
 {
-    return read_energy(device->data, device->plugin->data);
+    uint64_t value = 0;
+    read_energy(device->data, &value);
+    return value;
+}
+
+static
+int mqtt_plugin_get_energy_uj_batch(
+    const Device** devices, size_t n, unsigned long long* out, uint64_t* ts)
+{
+    int err = 0;
+
+    for(size_t i = 0; i < n; ++i)
+    {
+        uint64_t value = 0;
+        ts[i] = EMA_get_time_in_us();
+        if( read_energy(devices[i]->data, &value) != 0 )
+            err = 1;
+        out[i] = value;
+    }
+
+    return err;
 }
 
 static
@@ -419,6 +672,9 @@ int mqtt_plugin_finalize(Plugin* plugin)
 {
     MqttPluginData* p_data = (MqttPluginData*) plugin->data;
     DeviceArray devices = p_data->devices;
+
+    stop_subscriber(p_data);
+
     for(size_t i = 0; i < devices.size; i++)
     {
         EMA_finalize_overflow(&devices.array[i]);
@@ -459,11 +715,15 @@ Plugin* create_mqtt_plugin(
     _config->topic = strdup(config->topic);
     _config->read_devices_timeout_sec = config->read_devices_timeout_sec;
     _config->read_energy_timeout_sec = config->read_energy_timeout_sec;
+    _config->max_value_age_ms = config->max_value_age_ms;
 
     p_data->devices.array = NULL;
     p_data->devices.size = 0;
     p_data->config = _config;
     p_data->name = strdup(name);
+    p_data->creds = NULL;
+    p_data->mqtt = NULL;
+    p_data->topics = NULL;
 
     Plugin* plugin = malloc(sizeof(Plugin));
     ASSERT_OR_NULL(plugin);
@@ -474,6 +734,7 @@ Plugin* create_mqtt_plugin(
         mqtt_plugin_get_energy_update_interval;
     plugin->cbs.get_energy_max = mqtt_plugin_get_energy_max;
     plugin->cbs.get_energy_uj = mqtt_plugin_get_energy_uj;
+    plugin->cbs.get_energy_uj_batch = mqtt_plugin_get_energy_uj_batch;
     plugin->cbs.finalize = mqtt_plugin_finalize;
     plugin->data = p_data;
     plugin->name = name;
@@ -8,7 +8,8 @@ typedef struct
     uint16_t port;
     char* topic;
     int read_devices_timeout_sec;
-    int read_energy_timeout_sec;
+    int read_energy_timeout_sec;  // wait for the first reading per device
+    int max_value_age_ms;  // readings older than this are errors, 0: no limit
 } MqttPluginConfig;
 
 Plugin* create_mqtt_plugin(const char* name, const MqttPluginConfig* config);
@@ -256,6 +256,7 @@ Plugin* create_nvml_plugin(const char* name)
         nvml_plugin_get_energy_update_interval;
     plugin->cbs.get_energy_max = nvml_plugin_get_energy_max;
     plugin->cbs.get_energy_uj = nvml_plugin_get_energy_uj;
+    plugin->cbs.get_energy_uj_batch = NULL;
     plugin->cbs.finalize = nvml_plugin_finalize;
     plugin->data = NULL;
     plugin->name = name;
@@ -3,10 +3,12 @@
 #include <string.h>
 
 #include <ctype.h>  // isdigit
+#include <stdint.h>
 #include <dirent.h>  // dirent, opendir(), readdir, closedir()
 #include <errno.h>
+#include <fcntl.h>  // open, O_RDONLY, O_CLOEXEC
 #include <linux/limits.h>
-#include <unistd.h>  // access, F_OK, R_OK
+#include <unistd.h>  // access, F_OK, R_OK, pread, close
 
 #include <EMA/core/device.h>
 #include <EMA/core/overflow.h>
@@ -14,6 +16,7 @@
 #include <EMA/core/registry.h>
 #include <EMA/core/utils.h>
 #include <EMA/utils/error.h>
+#include <EMA/utils/time.h>
 
 #define RAPL_MAX 128
 #define RAPL_UID_MAX 15
@@ -34,6 +37,33 @@
 
 #define DEVICE_TYPE "cpu"
 
+#define RAPL_ROOT "/sys/class/powercap/intel-rapl"
+#define BOOT_ID_FILE "/proc/sys/kernel/random/boot_id"
+
+/* Optional per-boot cache of the zone table. */
+#define EMA_RAPL_CACHE "EMA_RAPL_CACHE"
+#define RAPL_CACHE_MAGIC "EMA-RAPL-ZONES"
+#define RAPL_CACHE_VERSION 1
+
+/* Backend selection and MSR device path (`%d` is replaced by the cpu). */
+#define EMA_RAPL_BACKEND "EMA_RAPL_BACKEND"
+#define EMA_RAPL_MSR_PATH "EMA_RAPL_MSR_PATH"
+#define MSR_PATH_DEFAULT "/dev/cpu/%d/msr"
+
+/* RAPL model specific registers. */
+#define MSR_RAPL_POWER_UNIT 0x606
+#define MSR_PKG_ENERGY_STATUS 0x611
+#define MSR_PKG_POWER_INFO 0x614
+#define MSR_DRAM_ENERGY_STATUS 0x619
+#define MSR_PP0_ENERGY_STATUS 0x639
+#define MSR_PP1_ENERGY_STATUS 0x641
+
+#define MSR_ENERGY_STATUS_MASK 0xffffffffULL
+#define MSR_POWER_UNIT(units) ((units) & 0xf)
+#define MSR_ENERGY_UNIT(units) (((units) >> 8) & 0x1f)
+#define MSR_MAX_POWER(info) (((info) >> 32) & 0x7fff)
+#define MSR_THERMAL_SPEC_POWER(info) ((info) & 0x7fff)
+
 /* ****************************************************************************
 **** Typedefs
 **************************************************************************** */
@@ -51,92 +81,43 @@ typedef struct
     unsigned long long energy_update_interval_ms;
     int package;
     int has_read_perm;
+    int fd;  // Persistent descriptor of `energy_zone` or of the MSR device.
+    off_t msr;  // Energy status register (MSR backend only).
+    unsigned int energy_unit;  // Energy unit as 1/2^energy_unit J (MSR only).
 } RaplDeviceData;
 
-/* ****************************************************************************
-**** Rapl Driver
-**************************************************************************** */
-
-static
-int create_zone(int zone_idx, char* zone)
-{
-    int ret = CONCAT(
-        zone,
-        "/sys/class/powercap/intel-rapl/intel-rapl:%d",
-        zone_idx
-    );
-
-    if(ret < 0)
-        RAPL_HANDLE_ERR(1, "Creating zone string failed.\n");
-
-    return 0;
-}
-
-static
-int create_subzone(int zone_idx, int subzone_idx, char* subzone)
+typedef struct
 {
-    int ret = CONCAT(
-        subzone,
-        "/sys/class/powercap/intel-rapl/intel-rapl:%d/intel-rapl:%d:%d",
-        zone_idx,
-        zone_idx,
-        subzone_idx
-    );
-
-    if(ret < 0)
-        RAPL_HANDLE_ERR(1, "Creating subzone string failed.\n");
-
-    return 0;
-}
+    char* zone;
+    char* name;
+    int package;
+    unsigned long long max_range;
+    unsigned long long energy_update_interval_ms;
+    int idx;
+    int sub_idx;  // -1 for top level zones.
+} RaplZone;
 
-static
-int _count_dir_with_prefix(const char *path, const char* prefix)
+typedef struct
 {
-    DIR *dir;
-    struct dirent *entry;
-    int count = 0;
-
-    dir = opendir(path);
-    if( dir != NULL )
-    {
-        while( entry = readdir(dir) )
-            if( strncmp(prefix, entry->d_name, strlen(prefix)) == 0 )
-                ++count;
-        closedir(dir);
-    }
-    else
-        fprintf(stderr, "Failed to open the directory.\n");
-
-    return count;
-}
+    RaplZone* array;
+    size_t size;
+} RaplZoneArray;
 
-static
-int get_num_rapl_sub_zones(int zone_idx)
+typedef struct
 {
-    char zone[PATH_MAX];
-    create_zone(zone_idx, zone);
-    return _count_dir_with_prefix(zone, "intel-rapl");
-}
+    off_t msr;
+    const char* name;
+} RaplMsrDomain;
 
-static
-int get_num_rapl_zones(void)
-{
-    return _count_dir_with_prefix(
-        "/sys/class/powercap/intel-rapl", "intel-rapl");
-}
+static const RaplMsrDomain MSR_SUB_DOMAINS[] = {
+    { MSR_PP0_ENERGY_STATUS, "core" },
+    { MSR_PP1_ENERGY_STATUS, "uncore" },
+    { MSR_DRAM_ENERGY_STATUS, "dram" },
+};
 
-static
-int count_all_rapl_zones(void)
-{
-    int rapl_count = 0;
-    for(int i = 0; i < get_num_rapl_zones(); i++)
-    {
-        rapl_count++;
-        for(int j = 0; j < get_num_rapl_sub_zones(i); j++)
-            rapl_count++;
-    }
-    return rapl_count;
-}
+/* ****************************************************************************
+**** Rapl Driver
+**************************************************************************** */
 
 static
 int _file_exist(const char* fname)
@@ -171,6 +152,44 @@ int _read_rapl_file(const char* fname, char* value)
     return 0;
 }
 
+/**
+ * Parse a decimal value as found in RAPL sysfs files. Parsing stops at the
+ * first non-digit character (usually the trailing newline).
+ * Return 1 if no digit was found.
+ */
+static inline
+int _parse_rapl_value(const char* buf, ssize_t len, unsigned long long* value)
+{
+    unsigned long long v = 0;
+    ssize_t i = 0;
+
+    for(; i < len && buf[i] >= '0' && buf[i] <= '9'; ++i)
+        v = v * 10 + (unsigned long long)(buf[i] - '0');
+
+    if( i == 0 )
+        return 1;
+
+    *value = v;
+    return 0;
+}
+
+/**
+ * Read a value from an already opened RAPL file. sysfs attributes are
+ * regenerated on every read from offset 0, so no seek or reopen is needed.
+ * Return 1 on failure.
+ */
+static inline
+int _read_rapl_fd(int fd, unsigned long long* value)
+{
+    char buf[RAPL_MAX];
+
+    ssize_t len = pread(fd, buf, sizeof(buf), 0);
+    if( len <= 0 )
+        return 1;
+
+    return _parse_rapl_value(buf, len, value);
+}
+
 static
 unsigned long long _read_rapl_max_range(const char* zone)
 {
@@ -302,76 +321,457 @@ cleanup:
     return -1;
 }
 
+/* ****************************************************************************
+**** Rapl Topology
+**************************************************************************** */
+
 static
-RaplDeviceData *create_rapl_device(const char* zone, const char* sub_zone)
+int _append_zone(RaplZoneArray* zones, const RaplZone* zone)
+{
+    RaplZone* mem = realloc(
+        zones->array, (zones->size + 1) * sizeof(RaplZone));
+    ASSERT_OR_1(mem);
+
+    zones->array = mem;
+    zones->array[zones->size++] = *zone;
+    return 0;
+}
+
+static
+int _compare_zones(const void* a, const void* b)
+{
+    const RaplZone* lhs = a;
+    const RaplZone* rhs = b;
+
+    if( lhs->idx != rhs->idx )
+        return lhs->idx < rhs->idx ? -1 : 1;
+    return (lhs->sub_idx > rhs->sub_idx) - (lhs->sub_idx < rhs->sub_idx);
+}
+
+static
+void free_rapl_zones(RaplZoneArray* zones)
+{
+    for(size_t i = 0; i < zones->size; ++i)
+    {
+        free(zones->array[i].zone);
+        free(zones->array[i].name);
+    }
+    free(zones->array);
+    zones->array = NULL;
+    zones->size = 0;
+}
+
+/**
+ * Add the sub zones of `parent`. Sub zones share package and wrap bound of
+ * their parent, so only their names are read.
+ */
+static
+void _discover_rapl_sub_zones(RaplZoneArray* zones, const RaplZone* parent)
+{
+    struct dirent *entry;
+    DIR *dir = opendir(parent->zone);
+    if( dir == NULL )
+        return;
+
+    while( (entry = readdir(dir)) )
+    {
+        int idx, sub_idx, len = 0;
+        int ret = sscanf(
+            entry->d_name, "intel-rapl:%d:%d%n", &idx, &sub_idx, &len);
+        if( ret != 2 || entry->d_name[len] != '\0' )
+            continue;
+
+        char zone[PATH_MAX];
+        char name[RAPL_MAX];
+        CONCAT(zone, "%s/%s", parent->zone, entry->d_name);
+        if( _read_zone_name(zone, name) != 0 )
+            continue;
+
+        RaplZone sub_zone = *parent;
+        sub_zone.zone = strdup(zone);
+        sub_zone.name = strdup(name);
+        sub_zone.sub_idx = sub_idx;
+        if( _append_zone(zones, &sub_zone) != 0 )
+        {
+            free(sub_zone.zone);
+            free(sub_zone.name);
+        }
+    }
+    closedir(dir);
+}
+
+/**
+ * Build the zone table with a single walk of the powercap tree. Only
+ * package zones and their sub zones are added.
+ */
+static
+int discover_rapl_zones(RaplZoneArray* zones)
+{
+    struct dirent *entry;
+
+    zones->array = NULL;
+    zones->size = 0;
+
+    DIR *dir = opendir(RAPL_ROOT);
+    if( dir == NULL )
+        RAPL_HANDLE_ERR(0, "Failed to open the directory.\n");
+
+    while( (entry = readdir(dir)) )
+    {
+        int idx, len = 0;
+        int ret = sscanf(entry->d_name, "intel-rapl:%d%n", &idx, &len);
+        if( ret != 1 || entry->d_name[len] != '\0' )
+            continue;
+
+        char zone[PATH_MAX];
+        char name[RAPL_MAX];
+        CONCAT(zone, "%s/%s", RAPL_ROOT, entry->d_name);
+        if( _read_zone_name(zone, name) != 0 )
+            continue;
+
+        /* Skip cpu-unrelated zones together with their sub zones. */
+        int package = _read_package_id(name);
+        if( package < 0 )
+            continue;
+
+        unsigned long long max_range = _read_rapl_max_range(zone);
+        if( max_range == 0 )
+            continue;
+
+        unsigned long long constraint_max_power =
+            _read_rapl_constraint_max_power_uw(zone);
+        if( constraint_max_power == 0 )
+        {
+            /* If no constraints are available, use default value. */
+            constraint_max_power = MAX_POWER_CONSTRAINT_DEFAULT_UW;
+        }
+
+        RaplZone top_zone = {
+            .zone = strdup(zone),
+            .name = strdup(name),
+            .package = package,
+            .max_range = max_range,
+            .energy_update_interval_ms =
+                1000 * max_range / constraint_max_power,
+            .idx = idx,
+            .sub_idx = -1
+        };
+        if( _append_zone(zones, &top_zone) != 0 )
+        {
+            free(top_zone.zone);
+            free(top_zone.name);
+            continue;
+        }
+
+        _discover_rapl_sub_zones(zones, &top_zone);
+    }
+    closedir(dir);
+
+    /* Keep the order of zone and sub zone indices. */
+    qsort(zones->array, zones->size, sizeof(RaplZone), _compare_zones);
+
+    return 0;
+}
+
+static
+int _read_boot_id(char* boot_id)
+{
+    if( !_file_has_read_perm(BOOT_ID_FILE) )
+        return 1;
+
+    if( _read_rapl_file(BOOT_ID_FILE, boot_id) != 0 )
+        return 1;
+
+    boot_id[strcspn(boot_id, "\n")] = '\0';
+    return 0;
+}
+
+/**
+ * Return 1 if the cache is missing, malformed or from another boot.
+ */
+static
+int load_rapl_zone_cache(
+    const char* fname, const char* boot_id, RaplZoneArray* zones)
+{
+    char line[2 * PATH_MAX];
+    char cached_boot_id[RAPL_MAX];
+    int version;
+
+    zones->array = NULL;
+    zones->size = 0;
+
+    FILE* f = fopen(fname, "r");
+    if( f == NULL )
+        return 1;
+
+    if( fgets(line, sizeof(line), f) == NULL
+        || sscanf(line, RAPL_CACHE_MAGIC " %d %127s",
+            &version, cached_boot_id) != 2
+        || version != RAPL_CACHE_VERSION
+        || strcmp(cached_boot_id, boot_id) != 0 )
+    {
+        fclose(f);
+        return 1;
+    }
+
+    while( fgets(line, sizeof(line), f) )
+    {
+        RaplZone zone = { .zone = NULL, .name = NULL };
+        int ret = sscanf(
+            line, "%d %d %d %llu %llu %ms %ms",
+            &zone.idx, &zone.sub_idx, &zone.package, &zone.max_range,
+            &zone.energy_update_interval_ms, &zone.name, &zone.zone);
+        if( ret != 7 || _append_zone(zones, &zone) != 0 )
+        {
+            free(zone.name);
+            free(zone.zone);
+            free_rapl_zones(zones);
+            fclose(f);
+            return 1;
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
+
+/**
+ * Write the cache to a temporary file first, so that concurrently starting
+ * processes never observe a partial cache.
+ */
+static
+int save_rapl_zone_cache(
+    const char* fname, const char* boot_id, const RaplZoneArray* zones)
+{
+    char tmp_fname[PATH_MAX];
+    int ret = CONCAT(tmp_fname, "%s.%d", fname, getpid());
+    if( ret < 0 || ret >= PATH_MAX )
+        return 1;
+
+    FILE* f = fopen(tmp_fname, "w");
+    if( f == NULL )
+        return 1;
+
+    fprintf(f, RAPL_CACHE_MAGIC " %d %s\n", RAPL_CACHE_VERSION, boot_id);
+    for(size_t i = 0; i < zones->size; ++i)
+    {
+        const RaplZone* zone = zones->array + i;
+        fprintf(
+            f, "%d %d %d %llu %llu %s %s\n",
+            zone->idx, zone->sub_idx, zone->package, zone->max_range,
+            zone->energy_update_interval_ms, zone->name, zone->zone);
+    }
+
+    if( fclose(f) != 0 || rename(tmp_fname, fname) != 0 )
+    {
+        unlink(tmp_fname);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Get the zone table from the per-boot cache if `EMA_RAPL_CACHE` is set and
+ * valid, otherwise discover it (and refresh the cache).
+ */
+static
+int get_rapl_zones(RaplZoneArray* zones)
+{
+    char boot_id[RAPL_MAX];
+    const char* cache = getenv(EMA_RAPL_CACHE);
+    int use_cache = cache && _read_boot_id(boot_id) == 0;
+
+    if( use_cache && load_rapl_zone_cache(cache, boot_id, zones) == 0 )
+        return 0;
+
+    int err = discover_rapl_zones(zones);
+    if( err )
+        return err;
+
+    if( use_cache && zones->size > 0 )
+    {
+        if( save_rapl_zone_cache(cache, boot_id, zones) != 0 )
+            fprintf(stderr, "Failed to write RAPL zone cache %s.\n", cache);
+    }
+
+    return 0;
+}
+
+static
+RaplDeviceData *create_rapl_device(const RaplZone* zone)
 {
-    char name[RAPL_MAX];
     char energy_zone[PATH_MAX];
-    unsigned long long max_range, constraint_max_power;
-    unsigned long long energy_update_interval_ms;
     int ret;
 
     /* Prepare energy zone. */
-    ret = CONCAT(
-        energy_zone, "%s%s", sub_zone ? sub_zone : zone, "/energy_uj");
+    ret = CONCAT(energy_zone, "%s%s", zone->zone, "/energy_uj");
 
     if( ret < 0 )
         RAPL_HANDLE_ERR(NULL, "Creating energy-zone string failed.\n");
 
-    if( !_file_exist(energy_zone) )
+    /* Keep the energy file open for the lifetime of the device. */
+    int fd = open(energy_zone, O_RDONLY | O_CLOEXEC);
+    if( fd < 0 && errno == ENOENT )
         RAPL_HANDLE_ERR(
             NULL, "RAPL is not supported. Missing: %s.\n", energy_zone);
 
-    int has_read_perm = _file_has_read_perm(energy_zone);
-    if( !has_read_perm )
+    if( fd < 0 && errno == EACCES )
         RAPL_HANDLE_ERR(
             NULL, "No read permissions for %s.\n", energy_zone);
 
-    /* Prepare zone name and package id. */
-    if( _read_zone_name(zone, name) != 0 )
-        return NULL;
+    if( fd < 0 )
+        RAPL_HANDLE_ERR(
+            NULL, "Failed to open %s: %s\n", energy_zone, strerror(errno));
+
+    /* Setup rapl device. */
+    RaplDeviceData *rapl_device = malloc(sizeof(RaplDeviceData));
+    rapl_device->package = zone->package;
+    rapl_device->zone = strdup(zone->zone);
+    rapl_device->energy_zone = strdup(energy_zone);
+    rapl_device->name = strdup(zone->name);
+    rapl_device->max_range = zone->max_range;
+    rapl_device->energy_update_interval_ms = zone->energy_update_interval_ms;
+    rapl_device->has_read_perm = 1;
+    rapl_device->fd = fd;
+    rapl_device->msr = 0;
+    rapl_device->energy_unit = 0;
+
+    return rapl_device;
+}
+
+static
+void free_rapl_device(RaplDeviceData *rapl_device)
+{
+    close(rapl_device->fd);
+    free(rapl_device->zone);
+    free(rapl_device->energy_zone);
+    free(rapl_device->name);
+    free(rapl_device);
+}
 
-    int package_id = _read_package_id(name);
-    if( sub_zone )
+/* ****************************************************************************
+**** Rapl MSR Driver
+**************************************************************************** */
+
+/**
+ * Substitute the first `%d` of `tmpl` with `cpu`. A template without `%d`
+ * names a single device which is only used for cpu 0.
+ * Return 1 on failure or if the template does not apply to `cpu`.
+ */
+static
+int _format_msr_path(char* path, const char* tmpl, int cpu)
+{
+    const char* pos = strstr(tmpl, "%d");
+    int ret;
+
+    if( !pos )
     {
-        if( _read_zone_name(sub_zone, name) != 0 )
-            return NULL;
+        if( cpu != 0 )
+            return 1;
+        ret = CONCAT(path, "%s", tmpl);
     }
+    else
+        ret = CONCAT(
+            path, "%.*s%d%s", (int)(pos - tmpl), tmpl, cpu, pos + 2);
 
-    /* Prepare rapl_device. */
-    max_range = _read_rapl_max_range(zone);
-    if( max_range == 0 )
-        return NULL;
+    return ret < 0 || ret >= PATH_MAX;
+}
 
-    constraint_max_power = _read_rapl_constraint_max_power_uw(zone);
+/**
+ * Return 1 if the register can not be read.
+ */
+static inline
+int _read_msr(int fd, off_t msr, uint64_t* value)
+{
+    return pread(fd, value, sizeof(*value), msr) != sizeof(*value);
+}
 
-    if (constraint_max_power == 0) {
-        /* If no constraints are available, use default value. */
-        constraint_max_power = MAX_POWER_CONSTRAINT_DEFAULT_UW;
-    }
+/**
+ * Return the package of `cpu` or `cpu` itself if topology is not available.
+ */
+static
+int _read_cpu_package(int cpu)
+{
+    char fname[PATH_MAX];
+    char value_s[RAPL_MAX];
 
-    energy_update_interval_ms = 1000 * max_range / constraint_max_power;
+    CONCAT(
+        fname,
+        "/sys/devices/system/cpu/cpu%d/topology/physical_package_id",
+        cpu
+    );
+    if( !_file_has_read_perm(fname) || _read_rapl_file(fname, value_s) != 0 )
+        return cpu;
+
+    return atoi(value_s);
+}
+
+static inline
+unsigned long long _msr_to_uj(uint64_t raw, unsigned int energy_unit)
+{
+    return (raw * 1000000ULL) >> energy_unit;
+}
+
+static
+RaplDeviceData *create_rapl_msr_device(
+    int fd, int package, off_t msr, const char* name,
+    unsigned int energy_unit, unsigned long long max_power_uw)
+{
+    uint64_t raw;
+
+    /* Skip registers that are not implemented or never updated. */
+    if( _read_msr(fd, msr, &raw) != 0 || (raw & MSR_ENERGY_STATUS_MASK) == 0 )
+        return NULL;
+
+    int dev_fd = dup(fd);
+    if( dev_fd < 0 )
+        RAPL_HANDLE_ERR(NULL, "Failed to dup MSR fd: %s\n", strerror(errno));
+
+    unsigned long long max_range =
+        _msr_to_uj(MSR_ENERGY_STATUS_MASK + 1, energy_unit);
 
-    /* Setup rapl device. */
     RaplDeviceData *rapl_device = malloc(sizeof(RaplDeviceData));
-    rapl_device->package = package_id;
-    rapl_device->zone = sub_zone ? strdup(sub_zone) : strdup(zone);
-    rapl_device->energy_zone = strdup(energy_zone);
+    rapl_device->package = package;
+    rapl_device->zone = NULL;
+    rapl_device->energy_zone = NULL;
     rapl_device->name = strdup(name);
     rapl_device->max_range = max_range;
-    rapl_device->energy_update_interval_ms = energy_update_interval_ms;
-    rapl_device->has_read_perm = has_read_perm;
+    rapl_device->energy_update_interval_ms = 1000 * max_range / max_power_uw;
+    rapl_device->has_read_perm = 1;
+    rapl_device->fd = dev_fd;
+    rapl_device->msr = msr;
+    rapl_device->energy_unit = energy_unit;
 
     return rapl_device;
 }
 
+/**
+ * Decode the unit register and the package power limits of a package once.
+ * Return 1 if the RAPL registers are not accessible.
+ */
 static
-void free_rapl_device(RaplDeviceData *rapl_device)
+int _read_msr_package_info(
+    int fd, unsigned int* energy_unit, unsigned long long* max_power_uw)
 {
-    free(rapl_device->zone);
-    free(rapl_device->energy_zone);
-    free(rapl_device->name);
-    free(rapl_device);
+    uint64_t units, info;
+
+    if( _read_msr(fd, MSR_RAPL_POWER_UNIT, &units) != 0 )
+        return 1;
+
+    *energy_unit = MSR_ENERGY_UNIT(units);
+    *max_power_uw = MAX_POWER_CONSTRAINT_DEFAULT_UW;
+
+    if( _read_msr(fd, MSR_PKG_POWER_INFO, &info) == 0 )
+    {
+        uint64_t power = MSR_MAX_POWER(info);
+        if( power == 0 )
+            power = MSR_THERMAL_SPEC_POWER(info);
+        if( power > 0 )
+            *max_power_uw = (power * 1000000ULL) >> MSR_POWER_UNIT(units);
+    }
+
+    return 0;
 }
 
 static
@@ -384,6 +784,29 @@ int get_full_name(char *full_name, int package, const char *name)
 }
 
 
+static
+int init_rapl_device(Device* device, Plugin* plugin, RaplDeviceData* data)
+{
+    char name[RAPL_MAX];
+    int ret = get_full_name(name, data->package, data->name);
+    if( ret != 0 )
+        return ret;
+
+    char uid[RAPL_UID_MAX];
+    snprintf(uid, RAPL_UID_MAX, "%d", data->package);
+
+    device->data = data;
+    device->plugin = plugin;
+    device->name = strdup(name);
+    device->type = strdup(DEVICE_TYPE);
+    device->uid = strdup(uid);
+    ret = EMA_init_overflow(device);
+    ASSERT_MSG_OR_1(!ret, "Failed to register overflow handling.");
+
+    return 0;
+}
+
+
 /* ****************************************************************************
 **** Plugin interface
 **************************************************************************** */
@@ -391,93 +814,138 @@ int get_full_name(char *full_name, int package, const char *name)
 static
 int rapl_plugin_init(Plugin* plugin)
 {
-    /* Create array of max possible size. */
+    RaplZoneArray zones;
+    int err = get_rapl_zones(&zones);
+    if( err )
+        return err;
+
     DeviceArray devices;
-    devices.size = count_all_rapl_zones();
-    devices.array = malloc(sizeof(Device) * devices.size);
+    devices.array = malloc(sizeof(Device) * zones.size);
 
-    /* Iterate rapl top level zones. */
     int count_devices = 0;
-    for(int i = 0; i < get_num_rapl_zones(); ++i)
+    for(size_t i = 0; i < zones.size; ++i)
     {
-        RaplDeviceData *rapl_device;
-        char zone[PATH_MAX];
-
-        if( create_zone(i, zone) != 0 )
-            continue;
-
-        rapl_device = create_rapl_device(zone, NULL);
+        RaplDeviceData *rapl_device = create_rapl_device(zones.array + i);
         if( !rapl_device )
             continue;
 
-        /* Skip non accessable or cpu-related RAPL devices. */
-        if( rapl_device->package < 0 )
+        Device *device = devices.array + count_devices;
+        if( init_rapl_device(device, plugin, rapl_device) != 0 )
         {
             free_rapl_device(rapl_device);
             continue;
         }
+        ++count_devices;
+    }
 
-        char name[RAPL_MAX];
-        int ret = get_full_name(
-            name, rapl_device->package, rapl_device->name);
-        if( ret != 0 )
+    size_t count_zones = zones.size;
+    free_rapl_zones(&zones);
+
+    /* Shrink array to finally needed size. */
+    devices.size = count_devices;
+    devices.array = realloc_s(devices.array, sizeof(Device) * devices.size);
+
+    /* Set plugin data. */
+    RaplPluginData* p_data = malloc(sizeof(RaplPluginData));
+    p_data->devices = devices;
+
+    plugin->data = p_data;
+
+    /* No access to RAPL devices. */
+    if( count_devices == 0 && count_zones > 0 )
+        RAPL_HANDLE_ERR(1, "No access to RAPL devices.\n");
+
+    /* No RAPL devices available. */
+    if( count_devices == 0 )
+        RAPL_HANDLE_ERR(0, "No RAPL devices detected.\n");
+
+    return 0;
+}
+
+static
+int rapl_msr_plugin_init(Plugin* plugin)
+{
+    const char* tmpl = getenv(EMA_RAPL_MSR_PATH);
+    if( !tmpl )
+        tmpl = MSR_PATH_DEFAULT;
+
+    long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if( num_cpus < 1 )
+        num_cpus = 1;
+
+    /* At most one package and all sub domains per cpu. */
+    size_t max_domains = 1 + sizeof(MSR_SUB_DOMAINS) / sizeof(RaplMsrDomain);
+    int* packages = malloc(sizeof(int) * num_cpus);
+    DeviceArray devices;
+    devices.array = malloc(sizeof(Device) * num_cpus * max_domains);
+
+    int count_devices = 0;
+    int count_packages = 0;
+    int count_accessible = 0;
+    for(int cpu = 0; cpu < num_cpus; ++cpu)
+    {
+        char path[PATH_MAX];
+        if( _format_msr_path(path, tmpl, cpu) != 0 )
+            continue;
+
+        /* Read each package through its first cpu only. */
+        int package = _read_cpu_package(cpu);
+        int seen = 0;
+        for(int k = 0; k < count_packages; ++k)
+            seen |= packages[k] == package;
+        if( seen )
+            continue;
+
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if( fd < 0 )
+            continue;
+        ++count_accessible;
+
+        unsigned int energy_unit;
+        unsigned long long max_power_uw;
+        if( _read_msr_package_info(fd, &energy_unit, &max_power_uw) != 0 )
         {
-            free_rapl_device(rapl_device);
+            fprintf(stderr, "Failed to read RAPL units from %s.\n", path);
+            close(fd);
             continue;
         }
+        packages[count_packages++] = package;
 
-        char uid[RAPL_UID_MAX];
-        snprintf(uid, RAPL_UID_MAX, "%d", rapl_device->package);
-
-        Device *device = devices.array + count_devices++;
-        device->data = rapl_device;
-        device->plugin = plugin;
-        device->name = strdup(name);
-        device->type = strdup(DEVICE_TYPE);
-        device->uid = strdup(uid);
-        ret = EMA_init_overflow(device);
-        ASSERT_MSG_OR_1(!ret, "Failed to register overflow handling.");
+        char name[RAPL_MAX];
+        snprintf(name, RAPL_MAX, "package-%d", package);
 
-        /* Iterate rapl sub zones. */
-        for(int j = 0; j < get_num_rapl_sub_zones(i); ++j)
+        RaplDeviceData *rapl_device = create_rapl_msr_device(
+            fd, package, MSR_PKG_ENERGY_STATUS, name,
+            energy_unit, max_power_uw);
+        if( rapl_device )
         {
-            RaplDeviceData *rapl_sub_device;
-            if( create_subzone(i, j, zone) != 0 )
-                continue;
+            Device *device = devices.array + count_devices;
+            if( init_rapl_device(device, plugin, rapl_device) == 0 )
+                ++count_devices;
+            else
+                free_rapl_device(rapl_device);
+        }
 
-            rapl_sub_device = create_rapl_device(rapl_device->zone, zone);
+        for(size_t j = 0; j < max_domains - 1; ++j)
+        {
+            RaplDeviceData *rapl_sub_device = create_rapl_msr_device(
+                fd, package, MSR_SUB_DOMAINS[j].msr, MSR_SUB_DOMAINS[j].name,
+                energy_unit, max_power_uw);
             if( !rapl_sub_device )
                 continue;
 
-            /* Skip non accessable rapl_sub_devices */
-            if( rapl_sub_device->package < 0 )
+            Device *device = devices.array + count_devices;
+            if( init_rapl_device(device, plugin, rapl_sub_device) != 0 )
             {
                 free_rapl_device(rapl_sub_device);
                 continue;
             }
-
-            char name[RAPL_MAX];
-            int ret = get_full_name(
-                name, rapl_sub_device->package, rapl_sub_device->name);
-            if( ret != 0 )
-            {
-                free_rapl_device(rapl_sub_device);
-                continue;
-            }
-
-            char suid[RAPL_UID_MAX];
-            snprintf(suid, RAPL_UID_MAX, "%d", rapl_sub_device->package);
-
-            Device *device = devices.array + count_devices++;
-            device->data = rapl_sub_device;
-            device->plugin = plugin;
-            device->name = strdup(name);
-            device->type = strdup(DEVICE_TYPE);
-            device->uid = strdup(suid);
-            ret = EMA_init_overflow(device);
-            ASSERT_MSG_OR_1(!ret, "Failed to register overflow handling.");
+            ++count_devices;
         }
+
+        close(fd);
     }
+    free(packages);
 
     /* Shrink array to finally needed size. */
     devices.size = count_devices;
@@ -489,13 +957,13 @@ int rapl_plugin_init(Plugin* plugin)
 
     plugin->data = p_data;
 
-    /* No access to RAPL devices. */
-    if( count_devices == 0 && count_all_rapl_zones() > 0 )
-        RAPL_HANDLE_ERR(1, "No access to RAPL devices.\n");
+    /* No access to RAPL registers. */
+    if( count_devices == 0 && count_accessible > 0 )
+        RAPL_HANDLE_ERR(1, "No access to RAPL registers.\n");
 
-    /* No RAPL devices available. */
+    /* No MSR devices available. */
     if( count_devices == 0 )
-        RAPL_HANDLE_ERR(0, "No RAPL devices detected.\n");
+        RAPL_HANDLE_ERR(0, "No RAPL MSR devices detected (%s).\n", tmpl);
 
     return 0;
 }
@@ -528,23 +996,81 @@ unsigned long long rapl_plugin_get_energy_uj(const Device* device)
     * Read energy value of the executing CPU.
     * Return measurement value.
     */
-    char energy_str[RAPL_MAX];
+    unsigned long long energy;
     RaplDeviceData* d_data = device->data;
 
-    /* Existence of the file and read permission already checked. */
-    int err = _read_rapl_file(d_data->energy_zone, energy_str);
+    /* File descriptor opened on device creation. */
+    int err = _read_rapl_fd(d_data->fd, &energy);
     if( err != 0 )
         RAPL_HANDLE_ERR(0, "Could not read RAPL energy value.\n");
 
-    errno = 0;
-    unsigned long long energy = strtoull(energy_str, NULL, 10);
-    if( errno != 0 )
-        RAPL_HANDLE_ERR(
-            0, "Failed to convert RAPL energy: %s\n", strerror(errno));
-
     return energy;
 }
 
+/**
+ * Read all requested zones in one pass over their descriptors.
+ */
+static
+int rapl_plugin_get_energy_uj_batch(
+    const Device** devices, size_t n, unsigned long long* out, uint64_t* ts)
+{
+    int err = 0;
+
+    for(size_t i = 0; i < n; ++i)
+    {
+        RaplDeviceData* d_data = devices[i]->data;
+        ts[i] = EMA_get_time_in_us();
+        if( _read_rapl_fd(d_data->fd, out + i) != 0 )
+        {
+            out[i] = 0;
+            err = 1;
+        }
+    }
+
+    if( err )
+        RAPL_HANDLE_ERR(err, "Could not read RAPL energy value.\n");
+
+    return 0;
+}
+
+static
+unsigned long long rapl_msr_plugin_get_energy_uj(const Device* device)
+{
+    uint64_t raw;
+    RaplDeviceData* d_data = device->data;
+
+    if( _read_msr(d_data->fd, d_data->msr, &raw) != 0 )
+        RAPL_HANDLE_ERR(0, "Could not read RAPL energy register.\n");
+
+    return _msr_to_uj(raw & MSR_ENERGY_STATUS_MASK, d_data->energy_unit);
+}
+
+static
+int rapl_msr_plugin_get_energy_uj_batch(
+    const Device** devices, size_t n, unsigned long long* out, uint64_t* ts)
+{
+    int err = 0;
+
+    for(size_t i = 0; i < n; ++i)
+    {
+        uint64_t raw;
+        RaplDeviceData* d_data = devices[i]->data;
+        ts[i] = EMA_get_time_in_us();
+        if( _read_msr(d_data->fd, d_data->msr, &raw) != 0 )
+        {
+            out[i] = 0;
+            err = 1;
+            continue;
+        }
+        out[i] = _msr_to_uj(raw & MSR_ENERGY_STATUS_MASK, d_data->energy_unit);
+    }
+
+    if( err )
+        RAPL_HANDLE_ERR(err, "Could not read RAPL energy register.\n");
+
+    return 0;
+}
+
 static
 int rapl_plugin_finalize(Plugin* plugin)
 {
@@ -578,6 +1104,7 @@ Plugin* create_rapl_plugin(const char* name)
     plugin->cbs.get_energy_update_interval = rapl_get_energy_update_interval;
     plugin->cbs.get_energy_max = rapl_get_energy_max;
     plugin->cbs.get_energy_uj = rapl_plugin_get_energy_uj;
+    plugin->cbs.get_energy_uj_batch = rapl_plugin_get_energy_uj_batch;
     plugin->cbs.finalize = rapl_plugin_finalize;
     plugin->data = NULL;
     plugin->name = name;
@@ -585,9 +1112,28 @@ Plugin* create_rapl_plugin(const char* name)
     return plugin;
 }
 
+Plugin* create_rapl_msr_plugin(const char* name)
+{
+    Plugin* plugin = create_rapl_plugin(name);
+    ASSERT_OR_NULL(plugin);
+
+    plugin->cbs.init = rapl_msr_plugin_init;
+    plugin->cbs.get_energy_uj = rapl_msr_plugin_get_energy_uj;
+    plugin->cbs.get_energy_uj_batch = rapl_msr_plugin_get_energy_uj_batch;
+
+    return plugin;
+}
+
 int register_rapl_plugin(void)
 {
-    Plugin *plugin = create_rapl_plugin("RAPL");
+    Plugin *plugin;
+    const char* backend = getenv(EMA_RAPL_BACKEND);
+
+    if( backend && strcmp(backend, "msr") == 0 )
+        plugin = create_rapl_msr_plugin("RAPL");
+    else
+        plugin = create_rapl_plugin("RAPL");
+
     ASSERT_OR_1(plugin);
     return EMA_register_plugin(plugin);
 }
@@ -1,4 +1,5 @@
 #include <EMA/core/plugin.h>
 
 Plugin* create_rapl_plugin(const char* name);
+Plugin* create_rapl_msr_plugin(const char* name);
 int register_rapl_plugin(void);
@@ -0,0 +1,249 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <EMA/utils/arena.h>
+#include <EMA/utils/error.h>
+
+#include "calltree.h"
+
+#define INITIAL_STACK_CAPACITY 16
+
+static atomic_ullong tree_count = 0;
+
+/* A node and its arrays are one block from the arena of the tree. */
+static
+CallNode* node_create(CallTree* tree, CallNode* parent, const CallNode* like)
+{
+    size_t n = like->size;
+    size_t counters = sizeof(unsigned long long) * n;
+    size_t size = sizeof(CallNode) + sizeof(Device*) * n + 4 * counters;
+
+    unsigned char* block = EMA_arena_calloc(tree->arena, size, 8);
+    ASSERT_MSG_OR_NULL(block, "Failed to allocate call tree node.");
+
+    CallNode* node = (CallNode*) block;
+    node->devices = (const Device**) (block + sizeof(CallNode));
+    node->energy = (unsigned long long*) (node->devices + n);
+    node->time = node->energy + n;
+    node->energy_start = node->time + n;
+    node->time_start = node->energy_start + n;
+
+    node->region_id = like->region_id;
+    node->idf = like->idf;
+    node->file = like->file;
+    node->function = like->function;
+    node->line = like->line;
+    node->size = n;
+    memcpy(node->devices, like->devices, sizeof(Device*) * n);
+
+    /* Keep the children in order of first visit. */
+    CallNode** link = &parent->child;
+    while( *link )
+        link = &(*link)->next;
+    node->parent = parent;
+    *link = node;
+
+    return node;
+}
+
+static
+CallNode* node_create_for_region(
+    CallTree* tree, CallNode* parent, const Region* region)
+{
+    CallNode like = {
+        .region_id = region->id,
+        .idf = region->idf,
+        .file = region->file,
+        .function = region->function,
+        .line = region->line,
+        .devices = region->devices,
+        .size = region->measurements.size,
+    };
+    return node_create(tree, parent, &like);
+}
+
+CallTree* EMA_calltree_init(Arena* arena)
+{
+    CallTree* tree = calloc(1, sizeof(CallTree));
+    ASSERT_MSG_OR_NULL(tree, "Failed to allocate call tree.");
+
+    tree->stack = malloc(sizeof(CallNode*) * INITIAL_STACK_CAPACITY);
+    if( !tree->stack )
+    {
+        free(tree);
+        return NULL;
+    }
+    tree->capacity = INITIAL_STACK_CAPACITY;
+    tree->depth = 0;
+    tree->arena = arena;
+    tree->id = atomic_fetch_add(&tree_count, 1) + 1;
+
+    return tree;
+}
+
+/* The nodes are released with the arena. */
+void EMA_calltree_finalize(CallTree* tree)
+{
+    free(tree->snapshot.devices);
+    free(tree->snapshot.energy);
+    free(tree->snapshot.time);
+    free(tree->snapshot.stale);
+    free(tree->stack);
+    free(tree);
+}
+
+/**
+ * Enter `region` below the innermost active node. Returns the node or NULL
+ * on allocation failure. A region is mostly entered from the same parent,
+ * so its last node is tried before the siblings are searched.
+ */
+CallNode* EMA_calltree_push(CallTree* tree, Region* region)
+{
+    CallNode* parent = tree->depth ? tree->stack[tree->depth - 1] : &tree->root;
+
+    /* The hint may be a node of another thread's tree, which is only
+     * dereferenced once the tree id matches. */
+    CallNode* node = region->node;
+    if( region->node_tree != tree->id || node->parent != parent )
+    {
+        node = parent->child;
+        while( node && node->region_id != region->id )
+            node = node->next;
+
+        if( !node )
+        {
+            node = node_create_for_region(tree, parent, region);
+            if( !node )
+                return NULL;
+        }
+        region->node = node;
+        region->node_tree = tree->id;
+    }
+
+    if( tree->depth == tree->capacity )
+    {
+        CallNode** stack = realloc(
+            tree->stack, sizeof(CallNode*) * tree->capacity * 2);
+        ASSERT_MSG_OR_NULL(stack, "Failed to grow region stack.");
+        tree->stack = stack;
+        tree->capacity *= 2;
+    }
+
+    tree->stack[tree->depth++] = node;
+    ++node->visits;
+    return node;
+}
+
+/**
+ * Leave `region`. Regions may overlap without nesting, e.g. begin A, begin
+ * B, end A, end B, so the innermost active visit of `region` is taken out
+ * of the stack wherever it is; the regions above it stay active. Returns
+ * the node or NULL if `region` is not active.
+ */
+CallNode* EMA_calltree_pop(CallTree* tree, const Region* region)
+{
+    size_t i = tree->depth;
+    while( i > 0 && tree->stack[i - 1]->region_id != region->id )
+        --i;
+    if( i == 0 )
+        return NULL;
+
+    CallNode* node = tree->stack[i - 1];
+    memmove(tree->stack + i - 1, tree->stack + i,
+        sizeof(CallNode*) * (tree->depth - i));
+    --tree->depth;
+    return node;
+}
+
+void EMA_calltree_node_begin(
+    CallNode* node, const unsigned long long* energy, const uint64_t* time)
+{
+    for(size_t i = 0; i < node->size; ++i)
+    {
+        node->energy_start[i] = energy[i];
+        node->time_start[i] = time[i];
+    }
+}
+
+void EMA_calltree_node_end(
+    CallNode* node, const unsigned long long* energy, const uint64_t* time)
+{
+    for(size_t i = 0; i < node->size; ++i)
+    {
+        node->energy[i] += energy[i] - node->energy_start[i];
+        node->time[i] += time[i] - node->time_start[i];
+    }
+}
+
+/**
+ * Exclusive energy and time of device `i` of `node`: the inclusive values
+ * minus those the children measured on the same device.
+ */
+void EMA_calltree_node_exclusive(
+    const CallNode* node, size_t i, unsigned long long* energy,
+    unsigned long long* time)
+{
+    unsigned long long child_energy = 0, child_time = 0;
+
+    for(const CallNode* child = node->child; child; child = child->next)
+        for(size_t j = 0; j < child->size; ++j)
+            if( child->devices[j] == node->devices[i] )
+            {
+                child_energy += child->energy[j];
+                child_time += child->time[j];
+            }
+
+    *energy = node->energy[i] > child_energy
+        ? node->energy[i] - child_energy : 0;
+    *time = node->time[i] > child_time ? node->time[i] - child_time : 0;
+}
+
+/* Nodes of different trees are the same if they are reached through the
+ * same path of region definitions; the strings are interned. */
+static
+int same_definition(const CallNode* a, const CallNode* b)
+{
+    return a->idf == b->idf && a->file == b->file
+        && a->function == b->function && a->line == b->line;
+}
+
+static
+int merge_children(CallTree* tree, CallNode* parent, const CallNode* src)
+{
+    for(const CallNode* child = src->child; child; child = child->next)
+    {
+        CallNode* node = parent->child;
+        while( node && !same_definition(node, child) )
+            node = node->next;
+
+        if( !node )
+        {
+            node = node_create(tree, parent, child);
+            ASSERT_OR_1(node);
+        }
+
+        node->visits += child->visits;
+        for(size_t j = 0; j < child->size; ++j)
+            for(size_t i = 0; i < node->size; ++i)
+                if( node->devices[i] == child->devices[j] )
+                {
+                    node->energy[i] += child->energy[j];
+                    node->time[i] += child->time[j];
+                }
+
+        int err = merge_children(tree, node, child);
+        if( err )
+            return err;
+    }
+    return 0;
+}
+
+/**
+ * Add the nodes of `src`, e.g. of an exited thread, to `tree`. Active
+ * regions of `src` are merged with what they measured so far.
+ */
+int EMA_calltree_merge(CallTree* tree, const CallTree* src)
+{
+    return merge_children(tree, &tree->root, &src->root);
+}
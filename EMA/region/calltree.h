@@ -0,0 +1,76 @@
+#ifndef EMA_REGION_CALLTREE_H
+#define EMA_REGION_CALLTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <EMA/core/device.h>
+#include <EMA/utils/arena.h>
+#include "region.h"
+
+/*
+ * Node of a per-thread call-path tree. The same region reached through
+ * different parents is a different node. Energy and time are inclusive; the
+ * exclusive part is the inclusive value minus that of the children.
+ */
+typedef struct CallNode
+{
+    unsigned long long region_id;
+    const char* idf;  // interned
+    const char* file;
+    const char* function;
+    unsigned int line;
+
+    const Device** devices;
+    size_t size;
+    unsigned long long visits;
+    unsigned long long* energy;
+    unsigned long long* time;
+    unsigned long long* energy_start;
+    unsigned long long* time_start;
+
+    struct CallNode* parent;
+    struct CallNode* child;  // first child
+    struct CallNode* next;  // next sibling
+} CallNode;
+
+/* Device readings of the last region boundary of a thread. */
+typedef struct
+{
+    const Device** devices;
+    unsigned long long* energy;
+    uint64_t* time;
+    unsigned char* stale;
+    size_t size;
+    size_t capacity;
+    uint64_t taken_us;
+    unsigned long long region_id;  // region of the boundary
+} Snapshot;
+
+/* Owned and used by a single thread. Nodes live in the arena of the
+ * thread's region store. */
+typedef struct CallTree
+{
+    CallNode root;
+    Snapshot snapshot;
+    CallNode** stack;
+    size_t depth;
+    size_t capacity;
+    Arena* arena;
+    unsigned long long id;  // unique per process
+} CallTree;
+
+CallTree* EMA_calltree_init(Arena* arena);
+void EMA_calltree_finalize(CallTree* tree);
+CallNode* EMA_calltree_push(CallTree* tree, Region* region);
+CallNode* EMA_calltree_pop(CallTree* tree, const Region* region);
+int EMA_calltree_merge(CallTree* tree, const CallTree* src);
+void EMA_calltree_node_begin(
+    CallNode* node, const unsigned long long* energy, const uint64_t* time);
+void EMA_calltree_node_end(
+    CallNode* node, const unsigned long long* energy, const uint64_t* time);
+void EMA_calltree_node_exclusive(
+    const CallNode* node, size_t i, unsigned long long* energy,
+    unsigned long long* time);
+
+#endif
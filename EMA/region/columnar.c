@@ -0,0 +1,352 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <EMA/ext/c-hashmap/map.h>
+#include <EMA/utils/arena.h>
+#include <EMA/utils/error.h>
+
+#include "columnar.user.h"
+#include "output.h"
+#include "sink.h"
+
+#define ALIGN8(size) (((size) + 7) & ~(size_t) 7)
+
+static const uint32_t COLUMN_WIDTHS[EMA_COLUMNAR_COLUMNS] = {
+    [EMA_COLUMN_THREAD] = sizeof(int32_t),
+    [EMA_COLUMN_REGION] = sizeof(uint32_t),
+    [EMA_COLUMN_DEVICE] = sizeof(uint32_t),
+    [EMA_COLUMN_VISITS ... EMA_COLUMN_TIME] = sizeof(uint64_t),
+    [EMA_COLUMN_STALE] = sizeof(uint8_t),
+    [EMA_COLUMN_ENERGY_MIN ... EMA_COLUMN_POWER_STD] = sizeof(double),
+    [EMA_COLUMN_ENERGY_P50 ... EMA_COLUMN_ENERGY_ERROR] = sizeof(uint64_t),
+};
+
+/* Growable array of `size` byte elements. */
+typedef struct
+{
+    unsigned char* data;
+    size_t size;  // elements
+    size_t capacity;
+} Buffer;
+
+static
+void* buffer_append(Buffer* buffer, size_t elements, size_t size)
+{
+    if( buffer->size + elements > buffer->capacity )
+    {
+        size_t capacity = buffer->capacity ? buffer->capacity : 64;
+        while( capacity < buffer->size + elements )
+            capacity *= 2;
+        unsigned char* data = realloc(buffer->data, capacity * size);
+        ASSERT_OR_NULL(data);
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+    void* element = buffer->data + buffer->size * size;
+    buffer->size += elements;
+    return element;
+}
+
+/* Region definition; strings are interned, so they compare by pointer. */
+typedef struct
+{
+    const char* idf;
+    const char* file;
+    const char* function;
+    uint64_t line;
+} RegionKey;
+
+typedef struct
+{
+    FILE* f;
+    hashmap* string_ids;  // by content
+    hashmap* region_ids;  // by RegionKey
+    hashmap* device_ids;  // by Device pointer
+    Arena keys;
+    Buffer string_offsets;
+    Buffer string_data;
+    Buffer regions;
+    Buffer devices;
+    Buffer columns[EMA_COLUMNAR_COLUMNS];
+    size_t num_rows;
+} ColumnarWriter;
+
+/* Ids are stored plus one, hashmap values of 0 are not told apart. */
+static
+int string_id(ColumnarWriter* writer, const char* string, uint32_t* id)
+{
+    uintptr_t value;
+    size_t length = strlen(string);
+    if( hashmap_get(writer->string_ids, string, length, &value) )
+    {
+        *id = value - 1;
+        return 0;
+    }
+
+    uint64_t* offset = buffer_append(
+        &writer->string_offsets, 1, sizeof(uint64_t));
+    ASSERT_OR_1(offset);
+    *offset = writer->string_data.size;
+    char* data = buffer_append(&writer->string_data, length + 1, 1);
+    ASSERT_OR_1(data);
+    memcpy(data, string, length + 1);
+
+    *id = writer->string_offsets.size - 1;
+    hashmap_set(writer->string_ids, string, length, *id + 1);
+    return 0;
+}
+
+static
+int region_id(
+    ColumnarWriter* writer, const OutputRecord* record, uint32_t* id)
+{
+    RegionKey key = {
+        .idf = record->idf,
+        .file = record->file,
+        .function = record->function,
+        .line = record->line,
+    };
+
+    uintptr_t value;
+    if( hashmap_get(writer->region_ids, &key, sizeof(key), &value) )
+    {
+        *id = value - 1;
+        return 0;
+    }
+
+    RegionKey* stored = EMA_arena_alloc(&writer->keys, sizeof(key), 8);
+    ColumnarRegion* entry = buffer_append(
+        &writer->regions, 1, sizeof(ColumnarRegion));
+    ASSERT_OR_1(stored && entry);
+    *stored = key;
+    entry->line = record->line;
+    if( string_id(writer, record->idf, &entry->idf)
+        || string_id(writer, record->file, &entry->file)
+        || string_id(writer, record->function, &entry->function) )
+        return 1;
+
+    *id = writer->regions.size - 1;
+    hashmap_set(writer->region_ids, stored, sizeof(key), *id + 1);
+    return 0;
+}
+
+static
+int device_id(ColumnarWriter* writer, const Device* device, uint32_t* id)
+{
+    uintptr_t value;
+    if( hashmap_get(writer->device_ids, &device, sizeof(device), &value) )
+    {
+        *id = value - 1;
+        return 0;
+    }
+
+    const Device** stored = EMA_arena_alloc(
+        &writer->keys, sizeof(device), 8);
+    ColumnarDevice* entry = buffer_append(
+        &writer->devices, 1, sizeof(ColumnarDevice));
+    ASSERT_OR_1(stored && entry);
+    *stored = device;
+    entry->reserved = 0;
+    if( string_id(writer, device->name, &entry->name)
+        || string_id(writer, device->uid, &entry->uid)
+        || string_id(writer, device->type, &entry->type) )
+        return 1;
+
+    *id = writer->devices.size - 1;
+    hashmap_set(writer->device_ids, stored, sizeof(device), *id + 1);
+    return 0;
+}
+
+static
+int add_record(ColumnarWriter* writer, const OutputRecord* record)
+{
+    unsigned char* row[EMA_COLUMNAR_COLUMNS];
+    for(int i = 0; i < EMA_COLUMNAR_COLUMNS; ++i)
+    {
+        row[i] = buffer_append(writer->columns + i, 1, COLUMN_WIDTHS[i]);
+        ASSERT_OR_1(row[i]);
+    }
+
+    int32_t thread = record->thread;
+    uint8_t stale = record->stale;
+    uint64_t values[EMA_COLUMNAR_COLUMNS] = {
+        [EMA_COLUMN_VISITS] = record->visits,
+        [EMA_COLUMN_ENERGY] = record->energy,
+        [EMA_COLUMN_TIME] = record->time,
+        [EMA_COLUMN_MEASURED_VISITS] = record->measured_visits,
+        [EMA_COLUMN_ENERGY_ERROR] = record->energy_error,
+    };
+    for(int i = 0; i < EMA_OUTPUT_PERCENTILES; ++i)
+    {
+        values[EMA_COLUMN_ENERGY_P50 + i] =
+            record->percentiles[EMA_OUTPUT_ENERGY][i];
+        values[EMA_COLUMN_TIME_P50 + i] =
+            record->percentiles[EMA_OUTPUT_TIME][i];
+    }
+
+    uint32_t region, device;
+    if( region_id(writer, record, &region)
+        || device_id(writer, record->device, &device) )
+        return 1;
+
+    memcpy(row[EMA_COLUMN_THREAD], &thread, sizeof(thread));
+    memcpy(row[EMA_COLUMN_REGION], &region, sizeof(region));
+    memcpy(row[EMA_COLUMN_DEVICE], &device, sizeof(device));
+    memcpy(row[EMA_COLUMN_STALE], &stale, sizeof(stale));
+    for(int i = 0; i <= EMA_COLUMN_POWER_STD - EMA_COLUMN_ENERGY_MIN; ++i)
+        memcpy(row[EMA_COLUMN_ENERGY_MIN + i],
+            &record->moments[i / 4][i % 4], sizeof(double));
+    for(int i = EMA_COLUMN_VISITS; i <= EMA_COLUMN_TIME; ++i)
+        memcpy(row[i], values + i, sizeof(uint64_t));
+    for(int i = EMA_COLUMN_ENERGY_P50; i <= EMA_COLUMN_ENERGY_ERROR; ++i)
+        memcpy(row[i], values + i, sizeof(uint64_t));
+
+    ++writer->num_rows;
+    return 0;
+}
+
+typedef struct
+{
+    FILE* f;
+    uint64_t offset;
+} FileWriter;
+
+static
+int write_section(FileWriter* out, const void* data, size_t size)
+{
+    static const char padding[8];
+    size_t padded = ALIGN8(size);
+    if( (size && fwrite(data, size, 1, out->f) != 1)
+        || (padded > size
+            && fwrite(padding, padded - size, 1, out->f) != 1) )
+        return 1;
+    out->offset += padded;
+    return 0;
+}
+
+static
+int write_file(ColumnarWriter* writer, FILE* f)
+{
+    size_t index_size = sizeof(ColumnarIndex)
+        + sizeof(ColumnarColumn) * EMA_COLUMNAR_COLUMNS;
+    ColumnarIndex* index = calloc(1, index_size);
+    ASSERT_OR_1(index);
+    index->num_rows = writer->num_rows;
+    index->num_strings = writer->string_offsets.size;
+    index->string_data_size = writer->string_data.size;
+    index->num_regions = writer->regions.size;
+    index->num_devices = writer->devices.size;
+    index->num_columns = EMA_COLUMNAR_COLUMNS;
+
+    ColumnarFileHeader header = { .version = EMA_COLUMNAR_VERSION };
+    memcpy(header.magic, EMA_COLUMNAR_MAGIC, sizeof(header.magic));
+
+    FileWriter out = { .f = f, .offset = 0 };
+    int err = write_section(&out, &header, sizeof(header));
+
+    index->string_offset = out.offset;
+    err = err || write_section(&out, writer->string_offsets.data,
+        sizeof(uint64_t) * writer->string_offsets.size);
+    index->string_data_offset = out.offset;
+    err = err || write_section(
+        &out, writer->string_data.data, writer->string_data.size);
+    index->region_offset = out.offset;
+    err = err || write_section(&out, writer->regions.data,
+        sizeof(ColumnarRegion) * writer->regions.size);
+    index->device_offset = out.offset;
+    err = err || write_section(&out, writer->devices.data,
+        sizeof(ColumnarDevice) * writer->devices.size);
+
+    for(uint32_t i = 0; i < EMA_COLUMNAR_COLUMNS && !err; ++i)
+    {
+        ColumnarColumn* column = index->columns + i;
+        column->id = i;
+        column->width = COLUMN_WIDTHS[i];
+        column->offset = out.offset;
+        err = write_section(&out, writer->columns[i].data,
+            (size_t) COLUMN_WIDTHS[i] * writer->num_rows);
+    }
+
+    ColumnarTrailer trailer = { .index_offset = out.offset };
+    memcpy(trailer.magic, EMA_COLUMNAR_MAGIC, sizeof(trailer.magic));
+    err = err || write_section(&out, index, index_size)
+        || write_section(&out, &trailer, sizeof(trailer));
+    free(index);
+    return err;
+}
+
+static
+int columnar_records(const OutputRecord* records, size_t n, void* usr)
+{
+    for(size_t i = 0; i < n; ++i)
+        if( add_record(usr, records + i) )
+            return 1;
+    return 0;
+}
+
+static
+int columnar_begin(const OutputInfo* info, void* usr)
+{
+    ColumnarWriter* writer = usr;
+    FILE* f = writer->f;
+    memset(writer, 0, sizeof(ColumnarWriter));
+    writer->f = f;
+    writer->string_ids = hashmap_create();
+    writer->region_ids = hashmap_create();
+    writer->device_ids = hashmap_create();
+    EMA_arena_init(&writer->keys);
+    return !writer->string_ids || !writer->region_ids || !writer->device_ids;
+}
+
+/* The file is written at the end, and not at all after a failure. */
+static
+int columnar_end(int failed, void* usr)
+{
+    ColumnarWriter* writer = usr;
+    int err = failed || write_file(writer, writer->f)
+        || fflush(writer->f) != 0;
+
+    if( writer->string_ids )
+        hashmap_free(writer->string_ids);
+    if( writer->region_ids )
+        hashmap_free(writer->region_ids);
+    if( writer->device_ids )
+        hashmap_free(writer->device_ids);
+    EMA_arena_finalize(&writer->keys);
+    free(writer->string_offsets.data);
+    free(writer->string_data.data);
+    free(writer->regions.data);
+    free(writer->devices.data);
+    for(int i = 0; i < EMA_COLUMNAR_COLUMNS; ++i)
+        free(writer->columns[i].data);
+    return err;
+}
+
+int EMA_output_sink_columnar(OutputSink* sink, FILE* f)
+{
+    ColumnarWriter* writer = calloc(1, sizeof(ColumnarWriter));
+    ASSERT_OR_1(writer);
+    writer->f = f;
+
+    *sink = (OutputSink) {
+        .kinds = EMA_OUTPUT_RESULTS,
+        .begin = columnar_begin,
+        .records = columnar_records,
+        .end = columnar_end,
+        .finalize = free,
+        .usr = writer,
+    };
+    return 0;
+}
+
+int EMA_print_all_columnar(FILE* f)
+{
+    OutputSink sink;
+    int err = EMA_output_sink_columnar(&sink, f);
+    if( err )
+        return err;
+
+    err = EMA_output_results(&sink, 0);
+    sink.finalize(sink.usr);
+    return err;
+}
@@ -0,0 +1,227 @@
+#ifndef EMA_REGION_COLUMNAR_USER_H
+#define EMA_REGION_COLUMNAR_USER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Columnar output format. */
+/*
+ * A columnar output file holds the rows of `EMA_print_all`, one per region,
+ * thread and device, column by column. Strings are stored once in a
+ * dictionary, and regions and devices in tables of string ids. The file can
+ * be mapped into memory and scanned in place:
+ *
+ *     ColumnarFileHeader
+ *     string offsets, uint64_t[num_strings]    at string_offset
+ *     string data, NUL-terminated              at string_data_offset
+ *     ColumnarRegion[num_regions]              at region_offset
+ *     ColumnarDevice[num_devices]              at device_offset
+ *     columns, width * num_rows bytes each     at ColumnarColumn.offset
+ *     ColumnarIndex with ColumnarColumn[num_columns]
+ *     ColumnarTrailer                          the last 16 bytes
+ *
+ * The writer streams the file front to back; readers start from the
+ * trailer, which locates the index. All integers are in host byte order and
+ * all sections are 8-byte aligned.
+ */
+#define EMA_COLUMNAR_MAGIC "EMACOLMN"
+#define EMA_COLUMNAR_VERSION 1
+
+/* Value of a percentile column without histograms. */
+#define EMA_COLUMNAR_NO_PERCENTILE UINT64_MAX
+
+/**
+ * Columns of a columnar output file. Statistics per visit are NaN without
+ * samples.
+ */
+typedef enum
+{
+    EMA_COLUMN_THREAD,  // int32_t
+    EMA_COLUMN_REGION,  // uint32_t, index into the region table
+    EMA_COLUMN_DEVICE,  // uint32_t, index into the device table
+    EMA_COLUMN_VISITS,  // uint64_t
+    EMA_COLUMN_ENERGY,  // uint64_t, uJ
+    EMA_COLUMN_TIME,  // uint64_t, us
+    EMA_COLUMN_STALE,  // uint8_t
+    EMA_COLUMN_ENERGY_MIN,  // double, ENERGY_MIN to POWER_STD
+    EMA_COLUMN_ENERGY_MAX,
+    EMA_COLUMN_ENERGY_MEAN,
+    EMA_COLUMN_ENERGY_STD,
+    EMA_COLUMN_TIME_MIN,
+    EMA_COLUMN_TIME_MAX,
+    EMA_COLUMN_TIME_MEAN,
+    EMA_COLUMN_TIME_STD,
+    EMA_COLUMN_POWER_MIN,
+    EMA_COLUMN_POWER_MAX,
+    EMA_COLUMN_POWER_MEAN,
+    EMA_COLUMN_POWER_STD,
+    EMA_COLUMN_ENERGY_P50,  // uint64_t, ENERGY_P50 to TIME_P99
+    EMA_COLUMN_ENERGY_P90,
+    EMA_COLUMN_ENERGY_P99,
+    EMA_COLUMN_TIME_P50,
+    EMA_COLUMN_TIME_P90,
+    EMA_COLUMN_TIME_P99,
+    EMA_COLUMN_MEASURED_VISITS,  // uint64_t
+    EMA_COLUMN_ENERGY_ERROR,  // uint64_t
+    EMA_COLUMNAR_COLUMNS,
+} ColumnarColumnId;
+
+/**
+ * The `ColumnarFileHeader` type is at the start of a columnar output file.
+ */
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+} ColumnarFileHeader;
+
+/**
+ * The `ColumnarRegion` type describes a region definition by string ids.
+ */
+typedef struct
+{
+    uint32_t idf;
+    uint32_t file;
+    uint32_t function;
+    uint32_t line;
+} ColumnarRegion;
+
+/**
+ * The `ColumnarDevice` type describes a `Device` by string ids.
+ */
+typedef struct
+{
+    uint32_t name;
+    uint32_t uid;
+    uint32_t type;
+    uint32_t reserved;
+} ColumnarDevice;
+
+/**
+ * The `ColumnarColumn` type locates a column with `width` bytes per row.
+ */
+typedef struct
+{
+    uint32_t id;  // ColumnarColumnId
+    uint32_t width;
+    uint64_t offset;
+} ColumnarColumn;
+
+/**
+ * The `ColumnarIndex` type is the footer index of a columnar output file.
+ */
+typedef struct
+{
+    uint64_t num_rows;
+    uint64_t num_strings;
+    uint64_t string_offset;
+    uint64_t string_data_offset;
+    uint64_t string_data_size;
+    uint64_t num_regions;
+    uint64_t region_offset;
+    uint64_t num_devices;
+    uint64_t device_offset;
+    uint32_t num_columns;
+    uint32_t reserved;
+    ColumnarColumn columns[];
+} ColumnarIndex;
+
+/**
+ * The `ColumnarTrailer` type ends a columnar output file.
+ */
+typedef struct
+{
+    uint64_t index_offset;
+    char magic[8];
+} ColumnarTrailer;
+
+/**
+ * This function returns the index of a mapped columnar output file of `size`
+ * bytes, or NULL if it is no complete columnar file. The sections the index
+ * refers to are within the file.
+ */
+static inline
+const ColumnarIndex* EMA_columnar_file_index(const void* file, size_t size)
+{
+    const char* base = (const char*) file;
+    if( size < sizeof(ColumnarFileHeader) + sizeof(ColumnarTrailer)
+        || memcmp(base, EMA_COLUMNAR_MAGIC, 8) != 0
+        || ((const ColumnarFileHeader*) base)->version
+            != EMA_COLUMNAR_VERSION )
+        return NULL;
+
+    const ColumnarTrailer* trailer = (const ColumnarTrailer*) (
+        base + size - sizeof(ColumnarTrailer));
+    size_t end = size - sizeof(ColumnarTrailer);
+    if( memcmp(trailer->magic, EMA_COLUMNAR_MAGIC, 8) != 0
+        || trailer->index_offset > end
+        || end - trailer->index_offset < sizeof(ColumnarIndex) )
+        return NULL;
+
+    const ColumnarIndex* index = (const ColumnarIndex*) (
+        base + trailer->index_offset);
+    if( sizeof(ColumnarIndex) + index->num_columns * sizeof(ColumnarColumn)
+            > end - trailer->index_offset
+        || index->string_offset + index->num_strings * sizeof(uint64_t) > end
+        || index->string_data_offset + index->string_data_size > end
+        || (index->string_data_size && base[index->string_data_offset
+            + index->string_data_size - 1] != '\0')
+        || index->region_offset + index->num_regions * sizeof(ColumnarRegion)
+            > end
+        || index->device_offset + index->num_devices * sizeof(ColumnarDevice)
+            > end )
+        return NULL;
+
+    for(uint32_t i = 0; i < index->num_columns; ++i)
+        if( index->columns[i].offset
+            + index->columns[i].width * index->num_rows > end )
+            return NULL;
+    return index;
+}
+
+/**
+ * This function returns column `id` of a mapped columnar output file, or
+ * NULL if the file has no such column.
+ */
+static inline
+const void* EMA_columnar_file_column(
+    const void* file, const ColumnarIndex* index, ColumnarColumnId id)
+{
+    for(uint32_t i = 0; i < index->num_columns; ++i)
+        if( index->columns[i].id == (uint32_t) id )
+            return (const char*) file + index->columns[i].offset;
+    return NULL;
+}
+
+/**
+ * This function returns string `id` of a mapped columnar output file.
+ */
+static inline
+const char* EMA_columnar_file_string(
+    const void* file, const ColumnarIndex* index, uint32_t id)
+{
+    const uint64_t* offsets = (const uint64_t*) (
+        (const char*) file + index->string_offset);
+    if( id >= index->num_strings
+        || offsets[id] >= index->string_data_size )
+        return "";
+    return (const char*) file + index->string_data_offset + offsets[id];
+}
+
+/* Columnar output interface. */
+/**
+ * This function writes the results of all registered `Device` objects, the
+ * same as :c:func:`EMA_print_all`, in the columnar format to a given file.
+ * `EMA_finalize` writes `output.EMA.<pid>` in this format if the environment
+ * variable `EMA_OUTPUT` is `columnar`.
+ *
+ * @param f: Specifies a file to write to, opened in binary mode.
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_print_all_columnar(FILE* f);
+
+#endif
@@ -0,0 +1,489 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <EMA/core/device.h>
+#include <EMA/ext/c-hashmap/map.h>
+#include <EMA/utils/arena.h>
+#include <EMA/utils/error.h>
+#include <EMA/utils/time.h>
+
+#include "export.h"
+#include "region.h"
+#include "region_store.h"
+#include "sampling.h"
+#include "shared.h"
+#include "sink.h"
+
+/*
+ * A snapshot sums the counters of the regions of a definition per device.
+ * Their threads keep adding to them meanwhile; the exporter only loads
+ * them. The window of an interval record is the difference to the totals
+ * of the previous snapshot, which the exporter keeps, so nothing has to be
+ * swapped or reset on the instrumented threads. Exited threads are merged
+ * into the retired store under the lock the iteration holds, so the sums
+ * stay continuous across thread exits.
+ */
+typedef struct
+{
+    const char* idf;  // interned, definitions compare by pointer
+    const char* file;
+    const char* function;
+    const Device* device;
+    uint64_t line;
+} ExportKey;
+
+typedef struct ExportEntry
+{
+    ExportKey key;
+    unsigned long long visits, energy, time;  // of the current snapshot
+    unsigned long long last_visits, last_energy, last_time;
+    struct ExportEntry* next;  // in order of appearance
+} ExportEntry;
+
+static struct
+{
+    ExportMode mode;
+    unsigned long long interval_ms;
+
+    /* Snapshots; the entries and the file are used under `snapshot_mutex`. */
+    pthread_mutex_t snapshot_mutex;
+    int running;
+    FILE* f;
+    unsigned long long snapshots;
+    uint64_t start_ns;
+    uint64_t last_ns;
+    hashmap* entries_by_key;
+    ExportEntry* entries;
+    ExportEntry** tail;
+    Arena arena;
+    OutputRecord* records;  // batch of a definition
+    size_t capacity;
+    OutputInfo info;  // of the snapshot being written
+
+    /* Exporter thread. */
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int stop;
+} exporter = {
+    .snapshot_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Only the extrapolated energy is used, not its error. */
+static const VisitStats no_stats;
+
+static
+ExportEntry* get_entry(const Region* region, const Device* device)
+{
+    ExportKey key = {
+        .idf = region->idf,
+        .file = region->file,
+        .function = region->function,
+        .device = device,
+        .line = region->line,
+    };
+
+    uintptr_t value;
+    if( hashmap_get(exporter.entries_by_key, &key, sizeof(key), &value) )
+        return (ExportEntry*) value;
+
+    ExportEntry* entry =
+        EMA_arena_calloc(&exporter.arena, sizeof(ExportEntry), 8);
+    ASSERT_OR_NULL(entry);
+    entry->key = key;
+    hashmap_set(exporter.entries_by_key,
+        &entry->key, sizeof(key), (uintptr_t) entry);
+
+    *exporter.tail = entry;
+    exporter.tail = &entry->next;
+    return entry;
+}
+
+static
+int add_region(const Region* region, unsigned long long visits)
+{
+    const Measurements* measurements = &region->measurements;
+    for(size_t i = 0; i < measurements->size; ++i)
+    {
+        ExportEntry* entry = get_entry(region, region->devices[i]);
+        ASSERT_OR_1(entry);
+
+        unsigned long long time =
+            EMA_counter_load(measurements->time_result + i);
+        unsigned long long energy, error;
+        EMA_sampling_extrapolate(
+            EMA_counter_load(measurements->energy_result + i),
+            EMA_counter_load(measurements->measured_time + i),
+            time, &no_stats, &energy, &error);
+
+        entry->visits += visits;
+        entry->energy += energy;
+        entry->time += time;
+    }
+    return 0;
+}
+
+static
+int add_thread_region(Region* region, void* usr)
+{
+    return add_region(region, EMA_counter_load(&region->visits));
+}
+
+static
+int add_region_store(const RegionStore* store, int thread_idx, void* usr)
+{
+    return EMA_region_store_iterate(store, add_thread_region, usr);
+}
+
+static
+int add_shared_region(const SharedRegion* shared, void* usr)
+{
+    unsigned long long visits;
+    EMA_shared_region_get_visits(shared, &visits, NULL);
+    return add_region(shared->region, visits);
+}
+
+static
+int write_header(void)
+{
+    int ret = fprintf(
+        exporter.f,
+        "snapshot,timestamp,window,region_idf,file,line,function,"
+        "device_name,device_uid,visits,energy,time\n"
+    );
+    return ret >= 0 ? 0 : 1;
+}
+
+/* `export.EMA.<pid>` is the sink of the snapshots that is always there. */
+static
+int file_begin(const OutputInfo* info, void* usr)
+{
+    exporter.info = *info;
+    return 0;
+}
+
+static
+int file_records(const OutputRecord* records, size_t n, void* usr)
+{
+    for(size_t i = 0; i < n; ++i)
+    {
+        /* Extrapolated energy may shrink, so windows print it signed. */
+        const OutputRecord* record = records + i;
+        int ret = fprintf(
+            exporter.f, "%llu,%llu,%llu,%s,%s,%u,%s,%s,%s,%llu,%lld,%llu\n",
+            exporter.info.snapshot,
+            exporter.info.timestamp,
+            exporter.info.window,
+            record->idf,
+            record->file,
+            record->line,
+            record->function,
+            record->device->name,
+            record->device->uid,
+            record->visits,
+            (long long) record->energy,
+            record->time
+        );
+        if( ret < 0 )
+            return 1;
+    }
+    return 0;
+}
+
+static
+int file_end(int failed, void* usr)
+{
+    return fflush(exporter.f) != 0 || failed;
+}
+
+static
+OutputRecord* next_record(size_t n)
+{
+    if( n == exporter.capacity )
+    {
+        size_t capacity = exporter.capacity ? exporter.capacity * 2 : 16;
+        OutputRecord* records = realloc(
+            exporter.records, sizeof(OutputRecord) * capacity);
+        ASSERT_OR_NULL(records);
+        exporter.records = records;
+        exporter.capacity = capacity;
+    }
+    return exporter.records + n;
+}
+
+/* The records of a snapshot, a batch per run of entries of a definition. */
+static
+int snapshot_records(EMA_output_batch_cb cb, void* usr)
+{
+    int interval = exporter.mode == EMA_EXPORT_INTERVAL;
+    size_t n = 0;
+    for(ExportEntry* entry = exporter.entries; entry; entry = entry->next)
+    {
+        unsigned long long visits = entry->visits;
+        unsigned long long energy = entry->energy;
+        unsigned long long time = entry->time;
+        if( interval )
+        {
+            visits -= entry->last_visits;
+            energy -= entry->last_energy;
+            time -= entry->last_time;
+            if( !visits && !energy && !time )
+                continue;
+        }
+
+        const ExportKey* key = &entry->key;
+        if( n && (exporter.records->idf != key->idf
+            || exporter.records->file != key->file
+            || exporter.records->function != key->function
+            || exporter.records->line != key->line) )
+        {
+            int err = cb(exporter.records, n, usr);
+            if( err )
+                return err;
+            n = 0;
+        }
+
+        OutputRecord* record = next_record(n);
+        ASSERT_OR_1(record);
+        *record = (OutputRecord) {
+            .thread = EMA_OUTPUT_ALL_THREADS,
+            .idf = key->idf,
+            .file = key->file,
+            .function = key->function,
+            .line = key->line,
+            .device = key->device,
+            .visits = visits,
+            .energy = energy,
+            .time = time,
+        };
+        for(int i = 0; i < EMA_OUTPUT_QUANTITIES; ++i)
+            for(int j = 0; j < 4; ++j)
+                record->moments[i][j] = NAN;
+        for(int i = 0; i < EMA_OUTPUT_PERCENTILE_QUANTITIES; ++i)
+            for(int j = 0; j < EMA_OUTPUT_PERCENTILES; ++j)
+                record->percentiles[i][j] = EMA_OUTPUT_NO_PERCENTILE;
+        ++n;
+    }
+    return n ? cb(exporter.records, n, usr) : 0;
+}
+
+static
+int write_snapshot(uint64_t now_ns)
+{
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+
+    int interval = exporter.mode == EMA_EXPORT_INTERVAL;
+    OutputInfo info = {
+        .kind = EMA_OUTPUT_SNAPSHOTS,
+        .mode = exporter.mode,
+        .snapshot = ++exporter.snapshots,
+        .timestamp = wall.tv_sec * 1000000ULL + wall.tv_nsec / 1000,
+        .window = (now_ns - (interval
+            ? exporter.last_ns : exporter.start_ns)) / 1000,
+    };
+    OutputSink file = {
+        .kinds = EMA_OUTPUT_SNAPSHOTS,
+        .begin = file_begin,
+        .records = file_records,
+        .end = file_end,
+    };
+    return EMA_output_run(&info, snapshot_records, &file, 1);
+}
+
+/* Called with `snapshot_mutex` held. */
+static
+int snapshot(void)
+{
+    for(ExportEntry* entry = exporter.entries; entry; entry = entry->next)
+    {
+        entry->last_visits = entry->visits;
+        entry->last_energy = entry->energy;
+        entry->last_time = entry->time;
+        entry->visits = entry->energy = entry->time = 0;
+    }
+
+    uint64_t now = EMA_get_time_in_ns();
+    int err = EMA_region_stores_iterate(add_region_store, NULL);
+    err = EMA_shared_regions_iterate(add_shared_region, NULL) || err;
+    err = write_snapshot(now) || err;
+    exporter.last_ns = now;
+    return err;
+}
+
+int EMA_export_snapshot(void)
+{
+    pthread_mutex_lock(&exporter.snapshot_mutex);
+    int err = 1;
+    if( exporter.running )
+        err = snapshot();
+    else
+        ERROR_MSG("The exporter is not running.");
+    pthread_mutex_unlock(&exporter.snapshot_mutex);
+    return err;
+}
+
+static
+void add_ms(struct timespec* ts, unsigned long long ms)
+{
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000L;
+    if( ts->tv_nsec >= 1000000000L )
+    {
+        ts->tv_sec += 1;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static
+void* export_thread(void* args)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    pthread_mutex_lock(&exporter.mutex);
+    while( !exporter.stop )
+    {
+        add_ms(&deadline, exporter.interval_ms);
+        int ret = 0;
+        while( !exporter.stop && ret != ETIMEDOUT )
+            ret = pthread_cond_timedwait(
+                &exporter.cond, &exporter.mutex, &deadline);
+        if( exporter.stop )
+            break;
+        pthread_mutex_unlock(&exporter.mutex);
+
+        if( EMA_export_snapshot() != 0 )
+            ERROR_MSG("Failed to export a snapshot.");
+
+        /* Skip the deadlines a slow snapshot missed instead of catching up. */
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if( now.tv_sec > deadline.tv_sec
+            || (now.tv_sec == deadline.tv_sec
+                && now.tv_nsec > deadline.tv_nsec) )
+            deadline = now;
+
+        pthread_mutex_lock(&exporter.mutex);
+    }
+    pthread_mutex_unlock(&exporter.mutex);
+    return NULL;
+}
+
+int EMA_export_running(void)
+{
+    pthread_mutex_lock(&exporter.snapshot_mutex);
+    int running = exporter.running;
+    pthread_mutex_unlock(&exporter.snapshot_mutex);
+    return running;
+}
+
+int EMA_export_start(ExportMode mode, unsigned long long interval_ms)
+{
+    ASSERT_MSG_OR_1(mode == EMA_EXPORT_INTERVAL
+        || mode == EMA_EXPORT_CUMULATIVE, "Invalid export mode %d.", mode);
+    ASSERT_MSG_OR_1(interval_ms > 0, "The export interval must not be 0.");
+
+    ASSERT_MSG_OR_1(!EMA_export_running(), "The exporter is already running.");
+
+    char* filename;
+    ASSERT_OR_1(asprintf(&filename, "export.EMA.%u", getpid()) >= 0);
+    exporter.f = fopen(filename, "w");
+    ASSERT_SYS_MSG(exporter.f, 1, "Failed to open '%s'", filename);
+    free(filename);
+
+    exporter.entries_by_key = hashmap_create();
+    ASSERT_OR_1(exporter.entries_by_key);
+    exporter.entries = NULL;
+    exporter.tail = &exporter.entries;
+    EMA_arena_init(&exporter.arena);
+    exporter.records = NULL;
+    exporter.capacity = 0;
+
+    exporter.mode = mode;
+    exporter.interval_ms = interval_ms;
+    exporter.snapshots = 0;
+    exporter.start_ns = exporter.last_ns = EMA_get_time_in_ns();
+    int err = write_header();
+    if( err )
+        return err;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&exporter.cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_mutex_lock(&exporter.snapshot_mutex);
+    exporter.running = 1;
+    pthread_mutex_unlock(&exporter.snapshot_mutex);
+
+    exporter.stop = 0;
+    err = pthread_create(&exporter.thread, NULL, export_thread, NULL);
+    if( err )
+    {
+        exporter.running = 0;
+        ERROR_MSG("Failed to start the exporter.");
+        return 1;
+    }
+    return 0;
+}
+
+int EMA_export_start_from_string(const char* config)
+{
+    ExportMode mode;
+    const char* value = strchr(config, ':');
+    char* end = NULL;
+
+    ASSERT_MSG_OR_1(value, "Invalid export config '%s'.", config);
+    size_t length = value - config;
+    ++value;
+
+    if( length == 8 && strncmp(config, "interval", 8) == 0 )
+        mode = EMA_EXPORT_INTERVAL;
+    else if( length == 10 && strncmp(config, "cumulative", 10) == 0 )
+        mode = EMA_EXPORT_CUMULATIVE;
+    else
+    {
+        ERROR_MSG("Invalid export config '%s'.", config);
+        return 1;
+    }
+
+    unsigned long long interval_ms = strtoull(value, &end, 10);
+    ASSERT_MSG_OR_1(end != value && *end == '\0',
+        "Invalid export config '%s'.", config);
+
+    return EMA_export_start(mode, interval_ms);
+}
+
+int EMA_export_stop(void)
+{
+    if( !EMA_export_running() )
+        return 0;
+
+    pthread_mutex_lock(&exporter.mutex);
+    exporter.stop = 1;
+    pthread_cond_signal(&exporter.cond);
+    pthread_mutex_unlock(&exporter.mutex);
+    pthread_join(exporter.thread, NULL);
+    pthread_cond_destroy(&exporter.cond);
+
+    pthread_mutex_lock(&exporter.snapshot_mutex);
+    int err = snapshot();
+    exporter.running = 0;
+    pthread_mutex_unlock(&exporter.snapshot_mutex);
+
+    err = fclose(exporter.f) != 0 || err;
+    hashmap_free(exporter.entries_by_key);
+    EMA_arena_finalize(&exporter.arena);
+    free(exporter.records);
+    return err;
+}
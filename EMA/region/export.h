@@ -0,0 +1,14 @@
+#ifndef EMA_REGION_EXPORT_H
+#define EMA_REGION_EXPORT_H
+
+#include "export.user.h"
+
+/* Environment variable that starts the exporter in `EMA_init`:
+ * interval:<ms> | cumulative:<ms> */
+#define EMA_EXPORT "EMA_EXPORT"
+
+int EMA_export_start_from_string(const char* config);
+int EMA_export_stop(void);  // writes a last snapshot
+int EMA_export_running(void);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef EMA_REGION_EXPORT_USER_H
+#define EMA_REGION_EXPORT_USER_H
+
+/* Periodic export interface. */
+/**
+ * The `ExportMode` type selects what the records of a snapshot count:
+ *
+ *   - `EMA_EXPORT_INTERVAL`: the visits, energy and time since the previous
+ *     snapshot; definitions without visits in between are left out,
+ *   - `EMA_EXPORT_CUMULATIVE`: the totals since `EMA_init`.
+ */
+typedef enum
+{
+    EMA_EXPORT_INTERVAL,
+    EMA_EXPORT_CUMULATIVE,
+} ExportMode;
+
+/**
+ * This function starts a background thread that appends a snapshot of all
+ * regions to `export.EMA.<pid>` every `interval_ms` milliseconds, and once
+ * more at `EMA_finalize`. Records sum the threads of a region definition
+ * per `Device`. Instrumented threads are never stopped or locked out:
+ * snapshots read their counters while they run.
+ *
+ * The exporter can also be started at `EMA_init` with the environment
+ * variable `EMA_EXPORT=interval:<ms>` or `EMA_EXPORT=cumulative:<ms>`.
+ *
+ * @param mode: `ExportMode` of the records.
+ * @param interval_ms: Time between snapshots in milli seconds.
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_export_start(ExportMode mode, unsigned long long interval_ms);
+
+/**
+ * This function appends a snapshot right away, e.g. before a service
+ * reloads. In interval mode, the next window starts now.
+ *
+ * @returns 0 on success or another value to indicate an error, e.g. if the
+ * exporter is not running.
+ */
+int EMA_export_snapshot(void);
+
+#endif
@@ -0,0 +1,99 @@
+#include <stdlib.h>
+
+#include <EMA/utils/error.h>
+
+#include "histogram.h"
+
+#define DEFAULT_MAX_BITS 40
+#define MAX_PRECISION_BITS 16
+
+HistogramLayout EMA_histogram_layout = {
+    .precision_bits = 0,
+    .max_bits = 0,
+    .size = 0
+};
+
+/* Must be called before regions are created. */
+int EMA_histogram_configure(unsigned int precision_bits, unsigned int max_bits)
+{
+    ASSERT_MSG_OR_1(precision_bits <= MAX_PRECISION_BITS,
+        "Histogram precision must be at most %d bits.", MAX_PRECISION_BITS);
+    ASSERT_MSG_OR_1(max_bits > precision_bits && max_bits <= 64,
+        "Histogram range must be within (%u, 64] bits.", precision_bits);
+
+    EMA_histogram_layout.precision_bits = precision_bits;
+    EMA_histogram_layout.max_bits = max_bits;
+    EMA_histogram_layout.size =
+        (size_t) (max_bits - precision_bits + 1) << precision_bits;
+    return 0;
+}
+
+/**
+ * Parse "<precision_bits>[:<max_bits>]", e.g. "3" or "3:40".
+ */
+int EMA_histogram_configure_from_string(const char* config)
+{
+    char* end;
+    unsigned long precision_bits = strtoul(config, &end, 10);
+    unsigned long max_bits = DEFAULT_MAX_BITS;
+
+    ASSERT_MSG_OR_1(end != config, "Invalid histogram config '%s'.", config);
+    if( *end == ':' )
+        max_bits = strtoul(end + 1, NULL, 10);
+
+    return EMA_histogram_configure(precision_bits, max_bits);
+}
+
+void EMA_histogram_merge(uint64_t* dst, const _Atomic uint64_t* src)
+{
+    for(size_t i = 0; i < EMA_histogram_layout.size; ++i)
+        dst[i] += atomic_load_explicit(
+            (_Atomic uint64_t*) src + i, memory_order_relaxed);
+}
+
+/* Largest value of bucket `i`. */
+static
+unsigned long long bucket_max(size_t i)
+{
+    unsigned int p = EMA_histogram_layout.precision_bits;
+
+    if( i < (1ULL << p) )
+        return i;
+
+    unsigned int exponent = (i >> p) + p - 1;
+    unsigned long long sub = i & ((1ULL << p) - 1);
+    unsigned long long width = 1ULL << (exponent - p);
+    return ((1ULL << exponent) + sub * width) + (width - 1);
+}
+
+/**
+ * Value at `percentile` (0 to 100): the largest value of the bucket that
+ * holds it. Returns 0 for an empty histogram.
+ */
+unsigned long long EMA_histogram_percentile(
+    const uint64_t* counts, double percentile)
+{
+    uint64_t total = 0;
+    for(size_t i = 0; i < EMA_histogram_layout.size; ++i)
+        total += counts[i];
+    if( total == 0 )
+        return 0;
+
+    if( percentile < 0 )
+        percentile = 0;
+    if( percentile > 100 )
+        percentile = 100;
+
+    uint64_t rank = (uint64_t) (percentile / 100 * total + 0.5);
+    if( rank == 0 )
+        rank = 1;
+
+    uint64_t seen = 0;
+    for(size_t i = 0; i < EMA_histogram_layout.size; ++i)
+    {
+        seen += counts[i];
+        if( seen >= rank )
+            return bucket_max(i);
+    }
+    return bucket_max(EMA_histogram_layout.size - 1);
+}
@@ -0,0 +1,69 @@
+#ifndef EMA_REGION_HISTOGRAM_H
+#define EMA_REGION_HISTOGRAM_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Environment variable enabling histograms: <precision_bits>[:<max_bits>] */
+#define EMA_HISTOGRAM "EMA_HISTOGRAM"
+
+/*
+ * Log-linear (HDR-style) histogram layout shared by all regions. Values
+ * below 2^precision_bits get exact buckets; above, each power of two is
+ * split into 2^precision_bits buckets, so the relative bucket width is at
+ * most 2^-precision_bits. Values from 2^max_bits on count into the last
+ * bucket. A histogram has `size` counters; 0 means histograms are disabled.
+ */
+typedef struct
+{
+    unsigned int precision_bits;
+    unsigned int max_bits;
+    size_t size;
+} HistogramLayout;
+
+extern HistogramLayout EMA_histogram_layout;
+
+int EMA_histogram_configure(unsigned int precision_bits, unsigned int max_bits);
+int EMA_histogram_configure_from_string(const char* config);
+
+static inline
+size_t EMA_histogram_index(unsigned long long value)
+{
+    unsigned int p = EMA_histogram_layout.precision_bits;
+
+    if( value < (1ULL << p) )
+        return value;
+
+    unsigned int exponent = 63 - __builtin_clzll(value);
+    if( exponent >= EMA_histogram_layout.max_bits )
+        return EMA_histogram_layout.size - 1;
+
+    size_t sub = (value >> (exponent - p)) - (1ULL << p);
+    return ((size_t) (exponent - p + 1) << p) + sub;
+}
+
+/* Single writer per histogram; readers may load concurrently. */
+static inline
+void EMA_histogram_add(_Atomic uint64_t* counts, unsigned long long value)
+{
+    _Atomic uint64_t* count = counts + EMA_histogram_index(value);
+    atomic_store_explicit(count,
+        atomic_load_explicit(count, memory_order_relaxed) + 1,
+        memory_order_relaxed);
+}
+
+/* For histograms with concurrent writers. */
+static inline
+void EMA_histogram_add_atomic(
+    _Atomic uint64_t* counts, unsigned long long value)
+{
+    atomic_fetch_add_explicit(
+        counts + EMA_histogram_index(value), 1, memory_order_relaxed);
+}
+
+void EMA_histogram_merge(uint64_t* dst, const _Atomic uint64_t* src);
+unsigned long long EMA_histogram_percentile(
+    const uint64_t* counts, double percentile);
+
+#endif
@@ -0,0 +1,589 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <EMA/core/device.h>
+#include <EMA/ext/c-hashmap/map.h>
+#include <EMA/utils/arena.h>
+#include <EMA/utils/error.h>
+
+#include "export.h"
+#include "metrics.h"
+#include "sink.h"
+
+#define METRICS_BACKLOG 16
+#define METRICS_REQUEST_SIZE 4096
+#define METRICS_TIMEOUT_S 1
+#define METRICS_CONTENT_TYPE \
+    "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+/*
+ * The counters are accumulated by a sink of the exporter's snapshots, on
+ * the exporter thread, which renders them into a page after each snapshot
+ * and publishes it with an atomic exchange. The server thread marks the
+ * page it sends in a hazard pointer; replaced pages are freed by the sink
+ * once the server no longer reads them. Neither side ever waits for the
+ * other, and neither touches the regions of the instrumented threads.
+ */
+typedef struct
+{
+    const char* idf;  // interned, definitions compare by pointer
+    const char* file;
+    const char* function;
+    const Device* device;
+    uint64_t line;
+} MetricKey;
+
+typedef struct MetricEntry
+{
+    MetricKey key;
+    unsigned long long visits, energy, time;  // since EMA_init, as served
+    unsigned long long estimate;  // extrapolated energy, may shrink
+    struct MetricEntry* next;  // in order of appearance
+} MetricEntry;
+
+typedef struct MetricsPage
+{
+    char* text;
+    size_t size;
+    struct MetricsPage* next;  // while retired
+} MetricsPage;
+
+static struct
+{
+    /* Accumulators; used by the sink only. */
+    int registered;
+    ExportMode mode;
+    hashmap* entries_by_key;
+    MetricEntry* entries;
+    MetricEntry** tail;
+    Arena arena;
+
+    /* Pages; published by the sink, read by the server. */
+    _Atomic(MetricsPage*) latest;
+    _Atomic(MetricsPage*) reading;
+    MetricsPage* retired;
+
+    /* Server. */
+    int running;
+    int listen_fd;
+    int wake[2];
+    char* unix_path;
+    pthread_t thread;
+} metrics;
+
+/* Pages. */
+static
+void print_escaped(FILE* f, const char* value)
+{
+    for(; *value; ++value)
+    {
+        if( *value == '\\' )
+            fputs("\\\\", f);
+        else if( *value == '"' )
+            fputs("\\\"", f);
+        else if( *value == '\n' )
+            fputs("\\n", f);
+        else
+            fputc(*value, f);
+    }
+}
+
+static
+void print_sample(FILE* f, const char* name, const MetricKey* key)
+{
+    fprintf(f, "%s_total{region=\"", name);
+    print_escaped(f, key->idf);
+    fputs("\",file=\"", f);
+    print_escaped(f, key->file);
+    fprintf(f, "\",line=\"%llu\",function=\"",
+        (unsigned long long) key->line);
+    print_escaped(f, key->function);
+    fputs("\",device=\"", f);
+    print_escaped(f, key->device->name);
+    fputs("\",device_uid=\"", f);
+    print_escaped(f, key->device->uid);
+    fputs("\"} ", f);
+}
+
+/* Samples of a family are contiguous, so each family is a pass. */
+static
+MetricsPage* render_page(void)
+{
+    MetricsPage* page = calloc(1, sizeof(MetricsPage));
+    ASSERT_OR_NULL(page);
+    FILE* f = open_memstream(&page->text, &page->size);
+    if( !f )
+    {
+        free(page);
+        return NULL;
+    }
+
+    fputs("# TYPE ema_region_visits counter\n"
+        "# HELP ema_region_visits Visits of the region by all threads.\n", f);
+    for(MetricEntry* entry = metrics.entries; entry; entry = entry->next)
+    {
+        print_sample(f, "ema_region_visits", &entry->key);
+        fprintf(f, "%llu\n", entry->visits);
+    }
+
+    fputs("# TYPE ema_region_energy_joules counter\n"
+        "# UNIT ema_region_energy_joules joules\n"
+        "# HELP ema_region_energy_joules Energy of the region on the device "
+        "by all threads.\n", f);
+    for(MetricEntry* entry = metrics.entries; entry; entry = entry->next)
+    {
+        print_sample(f, "ema_region_energy_joules", &entry->key);
+        fprintf(f, "%llu.%06llu\n",
+            entry->energy / 1000000, entry->energy % 1000000);
+    }
+
+    fputs("# TYPE ema_region_time_seconds counter\n"
+        "# UNIT ema_region_time_seconds seconds\n"
+        "# HELP ema_region_time_seconds Time in the region by all "
+        "threads.\n", f);
+    for(MetricEntry* entry = metrics.entries; entry; entry = entry->next)
+    {
+        print_sample(f, "ema_region_time_seconds", &entry->key);
+        fprintf(f, "%llu.%06llu\n",
+            entry->time / 1000000, entry->time % 1000000);
+    }
+
+    fputs("# EOF\n", f);
+    int err = ferror(f);
+    if( fclose(f) != 0 || err )
+    {
+        free(page->text);
+        free(page);
+        return NULL;
+    }
+    return page;
+}
+
+static
+void free_pages(MetricsPage* page)
+{
+    while( page )
+    {
+        MetricsPage* next = page->next;
+        free(page->text);
+        free(page);
+        page = next;
+    }
+}
+
+static
+void publish_page(MetricsPage* page)
+{
+    MetricsPage* old = atomic_exchange(&metrics.latest, page);
+    if( old )
+    {
+        old->next = metrics.retired;
+        metrics.retired = old;
+    }
+
+    /* A retired page the server does not read now, it never reads again. */
+    MetricsPage* reading = atomic_load(&metrics.reading);
+    MetricsPage** link = &metrics.retired;
+    while( *link )
+    {
+        MetricsPage* retired = *link;
+        if( retired == reading )
+        {
+            link = &retired->next;
+            continue;
+        }
+        *link = retired->next;
+        retired->next = NULL;
+        free_pages(retired);
+    }
+}
+
+static
+MetricsPage* acquire_page(void)
+{
+    MetricsPage* page;
+    do
+    {
+        page = atomic_load(&metrics.latest);
+        atomic_store(&metrics.reading, page);
+    } while( page != atomic_load(&metrics.latest) );
+    return page;
+}
+
+static
+void release_page(void)
+{
+    atomic_store(&metrics.reading, NULL);
+}
+
+/* Sink. */
+static
+MetricEntry* get_entry(const OutputRecord* record)
+{
+    MetricKey key = {
+        .idf = record->idf,
+        .file = record->file,
+        .function = record->function,
+        .device = record->device,
+        .line = record->line,
+    };
+
+    uintptr_t value;
+    if( hashmap_get(metrics.entries_by_key, &key, sizeof(key), &value) )
+        return (MetricEntry*) value;
+
+    MetricEntry* entry =
+        EMA_arena_calloc(&metrics.arena, sizeof(MetricEntry), 8);
+    ASSERT_OR_NULL(entry);
+    entry->key = key;
+    hashmap_set(metrics.entries_by_key,
+        &entry->key, sizeof(key), (uintptr_t) entry);
+
+    *metrics.tail = entry;
+    metrics.tail = &entry->next;
+    return entry;
+}
+
+static
+int metrics_begin(const OutputInfo* info, void* usr)
+{
+    metrics.mode = info->mode;
+    return 0;
+}
+
+/* Windows of interval snapshots add up; the energy estimate wraps back if
+ * a refined extrapolation shrank it. A counter must never decrease, so the
+ * served energy holds at its highest estimate until the estimate passes
+ * it again. */
+static
+int metrics_records(const OutputRecord* records, size_t n, void* usr)
+{
+    int interval = metrics.mode == EMA_EXPORT_INTERVAL;
+    for(size_t i = 0; i < n; ++i)
+    {
+        const OutputRecord* record = records + i;
+        MetricEntry* entry = get_entry(record);
+        ASSERT_OR_1(entry);
+        if( !interval )
+            entry->visits = entry->estimate = entry->time = 0;
+        entry->visits += record->visits;
+        entry->estimate += record->energy;
+        entry->time += record->time;
+        if( entry->estimate > entry->energy )
+            entry->energy = entry->estimate;
+    }
+    return 0;
+}
+
+static
+int metrics_end(int failed, void* usr)
+{
+    MetricsPage* page = render_page();
+    ASSERT_OR_1(page);
+    publish_page(page);
+    return failed;
+}
+
+static
+void metrics_finalize(void* usr)
+{
+    free_pages(atomic_exchange(&metrics.latest, NULL));
+    free_pages(metrics.retired);
+    metrics.retired = NULL;
+    hashmap_free(metrics.entries_by_key);
+    EMA_arena_finalize(&metrics.arena);
+    metrics.registered = 0;
+}
+
+/* Registered once, the accumulators outlive restarts of the server. */
+static
+int register_sink(void)
+{
+    if( metrics.registered )
+        return 0;
+
+    metrics.entries_by_key = hashmap_create();
+    ASSERT_OR_1(metrics.entries_by_key);
+    metrics.entries = NULL;
+    metrics.tail = &metrics.entries;
+    EMA_arena_init(&metrics.arena);
+
+    MetricsPage* page = render_page();
+    if( !page )
+    {
+        hashmap_free(metrics.entries_by_key);
+        return 1;
+    }
+    atomic_store(&metrics.latest, page);
+
+    OutputSink sink = {
+        .kinds = EMA_OUTPUT_SNAPSHOTS,
+        .begin = metrics_begin,
+        .records = metrics_records,
+        .end = metrics_end,
+        .finalize = metrics_finalize,
+    };
+    int err = EMA_register_output_sink(&sink);
+    if( err )
+    {
+        metrics_finalize(NULL);
+        return err;
+    }
+    metrics.registered = 1;
+    return 0;
+}
+
+/* Server. */
+static
+int send_all(int fd, const char* data, size_t size)
+{
+    while( size )
+    {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if( sent < 0 && errno == EINTR )
+            continue;
+        if( sent <= 0 )
+            return 1;
+        data += sent;
+        size -= sent;
+    }
+    return 0;
+}
+
+static
+int send_response(int fd, const char* status, const char* type,
+    const char* body, size_t size)
+{
+    char header[256];
+    int length = snprintf(header, sizeof(header),
+        "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+        "Connection: close\r\n\r\n", status, type, size);
+    if( length < 0 || (size_t) length >= sizeof(header) )
+        return 1;
+    return send_all(fd, header, length) || send_all(fd, body, size);
+}
+
+/* Reads the request head, up to the empty line. */
+static
+int read_request(int fd, char* request, size_t size)
+{
+    size_t used = 0;
+    request[0] = '\0';
+    while( used < size - 1 && !strstr(request, "\r\n\r\n") )
+    {
+        ssize_t n = recv(fd, request + used, size - 1 - used, 0);
+        if( n < 0 && errno == EINTR )
+            continue;
+        if( n <= 0 )
+            break;
+        used += n;
+        request[used] = '\0';
+    }
+    return used == 0;
+}
+
+static
+void serve(int fd)
+{
+    struct timeval timeout = { .tv_sec = METRICS_TIMEOUT_S };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    char request[METRICS_REQUEST_SIZE];
+    if( read_request(fd, request, sizeof(request)) )
+        return;
+
+    static const char* not_allowed = "Method Not Allowed\n";
+    static const char* not_found = "Not Found\n";
+    if( strncmp(request, "GET ", 4) != 0 )
+    {
+        send_response(fd, "405 Method Not Allowed", "text/plain",
+            not_allowed, strlen(not_allowed));
+        return;
+    }
+
+    const char* path = request + 4;
+    size_t length = strcspn(path, " ?\r\n");
+    if( length != 8 || strncmp(path, "/metrics", 8) != 0 )
+    {
+        send_response(fd, "404 Not Found", "text/plain",
+            not_found, strlen(not_found));
+        return;
+    }
+
+    MetricsPage* page = acquire_page();
+    send_response(fd, "200 OK", METRICS_CONTENT_TYPE, page->text, page->size);
+    release_page();
+}
+
+static
+void* metrics_thread(void* args)
+{
+    struct pollfd fds[2] = {
+        { .fd = metrics.listen_fd, .events = POLLIN },
+        { .fd = metrics.wake[0], .events = POLLIN },
+    };
+    for(;;)
+    {
+        if( poll(fds, 2, -1) < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            SYS_ERROR_MSG("Failed to wait for metrics requests");
+            break;
+        }
+        if( fds[1].revents )
+            break;
+        if( !(fds[0].revents & POLLIN) )
+            continue;
+
+        int fd = accept(metrics.listen_fd, NULL, NULL);
+        if( fd < 0 )
+            continue;
+        serve(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+static
+int listen_unix(const char* path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    ASSERT_MSG_OR_1(strlen(path) < sizeof(addr.sun_path),
+        "The metrics socket path '%s' is too long.", path);
+    strcpy(addr.sun_path, path);
+
+    /* A socket left behind by an earlier process is replaced. */
+    struct stat st;
+    if( stat(path, &st) == 0 && S_ISSOCK(st.st_mode) )
+        unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ASSERT_SYS_MSG(fd >= 0, 1, "Failed to create the metrics socket");
+    if( bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0
+        || listen(fd, METRICS_BACKLOG) != 0 )
+    {
+        SYS_ERROR_MSG("Failed to listen on '%s'", path);
+        close(fd);
+        return 1;
+    }
+
+    metrics.unix_path = strdup(path);
+    metrics.listen_fd = fd;
+    return 0;
+}
+
+static
+int listen_tcp(const char* port)
+{
+    char* end = NULL;
+    unsigned long value = strtoul(port, &end, 10);
+    ASSERT_MSG_OR_1(end != port && *end == '\0' && value <= 65535,
+        "Invalid metrics port '%s'.", port);
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(value),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ASSERT_SYS_MSG(fd >= 0, 1, "Failed to create the metrics socket");
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if( bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0
+        || listen(fd, METRICS_BACKLOG) != 0 )
+    {
+        SYS_ERROR_MSG("Failed to listen on port %lu", value);
+        close(fd);
+        return 1;
+    }
+
+    metrics.listen_fd = fd;
+    return 0;
+}
+
+static
+void close_server(void)
+{
+    close(metrics.listen_fd);
+    close(metrics.wake[0]);
+    close(metrics.wake[1]);
+    if( metrics.unix_path )
+        unlink(metrics.unix_path);
+    free(metrics.unix_path);
+    metrics.unix_path = NULL;
+}
+
+int EMA_metrics_start(const char* address)
+{
+    ASSERT_MSG_OR_1(!metrics.running, "The metrics server is already running.");
+
+    /* Without snapshots the counters would stay 0 forever. */
+    ASSERT_MSG_OR_1(EMA_export_running(), "The metrics server needs the "
+        "exporter; set EMA_EXPORT or call EMA_export_start first.");
+
+    int err;
+    if( strncmp(address, "unix:", 5) == 0 )
+        err = listen_unix(address + 5);
+    else if( strncmp(address, "tcp:", 4) == 0 )
+        err = listen_tcp(address + 4);
+    else
+    {
+        ERROR_MSG("Invalid metrics address '%s'.", address);
+        return 1;
+    }
+    if( err )
+        return err;
+
+    if( pipe2(metrics.wake, O_CLOEXEC) != 0 )
+    {
+        SYS_ERROR_MSG("Failed to create the metrics wake pipe");
+        metrics.wake[0] = metrics.wake[1] = -1;
+        close_server();
+        return 1;
+    }
+
+    err = register_sink();
+    if( err )
+    {
+        close_server();
+        return err;
+    }
+
+    err = pthread_create(&metrics.thread, NULL, metrics_thread, NULL);
+    if( err )
+    {
+        ERROR_MSG("Failed to start the metrics server.");
+        close_server();
+        return 1;
+    }
+    metrics.running = 1;
+    return 0;
+}
+
+int EMA_metrics_stop(void)
+{
+    if( !metrics.running )
+        return 0;
+
+    int err = write(metrics.wake[1], "", 1) != 1;
+    pthread_join(metrics.thread, NULL);
+    close_server();
+    metrics.running = 0;
+    return err;
+}
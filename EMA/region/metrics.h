@@ -0,0 +1,12 @@
+#ifndef EMA_REGION_METRICS_H
+#define EMA_REGION_METRICS_H
+
+#include "metrics.user.h"
+
+/* Environment variable that starts the metrics server in `EMA_init`:
+ * unix:<path> | tcp:<port> */
+#define EMA_METRICS "EMA_METRICS"
+
+int EMA_metrics_stop(void);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef EMA_REGION_METRICS_USER_H
+#define EMA_REGION_METRICS_USER_H
+
+/* Metrics interface. */
+/**
+ * This function starts a background thread that serves the regions as
+ * OpenMetrics text, for Prometheus or `curl`, over HTTP on a local socket:
+ *
+ *   - `unix:<path>`: a Unix domain socket, e.g.
+ *     `curl --unix-socket <path> http://localhost/metrics`,
+ *   - `tcp:<port>`: a port of the loopback interface, e.g.
+ *     `curl http://127.0.0.1:<port>/metrics`.
+ *
+ * The visits, energy and time counters of each region definition and
+ * `Device` sum all threads. They are accumulated from the snapshots of the
+ * exporter, see :c:func:`EMA_export_start`, which must already run: the
+ * server does not start without it. Scrapes read the last snapshot without locks and never reach
+ * the instrumented threads.
+ *
+ * The server can also be started at `EMA_init` with the environment variable
+ * `EMA_METRICS=unix:<path>` or `EMA_METRICS=tcp:<port>`, together with
+ * `EMA_EXPORT`. It stops in `EMA_finalize`.
+ *
+ * @param address: Address to listen on.
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_metrics_start(const char* address);
+
+#endif
@@ -1,69 +1,528 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <EMA/ext/c-hashmap/map.h>
+#include <EMA/utils/error.h>
+#include <EMA/utils/format.h>
+
+#include "calltree.h"
+#include "histogram.h"
 #include "output.h"
 #include "region.h"
 #include "region_store.h"
+#include "sampling.h"
+#include "shared.h"
+#include "sink.h"
 
 int EMA_print_header(FILE* f)
 {
     int ret = fprintf(
         f,
         "thread,region_idf,file,line,function,visits,"
-        "device_name,device_uid,device_type,energy,time\n"
+        "device_name,device_uid,device_type,energy,time,stale,"
+        "energy_min,energy_max,energy_mean,energy_std,"
+        "time_min,time_max,time_mean,time_std,"
+        "power_min,power_max,power_mean,power_std,"
+        "energy_p50,energy_p90,energy_p99,time_p50,time_p90,time_p99,"
+        "measured_visits,energy_error\n"
     );
     return ret >= 0 ? 0 : 1;
 }
 
-int EMA_print_region(const Region* region, int thread_idx, FILE* f)
+/* Records. */
+_Static_assert(EMA_OUTPUT_EXITED_THREADS == EMA_RETIRED_THREADS
+    && EMA_OUTPUT_SHARED_THREADS == EMA_SHARED_THREADS,
+    "Records name the threads of the region stores.");
+_Static_assert(EMA_OUTPUT_ENERGY < EMA_OUTPUT_PERCENTILE_QUANTITIES
+    && EMA_OUTPUT_TIME < EMA_OUTPUT_PERCENTILE_QUANTITIES,
+    "Percentiles are indexed by the energy and time statistics.");
+
+static const double RECORD_PERCENTILES[EMA_OUTPUT_PERCENTILES] = {
+    50, 90, 99 };
+
+/* min, max, mean, std; NaN without samples. */
+static
+void record_moments(
+    double* dst, const VisitMoments* moments, unsigned long long n)
 {
-    for(int i = 0; i < region->measurements.size; ++i)
+    if( n == 0 )
     {
-        const Measurement *measurement = region->measurements.array + i;
-        int ret = fprintf(
-            f, "%d,%s,%s,%d,%s,%llu,%s,%s,%s,%llu,%llu\n",
-            thread_idx,
-            region->idf,
-            region->file,
-            region->line,
-            region->function,
-            region->visits,
-            measurement->device->name,
-            measurement->device->uid,
-            measurement->device->type,
-            measurement->energy_result,
-            measurement->time_result
-        );
-        if( ret < 0 )
-            return 1;
+        for(int i = 0; i < 4; ++i)
+            dst[i] = NAN;
+        return;
     }
-    return 0;
+    dst[0] = moments->min;
+    dst[1] = moments->max;
+    dst[2] = moments->mean;
+    dst[3] = EMA_visit_moments_stddev(moments, n);
+}
+
+static
+void record_percentiles(
+    unsigned long long* dst, const _Atomic uint64_t* histogram,
+    uint64_t* counts)
+{
+    if( histogram )
+    {
+        memset(counts, 0, sizeof(uint64_t) * EMA_histogram_layout.size);
+        EMA_histogram_merge(counts, histogram);
+    }
+    for(size_t i = 0; i < EMA_OUTPUT_PERCENTILES; ++i)
+        dst[i] = histogram
+            ? EMA_histogram_percentile(counts, RECORD_PERCENTILES[i])
+            : EMA_OUTPUT_NO_PERCENTILE;
 }
 
 typedef struct
 {
+    EMA_output_batch_cb cb;
+    void* usr;
     int thread_idx;
+    OutputRecord* records;  // batch of a region
+    size_t capacity;
+} RecordIterator;
+
+static
+int output_region(
+    const Region* region, unsigned long long visits, RecordIterator* it)
+{
+    const Measurements* measurements = &region->measurements;
+    if( measurements->size == 0 )
+        return 0;
+    if( measurements->size > it->capacity )
+    {
+        OutputRecord* records = realloc(
+            it->records, sizeof(OutputRecord) * measurements->size);
+        ASSERT_OR_1(records);
+        it->records = records;
+        it->capacity = measurements->size;
+    }
+
+    uint64_t* counts = NULL;
+    if( measurements->histograms )
+    {
+        counts = malloc(sizeof(uint64_t) * EMA_histogram_layout.size);
+        ASSERT_OR_1(counts);
+    }
+
+    for(size_t i = 0; i < measurements->size; ++i)
+    {
+        const VisitStats* stats = measurements->stats + i;
+        OutputRecord* record = it->records + i;
+        *record = (OutputRecord) {
+            .thread = it->thread_idx,
+            .idf = region->idf,
+            .file = region->file,
+            .function = region->function,
+            .line = region->line,
+            .device = region->devices[i],
+            .visits = visits,
+            .time = measurements->time_result[i],
+            .stale = measurements->stale[i],
+            .measured_visits = region->measured_visits,
+        };
+        EMA_sampling_extrapolate(
+            measurements->energy_result[i], measurements->measured_time[i],
+            measurements->time_result[i], stats,
+            &record->energy, &record->energy_error);
+
+        record_moments(record->moments[EMA_OUTPUT_ENERGY],
+            &stats->energy, stats->n);
+        record_moments(record->moments[EMA_OUTPUT_TIME],
+            &stats->time, stats->n);
+        record_moments(record->moments[EMA_OUTPUT_POWER],
+            &stats->power, stats->power_n);
+        record_percentiles(record->percentiles[EMA_OUTPUT_ENERGY],
+            EMA_region_energy_histogram(region, i), counts);
+        record_percentiles(record->percentiles[EMA_OUTPUT_TIME],
+            EMA_region_time_histogram(region, i), counts);
+    }
+    free(counts);
+    return it->cb(it->records, measurements->size, it->usr);
+}
+
+static
+int output_thread_region(Region* region, void* usr)
+{
+    return output_region(region, region->visits, usr);
+}
+
+static
+int output_region_store(const RegionStore* store, int thread_idx, void* usr)
+{
+    RecordIterator* it = usr;
+    it->thread_idx = thread_idx;
+    return EMA_region_store_iterate(store, output_thread_region, it);
+}
+
+/* The visits of all threads; energy, time and statistics of the phases, or
+ * of the token visits. */
+static
+int output_shared_region(const SharedRegion* shared, void* usr)
+{
+    RecordIterator* it = usr;
+    unsigned long long visits;
+    EMA_shared_region_get_visits(shared, &visits, NULL);
+    it->thread_idx = EMA_SHARED_THREADS;
+    return output_region(shared->region, visits, it);
+}
+
+int EMA_output_iterate(EMA_output_batch_cb cb, void* usr)
+{
+    RecordIterator it = { .cb = cb, .usr = usr };
+    int err = EMA_region_stores_iterate(output_region_store, &it);
+    err = err || EMA_shared_regions_iterate(output_shared_region, &it);
+    free(it.records);
+    return err;
+}
+
+/* CSV. */
+/*
+ * Rows are formatted into a large buffer that is written in one piece when
+ * full. The leading columns of a region and of a device are rendered once
+ * and copied into each of their rows. Numbers are formatted without
+ * `printf`.
+ */
+#define CSV_BUFFER_SIZE (1 << 20)
+#define CSV_NUMBERS_SIZE 512  // numeric columns of a row, at most
+
+typedef struct
+{
+    const Device* device;  // hashmap key
+    size_t length;
+    char text[];  // device_name,device_uid,device_type,
+} DevicePrefix;
+
+typedef struct
+{
     FILE* f;
-} PrintIterator;
+    char* buffer;
+    size_t used;
+    int err;
+
+    /* thread,region_idf,file,line,function,visits, of the last batch */
+    char* region_prefix;
+    size_t region_prefix_length;
+
+    hashmap* device_prefixes;  // by Device pointer
+} CsvWriter;
+
+static
+void csv_flush(CsvWriter* writer)
+{
+    if( writer->used
+        && fwrite(writer->buffer, 1, writer->used, writer->f) != writer->used )
+        writer->err = 1;
+    writer->used = 0;
+}
+
+/* Space for `size` bytes at the end of the buffer. */
+static
+char* csv_reserve(CsvWriter* writer, size_t size)
+{
+    if( writer->used + size > CSV_BUFFER_SIZE )
+        csv_flush(writer);
+    return writer->buffer + writer->used;
+}
+
+static
+void csv_append(CsvWriter* writer, const char* text, size_t length)
+{
+    if( length > CSV_BUFFER_SIZE )
+    {
+        csv_flush(writer);
+        if( fwrite(text, 1, length, writer->f) != length )
+            writer->err = 1;
+        return;
+    }
+    memcpy(csv_reserve(writer, length), text, length);
+    writer->used += length;
+}
+
+static
+int render_region_prefix(CsvWriter* writer, const OutputRecord* record)
+{
+    free(writer->region_prefix);
+    int length = asprintf(&writer->region_prefix, "%d,%s,%s,%u,%s,%llu,",
+        record->thread, record->idf, record->file, record->line,
+        record->function, record->visits);
+    if( length < 0 )
+    {
+        writer->region_prefix = NULL;
+        return 1;
+    }
+
+    writer->region_prefix_length = length;
+    return 0;
+}
+
+static
+const DevicePrefix* device_prefix(CsvWriter* writer, const Device* device)
+{
+    uintptr_t value;
+    if( hashmap_get(writer->device_prefixes, &device, sizeof(device), &value) )
+        return (const DevicePrefix*) value;
+
+    int length = snprintf(NULL, 0, "%s,%s,%s,",
+        device->name, device->uid, device->type);
+    ASSERT_OR_NULL(length >= 0);
+    DevicePrefix* prefix = malloc(sizeof(DevicePrefix) + length + 1);
+    ASSERT_OR_NULL(prefix);
+    prefix->device = device;
+    prefix->length = length;
+    snprintf(prefix->text, length + 1, "%s,%s,%s,",
+        device->name, device->uid, device->type);
+
+    hashmap_set(writer->device_prefixes,
+        &prefix->device, sizeof(device), (uintptr_t) prefix);
+    return prefix;
+}
+
+static
+void free_device_prefix(void* key, size_t ksize, uintptr_t value, void* usr)
+{
+    free((DevicePrefix*) value);
+}
+
+/* min,max,mean,std; empty fields without samples. */
+static
+char* format_moments(char* out, const double* moments)
+{
+    if( isnan(moments[0]) )
+    {
+        memcpy(out, ",,,,", 4);
+        return out + 4;
+    }
+    for(int i = 0; i < 4; ++i)
+    {
+        *out++ = ',';
+        out = EMA_format_g6(out, moments[i]);
+    }
+    return out;
+}
+
+/* Empty fields if histograms are disabled. */
+static
+char* format_percentiles(char* out, const unsigned long long* percentiles)
+{
+    for(size_t i = 0; i < EMA_OUTPUT_PERCENTILES; ++i)
+    {
+        *out++ = ',';
+        if( percentiles[i] != EMA_OUTPUT_NO_PERCENTILE )
+            out = EMA_format_u64(out, percentiles[i]);
+    }
+    return out;
+}
+
+static
+int print_record(CsvWriter* writer, const OutputRecord* record)
+{
+    const DevicePrefix* device = device_prefix(writer, record->device);
+    ASSERT_OR_1(device);
+
+    csv_append(writer, writer->region_prefix, writer->region_prefix_length);
+    csv_append(writer, device->text, device->length);
+
+    char* out = csv_reserve(writer, CSV_NUMBERS_SIZE);
+    char* start = out;
+    out = EMA_format_u64(out, record->energy);
+    *out++ = ',';
+    out = EMA_format_u64(out, record->time);
+    *out++ = ',';
+    out = EMA_format_u64(out, record->stale);
+    out = format_moments(out, record->moments[EMA_OUTPUT_ENERGY]);
+    out = format_moments(out, record->moments[EMA_OUTPUT_TIME]);
+    out = format_moments(out, record->moments[EMA_OUTPUT_POWER]);
+    out = format_percentiles(out, record->percentiles[EMA_OUTPUT_ENERGY]);
+    out = format_percentiles(out, record->percentiles[EMA_OUTPUT_TIME]);
+    *out++ = ',';
+    out = EMA_format_u64(out, record->measured_visits);
+    *out++ = ',';
+    out = EMA_format_u64(out, record->energy_error);
+    *out++ = '\n';
+    writer->used += out - start;
+    return writer->err;
+}
 
-int _EMA_print_region_iterator(Region* region, void *usr)
+/* The records of a batch share their region columns. */
+static
+int csv_records(const OutputRecord* records, size_t n, void* usr)
 {
-    PrintIterator *it = usr;
-    return EMA_print_region(region, it->thread_idx, it->f);
+    CsvWriter* writer = usr;
+    if( render_region_prefix(writer, records) )
+        return 1;
+    for(size_t i = 0; i < n; ++i)
+        if( print_record(writer, records + i) )
+            return 1;
+    return 0;
+}
+
+static
+int csv_begin(const OutputInfo* info, void* usr)
+{
+    CsvWriter* writer = usr;
+    writer->used = 0;
+    writer->err = 0;
+    writer->buffer = malloc(CSV_BUFFER_SIZE);
+    writer->device_prefixes = hashmap_create();
+    if( !writer->buffer || !writer->device_prefixes )
+        return 1;
+    return EMA_print_header(writer->f);
+}
+
+static
+int csv_end(int failed, void* usr)
+{
+    CsvWriter* writer = usr;
+    if( writer->buffer )
+        csv_flush(writer);
+    int err = failed || writer->err || fflush(writer->f) != 0;
+
+    if( writer->device_prefixes )
+    {
+        hashmap_iterate(writer->device_prefixes, free_device_prefix, NULL);
+        hashmap_free(writer->device_prefixes);
+    }
+    free(writer->region_prefix);
+    free(writer->buffer);
+    writer->device_prefixes = NULL;
+    writer->region_prefix = NULL;
+    writer->buffer = NULL;
+    return err;
 }
 
-int EMA_print_region_store(const RegionStore* store, int thread_idx, FILE* f)
+int EMA_output_sink_csv(OutputSink* sink, FILE* f)
 {
-    PrintIterator it = { .thread_idx = thread_idx, .f = f };
-    return EMA_region_store_iterate(store, _EMA_print_region_iterator, &it);
+    CsvWriter* writer = calloc(1, sizeof(CsvWriter));
+    ASSERT_OR_1(writer);
+    writer->f = f;
+
+    *sink = (OutputSink) {
+        .kinds = EMA_OUTPUT_RESULTS,
+        .begin = csv_begin,
+        .records = csv_records,
+        .end = csv_end,
+        .finalize = free,
+        .usr = writer,
+    };
+    return 0;
 }
 
 int EMA_print_all(FILE* f)
 {
-    EMA_print_header(f);
-    for(int i = 0; i < EMA_thread_get_count(); ++i)
+    OutputSink sink;
+    int err = EMA_output_sink_csv(&sink, f);
+    if( err )
+        return err;
+
+    err = EMA_output_results(&sink, 0);
+    sink.finalize(sink.usr);
+    return err;
+}
+
+/* Call tree. */
+int EMA_print_calltree_header(FILE* f)
+{
+    int ret = fprintf(
+        f,
+        "thread,node,parent,depth,path,region_idf,file,line,function,visits,"
+        "device_name,device_uid,device_type,"
+        "energy_incl,energy_excl,time_incl,time_excl\n"
+    );
+    return ret >= 0 ? 0 : 1;
+}
+
+typedef struct
+{
+    int thread_idx;
+    size_t next_id;
+    FILE* f;
+} CallTreePrinter;
+
+static
+int print_calltree_node(
+    const CallNode* node, size_t parent_id, int depth, const char* parent_path,
+    CallTreePrinter* printer)
+{
+    size_t id = printer->next_id++;
+    char* path = NULL;
+    if( asprintf(&path, "%s%s%s", parent_path, *parent_path ? "/" : "",
+        node->idf) == -1 )
+        return 1;
+
+    for(size_t i = 0; i < node->size; ++i)
+    {
+        const Device* device = node->devices[i];
+        unsigned long long energy_excl, time_excl;
+        EMA_calltree_node_exclusive(node, i, &energy_excl, &time_excl);
+
+        int ret = fprintf(
+            printer->f, "%d,%zu,%zu,%d,%s,%s,%s,%u,%s,%llu,%s,%s,%s,"
+            "%llu,%llu,%llu,%llu\n",
+            printer->thread_idx,
+            id,
+            parent_id,
+            depth,
+            path,
+            node->idf,
+            node->file,
+            node->line,
+            node->function,
+            node->visits,
+            device->name,
+            device->uid,
+            device->type,
+            node->energy[i],
+            energy_excl,
+            node->time[i],
+            time_excl
+        );
+        if( ret < 0 )
+        {
+            free(path);
+            return 1;
+        }
+    }
+
+    for(const CallNode* child = node->child; child; child = child->next)
+    {
+        int ret = print_calltree_node(child, id, depth + 1, path, printer);
+        if( ret != 0 )
+        {
+            free(path);
+            return ret;
+        }
+    }
+
+    free(path);
+    return 0;
+}
+
+/* Node 0 is the implicit root of each thread. */
+int EMA_print_thread_calltree(const CallTree* tree, int thread_idx, FILE* f)
+{
+    CallTreePrinter printer = {
+        .thread_idx = thread_idx, .next_id = 1, .f = f };
+
+    for(const CallNode* node = tree->root.child; node; node = node->next)
     {
-        const RegionStore* store = EMA_get_region_store(i);
-        int ret = EMA_print_region_store(store, i, f);
+        int ret = print_calltree_node(node, 0, 1, "", &printer);
         if( ret != 0 )
             return ret;
     }
     return 0;
 }
+
+static
+int print_store_calltree(const RegionStore* store, int thread_idx, void* f)
+{
+    return EMA_print_thread_calltree(
+        EMA_region_store_get_calltree(store), thread_idx, f);
+}
+
+int EMA_print_calltree(FILE* f)
+{
+    EMA_print_calltree_header(f);
+    return EMA_region_stores_iterate(print_store_calltree, f);
+}
@@ -1,6 +1,24 @@
 #ifndef EMA_REGION_OUTPUT_H
 #define EMA_REGION_OUTPUT_H
 
+#include <stdint.h>
+
+#include <EMA/core/device.h>
 #include "output.user.h"
+#include "region.h"
+#include "sink.user.h"
+
+/* Environment variable with the format of `output.EMA.<pid>`:
+ * csv (default) | columnar */
+#define EMA_OUTPUT "EMA_OUTPUT"
+
+/* Environment variable that writes `calltree.EMA.<pid>` in `EMA_finalize`:
+ * 0 (default) | 1 */
+#define EMA_CALLTREE "EMA_CALLTREE"
+
+/* Records of the running threads, the exited threads and the shared
+ * regions, in this order; a batch per region with its devices. */
+typedef int (*EMA_output_batch_cb)(const OutputRecord*, size_t n, void* usr);
+int EMA_output_iterate(EMA_output_batch_cb cb, void* usr);
 
 #endif
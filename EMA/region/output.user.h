@@ -13,4 +13,15 @@
  */
 int EMA_print_all(FILE* f);
 
+/**
+ * This function prints the call-path tree of the nested regions of all
+ * threads to a given file. Each node reports inclusive and exclusive energy
+ * and time per `Device`.
+ *
+ * @param f: Specifies a file to print to.
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_print_calltree(FILE* f);
+
 #endif
@@ -1,94 +1,516 @@
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <pthread.h>
+
 #include <EMA/core/device.h>
+#include <EMA/core/executor.h>
 #include <EMA/core/registry.h>
 #include <EMA/user.h>
+#include <EMA/utils/arena.h>
 #include <EMA/utils/error.h>
+#include <EMA/utils/intern.h>
 #include <EMA/utils/time.h>
 
+#include "calltree.h"
 #include "filter.h"
+#include "histogram.h"
 #include "region.h"
 #include "region_store.h"
+#include "shared.h"
+#include "trace.h"
 
+/* A boundary of another region within this many us of the previous boundary
+ * on the same thread reuses its readings, e.g. a region that begins right
+ * after its parent began. The begin and end of one region never share
+ * readings. */
+#define SNAPSHOT_REUSE_US 10
 
 extern PluginRegistry registry;
 
-/* Public interface. */
-int EMA_region_create_and_init(
+static atomic_ullong region_count = 0;
+
+/* Snapshot reuse. */
+static
+int snapshot_lookup(
+    const Snapshot* snapshot, const Device** devices, size_t n,
+    unsigned long long* energy, uint64_t* time, unsigned char* stale)
+{
+    if( snapshot->size == n
+        && memcmp(snapshot->devices, devices, sizeof(Device*) * n) == 0 )
+    {
+        memcpy(energy, snapshot->energy, sizeof(unsigned long long) * n);
+        memcpy(time, snapshot->time, sizeof(uint64_t) * n);
+        memcpy(stale, snapshot->stale, n);
+        return 1;
+    }
+
+    /* The region measures a subset, e.g. with another filter. */
+    for(size_t i = 0; i < n; ++i)
+    {
+        size_t j = 0;
+        while( j < snapshot->size && snapshot->devices[j] != devices[i] )
+            ++j;
+        if( j == snapshot->size )
+            return 0;
+
+        energy[i] = snapshot->energy[j];
+        time[i] = snapshot->time[j];
+        stale[i] = snapshot->stale[j];
+    }
+    return 1;
+}
+
+static
+void snapshot_store(
+    Snapshot* snapshot, const Device** devices, size_t n,
+    const unsigned long long* energy, const uint64_t* time,
+    const unsigned char* stale, unsigned long long region_id)
+{
+    if( n > snapshot->capacity )
+    {
+        free(snapshot->devices);
+        free(snapshot->energy);
+        free(snapshot->time);
+        free(snapshot->stale);
+        snapshot->devices = malloc(sizeof(Device*) * n);
+        snapshot->energy = malloc(sizeof(unsigned long long) * n);
+        snapshot->time = malloc(sizeof(uint64_t) * n);
+        snapshot->stale = malloc(n);
+        snapshot->capacity = n;
+        snapshot->size = 0;
+        if( !snapshot->devices || !snapshot->energy || !snapshot->time
+            || !snapshot->stale )
+        {
+            snapshot->capacity = 0;
+            return;
+        }
+    }
+
+    memcpy(snapshot->devices, devices, sizeof(Device*) * n);
+    memcpy(snapshot->energy, energy, sizeof(unsigned long long) * n);
+    memcpy(snapshot->time, time, sizeof(uint64_t) * n);
+    memcpy(snapshot->stale, stale, n);
+    snapshot->size = n;
+    snapshot->taken_us = EMA_get_time_in_us();
+    snapshot->region_id = region_id;
+}
+
+static
+int read_devices(
+    CallTree* tree, const Region* region, unsigned long long* energy,
+    uint64_t* time, unsigned char* stale)
+{
+    size_t n = region->measurements.size;
+    Snapshot* snapshot = tree ? &tree->snapshot : NULL;
+
+    if( snapshot && snapshot->size && snapshot->region_id != region->id
+        && EMA_get_time_in_us() - snapshot->taken_us < SNAPSHOT_REUSE_US
+        && snapshot_lookup(snapshot, region->devices, n, energy, time, stale) )
+    {
+        snapshot->region_id = region->id;
+        return 0;
+    }
+
+    int err = EMA_executor_read_batch(region->devices, n, energy, time, stale);
+
+    if( snapshot )
+    {
+        snapshot->size = 0;
+        if( err == 0 )
+            snapshot_store(
+                snapshot, region->devices, n, energy, time, stale, region->id);
+    }
+    return err;
+}
+
+static
+CallTree* thread_calltree(void)
+{
+    if( EMA_thread_init() != 0 )
+        return NULL;
+    return EMA_thread_get_calltree();
+}
+
+/* An unmeasured visit only counts its time, on all devices alike. */
+static
+int end_unmeasured(CallTree* tree, Region* region, uint64_t now)
+{
+    unsigned long long visit_time =
+        (now - region->sampler.visit_start_ns) / 1000;
+
+    for(size_t i = 0; i < region->measurements.size; ++i)
+        EMA_counter_add(region->measurements.time_result + i, visit_time);
+
+    if( tree )
+        EMA_calltree_pop(tree, region);
+    return 0;
+}
+
+/* Byte offsets of the arrays of a region with `n` devices, which follow
+ * the region in one block. */
+typedef struct
+{
+    size_t devices;
+    size_t energy_start;
+    size_t energy_result;
+    size_t time_start;
+    size_t time_result;
+    size_t measured_time;
+    size_t stats;
+    size_t histograms;
+    size_t stale;
+    size_t size;
+} RegionLayout;
+
+#define ALIGN8(size) (((size) + 7) & ~(size_t) 7)
+
+static
+RegionLayout region_layout(size_t n, size_t buckets)
+{
+    RegionLayout layout;
+    size_t counters = sizeof(unsigned long long) * n;
+
+    layout.devices = ALIGN8(sizeof(Region));
+    layout.energy_start = layout.devices + sizeof(Device*) * n;
+    layout.energy_result = layout.energy_start + counters;
+    layout.time_start = layout.energy_result + counters;
+    layout.time_result = layout.time_start + counters;
+    layout.measured_time = layout.time_result + counters;
+    layout.stats = layout.measured_time + counters;
+    layout.histograms = layout.stats + sizeof(VisitStats) * n;
+    layout.stale = layout.histograms + sizeof(uint64_t) * 2 * buckets * n;
+    layout.size = ALIGN8(layout.stale + n);
+    return layout;
+}
+
+/* Regions of a store come from its arena, others from the heap. Strings
+ * are interned in both cases. */
+static
+int region_alloc(
+    Region **region,
+    const Device* const* devices,
+    size_t n,
+    const char* idf,
+    const char* file,
+    unsigned int line,
+    const char* func,
+    const RegionDescriptor* descriptor,
+    Arena* arena
+) {
+    size_t buckets = n ? EMA_histogram_layout.size : 0;
+    RegionLayout layout = region_layout(n, buckets);
+
+    unsigned char* block;
+    if( arena )
+        block = EMA_arena_calloc(arena, layout.size, 8);
+    else
+        block = calloc(1, layout.size);
+    ASSERT_MSG_OR_1(block, "Failed to allocate region '%s'.", idf);
+
+    Region* r = (Region*) block;
+    Measurements* measurements = &r->measurements;
+    measurements->size = n;
+    measurements->energy_start =
+        (unsigned long long*) (block + layout.energy_start);
+    measurements->energy_result =
+        (unsigned long long*) (block + layout.energy_result);
+    measurements->time_start =
+        (unsigned long long*) (block + layout.time_start);
+    measurements->time_result =
+        (unsigned long long*) (block + layout.time_result);
+    measurements->measured_time =
+        (unsigned long long*) (block + layout.measured_time);
+    measurements->stats = (VisitStats*) (block + layout.stats);
+    measurements->histograms =
+        buckets ? (_Atomic uint64_t*) (block + layout.histograms) : NULL;
+    measurements->stale = block + layout.stale;
+
+    r->devices = (const Device**) (block + layout.devices);
+    memcpy(r->devices, devices, sizeof(Device*) * n);
+    for(size_t i = 0; i < n; ++i)
+        EMA_visit_stats_init(measurements->stats + i);
+
+    EMA_sampler_init(&r->sampler, &EMA_sampling_default);
+    r->id = atomic_fetch_add(&region_count, 1) + 1;
+    r->idf = EMA_intern(idf);
+    r->file = EMA_intern(file);
+    r->function = EMA_intern(func);
+    r->line = line;
+    r->descriptor = descriptor;
+    r->in_arena = arena != NULL;
+    *region = r;
+
+    return !r->idf || !r->file || !r->function;
+}
+
+static
+int region_create(
     Region **region,
     const char* idf,
     Filter *filter,
     const char* file,
     unsigned int line,
-    const char* func
+    const char* func,
+    const RegionDescriptor* descriptor,
+    Arena* arena
 ) {
     DevicePtrArray devices = registry.devices;
     if( filter )
         devices = filter->apply(registry.devices, filter);
 
-    *region = (Region*) malloc(sizeof(Region));
+    int err = region_alloc(region, (const Device* const*) devices.array,
+        devices.size, idf, file, line, func, descriptor, arena);
+
+    if( filter )
+        free(devices.array);
+
+    if( err == 0 && EMA_trace_enabled )
+        return EMA_trace_add_region(*region);
+
+    return err;
+}
+
+/* Merging of the regions of exited threads. */
+int EMA_region_clone(Region** region, const Region* like, Arena* arena)
+{
+    return region_alloc(region, like->devices, like->measurements.size,
+        like->idf, like->file, like->line, like->function, like->descriptor,
+        arena);
+}
 
-    (*region)->measurements.array = (Measurement*) malloc(
-        sizeof(Measurement) * devices.size);
-    (*region)->measurements.size = devices.size;
+void EMA_region_merge(Region* dst, const Region* src)
+{
+    dst->visits += src->visits;
+    dst->measured_visits += src->measured_visits;
 
-    for(size_t i = 0; i < (*region)->measurements.size; ++i)
+    Measurements* to = &dst->measurements;
+    const Measurements* from = &src->measurements;
+    for(size_t j = 0; j < from->size; ++j)
     {
-        Measurement* measurement = (*region)->measurements.array + i;
-        measurement->device = devices.array[i];
-        measurement->energy_start = 0;
-        measurement->energy_result = 0;
-        measurement->time_start = 0;
-        measurement->time_result = 0;
-    }
+        ptrdiff_t i = EMA_region_device_index(dst, src->devices[j]);
+        if( i < 0 )
+            continue;
 
-    (*region)->visits = 0;
-    (*region)->idf = strdup(idf);
-    (*region)->file = strdup(file);
-    (*region)->function = strdup(func);
-    (*region)->line = line;
+        to->energy_result[i] += from->energy_result[j];
+        to->time_result[i] += from->time_result[j];
+        to->measured_time[i] += from->measured_time[j];
+        to->stale[i] |= from->stale[j];
+        EMA_visit_stats_merge(to->stats + i, from->stats + j);
 
-    if( filter )
-        free(devices.array);
+        if( !to->histograms || !from->histograms )
+            continue;
 
-    return 0;
+        /* The time histogram follows the energy histogram. */
+        _Atomic uint64_t* counts = EMA_region_energy_histogram(dst, i);
+        const _Atomic uint64_t* src_counts =
+            EMA_region_energy_histogram(src, j);
+        for(size_t k = 0; k < 2 * EMA_histogram_layout.size; ++k)
+            atomic_fetch_add_explicit(counts + k,
+                atomic_load_explicit(src_counts + k, memory_order_relaxed),
+                memory_order_relaxed);
+    }
+}
+
+/* Public interface. */
+int EMA_region_create_and_init(
+    Region **region,
+    const char* idf,
+    Filter *filter,
+    const char* file,
+    unsigned int line,
+    const char* func
+) {
+    return region_create(region, idf, filter, file, line, func, NULL, NULL);
 }
 
 int EMA_region_begin(Region *region)
 {
-    ++region->visits;
+    size_t n = region->measurements.size;
+    unsigned long long energy[n ? n : 1];
+    uint64_t time[n ? n : 1];
+    unsigned char stale[n ? n : 1];
 
-    for(size_t i = 0; i < region->measurements.size; ++i)
+    EMA_counter_add(&region->visits, 1);
+
+    CallTree* tree = thread_calltree();
+    CallNode* node = tree ? EMA_calltree_push(tree, region) : NULL;
+
+    Sampler* sampler = &region->sampler;
+    if( sampler->policy.mode != EMA_SAMPLE_ALL )
     {
-        Measurement* measurement = region->measurements.array + i;
-        measurement->time_start = EMA_get_time_in_us();
-        measurement->energy_start = EMA_plugin_get_energy_uj(
-            measurement->device);
+        uint64_t now = EMA_get_time_in_ns();
+        sampler->measuring = EMA_sampler_measure(sampler, now);
+        if( !sampler->measuring )
+        {
+            sampler->visit_start_ns = now;
+            return 0;
+        }
+        sampler->begin_ns = now;
     }
-    return 0;
+    EMA_counter_add(&region->measured_visits, 1);
+
+    int err = read_devices(tree, region, energy, time, stale);
+
+    Measurements* measurements = &region->measurements;
+    memcpy(measurements->energy_start, energy, sizeof(energy[0]) * n);
+    memcpy(measurements->time_start, time, sizeof(time[0]) * n);
+    for(size_t i = 0; i < n; ++i)
+        measurements->stale[i] |= stale[i];
+
+    if( node )
+        EMA_calltree_node_begin(node, energy, time);
+    if( EMA_trace_enabled )
+        EMA_trace_record(region, EMA_TRACE_BEGIN, energy);
+    if( sampler->policy.mode == EMA_SAMPLE_ADAPTIVE )
+        sampler->body_start_ns = EMA_get_time_in_ns();
+    return err;
 }
 
 int EMA_region_end(Region *region)
 {
-    for(size_t i = 0; i < region->measurements.size; ++i)
+    size_t n = region->measurements.size;
+    unsigned long long energy[n ? n : 1];
+    uint64_t time[n ? n : 1];
+    unsigned char stale[n ? n : 1];
+
+    CallTree* tree = thread_calltree();
+    Sampler* sampler = &region->sampler;
+    uint64_t body_end = 0;
+    if( sampler->policy.mode != EMA_SAMPLE_ALL )
     {
-        Measurement* measurement = region->measurements.array + i;
-        measurement->time_result +=
-            EMA_get_time_in_us() - measurement->time_start;
-        measurement->energy_result += EMA_plugin_get_energy_uj(
-            measurement->device) - measurement->energy_start;
+        body_end = EMA_get_time_in_ns();
+        if( !sampler->measuring )
+            return end_unmeasured(tree, region, body_end);
     }
-    return 0;
+
+    int err = read_devices(tree, region, energy, time, stale);
+
+    Measurements* measurements = &region->measurements;
+    unsigned long long visit_energy[n ? n : 1];
+    unsigned long long visit_time[n ? n : 1];
+    for(size_t i = 0; i < n; ++i)
+    {
+        visit_energy[i] = energy[i] - measurements->energy_start[i];
+        visit_time[i] = time[i] - measurements->time_start[i];
+        EMA_counter_add(measurements->energy_result + i, visit_energy[i]);
+        EMA_counter_add(measurements->time_result + i, visit_time[i]);
+        EMA_counter_add(measurements->measured_time + i, visit_time[i]);
+        measurements->stale[i] |= stale[i];
+    }
+
+    /* All measurements of a region count the same visits. */
+    double inv_visits = n ? 1.0 / (measurements->stats[0].n + 1) : 0;
+    for(size_t i = 0; i < n; ++i)
+        EMA_visit_stats_add(measurements->stats + i,
+            visit_energy[i], visit_time[i], inv_visits);
+
+    if( measurements->histograms )
+        for(size_t i = 0; i < n; ++i)
+        {
+            EMA_histogram_add(
+                EMA_region_energy_histogram(region, i), visit_energy[i]);
+            EMA_histogram_add(
+                EMA_region_time_histogram(region, i), visit_time[i]);
+        }
+
+    /* A visit the call tree could not track is only left out of it. */
+    CallNode* node = tree ? EMA_calltree_pop(tree, region) : NULL;
+    if( node )
+        EMA_calltree_node_end(node, energy, time);
+    if( EMA_trace_enabled )
+        EMA_trace_record(region, EMA_TRACE_END, energy);
+
+    if( sampler->policy.mode == EMA_SAMPLE_ADAPTIVE )
+        EMA_sampler_adapt(sampler,
+            (sampler->body_start_ns - sampler->begin_ns)
+                + (EMA_get_time_in_ns() - body_end),
+            body_end - sampler->body_start_ns);
+    return err;
+}
+
+RegionToken EMA_region_begin_token(Region *region)
+{
+    RegionToken token = { .region = NULL };
+    size_t n = region->measurements.size;
+    ASSERT_MSG(n <= EMA_TOKEN_MAX_DEVICES, token,
+        "Region '%s' measures more than %d devices for a token.",
+        region->idf, EMA_TOKEN_MAX_DEVICES);
+
+    SharedRegion* shared = EMA_shared_region_of_tokens(region);
+    ASSERT_MSG(shared, token,
+        "Failed to set up the token visits of region '%s'.", region->idf);
+
+    /* Tokens never reuse the readings of the thread: the begin and end of a
+     * token are read under different regions, so they could share them. */
+    uint64_t time[n ? n : 1];
+    unsigned char stale[n ? n : 1];
+    read_devices(NULL, region, token.energy, time, stale);
+
+    for(size_t i = 0; i < n; ++i)
+    {
+        token.time[i] = time[i];
+        token.stale |= stale[i];
+    }
+    token.size = n;
+    token.begin_ns = EMA_get_time_in_ns();
+    token.region = shared;
+
+    if( EMA_trace_enabled )
+        EMA_trace_record(shared->region, EMA_TRACE_BEGIN, token.energy);
+    return token;
+}
+
+/* Token visits of a definition may end concurrently on any thread, hence
+ * the atomics on the region owned by EMA rather than the thread. */
+int EMA_region_end_token(const RegionToken *token)
+{
+    SharedRegion* shared = token->region;
+    ASSERT_OR_1(shared && token->size == shared->region->measurements.size);
+    Region* region = shared->region;
+
+    size_t n = token->size;
+    unsigned long long energy[n ? n : 1];
+    uint64_t time[n ? n : 1];
+    unsigned char stale[n ? n : 1];
+    int err = read_devices(NULL, region, energy, time, stale);
+
+    Measurements* measurements = &region->measurements;
+    for(size_t i = 0; i < n; ++i)
+    {
+        unsigned long long visit_energy = energy[i] - token->energy[i];
+        unsigned long long visit_time = time[i] - token->time[i];
+        __atomic_fetch_add(
+            measurements->energy_result + i, visit_energy, __ATOMIC_RELAXED);
+        __atomic_fetch_add(
+            measurements->time_result + i, visit_time, __ATOMIC_RELAXED);
+        __atomic_fetch_add(
+            measurements->measured_time + i, visit_time, __ATOMIC_RELAXED);
+        if( stale[i] || token->stale )
+            __atomic_fetch_or(measurements->stale + i, 1, __ATOMIC_RELAXED);
+
+        if( measurements->histograms )
+        {
+            EMA_histogram_add_atomic(
+                EMA_region_energy_histogram(region, i), visit_energy);
+            EMA_histogram_add_atomic(
+                EMA_region_time_histogram(region, i), visit_time);
+        }
+    }
+    __atomic_fetch_add(&region->measured_visits, 1, __ATOMIC_RELAXED);
+    EMA_shared_region_count(shared, EMA_get_time_in_ns() - token->begin_ns);
+
+    if( EMA_trace_enabled )
+        EMA_trace_record(region, EMA_TRACE_END, energy);
+    return err;
 }
 
 int EMA_region_finalize(Region *region)
 {
-    free(region->idf);
-    free(region->file);
-    free(region->function);
-    free(region->measurements.array);
-    free(region);
+    /* Arena regions are released with their store. */
+    if( !region->in_arena )
+        free(region);
     return 0;
 }
 
@@ -109,13 +531,202 @@ int EMA_region_define(
     err = EMA_thread_init();
     ASSERT_OR_1(err == 0);
 
-    err = EMA_region_create_and_init(region, idf, filter, file, line, func);
+    RegionStore* store = EMA_thread_get_region_store();
+    ASSERT_OR_1(store);
+
+    err = region_create(region, idf, filter, file, line, func, NULL,
+        EMA_region_store_get_arena(store));
+    ASSERT_OR_1(err == 0);
+
+    return EMA_region_store_set(store, *region);
+}
+
+/* Static regions. */
+/* The ema_regions section is read as an array of descriptors, which only
+ * holds if no descriptor is padded to a larger alignment than its size. */
+_Static_assert(sizeof(RegionDescriptor) == _Alignof(RegionDescriptor),
+    "Descriptors must be packed in the ema_regions section.");
+
+static pthread_mutex_t descriptor_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int descriptor_count = 0;
+
+void EMA_region_descriptors_register(
+    RegionDescriptor* begin,
+    RegionDescriptor* end
+) {
+    pthread_mutex_lock(&descriptor_mutex);
+    for(RegionDescriptor* descriptor = begin; descriptor < end; ++descriptor)
+        if( __atomic_load_n(&descriptor->id, __ATOMIC_RELAXED) < 0 )
+            __atomic_store_n(
+                &descriptor->id, descriptor_count++, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&descriptor_mutex);
+}
+
+int EMA_region_define_static(
+    Region **region,
+    RegionDescriptor* descriptor,
+    Filter *filter
+) {
+    if( *region )
+        return 0;
+
+    int err = EMA_thread_init();
     ASSERT_OR_1(err == 0);
 
     RegionStore* store = EMA_thread_get_region_store();
     ASSERT_OR_1(store);
 
-    EMA_region_store_set(store, *region);
+    /* Descriptors outside a registered section, e.g. when the section was
+     * discarded, get their id on first use. */
+    int id = __atomic_load_n(&descriptor->id, __ATOMIC_ACQUIRE);
+    if( id < 0 )
+    {
+        EMA_region_descriptors_register(descriptor, descriptor + 1);
+        id = __atomic_load_n(&descriptor->id, __ATOMIC_ACQUIRE);
+    }
+
+    *region = EMA_region_store_get_static(store, id);
+    if( *region )
+        return 0;
+
+    err = region_create(
+        region, descriptor->idf, filter, descriptor->file, descriptor->line,
+        descriptor->function, descriptor, EMA_region_store_get_arena(store));
+    ASSERT_OR_1(err == 0);
+
+    return EMA_region_store_set_static(store, id, *region);
+}
+
+/* Percentiles. */
+static
+int histogram_percentiles(
+    const uint64_t* energy_counts, const uint64_t* time_counts,
+    double percentile, unsigned long long* energy_uj,
+    unsigned long long* time_us)
+{
+    if( energy_uj )
+        *energy_uj = EMA_histogram_percentile(energy_counts, percentile);
+    if( time_us )
+        *time_us = EMA_histogram_percentile(time_counts, percentile);
+    return 0;
+}
+
+int EMA_region_get_percentile(
+    const Region* region,
+    const Device* device,
+    double percentile,
+    unsigned long long* energy_uj,
+    unsigned long long* time_us
+) {
+    ptrdiff_t i = EMA_region_device_index(region, device);
+    ASSERT_OR_1(i >= 0 && region->measurements.histograms);
+
+    size_t buckets = EMA_histogram_layout.size;
+    uint64_t* counts = calloc(2 * buckets, sizeof(uint64_t));
+    ASSERT_OR_1(counts);
+
+    EMA_histogram_merge(counts, EMA_region_energy_histogram(region, i));
+    EMA_histogram_merge(counts + buckets, EMA_region_time_histogram(region, i));
+    histogram_percentiles(
+        counts, counts + buckets, percentile, energy_uj, time_us);
+
+    free(counts);
+    return 0;
+}
 
+int EMA_region_set_sampling(Region* region, const SamplingPolicy* policy)
+{
+    ASSERT_OR_1(region);
+    int err = EMA_sampling_policy_check(policy);
+    if( err )
+        return err;
+
+    EMA_sampler_init(&region->sampler, policy);
     return 0;
 }
+
+int EMA_region_get_energy(
+    const Region* region,
+    const Device* device,
+    unsigned long long* energy_uj,
+    unsigned long long* error_uj
+) {
+    ptrdiff_t i = EMA_region_device_index(region, device);
+    ASSERT_OR_1(i >= 0);
+
+    const Measurements* measurements = &region->measurements;
+    unsigned long long energy, error;
+    EMA_sampling_extrapolate(
+        measurements->energy_result[i], measurements->measured_time[i],
+        measurements->time_result[i], measurements->stats + i,
+        &energy, &error);
+
+    if( energy_uj )
+        *energy_uj = energy;
+    if( error_uj )
+        *error_uj = error;
+    return 0;
+}
+
+typedef struct
+{
+    const char* idf;
+    const Device* device;
+    uint64_t* counts;
+    int found;
+} PercentileMerge;
+
+static
+int merge_region_histograms(Region* region, void* usr)
+{
+    PercentileMerge* merge = usr;
+    if( strcmp(region->idf, merge->idf) != 0 )
+        return 0;
+
+    ptrdiff_t i = EMA_region_device_index(region, merge->device);
+    if( i < 0 || !region->measurements.histograms )
+        return 0;
+
+    EMA_histogram_merge(merge->counts, EMA_region_energy_histogram(region, i));
+    EMA_histogram_merge(
+        merge->counts + EMA_histogram_layout.size,
+        EMA_region_time_histogram(region, i));
+    merge->found = 1;
+    return 0;
+}
+
+static
+int merge_store_histograms(
+    const RegionStore* store, int thread_idx, void* merge)
+{
+    return EMA_region_store_iterate(store, merge_region_histograms, merge);
+}
+
+int EMA_get_percentile(
+    const char* idf,
+    const Device* device,
+    double percentile,
+    unsigned long long* energy_uj,
+    unsigned long long* time_us
+) {
+    size_t buckets = EMA_histogram_layout.size;
+    ASSERT_OR_1(buckets);
+
+    PercentileMerge merge = {
+        .idf = idf,
+        .device = device,
+        .counts = calloc(2 * buckets, sizeof(uint64_t)),
+        .found = 0
+    };
+    ASSERT_OR_1(merge.counts);
+
+    EMA_region_stores_iterate(merge_store_histograms, &merge);
+
+    if( merge.found )
+        histogram_percentiles(
+            merge.counts, merge.counts + buckets, percentile, energy_uj,
+            time_us);
+
+    free(merge.counts);
+    return merge.found ? 0 : 1;
+}
@@ -1,36 +1,105 @@
 #ifndef EMA_REGION_REGION_H
 #define EMA_REGION_REGION_H
 
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #include <EMA/core/device.h>
+#include <EMA/utils/arena.h>
+#include "histogram.h"
 #include "region.user.h"
+#include "sampling.h"
+#include "stats.h"
 
+/*
+ * Measurement state of a region, one array element per device. The arrays
+ * are parallel, so the per-device loops of begin and end are plain array
+ * arithmetic.
+ */
 typedef struct
 {
-    const Device *device;
-    unsigned long long energy_start;
-    unsigned long long energy_result;
-    unsigned long long time_start;
-    unsigned long long time_result;
-
-} Measurement;
-
-typedef struct
-{
-    Measurement* array;
     size_t size;
-} MeasurementArray;
+    unsigned long long* energy_start;
+    unsigned long long* energy_result;
+    unsigned long long* time_start;
+    unsigned long long* time_result;  // of all visits
+    unsigned long long* measured_time;  // of the visits that read the device
+    unsigned char* stale;  // a sample fell back to a stale value
+    VisitStats* stats;  // per measured visit
+    _Atomic uint64_t* histograms;  // NULL unless histograms are enabled
+} Measurements;
+
+struct CallNode;
+struct SharedRegion;
 
 typedef struct Region
 {
     /* measurement data */
-    MeasurementArray measurements;
+    Measurements measurements;
+    const Device** devices;  // devices of `measurements`
     unsigned long long visits;
+    unsigned long long measured_visits;
+    Sampler sampler;
+    unsigned long long id;  // unique per process, identifies call tree nodes
+    struct CallNode* node;  // last call tree node, a hint for the next visit
+    unsigned long long node_tree;  // id of the call tree of `node`
+    struct SharedRegion* tokens;  // of its token visits, owned by EMA
 
-    /* user info and hashkey. */
-    char* idf;
-    char* file;
-    char* function;
+    /* user info and hashkey; interned strings. */
+    const char* idf;
+    const char* file;
+    const char* function;
     unsigned int line;
+    const RegionDescriptor* descriptor;  // NULL if defined at runtime
+    int in_arena;  // allocated from the arena of a region store
 } Region;
 
+/* Copy of the definition of `like` without measurements, e.g. to merge
+ * the regions of exited threads into. */
+int EMA_region_clone(Region** region, const Region* like, Arena* arena);
+/* Add the measurements of `src` to `dst`, matched by device. */
+void EMA_region_merge(Region* dst, const Region* src);
+
+/* Counters have a single writer, but the exporter reads them meanwhile. */
+static inline
+void EMA_counter_add(unsigned long long* counter, unsigned long long value)
+{
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+static inline
+unsigned long long EMA_counter_load(const unsigned long long* counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/* Histograms of device `i`, or NULL if histograms are disabled. */
+static inline
+_Atomic uint64_t* EMA_region_energy_histogram(const Region* region, size_t i)
+{
+    if( !region->measurements.histograms )
+        return NULL;
+    return region->measurements.histograms + 2 * i * EMA_histogram_layout.size;
+}
+
+static inline
+_Atomic uint64_t* EMA_region_time_histogram(const Region* region, size_t i)
+{
+    if( !region->measurements.histograms )
+        return NULL;
+    return region->measurements.histograms
+        + (2 * i + 1) * EMA_histogram_layout.size;
+}
+
+/* Index of `device` in the measurements of `region`, or -1. */
+static inline
+ptrdiff_t EMA_region_device_index(const Region* region, const Device* device)
+{
+    for(size_t i = 0; i < region->measurements.size; ++i)
+        if( region->devices[i] == device )
+            return i;
+    return -1;
+}
+
 #endif
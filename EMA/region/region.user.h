@@ -2,6 +2,7 @@
 #define EMA_REGION_REGION_USER_H
 
 #include "filter.user.h"
+#include "shared.user.h"
 
 /* Region interface. */
 /**
@@ -14,6 +15,37 @@
  */
 typedef struct Region Region;
 
+/**
+ * Which visits of a `Region` read the `Devices`.
+ *
+ * - `EMA_SAMPLE_ALL`: every visit (default).
+ * - `EMA_SAMPLE_EVERY_NTH`: every `every_n`-th visit.
+ * - `EMA_SAMPLE_INTERVAL`: a visit if at least `interval_us` passed since the
+ *   last measured one.
+ * - `EMA_SAMPLE_ADAPTIVE`: every N-th visit, where N grows as long as the
+ *   time EMA spends reading exceeds `max_overhead` times the region time.
+ */
+typedef enum
+{
+    EMA_SAMPLE_ALL,
+    EMA_SAMPLE_EVERY_NTH,
+    EMA_SAMPLE_INTERVAL,
+    EMA_SAMPLE_ADAPTIVE,
+} SamplingMode;
+
+/**
+ * The `SamplingPolicy` type selects the measured visits of a `Region`.
+ * Unmeasured visits only count the visit and its time; the energy of all
+ * visits is extrapolated from the measured ones.
+ */
+typedef struct
+{
+    SamplingMode mode;
+    unsigned long long every_n;
+    unsigned long long interval_us;
+    double max_overhead;
+} SamplingPolicy;
+
 /**
  * This function creates and initializes a region.
  *
@@ -78,6 +110,135 @@ int EMA_region_end(Region *region);
  */
 int EMA_region_finalize(Region *region);
 
+/* Devices a `RegionToken` holds readings of; may be raised at compile time. */
+#ifndef EMA_TOKEN_MAX_DEVICES
+#define EMA_TOKEN_MAX_DEVICES 8
+#endif
+
+/**
+ * The `RegionToken` type holds the start readings of one visit of a
+ * `Region`. It is a plain value: it may be copied, stored in a task and
+ * passed to another thread, and needs no cleanup. Its `region` is the
+ * `SharedRegion` the visit adds to.
+ */
+typedef struct
+{
+    SharedRegion* region;  // NULL if the visit could not begin
+    unsigned int size;
+    unsigned int stale;
+    unsigned long long begin_ns;
+    unsigned long long energy[EMA_TOKEN_MAX_DEVICES];
+    unsigned long long time[EMA_TOKEN_MAX_DEVICES];
+} RegionToken;
+
+/**
+ * This function begins a visit of a `Region` whose start readings are kept
+ * in the returned token instead of the `Region`. Any number of visits of a
+ * `Region` may be open at a time, e.g. overlapping instances of an
+ * asynchronous handler, and each can end on any thread with
+ * :c:func:`EMA_region_end_token`.
+ *
+ * Token visits add to a `SharedRegion` owned by EMA, one per definition of
+ * the `Region` in all threads, which is reported with thread -2. Tokens may
+ * thus end after the thread of the `Region` exited, and the `Region` may be
+ * visited with :c:func:`EMA_region_begin` meanwhile.
+ *
+ * .. note::
+ *    The `Region` must measure at most `EMA_TOKEN_MAX_DEVICES` `Devices`.
+ *    Token visits are not part of the call tree, are not sampled and do not
+ *    update the per-visit statistics; they add to the energy, time, visits
+ *    and histograms. Tokens must end before `EMA_finalize`.
+ *
+ * @param region: The `Region` to visit.
+ *
+ * @returns The token; its `region` is `NULL` on error.
+ */
+RegionToken EMA_region_begin_token(Region *region);
+
+/**
+ * This function ends the visit of a token on the calling thread and adds it
+ * to its `SharedRegion` with atomic operations, without locking.
+ *
+ * @param token: A token of :c:func:`EMA_region_begin_token`.
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_region_end_token(const RegionToken *token);
+
+/**
+ * This function queries a percentile of the energy and the duration per
+ * visit of a `Region` on a `Device`. Requires histograms to be enabled with
+ * `EMA_HISTOGRAM`. The result is the upper bound of the histogram bucket.
+ *
+ * @param region: `Region` to query.
+ * @param device: `Device` measured by the `Region`.
+ * @param percentile: Percentile from 0 to 100, e.g. 99.
+ * @param energy_uj: Receives the energy in micro joules (may be NULL).
+ * @param time_us: Receives the duration in micro seconds (may be NULL).
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_region_get_percentile(
+    const Region* region,
+    const Device* device,
+    double percentile,
+    unsigned long long* energy_uj,
+    unsigned long long* time_us
+);
+
+/**
+ * This function queries a percentile like `EMA_region_get_percentile`, but
+ * over the merged histograms of the `Regions` with the identifier `idf` of
+ * all threads.
+ *
+ * @param idf: Identifier of the `Regions`.
+ * @param device: `Device` measured by the `Regions`.
+ * @param percentile: Percentile from 0 to 100, e.g. 99.
+ * @param energy_uj: Receives the energy in micro joules (may be NULL).
+ * @param time_us: Receives the duration in micro seconds (may be NULL).
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_get_percentile(
+    const char* idf,
+    const Device* device,
+    double percentile,
+    unsigned long long* energy_uj,
+    unsigned long long* time_us
+);
+
+/**
+ * This function sets the sampling policy of a `Region`. New regions use the
+ * policy of the `EMA_SAMPLING` environment variable or measure every visit.
+ * Must not be called while the `Region` is being measured.
+ *
+ * @param region: `Region` to configure.
+ * @param policy: The `SamplingPolicy`.
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_region_set_sampling(Region* region, const SamplingPolicy* policy);
+
+/**
+ * This function queries the energy of all visits of a `Region` on a
+ * `Device`. With sampling, the energy is extrapolated from the measured
+ * visits by their average power; `error_uj` then receives the standard
+ * error of the extrapolation, and 0 otherwise.
+ *
+ * @param region: `Region` to query.
+ * @param device: `Device` measured by the `Region`.
+ * @param energy_uj: Receives the energy in micro joules (may be NULL).
+ * @param error_uj: Receives the error in micro joules (may be NULL).
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_region_get_energy(
+    const Region* region,
+    const Device* device,
+    unsigned long long* energy_uj,
+    unsigned long long* error_uj
+);
+
 /* High-level region interface. */
 
 /**
@@ -103,6 +264,75 @@ int EMA_region_define(
     const char* func
 );
 
+/* Alignment of a `RegionDescriptor`, a power of two not below its size, so
+ * that the descriptors of a section form an array; at least 32, which
+ * compilers may give large static objects anyway. */
+#define EMA_REGION_DESCRIPTOR_ALIGN \
+    (4 * sizeof(void*) < 32 ? 32 : 4 * sizeof(void*))
+
+/**
+ * The `RegionDescriptor` type describes a `Region` defined with the
+ * `EMA_REGION_DEFINE` macros. Descriptors are static variables in the
+ * `ema_regions` linker section and get a dense id, starting at 0, when the
+ * program or library that contains them is loaded. Each thread keeps its
+ * `Regions` in an array indexed by that id. The `idf` of a descriptor is
+ * NULL if the macro was given an identifier only known at runtime.
+ */
+typedef struct __attribute__((aligned(EMA_REGION_DESCRIPTOR_ALIGN)))
+{
+    const char* idf;
+    const char* file;
+    const char* function;
+    unsigned int line;
+    int id;  // -1 until registered, accessed atomically
+} RegionDescriptor;
+
+/**
+ * This function assigns ids to the `RegionDescriptors` from `begin` to
+ * `end` that have none yet. It is called for the `ema_regions` section of
+ * each program or library when it is loaded.
+ *
+ * @param begin: First `RegionDescriptor`.
+ * @param end: Past the last `RegionDescriptor`.
+ */
+void EMA_region_descriptors_register(
+    RegionDescriptor* begin,
+    RegionDescriptor* end
+);
+
+/**
+ * This function sets up the `Region` of a `RegionDescriptor` for the calling
+ * thread if `region` does not point to one yet. Use the macro
+ * :c:macro:`EMA_REGION_DEFINE` instead of calling it directly.
+ *
+ * @param region: `Region` to define.
+ * @param descriptor: Static `RegionDescriptor` of the `Region`.
+ * @param filter: A `Filter` to disable `Devices` or `Plugins`, or `NULL`.
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_region_define_static(
+    Region **region,
+    RegionDescriptor* descriptor,
+    Filter *filter
+);
+
+/* Bounds of the `ema_regions` section of the including program or library,
+ * provided by the linker; NULL in modules without descriptors. */
+extern RegionDescriptor __start_ema_regions[]
+    __attribute__((weak, visibility("hidden")));
+extern RegionDescriptor __stop_ema_regions[]
+    __attribute__((weak, visibility("hidden")));
+
+static __attribute__((constructor, unused))
+void EMA_register_module_regions(void)
+{
+    RegionDescriptor* begin = __start_ema_regions;
+    RegionDescriptor* end = __stop_ema_regions;
+    if( begin != end )
+        EMA_region_descriptors_register(begin, end);
+}
+
 /**
  * This macro declares a thread-safe `Region` with a specified variable name.
  *
@@ -137,13 +367,61 @@ int EMA_region_define(
  *    If no `Filter` is required, use the macro :c:macro:`EMA_REGION_DEFINE`
  *    instead or set `filter` to `NULL`.
  *
+ * A constant identifier, e.g. a string literal, is kept in a static
+ * `RegionDescriptor` like with :c:macro:`EMA_REGION_DEFINE_STATIC`. Other
+ * identifiers define the `Region` with :c:func:`EMA_region_define`.
+ *
  * Args:
  *     region: `Region` to define.
- *     idf: Identifier or name of the `Region`.
+ *     name: Identifier or name of the `Region`.
+ *     filter: A `Filter` to disable `Devices` or `Plugins`.
+ */
+#define EMA_REGION_DEFINE_WITH_FILTER(region, name, filter) \
+    ({ \
+        static RegionDescriptor EMA_region_descriptor \
+            __attribute__((section("ema_regions"), used)) = { \
+                __builtin_constant_p(name) ? (name) : NULL, \
+                __FILE__, __func__, __LINE__, -1 }; \
+        *(region) ? 0 : EMA_region_descriptor.idf \
+            ? EMA_region_define_static( \
+                region, &EMA_region_descriptor, filter) \
+            : EMA_region_define( \
+                region, name, filter, __FILE__, __LINE__, __func__); \
+    })
+
+/**
+ * This function sets up a region with a string literal as identifier if it
+ * has not already been defined.
+ *
+ * Args:
+ *     region: `Region` to define.
+ *     idf: Identifier or name of the `Region`, a string literal.
+ *
+ * */
+#define EMA_REGION_DEFINE_STATIC(region, idf) \
+    EMA_REGION_DEFINE_STATIC_WITH_FILTER(region, idf, NULL)
+
+/**
+ * This function sets up a region with a string literal as identifier if it
+ * has not already been defined.
+ *
+ * The location and identifier are kept in a static `RegionDescriptor`, so
+ * once `region` is set, defining it again costs a single check. Other
+ * identifiers do not compile.
+ *
+ * Args:
+ *     region: `Region` to define.
+ *     idf: Identifier or name of the `Region`, a string literal.
  *     filter: A `Filter` to disable `Devices` or `Plugins`.
  */
-#define EMA_REGION_DEFINE_WITH_FILTER(region, idf, filter) \
-    EMA_region_define(region, idf, filter, __FILE__, __LINE__, __func__)
+#define EMA_REGION_DEFINE_STATIC_WITH_FILTER(region, idf, filter) \
+    ({ \
+        static RegionDescriptor EMA_region_descriptor \
+            __attribute__((section("ema_regions"), used)) = \
+            { "" idf, __FILE__, __func__, __LINE__, -1 }; \
+        *(region) ? 0 : EMA_region_define_static( \
+            region, &EMA_region_descriptor, filter); \
+    })
 
 /**
  * This macro is an alias for :c:func:`EMA_region_begin`.
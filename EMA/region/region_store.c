@@ -4,22 +4,40 @@
 #include <string.h>
 #include <threads.h>
 
+#include <pthread.h>
+
 #include <EMA/user.h>
+#include <EMA/utils/arena.h>
+#include <EMA/utils/error.h>
 #include "region_store.h"
+#include "trace.h"
 
 typedef struct RegionStore
 {
-    hashmap* hashmap;
+    hashmap* hashmap;  // regions defined at runtime, by location and idf
+    Region** regions;  // regions with a descriptor, by descriptor id
+    size_t capacity;
+    CallTree* tree;
+    Arena arena;  // regions, call tree nodes and keys of this thread
+
+    /* Orders adding regions against iterating them from other threads,
+     * e.g. the exporter; lookups by the owner need no lock. */
+    pthread_mutex_t mutex;
 } RegionStore;
 
-char* EMA_get_region_key(Region* region)
+static
+char* region_key(Arena* arena, const Region* region)
 {
-    char *key = NULL;
-    int ret = asprintf(
-        &key, "%s:%d(%s:%s)",
+    const char* format = "%s:%d(%s:%s)";
+    int size = snprintf(NULL, 0, format,
         region->file, region->line, region->function, region->idf);
-    if( ret == -1 )
+    if( size < 0 )
         return NULL;
+
+    char* key = EMA_arena_alloc(arena, size + 1, 1);
+    if( key )
+        snprintf(key, size + 1, format,
+            region->file, region->line, region->function, region->idf);
     return key;
 }
 
@@ -33,21 +51,79 @@ RegionStore* EMA_region_store_init(void)
     if( !store->hashmap )
         return NULL;
 
+    store->regions = NULL;
+    store->capacity = 0;
+    EMA_arena_init(&store->arena);
+    pthread_mutex_init(&store->mutex, NULL);
+
+    store->tree = EMA_calltree_init(&store->arena);
+    if( !store->tree )
+        return NULL;
+
     return store;
 }
 
 int EMA_region_store_set(RegionStore* store, Region* region)
 {
-    const char *key = EMA_get_region_key(region);
+    const char *key = region_key(&store->arena, region);
     if( !key )
         return 1;
+    pthread_mutex_lock(&store->mutex);
     hashmap_set(store->hashmap, key, strlen(key), (uintptr_t) region);
+    pthread_mutex_unlock(&store->mutex);
+    return 0;
+}
+
+Region* EMA_region_store_get_static(const RegionStore* store, int id)
+{
+    if( id < 0 || (size_t) id >= store->capacity )
+        return NULL;
+    return store->regions[id];
+}
+
+int EMA_region_store_set_static(RegionStore* store, int id, Region* region)
+{
+    ASSERT_OR_1(id >= 0);
+    pthread_mutex_lock(&store->mutex);
+    if( (size_t) id >= store->capacity )
+    {
+        size_t capacity = store->capacity ? store->capacity : 16;
+        while( capacity <= (size_t) id )
+            capacity *= 2;
+
+        Region** regions = realloc(store->regions, sizeof(Region*) * capacity);
+        if( !regions )
+        {
+            pthread_mutex_unlock(&store->mutex);
+            ERROR_MSG("Failed to grow the region store.");
+            return 1;
+        }
+        memset(regions + store->capacity, 0,
+            sizeof(Region*) * (capacity - store->capacity));
+        store->regions = regions;
+        store->capacity = capacity;
+    }
+    store->regions[id] = region;
+    pthread_mutex_unlock(&store->mutex);
     return 0;
 }
 
 size_t EMA_region_store_size(RegionStore* store)
 {
-    return hashmap_size(store->hashmap);
+    size_t size = hashmap_size(store->hashmap);
+    for(size_t i = 0; i < store->capacity; ++i)
+        size += store->regions[i] != NULL;
+    return size;
+}
+
+CallTree* EMA_region_store_get_calltree(const RegionStore* store)
+{
+    return store->tree;
+}
+
+Arena* EMA_region_store_get_arena(RegionStore* store)
+{
+    return &store->arena;
 }
 
 static void _EMA_region_finalize_iterator(
@@ -58,14 +134,25 @@ static void _EMA_region_finalize_iterator(
     int ret = EMA_region_finalize(region);
     if( ret != 0 )
         *err = ret;
-    free(key);
 }
 
 int EMA_region_store_finalize(RegionStore* store)
 {
     int err = 0;
+    for(size_t i = 0; i < store->capacity; ++i)
+    {
+        if( !store->regions[i] )
+            continue;
+        int ret = EMA_region_finalize(store->regions[i]);
+        if( ret != 0 )
+            err = ret;
+    }
+    free(store->regions);
     hashmap_iterate(store->hashmap, _EMA_region_finalize_iterator, &err);
     hashmap_free(store->hashmap);
+    EMA_calltree_finalize(store->tree);
+    EMA_arena_finalize(&store->arena);
+    pthread_mutex_destroy(&store->mutex);
     return err;
 }
 
@@ -90,53 +177,274 @@ int EMA_region_store_iterate(
     const RegionStore* store, EMA_region_iterator_cb cb, void *usr)
 {
     RegionIterator it = { .cb = cb, .usr = usr, .err = 0 };
+    pthread_mutex_t* mutex = (pthread_mutex_t*) &store->mutex;
+    pthread_mutex_lock(mutex);
+    for(size_t i = 0; i < store->capacity; ++i)
+    {
+        if( !store->regions[i] )
+            continue;
+        int ret = cb(store->regions[i], usr);
+        if( ret != 0 )
+            it.err = ret;
+    }
     hashmap_iterate(store->hashmap, _EMA_region_iterator, &it);
+    pthread_mutex_unlock(mutex);
     return it.err;
 }
 
+/* Merging. */
+static
+Region* find_region(RegionStore* store, const Region* like)
+{
+    if( like->descriptor )
+        return EMA_region_store_get_static(
+            store, __atomic_load_n(&like->descriptor->id, __ATOMIC_ACQUIRE));
+
+    char* key = NULL;
+    if( asprintf(&key, "%s:%d(%s:%s)",
+        like->file, like->line, like->function, like->idf) == -1 )
+        return NULL;
+
+    uintptr_t value;
+    Region* region = NULL;
+    if( hashmap_get(store->hashmap, key, strlen(key), &value) )
+        region = (Region*) value;
+    free(key);
+    return region;
+}
+
+static
+int merge_region(Region* region, void* usr)
+{
+    RegionStore* store = usr;
+    Region* merged = find_region(store, region);
+    if( !merged )
+    {
+        int err = EMA_region_clone(&merged, region, &store->arena);
+        ASSERT_OR_1(err == 0);
+
+        if( region->descriptor )
+            err = EMA_region_store_set_static(store,
+                __atomic_load_n(&region->descriptor->id, __ATOMIC_ACQUIRE),
+                merged);
+        else
+            err = EMA_region_store_set(store, merged);
+        ASSERT_OR_1(err == 0);
+    }
+    EMA_region_merge(merged, region);
+    return 0;
+}
+
+/* Add the regions and the call tree of `src` to `store`. */
+static
+int region_store_merge(RegionStore* store, const RegionStore* src)
+{
+    int err = EMA_region_store_iterate(src, merge_region, store);
+    return EMA_calltree_merge(store->tree, src->tree) || err;
+}
+
 /* Thread-level interface. */
-#define THREAD_LIMIT 1024
+/*
+ * Threads claim a slot of a registry that grows in chunks, chunk k holding
+ * FIRST_CHUNK_SLOTS << k slots, so slots never move. When a thread exits,
+ * its results are merged into the retired store and its slot is freed for
+ * the next thread. Threads claim slots without locking; the mutex orders
+ * retiring against output and finalization.
+ */
+#define FIRST_CHUNK_BITS 6
+#define FIRST_CHUNK_SLOTS (1 << FIRST_CHUNK_BITS)
+#define MAX_CHUNKS 26
 
-static atomic_int EMA_thread_count = 0;
+typedef struct
+{
+    atomic_int used;
+    _Atomic(RegionStore*) store;
+} ThreadSlot;
+
+static _Atomic(ThreadSlot*) EMA_thread_slots[MAX_CHUNKS];
+static atomic_size_t EMA_thread_count = 0;  // slots ever claimed
 static thread_local int EMA_local_thread_idx = -1;
-static RegionStore* EMA_region_store[THREAD_LIMIT];
+static thread_local ThreadSlot* EMA_local_thread_slot = NULL;
+
+static pthread_mutex_t EMA_thread_mutex = PTHREAD_MUTEX_INITIALIZER;
+static RegionStore* EMA_retired_store = NULL;
+static pthread_once_t EMA_thread_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t EMA_thread_key;
+
+static
+ThreadSlot* get_slot(size_t idx, int create)
+{
+    size_t chunk = 63 - __builtin_clzll((idx >> FIRST_CHUNK_BITS) + 1);
+    size_t first = ((1ULL << chunk) - 1) << FIRST_CHUNK_BITS;
+    if( chunk >= MAX_CHUNKS )
+        return NULL;
+
+    ThreadSlot* slots = atomic_load_explicit(
+        &EMA_thread_slots[chunk], memory_order_acquire);
+    if( !slots && create )
+    {
+        ThreadSlot* expected = NULL;
+        slots = calloc(FIRST_CHUNK_SLOTS << chunk, sizeof(ThreadSlot));
+        ASSERT_MSG_OR_NULL(slots, "Failed to grow the thread registry.");
+        if( !atomic_compare_exchange_strong(
+            &EMA_thread_slots[chunk], &expected, slots) )
+        {
+            free(slots);
+            slots = expected;
+        }
+    }
+    return slots ? slots + (idx - first) : NULL;
+}
+
+/* The lowest free slot, or a new one. */
+static
+int claim_slot(void)
+{
+    for(;;)
+    {
+        size_t count = atomic_load(&EMA_thread_count);
+        for(size_t i = 0; i < count; ++i)
+        {
+            ThreadSlot* slot = get_slot(i, 0);
+            int expected = 0;
+            if( slot && atomic_compare_exchange_strong(
+                &slot->used, &expected, 1) )
+                return i;
+        }
+
+        size_t idx = atomic_fetch_add(&EMA_thread_count, 1);
+        ThreadSlot* slot = get_slot(idx, 1);
+        if( !slot )
+            return -1;
+        int expected = 0;
+        if( atomic_compare_exchange_strong(&slot->used, &expected, 1) )
+            return idx;
+    }
+}
+
+/* TLS destructor of a thread that used EMA. */
+static
+void retire_thread(void* arg)
+{
+    ThreadSlot* slot = arg;
+
+    pthread_mutex_lock(&EMA_thread_mutex);
+    /* NULL if EMA was finalized while the thread ran. */
+    RegionStore* store = atomic_exchange(&slot->store, NULL);
+    if( store && !EMA_retired_store )
+        EMA_retired_store = EMA_region_store_init();
+    if( store && (!EMA_retired_store
+        || region_store_merge(EMA_retired_store, store) != 0) )
+        ERROR_MSG("Failed to merge the regions of an exited thread.");
+    pthread_mutex_unlock(&EMA_thread_mutex);
+
+    if( store )
+    {
+        EMA_region_store_finalize(store);
+        free(store);
+    }
+    EMA_trace_release_ring();
+
+    EMA_local_thread_idx = -1;
+    EMA_local_thread_slot = NULL;
+    atomic_store_explicit(&slot->used, 0, memory_order_release);
+}
+
+static
+void create_thread_key(void)
+{
+    pthread_key_create(&EMA_thread_key, retire_thread);
+}
 
 int EMA_thread_init(void)
 {
     if( EMA_local_thread_idx >= 0 )
         return 0;
 
-    EMA_local_thread_idx = atomic_fetch_add(&EMA_thread_count, 1);
-    if( EMA_local_thread_idx >= THREAD_LIMIT )
-        return 1;
+    pthread_once(&EMA_thread_key_once, create_thread_key);
 
-    EMA_region_store[EMA_local_thread_idx] = EMA_region_store_init();
+    int idx = claim_slot();
+    ASSERT_MSG_OR_1(idx >= 0, "Failed to register thread.");
+    ThreadSlot* slot = get_slot(idx, 0);
 
+    RegionStore* store = EMA_region_store_init();
+    if( !store )
+    {
+        atomic_store(&slot->used, 0);
+        ERROR_MSG("Failed to create the region store of a thread.");
+        return 1;
+    }
+    atomic_store_explicit(&slot->store, store, memory_order_release);
+    pthread_setspecific(EMA_thread_key, slot);
+
+    EMA_local_thread_idx = idx;
+    EMA_local_thread_slot = slot;
     return 0;
 }
 
 RegionStore* EMA_thread_get_region_store(void)
 {
-    if( EMA_local_thread_idx >= 0 )
-        return EMA_region_store[EMA_local_thread_idx];
+    if( EMA_local_thread_slot )
+        return atomic_load_explicit(
+            &EMA_local_thread_slot->store, memory_order_relaxed);
     return NULL;
 }
 
+CallTree* EMA_thread_get_calltree(void)
+{
+    RegionStore* store = EMA_thread_get_region_store();
+    return store ? store->tree : NULL;
+}
+
+int EMA_thread_get_index(void)
+{
+    return EMA_local_thread_idx;
+}
+
 size_t EMA_thread_get_count(void)
 {
-    return EMA_thread_count;
+    return atomic_load(&EMA_thread_count);
 }
 
-RegionStore* EMA_get_region_store(int thread_idx)
+int EMA_region_stores_iterate(EMA_region_store_iterator_cb cb, void* usr)
 {
-    return EMA_region_store[thread_idx];
+    int err = 0;
+    pthread_mutex_lock(&EMA_thread_mutex);
+    size_t count = atomic_load(&EMA_thread_count);
+    for(size_t i = 0; i < count && !err; ++i)
+    {
+        ThreadSlot* slot = get_slot(i, 0);
+        RegionStore* store = slot ? atomic_load(&slot->store) : NULL;
+        if( store )
+            err = cb(store, i, usr);
+    }
+    if( !err && EMA_retired_store )
+        err = cb(EMA_retired_store, EMA_RETIRED_THREADS, usr);
+    pthread_mutex_unlock(&EMA_thread_mutex);
+    return err;
 }
 
+/* Threads still running keep their slot, but no longer their store. */
 int EMA_region_stores_finalize(void)
 {
-    for(size_t i = 0; i < EMA_thread_count; ++i) {
-        EMA_region_store_finalize(EMA_region_store[i]);
-        free(EMA_region_store[i]);
+    pthread_mutex_lock(&EMA_thread_mutex);
+    size_t count = atomic_load(&EMA_thread_count);
+    for(size_t i = 0; i < count; ++i)
+    {
+        ThreadSlot* slot = get_slot(i, 0);
+        RegionStore* store = slot ? atomic_exchange(&slot->store, NULL) : NULL;
+        if( store )
+        {
+            EMA_region_store_finalize(store);
+            free(store);
+        }
+    }
+    if( EMA_retired_store )
+    {
+        EMA_region_store_finalize(EMA_retired_store);
+        free(EMA_retired_store);
+        EMA_retired_store = NULL;
     }
+    pthread_mutex_unlock(&EMA_thread_mutex);
     return 0;
 }
@@ -2,13 +2,19 @@
 #define EMA_REGION_REGION_STORE_H
 
 #include <EMA/ext/c-hashmap/map.h>
+#include <EMA/utils/arena.h>
+#include "calltree.h"
 #include "region.h"
 
 typedef struct RegionStore RegionStore;
 
 RegionStore* EMA_region_store_init(void);
 int EMA_region_store_set(RegionStore* store, Region* region);
+Region* EMA_region_store_get_static(const RegionStore* store, int id);
+int EMA_region_store_set_static(RegionStore* store, int id, Region* region);
 size_t EMA_region_store_size(RegionStore* store);
+CallTree* EMA_region_store_get_calltree(const RegionStore* store);
+Arena* EMA_region_store_get_arena(RegionStore* store);
 int EMA_region_store_finalize(RegionStore* store);
 
 typedef int (*EMA_region_iterator_cb)(Region*, void *usr);
@@ -16,10 +22,19 @@ int EMA_region_store_iterate(
     const RegionStore* store, EMA_region_iterator_cb cb, void *usr);
 
 /* Thread-level interface. */
+/* Thread index of the merged results of threads that exited. */
+#define EMA_RETIRED_THREADS -1
+
 int EMA_thread_init(void);
 RegionStore* EMA_thread_get_region_store(void);
-size_t EMA_thread_get_count(void);
-RegionStore* EMA_get_region_store(int thread_idx);
+CallTree* EMA_thread_get_calltree(void);
+int EMA_thread_get_index(void);
+size_t EMA_thread_get_count(void);  // slots, including free ones
 int EMA_region_stores_finalize(void);
 
+/* Visit the stores of the running threads and the retired store. */
+typedef int (*EMA_region_store_iterator_cb)(
+    const RegionStore*, int thread_idx, void* usr);
+int EMA_region_stores_iterate(EMA_region_store_iterator_cb cb, void* usr);
+
 #endif
@@ -0,0 +1,143 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <EMA/utils/error.h>
+
+#include "sampling.h"
+
+/* Measured visits between two adjustments of an adaptive stride. */
+#define ADAPT_WINDOW 16
+#define MAX_STRIDE (1ULL << 20)
+
+SamplingPolicy EMA_sampling_default = {
+    .mode = EMA_SAMPLE_ALL,
+    .every_n = 1,
+    .interval_us = 0,
+    .max_overhead = 0
+};
+
+int EMA_sampling_policy_check(const SamplingPolicy* policy)
+{
+    ASSERT_OR_1(policy);
+    switch( policy->mode )
+    {
+    case EMA_SAMPLE_ALL:
+    case EMA_SAMPLE_INTERVAL:
+        return 0;
+    case EMA_SAMPLE_EVERY_NTH:
+        ASSERT_MSG_OR_1(policy->every_n > 0,
+            "Sampling every n-th visit requires n > 0.");
+        return 0;
+    case EMA_SAMPLE_ADAPTIVE:
+        ASSERT_MSG_OR_1(policy->max_overhead > 0,
+            "Adaptive sampling requires a maximum overhead > 0.");
+        return 0;
+    }
+    ERROR_MSG("Unknown sampling mode %d.", policy->mode);
+    return 1;
+}
+
+/**
+ * Parse "nth:<n>", "interval:<us>" or "adaptive:<max_overhead>", e.g.
+ * "adaptive:0.01" for at most 1% overhead.
+ */
+int EMA_sampling_configure_from_string(const char* config)
+{
+    SamplingPolicy policy = EMA_sampling_default;
+    const char* value = strchr(config, ':');
+    char* end = NULL;
+
+    ASSERT_MSG_OR_1(value, "Invalid sampling config '%s'.", config);
+    size_t length = value - config;
+    ++value;
+
+    if( length == 3 && strncmp(config, "nth", 3) == 0 )
+    {
+        policy.mode = EMA_SAMPLE_EVERY_NTH;
+        policy.every_n = strtoull(value, &end, 10);
+    }
+    else if( length == 8 && strncmp(config, "interval", 8) == 0 )
+    {
+        policy.mode = EMA_SAMPLE_INTERVAL;
+        policy.interval_us = strtoull(value, &end, 10);
+    }
+    else if( length == 8 && strncmp(config, "adaptive", 8) == 0 )
+    {
+        policy.mode = EMA_SAMPLE_ADAPTIVE;
+        policy.max_overhead = strtod(value, &end);
+    }
+    ASSERT_MSG_OR_1(end && end != value && *end == '\0',
+        "Invalid sampling config '%s'.", config);
+
+    int err = EMA_sampling_policy_check(&policy);
+    if( err )
+        return err;
+
+    EMA_sampling_default = policy;
+    return 0;
+}
+
+void EMA_sampler_init(Sampler* sampler, const SamplingPolicy* policy)
+{
+    memset(sampler, 0, sizeof(Sampler));
+    sampler->policy = *policy;
+    sampler->stride =
+        policy->mode == EMA_SAMPLE_EVERY_NTH ? policy->every_n : 1;
+}
+
+void EMA_sampler_adapt(
+    Sampler* sampler, uint64_t overhead_ns, uint64_t body_ns)
+{
+    sampler->overhead_ns += overhead_ns;
+    sampler->body_ns += body_ns;
+    if( ++sampler->window < ADAPT_WINDOW )
+        return;
+
+    /* Measuring every N-th visit divides the overhead per visit by N. */
+    double ratio = sampler->body_ns
+        ? (double) sampler->overhead_ns / sampler->body_ns
+        : (double) MAX_STRIDE;
+    double stride = ceil(ratio / sampler->policy.max_overhead);
+
+    if( stride < 1 )
+        stride = 1;
+    if( stride > MAX_STRIDE )
+        stride = MAX_STRIDE;
+
+    sampler->stride = (unsigned long long) stride;
+    sampler->overhead_ns = 0;
+    sampler->body_ns = 0;
+    sampler->window = 0;
+}
+
+void EMA_sampling_extrapolate(
+    unsigned long long measured_energy,
+    unsigned long long measured_time,
+    unsigned long long total_time,
+    const VisitStats* stats,
+    unsigned long long* energy,
+    unsigned long long* error)
+{
+    *energy = measured_energy;
+    *error = 0;
+    if( total_time <= measured_time )
+        return;
+
+    /* Unmeasured time at the average power of the measured visits. */
+    double unmeasured_time = total_time - measured_time;
+    double extrapolated = 0;
+    if( measured_time )
+        extrapolated =
+            (double) measured_energy / measured_time * unmeasured_time;
+    *energy = measured_energy + (unsigned long long) llround(extrapolated);
+
+    /* Standard error of the mean power over the unmeasured time. Without
+     * two power samples, the extrapolated part itself is the error. */
+    if( stats->power_n >= 2 )
+        *error = (unsigned long long) llround(
+            EMA_visit_moments_stddev(&stats->power, stats->power_n)
+            / sqrt((double) stats->power_n) * unmeasured_time);
+    else
+        *error = (unsigned long long) llround(extrapolated);
+}
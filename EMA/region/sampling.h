@@ -0,0 +1,79 @@
+#ifndef EMA_REGION_SAMPLING_H
+#define EMA_REGION_SAMPLING_H
+
+#include <stdint.h>
+
+#include "region.user.h"
+#include "stats.h"
+
+/* Environment variable with the default policy of new regions:
+ * nth:<n> | interval:<us> | adaptive:<max_overhead> */
+#define EMA_SAMPLING "EMA_SAMPLING"
+
+extern SamplingPolicy EMA_sampling_default;
+
+/* Per-region sampling state. `stride` is the current N of every-Nth and
+ * adaptive sampling. */
+typedef struct
+{
+    SamplingPolicy policy;
+    unsigned long long stride;
+    unsigned long long countdown;  // unmeasured visits before the next one
+    uint64_t last_measured_ns;
+    uint64_t visit_start_ns;  // begin of an unmeasured visit
+    int measuring;  // the current visit reads the devices
+
+    /* Adaptive: time spent in EMA's reads against the time between them,
+     * accumulated over a window of measured visits. */
+    uint64_t begin_ns;
+    uint64_t body_start_ns;
+    uint64_t overhead_ns;
+    uint64_t body_ns;
+    unsigned int window;
+} Sampler;
+
+int EMA_sampling_policy_check(const SamplingPolicy* policy);
+int EMA_sampling_configure_from_string(const char* config);
+
+void EMA_sampler_init(Sampler* sampler, const SamplingPolicy* policy);
+
+/* Decide at the begin of a visit whether it is measured. */
+static inline
+int EMA_sampler_measure(Sampler* sampler, uint64_t now_ns)
+{
+    switch( sampler->policy.mode )
+    {
+    case EMA_SAMPLE_ALL:
+        return 1;
+    case EMA_SAMPLE_INTERVAL:
+        if( now_ns - sampler->last_measured_ns
+            < sampler->policy.interval_us * 1000ULL )
+            return 0;
+        sampler->last_measured_ns = now_ns;
+        return 1;
+    default:
+        if( sampler->countdown )
+        {
+            --sampler->countdown;
+            return 0;
+        }
+        sampler->countdown = sampler->stride - 1;
+        return 1;
+    }
+}
+
+/* Account one measured visit of an adaptive region. */
+void EMA_sampler_adapt(
+    Sampler* sampler, uint64_t overhead_ns, uint64_t body_ns);
+
+/* Energy of all visits from the energy and time of the measured ones,
+ * scaled by time, and the standard error of the extrapolated part. */
+void EMA_sampling_extrapolate(
+    unsigned long long measured_energy,
+    unsigned long long measured_time,
+    unsigned long long total_time,
+    const VisitStats* stats,
+    unsigned long long* energy,
+    unsigned long long* error);
+
+#endif
@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <EMA/utils/error.h>
+#include <EMA/utils/time.h>
+
+#include "shared.h"
+#include "trace.h"
+
+#define MAX_STRIPES 1024
+#define MAX_NESTING 64
+
+static pthread_mutex_t shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+static SharedRegion* shared_regions = NULL;
+
+/* Threads take stripes round-robin, so up to one thread per stripe never
+ * shares a cache line. */
+static atomic_uint next_stripe = 0;
+static thread_local int local_stripe = -1;
+
+/* Open visits of the calling thread. */
+static thread_local struct
+{
+    const SharedRegion* region;
+    uint64_t start_ns;
+} visits[MAX_NESTING];
+static thread_local size_t depth = 0;
+
+/* One stripe per processor, rounded up to a power of two. */
+static
+size_t stripe_count(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    size_t stripes = 1;
+    while( stripes < (size_t) cpus && stripes < MAX_STRIPES )
+        stripes <<= 1;
+    return stripes;
+}
+
+static
+SharedRegion* shared_region_alloc(const char* idf)
+{
+    SharedRegion* shared = calloc(1, sizeof(SharedRegion));
+    ASSERT_MSG_OR_NULL(shared, "Failed to allocate shared region '%s'.", idf);
+
+    size_t stripes = stripe_count();
+    shared->stripes = aligned_alloc(
+        alignof(SharedStripe), sizeof(SharedStripe) * stripes);
+    if( !shared->stripes )
+    {
+        free(shared);
+        ERROR_MSG("Failed to allocate shared region '%s'.", idf);
+        return NULL;
+    }
+    memset(shared->stripes, 0, sizeof(SharedStripe) * stripes);
+    shared->stripe_mask = stripes - 1;
+    return shared;
+}
+
+static
+int shared_region_create(
+    SharedRegion** region,
+    const char* idf,
+    Filter *filter,
+    const char* file,
+    unsigned int line,
+    const char* func
+) {
+    SharedRegion* shared = shared_region_alloc(idf);
+    if( !shared )
+        return 1;
+
+    int err = EMA_region_create_and_init(
+        &shared->region, idf, filter, file, line, func);
+    if( err )
+    {
+        free(shared->stripes);
+        free(shared);
+        return err;
+    }
+
+    *region = shared;
+    return 0;
+}
+
+int EMA_shared_region_define(
+    SharedRegion **region,
+    const char* idf,
+    Filter *filter,
+    const char* file,
+    unsigned int line,
+    const char* func
+) {
+    if( __atomic_load_n(region, __ATOMIC_ACQUIRE) )
+        return 0;
+
+    int err = 0;
+    pthread_mutex_lock(&shared_mutex);
+    if( !*region )
+    {
+        SharedRegion* shared;
+        err = shared_region_create(&shared, idf, filter, file, line, func);
+        if( err == 0 )
+        {
+            shared->next = shared_regions;
+            shared_regions = shared;
+            __atomic_store_n(region, shared, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&shared_mutex);
+    return err;
+}
+
+/* Strings are interned, so definitions compare by pointer. */
+static
+int same_definition(const Region* a, const Region* b)
+{
+    return a->idf == b->idf && a->file == b->file
+        && a->function == b->function && a->line == b->line
+        && a->measurements.size == b->measurements.size
+        && memcmp(a->devices, b->devices,
+            sizeof(Device*) * a->measurements.size) == 0;
+}
+
+SharedRegion* EMA_shared_region_of_tokens(Region* region)
+{
+    SharedRegion* shared = __atomic_load_n(&region->tokens, __ATOMIC_ACQUIRE);
+    if( shared )
+        return shared;
+
+    pthread_mutex_lock(&shared_mutex);
+    for(shared = shared_regions; shared; shared = shared->next)
+        if( shared->tokens && same_definition(shared->region, region) )
+            break;
+
+    if( !shared && (shared = shared_region_alloc(region->idf)) )
+    {
+        if( EMA_region_clone(&shared->region, region, NULL) != 0
+            || (EMA_trace_enabled && EMA_trace_add_region(shared->region)) )
+        {
+            free(shared->region);
+            free(shared->stripes);
+            free(shared);
+            shared = NULL;
+        }
+        else
+        {
+            shared->tokens = 1;
+            shared->next = shared_regions;
+            shared_regions = shared;
+        }
+    }
+
+    if( shared )
+        __atomic_store_n(&region->tokens, shared, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&shared_mutex);
+    return shared;
+}
+
+void EMA_shared_region_count(SharedRegion* region, uint64_t time_ns)
+{
+    if( local_stripe < 0 )
+        local_stripe = atomic_fetch_add_explicit(
+            &next_stripe, 1, memory_order_relaxed);
+
+    SharedStripe* stripe = region->stripes
+        + (local_stripe & region->stripe_mask);
+    atomic_fetch_add_explicit(&stripe->visits, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stripe->time_ns, time_ns, memory_order_relaxed);
+}
+
+int EMA_shared_region_begin(SharedRegion *region)
+{
+    ASSERT_MSG_OR_1(depth < MAX_NESTING,
+        "Shared regions nested deeper than %d.", MAX_NESTING);
+
+    visits[depth].region = region;
+    visits[depth].start_ns = EMA_get_time_in_ns();
+    ++depth;
+    return 0;
+}
+
+int EMA_shared_region_end(SharedRegion *region)
+{
+    uint64_t now = EMA_get_time_in_ns();
+    ASSERT_MSG_OR_1(depth && visits[depth - 1].region == region,
+        "Shared region '%s' ended while not the innermost one.",
+        region->region->idf);
+    --depth;
+
+    EMA_shared_region_count(region, now - visits[depth].start_ns);
+    return 0;
+}
+
+int EMA_shared_region_phase_begin(SharedRegion *region)
+{
+    ASSERT_MSG_OR_1(!atomic_exchange(&region->in_phase, 1),
+        "Phases of shared region '%s' overlap.", region->region->idf);
+    return EMA_region_begin(region->region);
+}
+
+int EMA_shared_region_phase_end(SharedRegion *region)
+{
+    int err = EMA_region_end(region->region);
+    atomic_store(&region->in_phase, 0);
+    return err;
+}
+
+int EMA_shared_region_get_visits(
+    const SharedRegion *region,
+    unsigned long long* visits,
+    unsigned long long* time_us
+) {
+    ASSERT_OR_1(region);
+
+    unsigned long long sum_visits = 0, sum_ns = 0;
+    for(size_t i = 0; i <= region->stripe_mask; ++i)
+    {
+        sum_visits += atomic_load_explicit(
+            &region->stripes[i].visits, memory_order_relaxed);
+        sum_ns += atomic_load_explicit(
+            &region->stripes[i].time_ns, memory_order_relaxed);
+    }
+
+    if( visits )
+        *visits = sum_visits;
+    if( time_us )
+        *time_us = sum_ns / 1000;
+    return 0;
+}
+
+int EMA_shared_regions_iterate(EMA_shared_region_iterator_cb cb, void* usr)
+{
+    int err = 0;
+    pthread_mutex_lock(&shared_mutex);
+    for(SharedRegion* shared = shared_regions; shared && !err;
+        shared = shared->next)
+        err = cb(shared, usr);
+    pthread_mutex_unlock(&shared_mutex);
+    return err;
+}
+
+/* Handles of the user dangle afterwards, like those of other regions. */
+int EMA_shared_regions_finalize(void)
+{
+    pthread_mutex_lock(&shared_mutex);
+    SharedRegion* shared = shared_regions;
+    shared_regions = NULL;
+    pthread_mutex_unlock(&shared_mutex);
+
+    while( shared )
+    {
+        SharedRegion* next = shared->next;
+        EMA_region_finalize(shared->region);
+        free(shared->stripes);
+        free(shared);
+        shared = next;
+    }
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef EMA_REGION_SHARED_H
+#define EMA_REGION_SHARED_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "region.h"
+#include "shared.user.h"
+
+/* Thread index of shared regions in the output. */
+#define EMA_SHARED_THREADS -2
+
+/* Counters of the threads that map to one stripe, on their own cache line.
+ * Threads rarely share a stripe, so the relaxed additions do not contend. */
+typedef struct
+{
+    alignas(64) _Atomic uint64_t visits;
+    _Atomic uint64_t time_ns;
+} SharedStripe;
+
+typedef struct SharedRegion
+{
+    SharedStripe* stripes;
+    size_t stripe_mask;  // stripes - 1, a power of two minus one
+    Region* region;  // devices, read at phase boundaries
+    atomic_int in_phase;
+    int tokens;  // holds the token visits of a region definition
+    struct SharedRegion* next;
+} SharedRegion;
+
+/* Shared region the token visits of `region` add to, one per definition
+ * and devices. It outlives the thread of `region`. */
+SharedRegion* EMA_shared_region_of_tokens(Region* region);
+/* Count a visit of `time_ns` on the stripe of the calling thread. */
+void EMA_shared_region_count(SharedRegion* region, uint64_t time_ns);
+typedef int (*EMA_shared_region_iterator_cb)(const SharedRegion*, void* usr);
+int EMA_shared_regions_iterate(EMA_shared_region_iterator_cb cb, void* usr);
+int EMA_shared_regions_finalize(void);
+
+#endif
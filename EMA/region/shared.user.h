@@ -0,0 +1,142 @@
+#ifndef EMA_REGION_SHARED_USER_H
+#define EMA_REGION_SHARED_USER_H
+
+#include "filter.user.h"
+
+/* Shared region interface. */
+/**
+ * The `SharedRegion` type is a region that many threads visit concurrently
+ * through one handle, e.g. the body of a parallel loop. Visits and their
+ * durations are counted per thread in separate cache lines and summed when
+ * read. The `Devices` are read once per parallel phase, see
+ * :c:func:`EMA_shared_region_phase_begin`, instead of once per visit.
+ *
+ * Shared regions are owned by EMA; they are reported with thread -2 and
+ * released by `EMA_finalize`.
+ */
+typedef struct SharedRegion SharedRegion;
+
+/**
+ * This function sets up a shared region if `region` does not point to one
+ * yet. Concurrent calls with the same `region` create it once.
+ *
+ * @param region: `SharedRegion` that should be created.
+ * @param idf: Region identifier or name of the `SharedRegion`.
+ * @param filter: `Filter` to define `Devices` for the measurement of the
+ * `SharedRegion`, or `NULL`.
+ * @param file: File name that describes where the `SharedRegion` is defined.
+ * @param line: Line number that describes where the `SharedRegion` is
+ * defined.
+ * @param func: Function name that describes where the `SharedRegion` is
+ * defined.
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_shared_region_define(
+    SharedRegion **region,
+    const char* idf,
+    Filter *filter,
+    const char* file,
+    unsigned int line,
+    const char* func
+);
+
+/**
+ * This function starts a visit of the calling thread. It reads no `Device`.
+ *
+ * .. note::
+ *    Visits of a thread must be properly nested with those of its other
+ *    shared regions.
+ *
+ * @param region: The visited `SharedRegion`.
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_shared_region_begin(SharedRegion *region);
+
+/**
+ * This function ends the visit of the calling thread and adds it and its
+ * duration to the counters of the thread.
+ *
+ * @param region: The visited `SharedRegion`.
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_shared_region_end(SharedRegion *region);
+
+/**
+ * This function starts a parallel phase of a shared region, typically right
+ * before a parallel section, and reads the `Devices`. The energy and time of
+ * the region are those of its phases.
+ *
+ * .. note::
+ *    Phases of a region must not overlap; a phase has to begin and end on
+ *    the same thread.
+ *
+ * @param region: The `SharedRegion`.
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_shared_region_phase_begin(SharedRegion *region);
+
+/**
+ * This function ends a parallel phase of a shared region and reads the
+ * `Devices`.
+ *
+ * @param region: The `SharedRegion`.
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_shared_region_phase_end(SharedRegion *region);
+
+/**
+ * This function sums the visits of all threads and their durations. It may
+ * be called while threads visit the region.
+ *
+ * @param region: The `SharedRegion`.
+ * @param visits: Receives the number of visits (may be NULL).
+ * @param time_us: Receives the summed duration in micro seconds (may be
+ * NULL).
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_shared_region_get_visits(
+    const SharedRegion *region,
+    unsigned long long* visits,
+    unsigned long long* time_us
+);
+
+/**
+ * This macro declares a `SharedRegion` handle with a specified variable name.
+ *
+ * Args:
+ *     region: Name of the region variable.
+ *
+ */
+#define EMA_SHARED_REGION_DECLARE(region) \
+    static SharedRegion *region = NULL
+
+/**
+ * This macro sets up a `SharedRegion` if it has not already been defined.
+ *
+ * Args:
+ *     region: `SharedRegion` to define.
+ *     idf: Identifier or name of the `SharedRegion`.
+ *
+ */
+#define EMA_SHARED_REGION_DEFINE(region, idf) \
+    EMA_SHARED_REGION_DEFINE_WITH_FILTER(region, idf, NULL)
+
+/**
+ * This macro sets up a `SharedRegion` with a `Filter` if it has not already
+ * been defined.
+ *
+ * Args:
+ *     region: `SharedRegion` to define.
+ *     idf: Identifier or name of the `SharedRegion`.
+ *     filter: A `Filter` to disable `Devices` or `Plugins`.
+ */
+#define EMA_SHARED_REGION_DEFINE_WITH_FILTER(region, idf, filter) \
+    EMA_shared_region_define(region, idf, filter, __FILE__, __LINE__, __func__)
+
+#endif
@@ -0,0 +1,160 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include <EMA/utils/error.h>
+
+#include "sink.h"
+
+static struct
+{
+    OutputSink* array;
+    size_t size;
+    pthread_mutex_t mutex;
+} sinks = {
+    .array = NULL,
+    .size = 0,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+int EMA_register_output_sink(const OutputSink* sink)
+{
+    ASSERT_MSG_OR_1(sink && sink->records,
+        "An output sink needs a records callback.");
+
+    pthread_mutex_lock(&sinks.mutex);
+    OutputSink* mem = realloc(
+        sinks.array, (sinks.size + 1) * sizeof(OutputSink));
+    if( mem )
+    {
+        sinks.array = mem;
+        sinks.array[sinks.size] = *sink;
+        ++sinks.size;
+    }
+    pthread_mutex_unlock(&sinks.mutex);
+    ASSERT_OR_1(mem);
+    return 0;
+}
+
+/*
+ * The sinks of an output are copied out of the registry, so callbacks run
+ * without its lock. A failed sink is left out of the rest of the output;
+ * registered sinks are only reported, so they cannot fail EMA's own files.
+ */
+typedef struct
+{
+    OutputSink sink;
+    int failed;
+    size_t id;  // in order of registration, SIZE_MAX for the extra sink
+} ActiveSink;
+
+typedef struct
+{
+    ActiveSink* array;
+    size_t size;
+    size_t failed;
+} SinkRun;
+
+static
+int run_batch(const OutputRecord* records, size_t n, void* usr)
+{
+    SinkRun* run = usr;
+    for(size_t i = 0; i < run->size; ++i)
+    {
+        ActiveSink* active = run->array + i;
+        if( active->failed )
+            continue;
+        if( active->sink.records(records, n, active->sink.usr) != 0 )
+        {
+            active->failed = 1;
+            ++run->failed;
+        }
+    }
+
+    /* Stop the source once no sink is left. */
+    return run->failed == run->size;
+}
+
+int EMA_output_run(
+    const OutputInfo* info, EMA_output_source source,
+    const OutputSink* sink, int registered)
+{
+    SinkRun run = { .array = NULL, .size = 0, .failed = 0 };
+
+    pthread_mutex_lock(&sinks.mutex);
+    size_t capacity = (registered ? sinks.size : 0) + 1;
+    run.array = malloc(capacity * sizeof(ActiveSink));
+    for(size_t i = 0; run.array && registered && i < sinks.size; ++i)
+        if( sinks.array[i].kinds & info->kind )
+            run.array[run.size++] = (ActiveSink) {
+                .sink = sinks.array[i], .id = i };
+    pthread_mutex_unlock(&sinks.mutex);
+    ASSERT_OR_1(run.array);
+
+    if( sink )
+        run.array[run.size++] = (ActiveSink) {
+            .sink = *sink, .id = SIZE_MAX };
+    if( run.size == 0 )
+    {
+        free(run.array);
+        return 0;
+    }
+
+    for(size_t i = 0; i < run.size; ++i)
+    {
+        ActiveSink* active = run.array + i;
+        if( active->sink.begin
+            && active->sink.begin(info, active->sink.usr) != 0 )
+        {
+            active->failed = 1;
+            ++run.failed;
+        }
+    }
+
+    /* A failed source leaves every sink with an incomplete output. */
+    int err = 0;
+    if( run.failed < run.size )
+        err = source(run_batch, &run) != 0 && run.failed < run.size;
+
+    for(size_t i = 0; i < run.size; ++i)
+    {
+        ActiveSink* active = run.array + i;
+        active->failed |= err;
+        if( active->sink.end
+            && active->sink.end(active->failed, active->sink.usr) != 0 )
+            active->failed = 1;
+
+        if( active->id == SIZE_MAX )
+            err |= active->failed;
+        else if( active->failed )
+            ERROR_MSG("Output sink %zu failed.", active->id);
+    }
+    free(run.array);
+    return err;
+}
+
+int EMA_output_results(const OutputSink* sink, int registered)
+{
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+
+    OutputInfo info = {
+        .kind = EMA_OUTPUT_RESULTS,
+        .timestamp = wall.tv_sec * 1000000ULL + wall.tv_nsec / 1000,
+    };
+    return EMA_output_run(&info, EMA_output_iterate, sink, registered);
+}
+
+void EMA_output_sinks_finalize(void)
+{
+    pthread_mutex_lock(&sinks.mutex);
+    for(size_t i = 0; i < sinks.size; ++i)
+        if( sinks.array[i].finalize )
+            sinks.array[i].finalize(sinks.array[i].usr);
+    free(sinks.array);
+    sinks.array = NULL;
+    sinks.size = 0;
+    pthread_mutex_unlock(&sinks.mutex);
+}
@@ -0,0 +1,22 @@
+#ifndef EMA_REGION_SINK_H
+#define EMA_REGION_SINK_H
+
+#include "output.h"
+#include "sink.user.h"
+
+/* Calls `cb` with the batches of an output. */
+typedef int (*EMA_output_source)(EMA_output_batch_cb cb, void* usr);
+
+/* Passes an output to `sink`, if not NULL, and to the registered sinks of
+ * its kind if `registered`. Returns nonzero if a sink or the source
+ * failed. */
+int EMA_output_run(
+    const OutputInfo* info, EMA_output_source source,
+    const OutputSink* sink, int registered);
+
+/* The results at this time, see `EMA_output_run`. */
+int EMA_output_results(const OutputSink* sink, int registered);
+
+void EMA_output_sinks_finalize(void);
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef EMA_REGION_SINK_USER_H
+#define EMA_REGION_SINK_USER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <EMA/core/device.user.h>
+#include <EMA/region/export.user.h>
+
+/* Output records. */
+/* Percentiles per visit in a record (p50, p90, p99), and their value
+ * without histograms. */
+#define EMA_OUTPUT_PERCENTILES 3
+#define EMA_OUTPUT_NO_PERCENTILE UINT64_MAX
+
+/* Thread of the records of exited threads, of shared regions and of
+ * snapshots, which sum all threads. */
+#define EMA_OUTPUT_EXITED_THREADS -1
+#define EMA_OUTPUT_SHARED_THREADS -2
+#define EMA_OUTPUT_ALL_THREADS -3
+
+/* Statistics per visit of a record. */
+enum
+{
+    EMA_OUTPUT_ENERGY,
+    EMA_OUTPUT_TIME,
+    EMA_OUTPUT_POWER,
+    EMA_OUTPUT_QUANTITIES,
+};
+
+/* Quantities with percentiles, indexed like the statistics: energy and
+ * time. */
+#define EMA_OUTPUT_PERCENTILE_QUANTITIES 2
+
+/**
+ * The `OutputRecord` type is one row of the results: a region definition of
+ * a thread on one of its `Device` objects, like a line of `output.EMA.<pid>`.
+ * The strings are valid until `EMA_finalize` returns.
+ *
+ * Members:
+ *   thread: Thread ID or one of the `EMA_OUTPUT_*_THREADS` values.
+ *   idf, file, function, line: Region definition.
+ *   visits: Number of visits.
+ *   energy: Energy in uJ, extrapolated for sampled regions.
+ *   time: Duration in us.
+ *   stale: Whether a read of the device missed its deadline.
+ *   moments: Min, max, mean and standard deviation per visit of energy,
+ *     time and power; NaN without samples.
+ *   percentiles: p50, p90 and p99 per visit of energy and time, or
+ *     `EMA_OUTPUT_NO_PERCENTILE` without histograms.
+ *   measured_visits: Number of visits that read the devices.
+ *   energy_error: Error bound of the extrapolated energy in uJ.
+ *
+ * Records of a snapshot only fill `visits`, `energy` and `time`; in
+ * interval mode they count the window, and `energy` may then be negative
+ * as a `long long` when an extrapolation was refined.
+ */
+typedef struct
+{
+    int thread;
+    const char* idf;
+    const char* file;
+    const char* function;
+    unsigned int line;
+    const Device* device;
+    unsigned long long visits;
+    unsigned long long energy;
+    unsigned long long time;
+    int stale;
+    double moments[EMA_OUTPUT_QUANTITIES][4];
+    unsigned long long percentiles[EMA_OUTPUT_PERCENTILE_QUANTITIES]
+        [EMA_OUTPUT_PERCENTILES];
+    unsigned long long measured_visits;
+    unsigned long long energy_error;
+} OutputRecord;
+
+/* Output sink interface. */
+/**
+ * The `OutputKind` type tells the results at `EMA_finalize` from the
+ * snapshots of the periodic exporter. As a mask it selects what a sink
+ * receives.
+ */
+typedef enum
+{
+    EMA_OUTPUT_RESULTS = 1,
+    EMA_OUTPUT_SNAPSHOTS = 2,
+} OutputKind;
+
+/**
+ * The `OutputInfo` type describes one output passed to the sinks.
+ *
+ * Members:
+ *   kind: `EMA_OUTPUT_RESULTS` or `EMA_OUTPUT_SNAPSHOTS`.
+ *   mode: `ExportMode` of a snapshot.
+ *   snapshot: Number of the snapshot from 1, 0 for the results.
+ *   timestamp: Wall-clock time in us since the epoch.
+ *   window: Time covered by the records of a snapshot in us.
+ */
+typedef struct
+{
+    OutputKind kind;
+    ExportMode mode;
+    unsigned long long snapshot;
+    unsigned long long timestamp;
+    unsigned long long window;
+} OutputInfo;
+
+typedef int (*EMA_sink_cb_begin)(const OutputInfo* info, void* usr);
+typedef int (*EMA_sink_cb_records)(
+    const OutputRecord* records, size_t n, void* usr);
+typedef int (*EMA_sink_cb_end)(int failed, void* usr);
+typedef void (*EMA_sink_cb_finalize)(void* usr);
+
+/**
+ * The `OutputSink` type receives the output of EMA. Each output is one call
+ * of `begin`, a call of `records` per region definition and thread with its
+ * records of all `Device` objects, and one call of `end`. A sink whose
+ * callback fails misses the rest of that output and is reported on stderr;
+ * the other sinks and the files of EMA do not miss anything.
+ *
+ * Members:
+ *   kinds: Mask of the `OutputKind` values to receive.
+ *   begin: Called at the start of an output, may be NULL.
+ *   records: Called with a batch of `n` records.
+ *   end: Called at the end of each output that began, with `failed` set if
+ *     the output is incomplete; may be NULL.
+ *   finalize: Called once in `EMA_finalize` after the results; may be NULL.
+ *   usr: Passed to the callbacks.
+ */
+typedef struct
+{
+    unsigned int kinds;
+    EMA_sink_cb_begin begin;
+    EMA_sink_cb_records records;
+    EMA_sink_cb_end end;
+    EMA_sink_cb_finalize finalize;
+    void* usr;
+} OutputSink;
+
+/**
+ * This function registers an output sink in addition to `output.EMA.<pid>`
+ * and `export.EMA.<pid>`, e.g. from the callback of `EMA_init`. Results are
+ * passed to the sinks in `EMA_finalize`; snapshots on the thread of the
+ * exporter, so the instrumented threads never wait for a sink. A sink
+ * registered during an output receives the next one.
+ *
+ * @param sink: `OutputSink` to copy into the registry.
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_register_output_sink(const OutputSink* sink);
+
+/**
+ * This function sets up a sink that writes CSV like `output.EMA.<pid>`,
+ * with a header per output, to a given file. It receives the results; add
+ * `EMA_OUTPUT_SNAPSHOTS` to its `kinds` for the snapshots as well. The file
+ * stays open; the sink is released by its `finalize` callback.
+ *
+ * @param sink: `OutputSink` to set up.
+ * @param f: Specifies a file to write to.
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_output_sink_csv(OutputSink* sink, FILE* f);
+
+/**
+ * This function sets up a sink that writes the results in the columnar
+ * format of :c:func:`EMA_print_all_columnar` to a given file. A file holds
+ * one output, so it must only receive the results. The file stays open; the
+ * sink is released by its `finalize` callback.
+ *
+ * @param sink: `OutputSink` to set up.
+ * @param f: Specifies a file to write to, opened in binary mode.
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_output_sink_columnar(OutputSink* sink, FILE* f);
+
+#endif
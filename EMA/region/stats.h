@@ -0,0 +1,124 @@
+#ifndef EMA_REGION_STATS_H
+#define EMA_REGION_STATS_H
+
+#include <float.h>
+#include <math.h>
+
+/*
+ * Streaming min/max/mean/variance over the visits of a region (Welford's
+ * algorithm). Constant size, no allocation.
+ */
+typedef struct
+{
+    double min;
+    double max;
+    double mean;
+    double m2;  // sum of squared differences from the mean
+} VisitMoments;
+
+/* Energy (uJ), time (us) and average power (W) per visit. Power is only
+ * defined for visits with a duration, so it keeps its own count. */
+typedef struct
+{
+    unsigned long long n;
+    unsigned long long power_n;
+    VisitMoments energy;
+    VisitMoments time;
+    VisitMoments power;
+} VisitStats;
+
+static inline
+void EMA_visit_moments_init(VisitMoments* moments)
+{
+    moments->min = DBL_MAX;
+    moments->max = -DBL_MAX;
+    moments->mean = 0;
+    moments->m2 = 0;
+}
+
+/* Add `x` as sample number n, `inv_n` is 1/n. */
+static inline
+void EMA_visit_moments_add(VisitMoments* moments, double x, double inv_n)
+{
+    double delta = x - moments->mean;
+    moments->mean += delta * inv_n;
+    moments->m2 += delta * (x - moments->mean);
+    moments->min = x < moments->min ? x : moments->min;
+    moments->max = x > moments->max ? x : moments->max;
+}
+
+/* Sample standard deviation, 0 for less than two samples. */
+static inline
+double EMA_visit_moments_stddev(
+    const VisitMoments* moments, unsigned long long n)
+{
+    return n > 1 ? sqrt(moments->m2 / (n - 1)) : 0;
+}
+
+static inline
+void EMA_visit_stats_init(VisitStats* stats)
+{
+    stats->n = 0;
+    stats->power_n = 0;
+    EMA_visit_moments_init(&stats->energy);
+    EMA_visit_moments_init(&stats->time);
+    EMA_visit_moments_init(&stats->power);
+}
+
+/*
+ * Add a visit. `inv_n` is 1 / (stats->n + 1); it is passed in so that the
+ * measurements of a region, which all count the same visits, share one
+ * division. It also serves the power moments while every visit has a
+ * duration.
+ */
+static inline
+void EMA_visit_stats_add(
+    VisitStats* stats, unsigned long long energy, unsigned long long time,
+    double inv_n)
+{
+    /* Deltas fit into 63 bits; the signed conversion is a single
+     * instruction, the unsigned one is not. */
+    double e = (long long) energy;
+    double t = (long long) time;
+
+    ++stats->n;
+    EMA_visit_moments_add(&stats->energy, e, inv_n);
+    EMA_visit_moments_add(&stats->time, t, inv_n);
+
+    if( time )
+    {
+        if( ++stats->power_n != stats->n )
+            inv_n = 1.0 / stats->power_n;
+        EMA_visit_moments_add(&stats->power, e / t, inv_n);
+    }
+}
+
+/* Combine the moments of `n` and `src_n` samples (Chan et al.). */
+static inline
+void EMA_visit_moments_merge(
+    VisitMoments* moments, unsigned long long n, const VisitMoments* src,
+    unsigned long long src_n)
+{
+    if( src_n == 0 )
+        return;
+
+    double total = (double) n + src_n;
+    double delta = src->mean - moments->mean;
+    moments->mean += delta * src_n / total;
+    moments->m2 += src->m2 + delta * delta * ((double) n * src_n / total);
+    moments->min = src->min < moments->min ? src->min : moments->min;
+    moments->max = src->max > moments->max ? src->max : moments->max;
+}
+
+static inline
+void EMA_visit_stats_merge(VisitStats* stats, const VisitStats* src)
+{
+    EMA_visit_moments_merge(&stats->energy, stats->n, &src->energy, src->n);
+    EMA_visit_moments_merge(&stats->time, stats->n, &src->time, src->n);
+    EMA_visit_moments_merge(
+        &stats->power, stats->power_n, &src->power, src->power_n);
+    stats->n += src->n;
+    stats->power_n += src->power_n;
+}
+
+#endif
@@ -0,0 +1,458 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <EMA/core/device.h>
+#include <EMA/core/registry.h>
+#include <EMA/utils/error.h>
+
+#include "region_store.h"
+#include "trace.h"
+
+#define DEFAULT_RING_EVENTS (1 << 15)
+#define FLUSH_INTERVAL_MS 10
+#define WRITE_BUFFER_SIZE (4 << 20)
+
+#define ALIGN8(size) (((size) + 7) & ~(size_t) 7)
+
+extern PluginRegistry registry;
+
+atomic_int EMA_trace_enabled = 0;
+atomic_uint EMA_trace_session = 0;
+size_t EMA_trace_event_size = 0;
+thread_local TraceRing* EMA_trace_local_ring = NULL;
+
+static struct
+{
+    int fd;
+    TraceFileHeader header;
+    size_t ring_events;
+    _Atomic(TraceRing*) rings;
+    TraceRing* free_rings;  // of exited threads, under `region_mutex`
+
+    /* Flusher; only it touches the write buffer until it is joined. */
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int stop;
+    unsigned char* buffer;
+    size_t buffered;
+    int write_failed;
+
+    /* Region records, written at the end. */
+    pthread_mutex_t region_mutex;
+    unsigned char* regions;
+    size_t region_capacity;
+} trace = {
+    .fd = -1,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .region_mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static
+int write_all(const void* data, size_t size, off_t offset)
+{
+    const char* bytes = data;
+    while( size )
+    {
+        ssize_t ret = pwrite(trace.fd, bytes, size, offset);
+        if( ret < 0 && errno == EINTR )
+            continue;
+        ASSERT_SYS_MSG(ret > 0, 1, "Failed to write trace");
+        bytes += ret;
+        size -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+/* Append the buffered events to the file with one large write. */
+static
+void flush_buffer(void)
+{
+    if( trace.buffered && !trace.write_failed )
+    {
+        off_t offset = trace.header.event_offset
+            + trace.header.num_events * trace.header.event_size
+            - trace.buffered;
+        trace.write_failed = write_all(trace.buffer, trace.buffered, offset);
+    }
+    trace.buffered = 0;
+}
+
+/* Move all published events of all rings into the write buffer. */
+static
+void drain(void)
+{
+    size_t event_size = EMA_trace_event_size;
+    size_t buffer_events = WRITE_BUFFER_SIZE / event_size;
+
+    TraceRing* ring = atomic_load_explicit(&trace.rings, memory_order_acquire);
+    for(; ring; ring = ring->next)
+    {
+        uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        while( tail != head )
+        {
+            uint64_t index = tail & (ring->capacity - 1);
+            uint64_t count = head - tail;
+            uint64_t space = buffer_events - trace.buffered / event_size;
+
+            if( space == 0 )
+            {
+                flush_buffer();
+                continue;
+            }
+            if( count > ring->capacity - index )
+                count = ring->capacity - index;
+            if( count > space )
+                count = space;
+
+            memcpy(trace.buffer + trace.buffered,
+                ring->events + index * event_size, count * event_size);
+            trace.buffered += count * event_size;
+            trace.header.num_events += count;
+            tail += count;
+            atomic_store_explicit(&ring->tail, tail, memory_order_release);
+        }
+    }
+}
+
+static
+uint64_t dropped_events(void)
+{
+    uint64_t dropped = 0;
+    TraceRing* ring = atomic_load_explicit(&trace.rings, memory_order_acquire);
+    for(; ring; ring = ring->next)
+        dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    return dropped;
+}
+
+static
+void* flusher(void* args)
+{
+    pthread_mutex_lock(&trace.mutex);
+    while( !trace.stop )
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_nsec += FLUSH_INTERVAL_MS * 1000000L;
+        if( ts.tv_nsec >= 1000000000L )
+        {
+            ts.tv_sec += 1;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&trace.cond, &trace.mutex, &ts);
+
+        pthread_mutex_unlock(&trace.mutex);
+        drain();
+        pthread_mutex_lock(&trace.mutex);
+    }
+    pthread_mutex_unlock(&trace.mutex);
+    return NULL;
+}
+
+static
+void copy_name(char* dst, const char* src)
+{
+    strncpy(dst, src ? src : "", EMA_TRACE_NAME_SIZE - 1);
+    dst[EMA_TRACE_NAME_SIZE - 1] = '\0';
+}
+
+/* Header and device table; the header is rewritten at the end. */
+static
+int write_prologue(void)
+{
+    size_t num_devices = registry.devices.size;
+    TraceFileHeader* header = &trace.header;
+
+    memset(header, 0, sizeof(TraceFileHeader));
+    memcpy(header->magic, EMA_TRACE_MAGIC, sizeof(header->magic));
+    header->version = EMA_TRACE_VERSION;
+    header->num_devices = num_devices;
+    header->event_size = EMA_trace_event_size;
+    header->region_size =
+        ALIGN8(sizeof(TraceRegion) + sizeof(uint32_t) * num_devices);
+    header->device_offset = ALIGN8(sizeof(TraceFileHeader));
+    header->event_offset = ALIGN8(
+        header->device_offset + sizeof(TraceDevice) * num_devices);
+
+    TraceDevice* devices = calloc(num_devices ? num_devices : 1,
+        sizeof(TraceDevice));
+    ASSERT_OR_1(devices);
+    for(size_t i = 0; i < num_devices; ++i)
+    {
+        const Device* device = registry.devices.array[i];
+        copy_name(devices[i].name, device->name);
+        copy_name(devices[i].uid, device->uid);
+        copy_name(devices[i].type, device->type);
+    }
+
+    int err = write_all(header, sizeof(TraceFileHeader), 0)
+        || write_all(devices, sizeof(TraceDevice) * num_devices,
+            header->device_offset);
+    free(devices);
+    return err;
+}
+
+int EMA_trace_start(size_t ring_events)
+{
+    if( ring_events == 0 )
+        ring_events = DEFAULT_RING_EVENTS;
+    trace.ring_events = 1;
+    while( trace.ring_events < ring_events )
+        trace.ring_events <<= 1;
+
+    EMA_trace_event_size = ALIGN8(
+        sizeof(TraceEvent) + sizeof(uint64_t) * registry.devices.size);
+
+    char* filename;
+    ASSERT_OR_1(asprintf(&filename, "trace.EMA.%u", getpid()) >= 0);
+    trace.fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_SYS_MSG(trace.fd >= 0, 1, "Failed to open '%s'", filename);
+    free(filename);
+
+    trace.buffer = malloc(WRITE_BUFFER_SIZE);
+    ASSERT_OR_1(trace.buffer);
+    memset(trace.buffer, 0, WRITE_BUFFER_SIZE);
+    trace.buffered = 0;
+    trace.write_failed = 0;
+
+    int err = write_prologue();
+    if( err )
+        return err;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&trace.cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    trace.stop = 0;
+    err = pthread_create(&trace.thread, NULL, flusher, NULL);
+    ASSERT_MSG_OR_1(err == 0, "Failed to start the trace flusher.");
+
+    atomic_store(&EMA_trace_enabled, 1);
+    return 0;
+}
+
+/* Called with `region_mutex` held after tracing was disabled. */
+static
+void wait_for_producers(void)
+{
+    TraceRing* ring = atomic_load_explicit(&trace.rings, memory_order_acquire);
+    for(; ring; ring = ring->next)
+        while( atomic_load(&ring->busy) )
+            sched_yield();
+}
+
+/* Called with `region_mutex` held. Running threads still point at their
+ * rings, they retire them in `EMA_trace_ring_create` or on exit. */
+static
+void detach_rings(void)
+{
+    TraceRing* ring = atomic_exchange(&trace.rings, NULL);
+    while( ring )
+    {
+        TraceRing* next = ring->next;
+        free(ring->events);
+        ring->events = NULL;
+        if( ring->exited )
+            free(ring);
+        ring = next;
+    }
+    trace.free_rings = NULL;
+    atomic_fetch_add(&EMA_trace_session, 1);
+}
+
+int EMA_trace_stop(void)
+{
+    if( !atomic_exchange(&EMA_trace_enabled, 0) )
+        return 0;
+
+    /* No ring is created or region added from here on. */
+    pthread_mutex_lock(&trace.region_mutex);
+    wait_for_producers();
+
+    pthread_mutex_lock(&trace.mutex);
+    trace.stop = 1;
+    pthread_cond_signal(&trace.cond);
+    pthread_mutex_unlock(&trace.mutex);
+    pthread_join(trace.thread, NULL);
+    pthread_cond_destroy(&trace.cond);
+
+    drain();
+    flush_buffer();
+
+    TraceFileHeader* header = &trace.header;
+    header->dropped = dropped_events();
+    header->region_offset =
+        header->event_offset + header->num_events * header->event_size;
+
+    int err = trace.write_failed
+        || write_all(trace.regions, header->num_regions * header->region_size,
+            header->region_offset)
+        || write_all(header, sizeof(TraceFileHeader), 0);
+
+    if( header->dropped )
+        ERROR_MSG("EMA trace: %llu events dropped, ring buffers were full.",
+            (unsigned long long) header->dropped);
+
+    detach_rings();
+    free(trace.regions);
+    trace.regions = NULL;
+    trace.region_capacity = 0;
+    pthread_mutex_unlock(&trace.region_mutex);
+
+    free(trace.buffer);
+    trace.buffer = NULL;
+    close(trace.fd);
+    trace.fd = -1;
+    return err;
+}
+
+int EMA_trace_add_region(const Region* region)
+{
+    size_t region_size = trace.header.region_size;
+
+    pthread_mutex_lock(&trace.region_mutex);
+    if( !atomic_load(&EMA_trace_enabled) )
+    {
+        pthread_mutex_unlock(&trace.region_mutex);
+        return 0;
+    }
+
+    if( trace.header.num_regions == trace.region_capacity )
+    {
+        size_t capacity =
+            trace.region_capacity ? 2 * trace.region_capacity : 64;
+        unsigned char* regions = realloc(trace.regions, capacity * region_size);
+        if( !regions )
+        {
+            pthread_mutex_unlock(&trace.region_mutex);
+            ERROR_MSG("Failed to grow trace region table.");
+            return 1;
+        }
+        trace.regions = regions;
+        trace.region_capacity = capacity;
+    }
+
+    TraceRegion* record = (TraceRegion*) (
+        trace.regions + trace.header.num_regions++ * region_size);
+    memset(record, 0, region_size);
+    record->id = region->id;
+    record->size = region->measurements.size;
+    record->line = region->line;
+    copy_name(record->idf, region->idf);
+    copy_name(record->function, region->function);
+
+    for(size_t i = 0; i < region->measurements.size; ++i)
+        for(size_t j = 0; j < registry.devices.size; ++j)
+            if( registry.devices.array[j] == region->devices[i] )
+                record->devices[i] = j;
+    pthread_mutex_unlock(&trace.region_mutex);
+    return 0;
+}
+
+/* Called with `region_mutex` held. */
+static
+TraceRing* reuse_ring(void)
+{
+    /* A ring of an exited thread has no producer left. */
+    TraceRing* ring = trace.free_rings;
+    if( ring )
+    {
+        trace.free_rings = ring->next_free;
+        ring->exited = 0;
+        ring->thread = EMA_thread_get_index();
+        EMA_trace_local_ring = ring;
+    }
+    return ring;
+}
+
+TraceRing* EMA_trace_ring_create(void)
+{
+    if( EMA_thread_init() != 0 )
+        return NULL;
+
+    pthread_mutex_lock(&trace.region_mutex);
+    /* The ring of this thread from an earlier trace was detached by
+     * `EMA_trace_stop`. */
+    free(EMA_trace_local_ring);
+    EMA_trace_local_ring = NULL;
+    int enabled = atomic_load(&EMA_trace_enabled);
+    TraceRing* ring = enabled ? reuse_ring() : NULL;
+    pthread_mutex_unlock(&trace.region_mutex);
+    if( ring || !enabled )
+        return ring;
+
+    ring = aligned_alloc(alignof(TraceRing), sizeof(TraceRing));
+    ASSERT_MSG_OR_NULL(ring, "Failed to allocate a trace ring.");
+    memset(ring, 0, sizeof(TraceRing));
+
+    ring->events = malloc(trace.ring_events * EMA_trace_event_size);
+    if( !ring->events )
+    {
+        free(ring);
+        ERROR_MSG("Failed to allocate a trace ring.");
+        return NULL;
+    }
+    /* Fault the pages in now rather than on the first lap of events. */
+    memset(ring->events, 0, trace.ring_events * EMA_trace_event_size);
+    ring->capacity = trace.ring_events;
+    ring->thread = EMA_thread_get_index();
+
+    /* Published under the mutex, so `EMA_trace_stop` sees every ring of
+     * its session. */
+    pthread_mutex_lock(&trace.region_mutex);
+    if( !atomic_load(&EMA_trace_enabled) )
+    {
+        pthread_mutex_unlock(&trace.region_mutex);
+        free(ring->events);
+        free(ring);
+        return NULL;
+    }
+    ring->session = atomic_load(&EMA_trace_session);
+    ring->next = atomic_load(&trace.rings);
+    atomic_store_explicit(&trace.rings, ring, memory_order_release);
+    pthread_mutex_unlock(&trace.region_mutex);
+
+    EMA_trace_local_ring = ring;
+    return ring;
+}
+
+void EMA_trace_release_ring(void)
+{
+    TraceRing* ring = EMA_trace_local_ring;
+    if( !ring )
+        return;
+
+    /* Kept for the next thread while it is part of the running trace. */
+    EMA_trace_local_ring = NULL;
+    pthread_mutex_lock(&trace.region_mutex);
+    if( ring->session == atomic_load(&EMA_trace_session) )
+    {
+        ring->exited = 1;
+        ring->next_free = trace.free_rings;
+        trace.free_rings = ring;
+        ring = NULL;
+    }
+    pthread_mutex_unlock(&trace.region_mutex);
+    free(ring);
+}
+
+unsigned long long EMA_trace_get_dropped(void)
+{
+    pthread_mutex_lock(&trace.region_mutex);
+    unsigned long long dropped = atomic_load(&EMA_trace_enabled)
+        ? dropped_events() : trace.header.dropped;
+    pthread_mutex_unlock(&trace.region_mutex);
+    return dropped;
+}
@@ -0,0 +1,108 @@
+#ifndef EMA_REGION_TRACE_H
+#define EMA_REGION_TRACE_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <threads.h>
+
+#include <EMA/utils/time.h>
+
+#include "region.h"
+#include "trace.user.h"
+
+/* Environment variables: enable tracing, events per thread ring buffer. */
+#define EMA_TRACE "EMA_TRACE"
+#define EMA_TRACE_RING "EMA_TRACE_RING"
+
+/*
+ * Single-producer single-consumer ring of fixed-size events. The owning
+ * thread appends at `head`, the flusher consumes up to `head` and publishes
+ * `tail`. Both live on their own cache line. A full ring drops the event.
+ *
+ * `EMA_trace_stop` waits until no producer is `busy` and frees the events.
+ * The ring itself stays with a running thread, which retires it when it
+ * finds it belongs to an earlier `session` or when it exits.
+ */
+typedef struct TraceRing
+{
+    alignas(64) _Atomic uint64_t head;
+    uint64_t cached_tail;  // producer's last view of `tail`
+    _Atomic uint64_t dropped;
+    atomic_int busy;  // while the producer appends
+
+    alignas(64) _Atomic uint64_t tail;
+
+    uint64_t capacity;  // events, a power of two
+    uint32_t thread;
+    unsigned int session;
+    int exited;  // its thread is gone, under the region mutex
+    unsigned char* events;
+    struct TraceRing* next;
+    struct TraceRing* next_free;  // while its thread is gone
+} TraceRing;
+
+/* Set while tracing. The session counts the stopped traces. */
+extern atomic_int EMA_trace_enabled;
+extern atomic_uint EMA_trace_session;
+extern size_t EMA_trace_event_size;
+extern thread_local TraceRing* EMA_trace_local_ring;
+
+int EMA_trace_start(size_t ring_events);
+int EMA_trace_stop(void);
+int EMA_trace_add_region(const Region* region);
+TraceRing* EMA_trace_ring_create(void);
+void EMA_trace_release_ring(void);  // on thread exit
+
+/* Append an event of `region` with the energy of its devices. */
+static inline
+void EMA_trace_record(
+    const Region* region, TraceEventType type,
+    const unsigned long long* energy)
+{
+    TraceRing* ring = EMA_trace_local_ring;
+    if( (!ring || ring->session != atomic_load_explicit(
+            &EMA_trace_session, memory_order_relaxed))
+        && !(ring = EMA_trace_ring_create()) )
+        return;
+
+    /* Pairs with `EMA_trace_stop`: either it sees the ring busy or the
+     * producer sees tracing disabled. */
+    atomic_store(&ring->busy, 1);
+    if( !atomic_load(&EMA_trace_enabled) )
+    {
+        atomic_store_explicit(&ring->busy, 0, memory_order_release);
+        return;
+    }
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if( head - ring->cached_tail == ring->capacity )
+    {
+        ring->cached_tail =
+            atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if( head - ring->cached_tail == ring->capacity )
+        {
+            atomic_store_explicit(&ring->dropped,
+                atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1,
+                memory_order_relaxed);
+            atomic_store_explicit(&ring->busy, 0, memory_order_release);
+            return;
+        }
+    }
+
+    TraceEvent* event = (TraceEvent*) (ring->events
+        + (head & (ring->capacity - 1)) * EMA_trace_event_size);
+    event->time_ns = EMA_get_time_in_ns();
+    event->region_id = region->id;
+    event->thread = ring->thread;
+    event->type = type;
+    event->size = region->measurements.size;
+    memcpy(event->energy, energy, sizeof(uint64_t) * event->size);
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    atomic_store_explicit(&ring->busy, 0, memory_order_release);
+}
+
+#endif
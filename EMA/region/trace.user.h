@@ -0,0 +1,123 @@
+#ifndef EMA_REGION_TRACE_USER_H
+#define EMA_REGION_TRACE_USER_H
+
+#include <stdint.h>
+
+/* Trace file format. */
+/*
+ * A trace file (`trace.EMA.<pid>`) consists of fixed-size records that can
+ * be used in place after mapping the file into memory:
+ *
+ *     TraceFileHeader
+ *     TraceDevice[num_devices]                at device_offset
+ *     event records, event_size bytes each    at event_offset
+ *     region records, region_size bytes each  at region_offset
+ *
+ * All integers are in host byte order and all records are 8-byte aligned.
+ * Events of one thread are in order; threads are interleaved in chunks.
+ */
+#define EMA_TRACE_MAGIC "EMATRACE"
+#define EMA_TRACE_VERSION 1
+#define EMA_TRACE_NAME_SIZE 64
+
+/**
+ * Kind of a `TraceEvent`.
+ */
+typedef enum
+{
+    EMA_TRACE_BEGIN,
+    EMA_TRACE_END,
+} TraceEventType;
+
+/**
+ * The `TraceFileHeader` type is at the start of a trace file. `num_events`
+ * is 0 and `dropped` incomplete while the traced process runs.
+ */
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t num_devices;
+    uint32_t event_size;
+    uint32_t region_size;
+    uint64_t device_offset;
+    uint64_t event_offset;
+    uint64_t num_events;
+    uint64_t region_offset;
+    uint64_t num_regions;
+    uint64_t dropped;  // events lost to full ring buffers
+} TraceFileHeader;
+
+/**
+ * The `TraceDevice` type describes a `Device`; events refer to it by its
+ * index.
+ */
+typedef struct
+{
+    char name[EMA_TRACE_NAME_SIZE];
+    char uid[EMA_TRACE_NAME_SIZE];
+    char type[EMA_TRACE_NAME_SIZE];
+} TraceDevice;
+
+/**
+ * The `TraceEvent` type is a begin or end of a measured `Region` visit.
+ * `energy` holds the raw energy counters in micro joules of the `size`
+ * devices of the region, in the order of `TraceRegion.devices`.
+ */
+typedef struct
+{
+    uint64_t time_ns;  // CLOCK_MONOTONIC
+    uint64_t region_id;
+    uint32_t thread;
+    uint16_t type;
+    uint16_t size;
+    uint64_t energy[];
+} TraceEvent;
+
+/**
+ * The `TraceRegion` type maps a region id to its identifier and devices.
+ */
+typedef struct
+{
+    uint64_t id;
+    uint32_t size;
+    uint32_t line;
+    char idf[EMA_TRACE_NAME_SIZE];
+    char function[EMA_TRACE_NAME_SIZE];
+    uint32_t devices[];  // indices into the TraceDevice table
+} TraceRegion;
+
+/**
+ * This function returns the event record `i` of a mapped trace file.
+ */
+static inline
+const TraceEvent* EMA_trace_file_event(
+    const TraceFileHeader* header, uint64_t i)
+{
+    return (const TraceEvent*) (
+        (const char*) header + header->event_offset + i * header->event_size);
+}
+
+/**
+ * This function returns the region record `i` of a mapped trace file.
+ */
+static inline
+const TraceRegion* EMA_trace_file_region(
+    const TraceFileHeader* header, uint64_t i)
+{
+    return (const TraceRegion*) (
+        (const char*) header + header->region_offset
+        + i * header->region_size);
+}
+
+/* Tracing interface. */
+/**
+ * This function returns the number of trace events lost so far because a
+ * thread's ring buffer was full. Events are dropped rather than blocking the
+ * application; the total is also stored in the trace file.
+ *
+ * @returns Number of dropped events, 0 if tracing is disabled.
+ */
+unsigned long long EMA_trace_get_dropped(void);
+
+#endif
@@ -1,14 +1,26 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include <unistd.h>
 
+#include <EMA/core/executor.h>
+#include <EMA/core/guard.h>
+#include <EMA/core/overflow.h>
 #include <EMA/core/registry.h>
 #ifdef EMA_HAVE_NVML
     #include <EMA/plugins/plugin_nvml.h>
 #endif
 #include <EMA/plugins/plugin_rapl.h>
+#include <EMA/region/export.h>
+#include <EMA/region/histogram.h>
+#include <EMA/region/metrics.h>
 #include <EMA/region/output.h>
 #include <EMA/region/region_store.h>
+#include <EMA/region/sampling.h>
+#include <EMA/region/shared.h>
+#include <EMA/region/sink.h>
+#include <EMA/region/trace.h>
+#include <EMA/utils/intern.h>
 
 #include "user.h"
 
@@ -29,7 +41,36 @@ int EMA_print_results(void)
     if( !f )
         return 1;
 
-    ret = EMA_print_all(f);
+    /* The file and the registered sinks get the results in one pass. */
+    OutputSink sink;
+    const char* format = getenv(EMA_OUTPUT);
+    if( format && strcmp(format, "columnar") == 0 )
+        ret = EMA_output_sink_columnar(&sink, f);
+    else
+        ret = EMA_output_sink_csv(&sink, f);
+    if( ret == 0 )
+    {
+        ret = EMA_output_results(&sink, 1);
+        sink.finalize(sink.usr);
+    }
+    ret = fclose(f) != 0 || ret;
+    if( ret != 0 )
+        return ret;
+
+    const char* calltree = getenv(EMA_CALLTREE);
+    if( !calltree || strcmp(calltree, "0") == 0 )
+        return 0;
+
+    ret = asprintf(&filename, "calltree.EMA.%u", getpid());
+    if( ret == -1 )
+        return 1;
+
+    f = fopen(filename, "w");
+    free(filename);
+    if( !f )
+        return 1;
+
+    ret = EMA_print_calltree(f);
     fclose(f);
     if( ret != 0 )
         return ret;
@@ -53,6 +94,22 @@ int EMA_init(EMA_init_cb callback)
     if( err )
         return err;
 
+    const char* histogram = getenv(EMA_HISTOGRAM);
+    if( histogram )
+    {
+        err = EMA_histogram_configure_from_string(histogram);
+        if( err )
+            return err;
+    }
+
+    const char* sampling = getenv(EMA_SAMPLING);
+    if( sampling )
+    {
+        err = EMA_sampling_configure_from_string(sampling);
+        if( err )
+            return err;
+    }
+
     if( callback )
     {
         int err = callback();
@@ -79,23 +136,82 @@ int EMA_init(EMA_init_cb callback)
         Plugin *plugin = registry.plugins.array[i];
         DeviceArray devices = plugin->cbs.get_devices(plugin);
         for(size_t j = 0; j < devices.size; ++j)
+        {
+            devices.array[j].guard = NULL;
             registry.devices.array[k++] = &devices.array[j];
+        }
     }
 
     err = start_overflow_tracking(&registry.devices);
     if( err )
         return err;
 
+    const char* workers = getenv(EMA_READ_WORKERS);
+    if( workers )
+    {
+        err = EMA_executor_start(strtoul(workers, NULL, 10));
+        if( err )
+            return err;
+    }
+
+    const char* deadlines = getenv(EMA_READ_DEADLINE_US);
+    for(size_t i = 0; deadlines && i < registry.plugins.size; ++i)
+    {
+        const Plugin* plugin = registry.plugins.array[i];
+        uint64_t deadline = EMA_guard_parse_deadline(deadlines, plugin->name);
+        if( deadline == 0 )
+            continue;
+
+        err = EMA_plugin_set_read_deadline(plugin, deadline);
+        if( err )
+            return err;
+    }
+
+    const char* trace = getenv(EMA_TRACE);
+    if( trace && strcmp(trace, "0") != 0 )
+    {
+        const char* ring = getenv(EMA_TRACE_RING);
+        err = EMA_trace_start(ring ? strtoul(ring, NULL, 10) : 0);
+        if( err )
+            return err;
+    }
+
+    const char* export = getenv(EMA_EXPORT);
+    if( export )
+    {
+        err = EMA_export_start_from_string(export);
+        if( err )
+            return err;
+    }
+
+    const char* address = getenv(EMA_METRICS);
+    if( address )
+    {
+        err = EMA_metrics_start(address);
+        if( err )
+            return err;
+    }
+
     return 0;
 }
 
+/* A failing step, e.g. of an optional output file, neither keeps the results
+ * from being written nor the services from being stopped. */
 int EMA_finalize(void)
 {
-    int ret = EMA_print_results();
-    if( ret != 0 )
-        return ret;
+    int ret = EMA_export_stop();
+    ret = EMA_metrics_stop() || ret;
+
+    ret = EMA_print_results() || ret;
+    EMA_output_sinks_finalize();
+
+    ret = EMA_trace_stop() || ret;
 
     stop_overflow_tracking();
+    EMA_executor_stop();
+
+    for(size_t i = 0; i < registry.devices.size; ++i)
+        EMA_guard_destroy(registry.devices.array[i]);
 
     for(int i = 0; i < registry.plugins.size; ++i)
     {
@@ -110,7 +226,10 @@ int EMA_finalize(void)
     if( registry.devices.array )
         free(registry.devices.array);
 
-    return EMA_region_stores_finalize();
+    ret = EMA_region_stores_finalize() || ret;
+    EMA_shared_regions_finalize();
+    EMA_intern_finalize();
+    return ret;
 }
 
 
@@ -141,6 +260,35 @@ unsigned long long EMA_plugin_get_energy_uj(const Device* device)
     return EMA_get_handled_energy_uj(device);
 }
 
+int EMA_plugin_get_energy_uj_batch(
+    const Device** devices,
+    size_t n,
+    unsigned long long* energy_uj,
+    uint64_t* time_us
+) {
+    return EMA_executor_read_batch(devices, n, energy_uj, time_us, NULL);
+}
+
+int EMA_plugin_set_read_deadline(
+    const Plugin* plugin,
+    unsigned long long deadline_us
+) {
+    Device* devices[registry.devices.size + 1];
+    size_t n = 0;
+    for(size_t i = 0; i < registry.devices.size; ++i)
+        if( registry.devices.array[i]->plugin == plugin )
+            devices[n++] = registry.devices.array[i];
+
+    if( n == 0 )
+        return 0;
+
+    EMA_guard_destroy(devices[0]);
+    if( deadline_us == 0 )
+        return 0;
+
+    return EMA_guard_create(devices, n, deadline_us);
+}
+
 int EMA_plugin_finalize(Plugin* plugin)
 {
     return plugin->cbs.finalize(plugin);
@@ -1,12 +1,19 @@
 #ifndef EMA_USER_H
 #define EMA_USER_H
 
+#include <stdint.h>
 #include <threads.h>
 
 #include <EMA/core/device.user.h>
 #include <EMA/core/plugin.user.h>
+#include <EMA/region/columnar.user.h>
+#include <EMA/region/export.user.h>
+#include <EMA/region/metrics.user.h>
 #include <EMA/region/output.user.h>
 #include <EMA/region/region.user.h>
+#include <EMA/region/shared.user.h>
+#include <EMA/region/sink.user.h>
+#include <EMA/region/trace.user.h>
 #include <EMA/utils/time.user.h>
 
 /**
@@ -29,7 +36,11 @@ typedef int (*EMA_init_cb)(void);
 int EMA_init(EMA_init_cb);
 
 /**
- * This function finalizes the EMA framework.
+ * This function finalizes the EMA framework. It writes the results and
+ * stops all services even if a step fails, e.g. the last snapshot of the
+ * exporter.
+ *
+ * @returns 0 on success or another value if any step failed.
  */
 int EMA_finalize(void);
 
@@ -71,6 +82,44 @@ unsigned long long EMA_get_energy_uj(const Device* device);
  */
 unsigned long long EMA_plugin_get_energy_uj(const Device* device);
 
+/**
+ * This function reads the current energy values of several `Devices`. Each
+ * run of consecutive `Devices` of a `Plugin` is queried once, so a `Plugin`
+ * whose `Devices` are interleaved with others is queried once per run.
+ * `Devices` in the order of the registry, which the built-in filters keep,
+ * are already grouped by `Plugin`.
+ *
+ * @param devices: `Devices` from which the energy values are to be read.
+ * @param n: Number of elements in `devices`.
+ * @param energy_uj: Receives the energy value in micro joules per `Device`.
+ * @param time_us: Receives the sample time in micro seconds per `Device`.
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_plugin_get_energy_uj_batch(
+    const Device** devices,
+    size_t n,
+    unsigned long long* energy_uj,
+    uint64_t* time_us
+);
+
+/**
+ * This function bounds the time a read of the `Devices` of a given `Plugin`
+ * may take. Reads exceeding the deadline return the last good value and
+ * mark the `Measurement` as stale. After repeated failures the `Devices` are
+ * only probed in the background until they respond within the deadline
+ * again. Must not be called while regions are measured.
+ *
+ * @param plugin: `Plugin` whose reads are to be bounded.
+ * @param deadline_us: Deadline in micro seconds, 0 removes the deadline.
+ *
+ * @returns 0 on success or another value to indicate an error.
+ */
+int EMA_plugin_set_read_deadline(
+    const Plugin* plugin,
+    unsigned long long deadline_us
+);
+
 /**
  * This function finalizes a given `Plugin`.
  *
@@ -0,0 +1,87 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "error.h"
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+void EMA_arena_init(Arena* arena)
+{
+    arena->chunks = NULL;
+    arena->allocated = 0;
+}
+
+static
+ArenaChunk* chunk_create(size_t size)
+{
+    ArenaChunk* chunk = aligned_alloc(
+        _Alignof(ArenaChunk), sizeof(ArenaChunk) + size);
+    ASSERT_MSG_OR_NULL(chunk, "Failed to allocate arena chunk.");
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+/* `alignment` must be a power of two of at most 64. */
+void* EMA_arena_alloc(Arena* arena, size_t size, size_t alignment)
+{
+    ArenaChunk* chunk = arena->chunks;
+    size_t offset = 0;
+    if( chunk )
+        offset = (chunk->used + alignment - 1) & ~(alignment - 1);
+
+    if( !chunk || offset + size > chunk->size )
+    {
+        /* Large blocks get a chunk of their own behind the current one. */
+        if( size > ARENA_CHUNK_SIZE / 4 )
+        {
+            ArenaChunk* large = chunk_create(size);
+            ASSERT_OR_NULL(large);
+            large->used = size;
+            if( chunk )
+            {
+                large->next = chunk->next;
+                chunk->next = large;
+            }
+            else
+            {
+                large->next = NULL;
+                arena->chunks = large;
+            }
+            arena->allocated += size;
+            return large->data;
+        }
+
+        chunk = chunk_create(ARENA_CHUNK_SIZE);
+        ASSERT_OR_NULL(chunk);
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        offset = 0;
+    }
+
+    chunk->used = offset + size;
+    arena->allocated += size;
+    return chunk->data + offset;
+}
+
+void* EMA_arena_calloc(Arena* arena, size_t size, size_t alignment)
+{
+    void* data = EMA_arena_alloc(arena, size, alignment);
+    if( data )
+        memset(data, 0, size);
+    return data;
+}
+
+void EMA_arena_finalize(Arena* arena)
+{
+    ArenaChunk* chunk = arena->chunks;
+    while( chunk )
+    {
+        ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    EMA_arena_init(arena);
+}
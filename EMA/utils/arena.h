@@ -0,0 +1,29 @@
+#ifndef EMA_UTILS_ARENA_H
+#define EMA_UTILS_ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Bump allocator over a list of chunks. Memory is released all at once by
+ * `EMA_arena_finalize`. Not thread-safe; each thread uses its own arena.
+ */
+typedef struct ArenaChunk
+{
+    struct ArenaChunk* next;
+    size_t size;
+    size_t used;
+    _Alignas(64) unsigned char data[];
+} ArenaChunk;
+
+typedef struct
+{
+    ArenaChunk* chunks;  // the current chunk first
+    size_t allocated;  // bytes handed out
+} Arena;
+
+void EMA_arena_init(Arena* arena);
+void* EMA_arena_alloc(Arena* arena, size_t size, size_t alignment);
+void* EMA_arena_calloc(Arena* arena, size_t size, size_t alignment);
+void EMA_arena_finalize(Arena* arena);
+
+#endif
@@ -0,0 +1,141 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "format.h"
+
+/* Powers of ten that are exact doubles. */
+static const double POW10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+#define MAX_POW10 22
+
+char* EMA_format_u64(char* out, unsigned long long value)
+{
+    char digits[20];
+    char* end = digits + sizeof(digits);
+    char* p = end;
+    do
+    {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while( value );
+    memcpy(out, p, end - p);
+    return out + (end - p);
+}
+
+/* `value` scaled to six digits before the point, by one exactly rounded
+ * multiplication or division; 0 if out of the exact powers of ten. */
+static
+int scale(double value, int exponent, double* scaled)
+{
+    int shift = 5 - exponent;
+    if( shift > MAX_POW10 || -shift > MAX_POW10 )
+        return 0;
+    *scaled = shift >= 0 ? value * POW10[shift] : value / POW10[-shift];
+    return 1;
+}
+
+static
+char* fallback(char* out, double value)
+{
+    char text[32];
+    int length = snprintf(text, sizeof(text), "%.6g", value);
+    memcpy(out, text, length);
+    return out + length;
+}
+
+/*
+ * Six significant digits, rounded once from the scaled value. The scaling
+ * is off by at most half an ulp, so the rounding can only differ from that
+ * of the exact value close to a tie; those values take the slow path.
+ */
+char* EMA_format_g6(char* out, double value)
+{
+    if( !isfinite(value) )
+        return fallback(out, value);
+    if( signbit(value) )
+    {
+        *out++ = '-';
+        value = -value;
+    }
+    if( value == 0 )
+    {
+        *out++ = '0';
+        return out;
+    }
+
+    int exponent = (int) floor(log10(value));
+    double scaled;
+    if( !scale(value, exponent, &scaled) )
+        return fallback(out, value);
+    if( scaled < 100000 )
+    {
+        --exponent;
+        if( !scale(value, exponent, &scaled) )
+            return fallback(out, value);
+    }
+    else if( scaled >= 1000000 )
+    {
+        ++exponent;
+        if( !scale(value, exponent, &scaled) )
+            return fallback(out, value);
+    }
+    if( fabs(scaled - floor(scaled) - 0.5) < 1e-6 )
+        return fallback(out, value);
+
+    unsigned long mantissa = (unsigned long) nearbyint(scaled);
+    if( mantissa == 1000000 )
+    {
+        mantissa = 100000;
+        ++exponent;
+    }
+
+    char digits[6];
+    for(int i = 5; i >= 0; --i)
+    {
+        digits[i] = '0' + mantissa % 10;
+        mantissa /= 10;
+    }
+    int significant = 6;
+    while( significant > 1 && digits[significant - 1] == '0' )
+        --significant;
+
+    if( exponent < -4 || exponent >= 6 )
+    {
+        *out++ = digits[0];
+        if( significant > 1 )
+        {
+            *out++ = '.';
+            memcpy(out, digits + 1, significant - 1);
+            out += significant - 1;
+        }
+        *out++ = 'e';
+        *out++ = exponent < 0 ? '-' : '+';
+        int magnitude = exponent < 0 ? -exponent : exponent;
+        if( magnitude < 10 )
+            *out++ = '0';
+        return EMA_format_u64(out, magnitude);
+    }
+
+    if( exponent < 0 )
+    {
+        memcpy(out, "0.", 2);
+        out += 2;
+        memset(out, '0', -exponent - 1);
+        out += -exponent - 1;
+        memcpy(out, digits, significant);
+        return out + significant;
+    }
+
+    memcpy(out, digits, exponent + 1);
+    out += exponent + 1;
+    if( significant > exponent + 1 )
+    {
+        *out++ = '.';
+        memcpy(out, digits + exponent + 1, significant - exponent - 1);
+        out += significant - exponent - 1;
+    }
+    return out;
+}
@@ -0,0 +1,16 @@
+#ifndef EMA_UTILS_FORMAT_H
+#define EMA_UTILS_FORMAT_H
+
+/*
+ * Number formatting for bulk output, without the parsing of a format
+ * string. Each function writes at `out`, without a terminating NUL, and
+ * returns the end of what it wrote.
+ */
+
+/* Decimal digits, at most 20 bytes. */
+char* EMA_format_u64(char* out, unsigned long long value);
+
+/* The same as `sprintf(out, "%.6g", value)`, at most 13 bytes. */
+char* EMA_format_g6(char* out, double value);
+
+#endif
@@ -0,0 +1,60 @@
+#include <string.h>
+
+#include <pthread.h>
+
+#include <EMA/ext/c-hashmap/map.h>
+
+#include "arena.h"
+#include "error.h"
+#include "intern.h"
+
+static pthread_mutex_t intern_mutex = PTHREAD_MUTEX_INITIALIZER;
+static hashmap* strings = NULL;
+static Arena arena = { .chunks = NULL, .allocated = 0 };
+
+const char* EMA_intern(const char* str)
+{
+    size_t length = strlen(str);
+    uintptr_t value;
+    const char* interned = NULL;
+
+    pthread_mutex_lock(&intern_mutex);
+    if( !strings )
+        strings = hashmap_create();
+
+    if( strings && hashmap_get(strings, str, length, &value) )
+        interned = (const char*) value;
+    else if( strings )
+    {
+        char* copy = EMA_arena_alloc(&arena, length + 1, 1);
+        if( copy )
+        {
+            memcpy(copy, str, length + 1);
+            hashmap_set(strings, copy, length, (uintptr_t) copy);
+            interned = copy;
+        }
+    }
+    pthread_mutex_unlock(&intern_mutex);
+
+    if( !interned )
+        ERROR_MSG("Failed to intern string '%s'.", str);
+    return interned;
+}
+
+size_t EMA_intern_size(void)
+{
+    pthread_mutex_lock(&intern_mutex);
+    size_t size = arena.allocated;
+    pthread_mutex_unlock(&intern_mutex);
+    return size;
+}
+
+void EMA_intern_finalize(void)
+{
+    pthread_mutex_lock(&intern_mutex);
+    if( strings )
+        hashmap_free(strings);
+    strings = NULL;
+    EMA_arena_finalize(&arena);
+    pthread_mutex_unlock(&intern_mutex);
+}
@@ -0,0 +1,14 @@
+#ifndef EMA_UTILS_INTERN_H
+#define EMA_UTILS_INTERN_H
+
+#include <stddef.h>
+
+/*
+ * Process-wide table of immutable strings. Equal strings share one copy,
+ * which stays valid until `EMA_intern_finalize`.
+ */
+const char* EMA_intern(const char* str);
+size_t EMA_intern_size(void);  // bytes of all interned strings
+void EMA_intern_finalize(void);
+
+#endif
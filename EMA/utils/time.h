@@ -1,6 +1,17 @@
 #ifndef EMA_UTILS_TIME_H
 #define EMA_UTILS_TIME_H
 
+#include <stdint.h>
+
 #include "time.user.h"
 
+/* Current monotonic time in nano seconds, inline for hot paths. */
+static inline
+uint64_t EMA_get_time_in_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 #endif
@@ -0,0 +1,125 @@
+/*
+ * Throughput of the result output with many threads, regions and devices,
+ * written to /dev/null so formatting dominates:
+ *
+ *   csv:      `EMA_print_all`, the CSV of `output.EMA.<pid>`,
+ *   columnar: `EMA_print_all_columnar`.
+ *
+ * Usage: csv_output [threads] [regions per thread] [devices] [repetitions]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include <EMA.h>
+#include <EMA/plugins/plugin_mock.user.h>
+
+#define DEFAULT_THREADS 64
+#define DEFAULT_REGIONS 500
+#define DEFAULT_DEVICES 8
+#define DEFAULT_REPETITIONS 3
+#define VISITS 3
+
+static unsigned int num_devices;
+static long num_regions;
+static Filter* filter;
+static pthread_barrier_t barrier;
+
+static
+double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static
+int register_mock(void)
+{
+    MockPluginConfig config = {
+        .num_devices = num_devices,
+        .power_model = MOCK_POWER_RAMP,
+        .power_w = 1.0,
+    };
+    return register_mock_plugin("MOCK", &config);
+}
+
+/* Define and visit the regions, then stay alive until the output is done. */
+static
+void* worker(void* arg)
+{
+    char idf[32];
+    for(long i = 0; i < num_regions; ++i)
+    {
+        Region* region = NULL;
+        snprintf(idf, sizeof(idf), "region-%ld", i);
+        EMA_region_define(&region, idf, filter, "bench/csv_output.c", i,
+            "worker");
+        for(int j = 0; j < VISITS; ++j)
+        {
+            EMA_region_begin(region);
+            EMA_region_end(region);
+        }
+    }
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+    return NULL;
+}
+
+static
+double rows_per_s(int (*print)(FILE*), long repetitions, double rows)
+{
+    double best = 0;
+    for(long i = 0; i < repetitions; ++i)
+    {
+        FILE* f = fopen("/dev/null", "w");
+        double start = now_s();
+        print(f);
+        fclose(f);
+        double rate = rows / (now_s() - start);
+        if( rate > best )
+            best = rate;
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    int num_threads = argc > 1 ? atoi(argv[1]) : DEFAULT_THREADS;
+    num_regions = argc > 2 ? atol(argv[2]) : DEFAULT_REGIONS;
+    num_devices = argc > 3 ? atoi(argv[3]) : DEFAULT_DEVICES;
+    long repetitions = argc > 4 ? atol(argv[4]) : DEFAULT_REPETITIONS;
+
+    int err = EMA_init(register_mock);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+    filter = EMA_filter_exclude_plugin("RAPL");
+
+    pthread_t* threads = malloc(sizeof(pthread_t) * num_threads);
+    pthread_barrier_init(&barrier, NULL, num_threads + 1);
+    for(int i = 0; i < num_threads; ++i)
+        pthread_create(threads + i, NULL, worker, NULL);
+    pthread_barrier_wait(&barrier);
+
+    double rows = (double) num_threads * num_regions * num_devices;
+    printf("format,threads,regions,devices,rows,rows_per_s\n");
+    printf("csv,%d,%ld,%u,%.0f,%.0f\n", num_threads, num_regions,
+        num_devices, rows, rows_per_s(EMA_print_all, repetitions, rows));
+    printf("columnar,%d,%ld,%u,%.0f,%.0f\n", num_threads, num_regions,
+        num_devices, rows,
+        rows_per_s(EMA_print_all_columnar, repetitions, rows));
+
+    pthread_barrier_wait(&barrier);
+    for(int i = 0; i < num_threads; ++i)
+        pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&barrier);
+    free(threads);
+
+    EMA_filter_finalize(filter);
+    return EMA_finalize();
+}
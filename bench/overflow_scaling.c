@@ -0,0 +1,116 @@
+/*
+ * Scaling of `EMA_region_begin`/`EMA_region_end` with 1 to 64 threads that
+ * all measure the same device while the overflow thread keeps publishing its
+ * wrap state.
+ *
+ * Usage: overflow_scaling [iterations per thread] [max threads]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include <EMA.h>
+#include <EMA/core/plugin.h>
+#include <EMA/plugins/plugin_mock.user.h>
+
+#define PLUGIN_NAME "MOCK"
+#define DEFAULT_ITERATIONS 100000
+#define DEFAULT_MAX_THREADS 64
+
+static long iterations;
+static pthread_barrier_t barrier;
+static Filter* filter;
+
+static
+double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* A 1 W device without shared writes on read. The overflow thread samples
+ * it every ms to exercise concurrent publication. */
+static
+int register_bench_plugin(void)
+{
+    MockPluginConfig config = {
+        .num_devices = 1,
+        .power_model = MOCK_POWER_RAMP,
+        .power_w = 1.0,
+        .update_interval_ms = 1,
+    };
+    return register_mock_plugin(PLUGIN_NAME, &config);
+}
+
+static
+DevicePtrArray only_bench_plugin(DevicePtrArray devices, Filter* filter)
+{
+    DevicePtrArray filtered = { .array = malloc(sizeof(Device*)), .size = 0 };
+    for(size_t i = 0; i < devices.size; ++i)
+        if( strcmp(devices.array[i]->plugin->name, PLUGIN_NAME) == 0 )
+            filtered.array[filtered.size++] = devices.array[i];
+    return filtered;
+}
+
+static
+void* worker(void* arg)
+{
+    EMA_REGION_DECLARE(region);
+    EMA_REGION_DEFINE_WITH_FILTER(&region, "bench", filter);
+
+    pthread_barrier_wait(&barrier);
+    for(long i = 0; i < iterations; ++i)
+    {
+        EMA_REGION_BEGIN(region);
+        EMA_REGION_END(region);
+    }
+    pthread_barrier_wait(&barrier);
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    iterations = argc > 1 ? atol(argv[1]) : DEFAULT_ITERATIONS;
+    int max_threads = argc > 2 ? atoi(argv[2]) : DEFAULT_MAX_THREADS;
+
+    int err = EMA_init(register_bench_plugin);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+    filter = EMA_filter_create(only_bench_plugin, NULL);
+
+    printf("threads,pairs_per_s,ns_per_pair_per_thread\n");
+    for(int n = 1; n <= max_threads; n *= 2)
+    {
+        pthread_t threads[DEFAULT_MAX_THREADS];
+        if( n > DEFAULT_MAX_THREADS )
+            break;
+
+        pthread_barrier_init(&barrier, NULL, n + 1);
+        for(int i = 0; i < n; ++i)
+            pthread_create(threads + i, NULL, worker, NULL);
+
+        pthread_barrier_wait(&barrier);
+        double start = now_s();
+        pthread_barrier_wait(&barrier);
+        double elapsed = now_s() - start;
+
+        for(int i = 0; i < n; ++i)
+            pthread_join(threads[i], NULL);
+        pthread_barrier_destroy(&barrier);
+
+        double pairs = (double) n * iterations;
+        printf("%d,%.0f,%.1f\n",
+            n, pairs / elapsed, elapsed * 1e9 / iterations);
+    }
+
+    EMA_filter_finalize(filter);
+    return EMA_finalize();
+}
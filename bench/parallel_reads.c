@@ -0,0 +1,114 @@
+/*
+ * Latency and timestamp skew of one read of all devices, sequential and with
+ * the read executor. Three mock plugins with two devices each take 200 us,
+ * 500 us and 1000 us per (batched) read.
+ *
+ * Usage: parallel_reads [iterations] [workers]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <EMA.h>
+#include <EMA/core/executor.h>
+#include <EMA/core/plugin.h>
+#include <EMA/plugins/plugin_mock.user.h>
+
+#define PLUGIN_PREFIX "SLOW"
+#define NUM_PLUGINS 3
+#define DEVICES_PER_PLUGIN 2
+#define DEFAULT_ITERATIONS 200
+#define DEFAULT_WORKERS 2
+
+static const unsigned int latencies_us[NUM_PLUGINS] = { 200, 500, 1000 };
+static char names[NUM_PLUGINS][16];
+
+static
+int register_slow_plugins(void)
+{
+    for(int i = 0; i < NUM_PLUGINS; ++i)
+    {
+        MockPluginConfig config = {
+            .num_devices = DEVICES_PER_PLUGIN,
+            .read_latency_us = latencies_us[i],
+            .latency_mode = MOCK_LATENCY_SLEEP,
+            .power_model = MOCK_POWER_RAMP,
+            .power_w = 1.0,
+        };
+        snprintf(names[i], sizeof(names[i]), PLUGIN_PREFIX "%d", i);
+
+        int err = register_mock_plugin(names[i], &config);
+        if( err )
+            return err;
+    }
+    return 0;
+}
+
+static
+void run(const char* mode, const Device** devices, size_t n, long iterations)
+{
+    unsigned long long energy[n];
+    uint64_t time[n];
+    double latency = 0;
+    double skew = 0;
+    uint64_t max_skew = 0;
+
+    for(long i = 0; i < iterations; ++i)
+    {
+        uint64_t start = EMA_get_time_in_us();
+        EMA_plugin_get_energy_uj_batch(devices, n, energy, time);
+        latency += EMA_get_time_in_us() - start;
+
+        uint64_t first = time[0], last = time[0];
+        for(size_t j = 1; j < n; ++j)
+        {
+            if( time[j] < first )
+                first = time[j];
+            if( time[j] > last )
+                last = time[j];
+        }
+        skew += last - first;
+        if( last - first > max_skew )
+            max_skew = last - first;
+    }
+
+    printf("%s,%.1f,%.1f,%llu\n", mode, latency / iterations,
+        skew / iterations, (unsigned long long) max_skew);
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : DEFAULT_ITERATIONS;
+    size_t workers = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_WORKERS;
+
+    int err = EMA_init(register_slow_plugins);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+
+    const Device* devices[NUM_PLUGINS * DEVICES_PER_PLUGIN];
+    size_t n = 0;
+    DevicePtrArray all = EMA_get_devices();
+    for(size_t i = 0; i < all.size; ++i)
+    {
+        const Device* device = all.array[i];
+        if( strncmp(device->plugin->name, PLUGIN_PREFIX,
+            strlen(PLUGIN_PREFIX)) == 0 )
+            devices[n++] = device;
+    }
+
+    printf("mode,latency_us,skew_us,max_skew_us\n");
+    run("sequential", devices, n, iterations);
+
+    if( EMA_executor_start(workers) )
+    {
+        printf("Failed to start the read executor.\n");
+        return 1;
+    }
+    run("executor", devices, n, iterations);
+    EMA_executor_stop();
+
+    return EMA_finalize();
+}
@@ -0,0 +1,85 @@
+/*
+ * Compare the per-sample cost of reading a RAPL energy file with
+ * `fopen`/`fgets`/`fclose` (former RAPL plugin path) against a persistent
+ * descriptor read with `pread` (current RAPL plugin path).
+ *
+ * Usage: rapl_read [energy_uj file] [iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define RAPL_MAX 128
+#define DEFAULT_FILE "/sys/class/powercap/intel-rapl/intel-rapl:0/energy_uj"
+#define DEFAULT_ITERATIONS 200000
+
+static
+double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static
+unsigned long long read_stdio(const char* fname)
+{
+    char value[RAPL_MAX];
+    FILE* ptr = fopen(fname, "r");
+    if( ptr == NULL )
+        return 0;
+    if( fgets(value, RAPL_MAX, ptr) == NULL )
+        value[0] = '\0';
+    fclose(ptr);
+    return strtoull(value, NULL, 10);
+}
+
+static
+unsigned long long read_pread(int fd)
+{
+    char buf[RAPL_MAX];
+    unsigned long long v = 0;
+    ssize_t len = pread(fd, buf, sizeof(buf), 0);
+    for(ssize_t i = 0; i < len && buf[i] >= '0' && buf[i] <= '9'; ++i)
+        v = v * 10 + (unsigned long long)(buf[i] - '0');
+    return v;
+}
+
+int main(int argc, char **argv)
+{
+    const char* fname = argc > 1 ? argv[1] : DEFAULT_FILE;
+    long iterations = argc > 2 ? atol(argv[2]) : DEFAULT_ITERATIONS;
+    volatile unsigned long long sink = 0;
+
+    int fd = open(fname, O_RDONLY | O_CLOEXEC);
+    if( fd < 0 )
+    {
+        perror(fname);
+        return 1;
+    }
+
+    double start = now_s();
+    for(long i = 0; i < iterations; ++i)
+        sink += read_stdio(fname);
+    double t_stdio = now_s() - start;
+
+    start = now_s();
+    for(long i = 0; i < iterations; ++i)
+        sink += read_pread(fd);
+    double t_pread = now_s() - start;
+
+    close(fd);
+
+    printf("file: %s\n", fname);
+    printf("iterations: %ld\n", iterations);
+    printf("fopen/fgets/fclose: %12.0f reads/s (%8.1f ns/read)\n",
+        iterations / t_stdio, t_stdio * 1e9 / iterations);
+    printf("pread:              %12.0f reads/s (%8.1f ns/read)\n",
+        iterations / t_pread, t_pread * 1e9 / iterations);
+    printf("speedup: %.2fx\n", t_stdio / t_pread);
+
+    return 0;
+}
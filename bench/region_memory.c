@@ -0,0 +1,103 @@
+/*
+ * Memory footprint and begin/end cost of many regions on mock devices:
+ *
+ *   footprint: heap bytes per region defined with `EMA_region_define`,
+ *   hot:       cycles per `EMA_region_begin`/`EMA_region_end` pair, one
+ *              region,
+ *   cold:      the same, round-robin over all regions.
+ *
+ * Cycles are TSC ticks on x86 and ns elsewhere.
+ *
+ * Usage: region_memory [regions] [devices] [iterations]
+ */
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <EMA.h>
+#include <EMA/plugins/plugin_mock.user.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define DEFAULT_REGIONS 10000
+#define DEFAULT_DEVICES 4
+#define DEFAULT_ITERATIONS 200000
+
+static unsigned int num_devices;
+
+static
+unsigned long long cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static
+int register_mock(void)
+{
+    MockPluginConfig config = {
+        .num_devices = num_devices,
+        .power_model = MOCK_POWER_RAMP,
+        .power_w = 1.0,
+    };
+    return register_mock_plugin("MOCK", &config);
+}
+
+static
+double begin_end(Region** regions, long num_regions, long iterations)
+{
+    unsigned long long start = cycles();
+    for(long i = 0; i < iterations; ++i)
+    {
+        Region* region = regions[i % num_regions];
+        EMA_region_begin(region);
+        EMA_region_end(region);
+    }
+    return (double) (cycles() - start) / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    long regions = argc > 1 ? atol(argv[1]) : DEFAULT_REGIONS;
+    num_devices = argc > 2 ? atoi(argv[2]) : DEFAULT_DEVICES;
+    long iterations = argc > 3 ? atol(argv[3]) : DEFAULT_ITERATIONS;
+
+    int err = EMA_init(register_mock);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+
+    Filter* filter = EMA_filter_exclude_plugin("RAPL");
+    Region** defined = calloc(regions, sizeof(Region*));
+    char idf[32];
+
+    /* The first definition sets up the thread. */
+    EMA_region_define(defined, "region-0", filter, "bench", 0, "main");
+    size_t heap = mallinfo2().uordblks;
+    for(long i = 1; i < regions; ++i)
+    {
+        snprintf(idf, sizeof(idf), "region-%ld", i);
+        EMA_region_define(defined + i, idf, filter, "bench", i, "main");
+    }
+    double bytes = (double) (mallinfo2().uordblks - heap) / (regions - 1);
+
+    printf("case,regions,devices,value\n");
+    printf("footprint,%ld,%u,%.0f\n", regions, num_devices, bytes);
+    printf("hot,1,%u,%.0f\n", num_devices, begin_end(defined, 1, iterations));
+    printf("cold,%ld,%u,%.0f\n",
+        regions, num_devices, begin_end(defined, regions, iterations));
+
+    EMA_filter_finalize(filter);
+    free(defined);
+    return EMA_finalize();
+}
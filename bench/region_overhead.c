@@ -0,0 +1,136 @@
+/*
+ * Overhead of EMA on mock devices, reproducible without RAPL, NVML or MQTT:
+ *
+ *   begin_end: ns per `EMA_region_begin`/`EMA_region_end` pair,
+ *   wraps:     the same with counters wrapping every ms, plus the relative
+ *              error of the wrap-corrected energy against a 1 W ramp,
+ *   output:    ns per region written by `EMA_print_all`.
+ *
+ * Usage: region_overhead [iterations] [devices] [regions]
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <EMA.h>
+#include <EMA/core/device.h>
+#include <EMA/core/plugin.h>
+#include <EMA/plugins/plugin_mock.user.h>
+#include <EMA/region/region.h>
+
+#define DEFAULT_ITERATIONS 200000
+#define DEFAULT_DEVICES 4
+#define DEFAULT_REGIONS 10000
+
+/* 1 mJ at 1 W: the counters wrap every ms. */
+#define WRAP_RANGE_UJ 1000
+
+static unsigned int num_devices;
+
+static
+double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static
+int register_mock_plugins(void)
+{
+    MockPluginConfig ramp = {
+        .num_devices = num_devices,
+        .power_model = MOCK_POWER_RAMP,
+        .power_w = 1.0,
+    };
+    MockPluginConfig wraps = ramp;
+    wraps.max_range_uj = WRAP_RANGE_UJ;
+
+    int err = register_mock_plugin("MOCK", &ramp);
+    if( err )
+        return err;
+    return register_mock_plugin("MOCK-WRAP", &wraps);
+}
+
+static
+DevicePtrArray only_plugin(DevicePtrArray devices, Filter* filter)
+{
+    const char* name = filter->data;
+    DevicePtrArray filtered = {
+        .array = malloc(sizeof(Device*) * devices.size), .size = 0 };
+    for(size_t i = 0; i < devices.size; ++i)
+        if( strcmp(devices.array[i]->plugin->name, name) == 0 )
+            filtered.array[filtered.size++] = devices.array[i];
+    return filtered;
+}
+
+static
+double begin_end(const char* plugin, long iterations, Region** region)
+{
+    Filter* filter = EMA_filter_create(only_plugin, strdup(plugin));
+    EMA_region_create_and_init(region, plugin, filter, "", 0, "");
+    EMA_filter_finalize(filter);
+
+    double start = now_s();
+    for(long i = 0; i < iterations; ++i)
+    {
+        EMA_region_begin(*region);
+        EMA_region_end(*region);
+    }
+    return (now_s() - start) * 1e9 / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : DEFAULT_ITERATIONS;
+    num_devices = argc > 2 ? atoi(argv[2]) : DEFAULT_DEVICES;
+    long regions = argc > 3 ? atol(argv[3]) : DEFAULT_REGIONS;
+
+    int err = EMA_init(register_mock_plugins);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+
+    printf("case,devices,ns,error\n");
+
+    Region* region;
+    double ns = begin_end("MOCK", iterations, &region);
+    printf("begin_end,%u,%.1f,\n", num_devices, ns);
+    EMA_region_finalize(region);
+
+    ns = begin_end("MOCK-WRAP", iterations, &region);
+    double error = 0;
+    for(unsigned int i = 0; i < num_devices; ++i)
+    {
+        double energy = region->measurements.energy_result[i];
+        double time = region->measurements.time_result[i];
+        if( time )
+            error = fmax(error, fabs(energy - time) / time);
+    }
+    printf("wraps,%u,%.1f,%.2e\n", num_devices, ns, error);
+    EMA_region_finalize(region);
+
+    Region** defined = calloc(regions, sizeof(Region*));
+    char idf[32];
+    for(long i = 0; i < regions; ++i)
+    {
+        snprintf(idf, sizeof(idf), "region-%ld", i);
+        EMA_region_define(defined + i, idf, NULL, "bench", i, "main");
+        EMA_region_begin(defined[i]);
+        EMA_region_end(defined[i]);
+    }
+
+    FILE* null = fopen("/dev/null", "w");
+    double start = now_s();
+    EMA_print_all(null);
+    double elapsed = now_s() - start;
+    fclose(null);
+    printf("output,%u,%.1f,\n", 2 * num_devices, elapsed * 1e9 / regions);
+    free(defined);
+
+    return EMA_finalize();
+}
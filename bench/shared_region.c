@@ -0,0 +1,134 @@
+/*
+ * Scaling of visits to one region from 1 to 128 threads:
+ *
+ *   shared:  one `SharedRegion`, striped counters, devices read per phase,
+ *   counter: the same visits counted in a single pair of atomics, i.e. what
+ *            sharing a region without stripes costs,
+ *   thread:  a region per thread, devices read per visit.
+ *
+ * Usage: shared_region [iterations per thread] [max threads]
+ */
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include <EMA.h>
+#include <EMA/plugins/plugin_mock.user.h>
+#include <EMA/utils/time.h>
+
+#define DEFAULT_ITERATIONS 100000
+#define DEFAULT_MAX_THREADS 128
+
+typedef enum { SHARED, COUNTER, THREAD } Case;
+static const char* CASE_NAMES[] = { "shared", "counter", "thread" };
+
+static Case current;
+static long iterations;
+static pthread_barrier_t barrier;
+static Filter* filter;
+static SharedRegion* shared;
+static _Atomic uint64_t counter_visits, counter_time_ns;
+
+static
+double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static
+int register_mock(void)
+{
+    MockPluginConfig config = {
+        .num_devices = 1,
+        .power_model = MOCK_POWER_RAMP,
+        .power_w = 1.0,
+    };
+    return register_mock_plugin("MOCK", &config);
+}
+
+static
+void* worker(void* arg)
+{
+    EMA_REGION_DECLARE(region);
+    if( current == THREAD )
+        EMA_REGION_DEFINE_WITH_FILTER(&region, "thread", filter);
+
+    pthread_barrier_wait(&barrier);
+    for(long i = 0; i < iterations; ++i)
+    {
+        if( current == SHARED )
+        {
+            EMA_shared_region_begin(shared);
+            EMA_shared_region_end(shared);
+        }
+        else if( current == COUNTER )
+        {
+            uint64_t start = EMA_get_time_in_ns();
+            atomic_fetch_add_explicit(
+                &counter_visits, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&counter_time_ns,
+                EMA_get_time_in_ns() - start, memory_order_relaxed);
+        }
+        else
+        {
+            EMA_REGION_BEGIN(region);
+            EMA_REGION_END(region);
+        }
+    }
+    pthread_barrier_wait(&barrier);
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    iterations = argc > 1 ? atol(argv[1]) : DEFAULT_ITERATIONS;
+    int max_threads = argc > 2 ? atoi(argv[2]) : DEFAULT_MAX_THREADS;
+    if( max_threads > DEFAULT_MAX_THREADS )
+        max_threads = DEFAULT_MAX_THREADS;
+
+    int err = EMA_init(register_mock);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+    filter = EMA_filter_exclude_plugin("RAPL");
+    EMA_SHARED_REGION_DEFINE_WITH_FILTER(&shared, "shared", filter);
+
+    printf("case,threads,pairs_per_s,ns_per_pair_per_thread\n");
+    for(current = SHARED; current <= THREAD; ++current)
+        for(int n = 1; n <= max_threads; n *= 2)
+        {
+            pthread_t threads[DEFAULT_MAX_THREADS];
+            pthread_barrier_init(&barrier, NULL, n + 1);
+            for(int i = 0; i < n; ++i)
+                pthread_create(threads + i, NULL, worker, NULL);
+
+            if( current == SHARED )
+                EMA_shared_region_phase_begin(shared);
+            pthread_barrier_wait(&barrier);
+            double start = now_s();
+            pthread_barrier_wait(&barrier);
+            double elapsed = now_s() - start;
+            if( current == SHARED )
+                EMA_shared_region_phase_end(shared);
+
+            for(int i = 0; i < n; ++i)
+                pthread_join(threads[i], NULL);
+            pthread_barrier_destroy(&barrier);
+
+            double pairs = (double) n * iterations;
+            printf("%s,%d,%.0f,%.1f\n", CASE_NAMES[current],
+                n, pairs / elapsed, elapsed * 1e9 / iterations);
+        }
+
+    EMA_filter_finalize(filter);
+    return EMA_finalize();
+}
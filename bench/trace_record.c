@@ -0,0 +1,108 @@
+/*
+ * Cost of recording a trace event in `EMA_region_begin`/`EMA_region_end`,
+ * without the device read:
+ *
+ *   record: ns per event appended to a thread's ring buffer,
+ *   drop:   ns per event dropped because the ring buffer is full.
+ *
+ * The best of several rounds is reported; between rounds the flusher drains
+ * the ring, so its work does not count on machines with a single CPU.
+ *
+ * Usage: trace_record [events] [devices]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include <EMA.h>
+#include <EMA/plugins/plugin_mock.user.h>
+#include <EMA/region/region.h>
+#include <EMA/region/trace.h>
+
+#define DEFAULT_EVENTS (1 << 16)
+#define DEFAULT_DEVICES 4
+#define ROUNDS 5
+
+static unsigned int num_devices;
+
+static
+double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static
+int register_mock(void)
+{
+    MockPluginConfig config = {
+        .num_devices = num_devices,
+        .power_model = MOCK_POWER_RAMP,
+        .power_w = 1.0,
+    };
+    return register_mock_plugin("MOCK", &config);
+}
+
+/* Best ns per event of `events` records in a row. */
+static
+double record(const Region* region, long events)
+{
+    unsigned long long energy[num_devices];
+    for(unsigned int i = 0; i < num_devices; ++i)
+        energy[i] = i;
+
+    double best = 1e9;
+    for(int round = 0; round < ROUNDS; ++round)
+    {
+        usleep(50000);
+        double start = now_s();
+        for(long i = 0; i < events; ++i)
+            EMA_trace_record(region, i & 1, energy);
+        double ns = (now_s() - start) * 1e9 / events;
+        best = ns < best ? ns : best;
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    long events = argc > 1 ? atol(argv[1]) : DEFAULT_EVENTS;
+    num_devices = argc > 2 ? atoi(argv[2]) : DEFAULT_DEVICES;
+
+    char ring[32];
+    snprintf(ring, sizeof(ring), "%ld", events);
+    setenv("EMA_TRACE", "1", 1);
+    setenv("EMA_TRACE_RING", ring, 1);
+
+    int err = EMA_init(register_mock);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+
+    Filter* filter = EMA_filter_exclude_plugin("RAPL");
+    Region* region;
+    EMA_region_create_and_init(&region, "trace", filter, "", 0, "");
+    EMA_filter_finalize(filter);
+
+    printf("case,devices,ns\n");
+    printf("record,%u,%.1f\n", num_devices, record(region, events));
+
+    /* The first lap fills the ring, the other laps are dropped. */
+    unsigned long long energy[num_devices];
+    for(unsigned int i = 0; i < num_devices; ++i)
+        energy[i] = i;
+    for(long i = 0; i < events; ++i)
+        EMA_trace_record(region, EMA_TRACE_BEGIN, energy);
+    double start = now_s();
+    for(long i = 0; i < events; ++i)
+        EMA_trace_record(region, EMA_TRACE_BEGIN, energy);
+    printf("drop,%u,%.1f\n", num_devices, (now_s() - start) * 1e9 / events);
+
+    EMA_region_finalize(region);
+    return EMA_finalize();
+}
@@ -0,0 +1,102 @@
+/*
+ * Cost of the per-visit statistics in `EMA_region_end`: ns per device for
+ * the plain accumulation of energy and time, and for the accumulation plus
+ * the Welford updates of energy, time and power.
+ *
+ * Usage: visit_stats [iterations] [devices]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <EMA/region/stats.h>
+
+#define DEFAULT_ITERATIONS 10000000
+#define DEFAULT_DEVICES 4
+#define NUM_SAMPLES 1024
+
+typedef struct
+{
+    unsigned long long energy_result;
+    unsigned long long time_result;
+    VisitStats stats;
+} BenchMeasurement;
+
+static unsigned long long energy_samples[NUM_SAMPLES];
+static unsigned long long time_samples[NUM_SAMPLES];
+
+static
+double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static
+void accumulate(BenchMeasurement* m, size_t devices, size_t k)
+{
+    for(size_t i = 0; i < devices; ++i)
+    {
+        unsigned long long visit_energy = energy_samples[(k + i) % NUM_SAMPLES];
+        unsigned long long visit_time = time_samples[(k + i) % NUM_SAMPLES];
+        m[i].energy_result += visit_energy;
+        m[i].time_result += visit_time;
+    }
+}
+
+static
+void accumulate_stats(BenchMeasurement* m, size_t devices, size_t k)
+{
+    double inv_n = 1.0 / (m[0].stats.n + 1);
+    for(size_t i = 0; i < devices; ++i)
+    {
+        unsigned long long visit_energy = energy_samples[(k + i) % NUM_SAMPLES];
+        unsigned long long visit_time = time_samples[(k + i) % NUM_SAMPLES];
+        m[i].energy_result += visit_energy;
+        m[i].time_result += visit_time;
+        EMA_visit_stats_add(&m[i].stats, visit_energy, visit_time, inv_n);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : DEFAULT_ITERATIONS;
+    size_t devices = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_DEVICES;
+
+    srand(1);
+    for(size_t i = 0; i < NUM_SAMPLES; ++i)
+    {
+        time_samples[i] = 100 + rand() % 1000;
+        energy_samples[i] = time_samples[i] * (10 + rand() % 50);
+    }
+
+    BenchMeasurement* m = calloc(devices, sizeof(BenchMeasurement));
+    for(size_t i = 0; i < devices; ++i)
+        EMA_visit_stats_init(&m[i].stats);
+
+    double start = now_s();
+    for(long k = 0; k < iterations; ++k)
+        accumulate(m, devices, k);
+    double plain = (now_s() - start) * 1e9 / iterations / devices;
+
+    start = now_s();
+    for(long k = 0; k < iterations; ++k)
+        accumulate_stats(m, devices, k);
+    double stats = (now_s() - start) * 1e9 / iterations / devices;
+
+    printf("mode,ns_per_device\n");
+    printf("plain,%.2f\n", plain);
+    printf("stats,%.2f\n", stats);
+    printf("overhead,%.2f\n", stats - plain);
+
+    /* Keep the results alive. */
+    double sink = 0;
+    for(size_t i = 0; i < devices; ++i)
+        sink += m[i].energy_result + m[i].stats.power.mean
+            + EMA_visit_moments_stddev(&m[i].stats.time, m[i].stats.n);
+    fprintf(stderr, "%g\n", sink);
+
+    free(m);
+    return 0;
+}
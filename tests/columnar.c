@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <EMA.h>
+
+#define MOCK_NUM_DEVICES 2
+
+#include "test_utils.h"
+
+#define MAX_ROWS 64
+
+static Filter* filter;
+
+static
+void visit(int n)
+{
+    EMA_REGION_DECLARE(region);
+    EMA_REGION_DEFINE_WITH_FILTER(&region, "work", filter);
+    for(int i = 0; i < n; ++i)
+    {
+        EMA_REGION_BEGIN(region);
+        EMA_REGION_END(region);
+    }
+}
+
+static
+void visit_other(void)
+{
+    EMA_REGION_DECLARE(region);
+    EMA_REGION_DEFINE_WITH_FILTER(&region, "other", filter);
+    EMA_REGION_BEGIN(region);
+    EMA_REGION_END(region);
+}
+
+static
+void* visit_and_exit(void* arg)
+{
+    visit(3);
+    return NULL;
+}
+
+/* A row of the columnar file, printed like the leading CSV columns. */
+static
+void format_row(
+    const void* file, const ColumnarIndex* index, uint64_t row,
+    char* line, size_t size)
+{
+    const int32_t* thread =
+        EMA_columnar_file_column(file, index, EMA_COLUMN_THREAD);
+    const uint32_t* region_ids =
+        EMA_columnar_file_column(file, index, EMA_COLUMN_REGION);
+    const uint32_t* device_ids =
+        EMA_columnar_file_column(file, index, EMA_COLUMN_DEVICE);
+    const uint64_t* visits =
+        EMA_columnar_file_column(file, index, EMA_COLUMN_VISITS);
+    const uint64_t* energy =
+        EMA_columnar_file_column(file, index, EMA_COLUMN_ENERGY);
+    const uint64_t* time =
+        EMA_columnar_file_column(file, index, EMA_COLUMN_TIME);
+
+    const ColumnarRegion* region = (const ColumnarRegion*) (
+        (const char*) file + index->region_offset) + region_ids[row];
+    const ColumnarDevice* device = (const ColumnarDevice*) (
+        (const char*) file + index->device_offset) + device_ids[row];
+    snprintf(line, size, "%d,%s,%s,%u,%s,%llu,%s,%s,%s,%llu,%llu,",
+        thread[row],
+        EMA_columnar_file_string(file, index, region->idf),
+        EMA_columnar_file_string(file, index, region->file),
+        region->line,
+        EMA_columnar_file_string(file, index, region->function),
+        (unsigned long long) visits[row],
+        EMA_columnar_file_string(file, index, device->name),
+        EMA_columnar_file_string(file, index, device->uid),
+        EMA_columnar_file_string(file, index, device->type),
+        (unsigned long long) energy[row],
+        (unsigned long long) time[row]);
+}
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+
+    setenv("EMA_HISTOGRAM", "3", 1);
+    int err = EMA_init(register_mock);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+    filter = EMA_filter_exclude_plugin("RAPL");
+
+    visit(5);
+    visit_other();
+    pthread_t thread;
+    pthread_create(&thread, NULL, visit_and_exit, NULL);
+    pthread_join(thread, NULL);
+
+    FILE* csv = tmpfile();
+    FILE* columnar = tmpfile();
+    failed |= check(EMA_print_all(csv) == 0, "print CSV");
+    failed |= check(EMA_print_all_columnar(columnar) == 0, "print columnar");
+    fflush(columnar);
+
+    size_t size = ftell(columnar);
+    const void* file = mmap(NULL, size, PROT_READ, MAP_PRIVATE,
+        fileno(columnar), 0);
+    const ColumnarIndex* index = file != MAP_FAILED
+        ? EMA_columnar_file_index(file, size) : NULL;
+    failed |= check(index != NULL, "columnar index");
+
+    /* Rows in the same order as the CSV, with the same values. */
+    char lines[MAX_ROWS][512];
+    size_t rows = 0;
+    rewind(csv);
+    fgets(lines[0], sizeof(lines[0]), csv);
+    while( rows < MAX_ROWS && fgets(lines[rows], sizeof(lines[0]), csv) )
+        ++rows;
+
+    failed |= check(index && index->num_rows == rows && rows == 6,
+        "a row per region, thread and device");
+    failed |= check(index && index->num_regions == 2
+        && index->num_devices == 2, "region and device tables");
+
+    int same = index != NULL;
+    for(size_t i = 0; same && i < rows; ++i)
+    {
+        char row[512];
+        format_row(file, index, i, row, sizeof(row));
+        same &= strncmp(row, lines[i], strlen(row)) == 0;
+    }
+    failed |= check(same, "rows match the CSV");
+
+    const uint64_t* p50 = index
+        ? EMA_columnar_file_column(file, index, EMA_COLUMN_TIME_P50) : NULL;
+    failed |= check(p50 && p50[0] != EMA_COLUMNAR_NO_PERCENTILE,
+        "percentiles with histograms");
+
+    /* A truncated file is rejected. */
+    failed |= check(index && !EMA_columnar_file_index(file, size - 1),
+        "truncated file");
+
+    if( file != MAP_FAILED )
+        munmap((void*) file, size);
+    fclose(csv);
+    fclose(columnar);
+
+    EMA_filter_finalize(filter);
+    EMA_finalize();
+    return failed;
+}
@@ -0,0 +1,245 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <EMA.h>
+
+#include "test_utils.h"
+
+#define MAX_SNAPSHOTS 4096
+#define VISIT_US 20
+
+static Filter* filter;
+static atomic_int running;
+static unsigned long long worker_visits;
+
+/* One definition, whichever thread visits it. */
+static
+void visit(int n)
+{
+    EMA_REGION_DECLARE(region);
+    EMA_REGION_DEFINE_WITH_FILTER(&region, "work", filter);
+    for(int i = 0; i < n; ++i)
+    {
+        EMA_REGION_BEGIN(region);
+        busy_wait(VISIT_US);
+        EMA_REGION_END(region);
+    }
+}
+
+static
+void* visit_and_exit(void* arg)
+{
+    visit((long) arg);
+    return NULL;
+}
+
+static
+void* visit_until_stopped(void* arg)
+{
+    while( running )
+    {
+        visit(1);
+        ++worker_visits;
+    }
+    return NULL;
+}
+
+/* Visits, energy and records of region "work" per snapshot of the export
+ * file of process `pid`. */
+static
+int read_export(
+    pid_t pid, unsigned long long* visits, long long* energy, int* records)
+{
+    char filename[64];
+    snprintf(filename, sizeof(filename), "export.EMA.%u", pid);
+    FILE* f = fopen(filename, "r");
+    if( !f )
+        return 0;
+
+    char line[1024];
+    int snapshots = 0;
+    if( !fgets(line, sizeof(line), f) )
+        snapshots = -1;
+    while( snapshots >= 0 && fgets(line, sizeof(line), f) )
+    {
+        unsigned long long snapshot, region_visits;
+        long long region_energy;
+        char idf[64];
+        if( sscanf(line, "%llu,%*u,%*u,%63[^,],%*[^,],%*u,%*[^,],"
+                "%*[^,],%*[^,],%llu,%lld",
+                &snapshot, idf, &region_visits, &region_energy) != 4
+            || snapshot == 0 || snapshot > MAX_SNAPSHOTS )
+        {
+            snapshots = -1;
+            break;
+        }
+        if( strcmp(idf, "work") != 0 )
+            continue;
+        visits[snapshot - 1] += region_visits;
+        energy[snapshot - 1] += region_energy;
+        records[snapshot - 1] += 1;
+        if( snapshot > (unsigned long long) snapshots )
+            snapshots = snapshot;
+    }
+    fclose(f);
+    remove(filename);
+    return snapshots;
+}
+
+/* Interval windows, across the exit of a thread and without visits. */
+static
+int test_interval(void)
+{
+    int failed = 0;
+    int err = EMA_init(register_mock);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+    filter = EMA_filter_exclude_plugin("RAPL");
+
+    failed |= check(EMA_export_snapshot() != 0, "snapshot without exporter");
+    failed |= check(EMA_export_start(EMA_EXPORT_INTERVAL, 3600 * 1000) == 0,
+        "start exporter");
+
+    visit(10);
+    EMA_export_snapshot();
+    visit(5);
+    EMA_export_snapshot();
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, visit_and_exit, (void*) 7);
+    pthread_join(thread, NULL);
+    EMA_export_snapshot();
+    EMA_export_snapshot();
+
+    EMA_filter_finalize(filter);
+    EMA_finalize();
+
+    unsigned long long visits[MAX_SNAPSHOTS] = { 0 };
+    long long energy[MAX_SNAPSHOTS] = { 0 };
+    int records[MAX_SNAPSHOTS] = { 0 };
+    int snapshots = read_export(getpid(), visits, energy, records);
+    failed |= check(snapshots == 3, "snapshots with visits");
+    failed |= check(visits[0] == 10 && visits[1] == 5, "visits per window");
+    failed |= check(visits[2] == 7, "visits of an exited thread");
+    failed |= check(records[3] == 0 && records[4] == 0, "idle windows");
+    failed |= check(energy[0] > 0 && energy[1] > 0, "energy per window");
+    return failed;
+}
+
+/* Cumulative snapshots every millisecond while a thread visits. */
+static
+int test_cumulative(void)
+{
+    int failed = 0;
+    setenv("EMA_EXPORT", "cumulative:1", 1);
+    int err = EMA_init(register_mock);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+    filter = EMA_filter_exclude_plugin("RAPL");
+
+    running = 1;
+    pthread_t thread;
+    pthread_create(&thread, NULL, visit_until_stopped, NULL);
+    usleep(50 * 1000);
+    running = 0;
+    pthread_join(thread, NULL);
+    visit(1);
+
+    EMA_filter_finalize(filter);
+    EMA_finalize();
+
+    static unsigned long long visits[MAX_SNAPSHOTS];
+    static long long energy[MAX_SNAPSHOTS];
+    static int records[MAX_SNAPSHOTS];
+    int snapshots = read_export(getpid(), visits, energy, records);
+    failed |= check(snapshots > 2, "periodic snapshots");
+
+    int monotonic = snapshots > 0;
+    for(int i = 1; i < snapshots; ++i)
+        monotonic &= visits[i] >= visits[i - 1] && energy[i] >= energy[i - 1];
+    failed |= check(monotonic, "cumulative records grow");
+    failed |= check(snapshots > 0
+        && visits[snapshots - 1] == worker_visits + 1,
+        "last snapshot counts all visits");
+    failed |= check(snapshots > 0 && records[snapshots - 1] == 1,
+        "one record per definition and device");
+    return failed;
+}
+
+/* An export file that cannot be written fails EMA_finalize, but neither
+ * the results nor the teardown. */
+static
+int test_failing_export(void)
+{
+    int failed = 0;
+    char export[64], output[64];
+    snprintf(export, sizeof(export), "export.EMA.%u", getpid());
+    snprintf(output, sizeof(output), "output.EMA.%u", getpid());
+    if( symlink("/dev/full", export) != 0 )
+    {
+        printf("Failed to link '%s' to /dev/full\n", export);
+        return 1;
+    }
+
+    setenv("EMA_EXPORT", "cumulative:3600000", 1);
+    int err = EMA_init(register_mock);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        unlink(export);
+        return 1;
+    }
+    filter = EMA_filter_exclude_plugin("RAPL");
+    visit(1);
+
+    EMA_filter_finalize(filter);
+    failed |= check(EMA_finalize() != 0, "failing export fails finalize");
+    unlink(export);
+
+    char line[512];
+    int found = 0;
+    FILE* f = fopen(output, "r");
+    while( f && !found && fgets(line, sizeof(line), f) )
+        found = strstr(line, ",work,") != NULL;
+    if( f )
+        fclose(f);
+    failed |= check(found, "results despite a failing export");
+    return failed;
+}
+
+static
+int wait_child(pid_t child)
+{
+    int status;
+    waitpid(child, &status, 0);
+    return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+int main(int argc, char **argv)
+{
+    /* Each mode in its own process, with its own export file. */
+    pid_t cumulative = fork();
+    if( cumulative == 0 )
+        return test_cumulative();
+
+    pid_t failing = fork();
+    if( failing == 0 )
+        return test_failing_export();
+
+    int failed = test_interval();
+    failed |= wait_child(cumulative);
+    failed |= wait_child(failing);
+    return failed;
+}
@@ -0,0 +1,104 @@
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <EMA/utils/format.h>
+
+#include "test_utils.h"
+
+#define RANDOM_VALUES 1000000
+
+static uint64_t state = 0x9e3779b97f4a7c15ULL;
+
+static
+uint64_t next_random(void)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+/* Compare with printf; print the first mismatch. */
+static
+int same_g6(double value)
+{
+    char expected[32], actual[32];
+    snprintf(expected, sizeof(expected), "%.6g", value);
+    *EMA_format_g6(actual, value) = '\0';
+    if( strcmp(expected, actual) == 0 )
+        return 1;
+    printf("%.17g: expected %s, got %s\n", value, expected, actual);
+    return 0;
+}
+
+static
+int same_u64(unsigned long long value)
+{
+    char expected[32], actual[32];
+    snprintf(expected, sizeof(expected), "%llu", value);
+    *EMA_format_u64(actual, value) = '\0';
+    return strcmp(expected, actual) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+
+    static const double special[] = {
+        0.0, -0.0, 1.0, -1.0, 0.5, 0.1, 1e-4, 1e-5, 9.99999e-5, 9.999995e-5,
+        99999.5, 999999.0, 999999.5, 1e6, 123456.5, 1234565.0, 2.5e-7,
+        0.000123456789, 1e-17, 1e27, 1e28, 5e-324, DBL_MAX, DBL_MIN,
+        INFINITY, -INFINITY, NAN,
+    };
+    int same = 1;
+    for(size_t i = 0; i < sizeof(special) / sizeof(special[0]); ++i)
+        same &= same_g6(special[i]);
+    failed |= check(same, "special values");
+
+    same = 1;
+    for(unsigned long long i = 0; i < 2000000 && same; i += 7)
+        same &= same_g6((double) i);
+    failed |= check(same, "integers");
+
+    /* Any bit pattern, full mantissas of moderate magnitude, and values of 6
+     * to 8 digits around ties. */
+    same = 1;
+    for(int i = 0; i < RANDOM_VALUES && same; ++i)
+    {
+        uint64_t bits = next_random();
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        same &= same_g6(value);
+    }
+    failed |= check(same, "random bit patterns");
+
+    same = 1;
+    for(int i = 0; i < RANDOM_VALUES && same; ++i)
+    {
+        uint64_t random = next_random();
+        int exponent = (int) (random % 120) - 60;
+        same &= same_g6(ldexp((double) (random >> 11), exponent - 53));
+    }
+    failed |= check(same, "random values in the fast range");
+
+    same = 1;
+    for(int i = 0; i < RANDOM_VALUES && same; ++i)
+    {
+        uint64_t random = next_random();
+        double digits = (double) (random % 100000000) + (random >> 63) * 0.5;
+        int exponent = (int) ((random >> 32) % 40) - 20;
+        same &= same_g6(digits * pow(10, exponent));
+    }
+    failed |= check(same, "values near ties");
+
+    same = same_u64(0) && same_u64(UINT64_MAX);
+    for(int i = 0; i < RANDOM_VALUES && same; ++i)
+        same &= same_u64(next_random() >> (i % 64));
+    failed |= check(same, "unsigned integers");
+
+    return failed;
+}
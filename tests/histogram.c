@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <EMA.h>
+#include <EMA/region/histogram.h>
+
+#include "test_utils.h"
+
+#define PRECISION_BITS 3
+#define SHORT_US 1000
+#define LONG_US 20000
+
+static Filter* filter;
+
+/* Every value lies in a bucket at most 2^-precision wider than itself. */
+static
+int check_buckets(void)
+{
+    uint64_t* counts = calloc(EMA_histogram_layout.size, sizeof(uint64_t));
+    int ok = 1;
+
+    for(unsigned long long v = 0; v < (1ULL << 36); v = v * 5 / 4 + 1)
+    {
+        memset(counts, 0, sizeof(uint64_t) * EMA_histogram_layout.size);
+        counts[EMA_histogram_index(v)] = 1;
+        unsigned long long upper = EMA_histogram_percentile(counts, 100);
+        if( upper < v || upper - v > (v >> PRECISION_BITS) )
+        {
+            printf("value %llu: bucket upper bound %llu\n", v, upper);
+            ok = 0;
+        }
+    }
+
+    free(counts);
+    return ok;
+}
+
+/* 90 short and 10 long visits. */
+static
+void* visit(void* arg)
+{
+    EMA_REGION_DECLARE(region);
+    EMA_REGION_DEFINE_WITH_FILTER(&region, "handler", filter);
+
+    for(int i = 0; i < 100; ++i)
+    {
+        EMA_REGION_BEGIN(region);
+        usleep(i % 10 == 9 ? LONG_US : SHORT_US);
+        EMA_REGION_END(region);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+
+    setenv("EMA_HISTOGRAM", "3:40", 1);
+    int err = EMA_init(register_mock);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+
+    failed |= check(EMA_histogram_layout.size == (38 << 3), "layout");
+    failed |= check(check_buckets(), "bucket bounds");
+
+    filter = EMA_filter_exclude_plugin("RAPL");
+    pthread_t thread;
+    pthread_create(&thread, NULL, visit, NULL);
+    visit(NULL);
+    pthread_join(thread, NULL);
+
+    const Device* device = NULL;
+    DevicePtrArray devices = EMA_get_devices();
+    for(size_t i = 0; i < devices.size; ++i)
+        if( strcmp(EMA_get_device_name(devices.array[i]), "mock-0") == 0 )
+            device = devices.array[i];
+
+    unsigned long long p50_energy, p50_time, p99_energy, p99_time;
+    failed |= check(
+        EMA_get_percentile("handler", device, 50, &p50_energy, &p50_time) == 0
+        && EMA_get_percentile("handler", device, 99, &p99_energy, &p99_time)
+            == 0,
+        "merged percentiles");
+    printf("p50: %llu uJ, %llu us; p99: %llu uJ, %llu us\n",
+        p50_energy, p50_time, p99_energy, p99_time);
+    failed |= check(p50_time >= SHORT_US && p50_time < LONG_US / 2, "p50");
+    failed |= check(p99_time >= LONG_US, "p99");
+    failed |= check(
+        EMA_get_percentile("missing", device, 50, NULL, NULL) != 0,
+        "unknown region");
+
+    EMA_filter_finalize(filter);
+    EMA_finalize();
+
+    return failed;
+}
@@ -0,0 +1,180 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <EMA.h>
+
+#define MOCK_NUM_DEVICES 2
+
+#include "test_utils.h"
+
+#define RESPONSE_SIZE 65536
+#define SCRAPES 20
+
+static Filter* filter;
+static atomic_int running;
+static char socket_path[108];
+static char response[RESPONSE_SIZE];
+
+static
+void visit(const char* idf, int n)
+{
+    Region* region = NULL;
+    EMA_region_define(&region, idf, filter, "tests/metrics.c", 0, "visit");
+    for(int i = 0; i < n; ++i)
+    {
+        EMA_region_begin(region);
+        EMA_region_end(region);
+    }
+}
+
+static
+void* visit_and_exit(void* arg)
+{
+    visit("work", 4);
+    return NULL;
+}
+
+static
+void* visit_until_stopped(void* arg)
+{
+    Region* region = NULL;
+    EMA_region_define(&region, "busy", filter, "tests/metrics.c", 0, "visit");
+    while( running )
+    {
+        EMA_region_begin(region);
+        EMA_region_end(region);
+    }
+    return NULL;
+}
+
+/* Sends `request` to the socket like `curl --unix-socket` and reads the
+ * whole response. */
+static
+int scrape(const char* request)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if( fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 )
+    {
+        if( fd >= 0 )
+            close(fd);
+        return 1;
+    }
+
+    send(fd, request, strlen(request), MSG_NOSIGNAL);
+    size_t used = 0;
+    ssize_t n;
+    while( used < RESPONSE_SIZE - 1
+        && (n = recv(fd, response + used, RESPONSE_SIZE - 1 - used, 0)) > 0 )
+        used += n;
+    response[used] = '\0';
+    close(fd);
+    return 0;
+}
+
+static
+int get_metrics(void)
+{
+    return scrape("GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+}
+
+/* Value of the first sample starting with `prefix`, or -1. */
+static
+double sample(const char* prefix)
+{
+    const char* line = strstr(response, prefix);
+    if( !line )
+        return -1;
+    const char* value = strstr(line, "} ");
+    return value ? strtod(value + 2, NULL) : -1;
+}
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+    snprintf(socket_path, sizeof(socket_path), "/tmp/ema-metrics-%u.sock",
+        getpid());
+    char address[128];
+    snprintf(address, sizeof(address), "unix:%s", socket_path);
+    setenv("EMA_EXPORT", "interval:1", 1);
+    setenv("EMA_METRICS", address, 1);
+
+    int err = EMA_init(register_mock);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+    filter = EMA_filter_exclude_plugin("RAPL");
+
+    failed |= check(get_metrics() == 0, "connect to the socket");
+    failed |= check(strncmp(response, "HTTP/1.1 200 OK\r\n", 17) == 0
+        && strstr(response, "application/openmetrics-text"), "OpenMetrics");
+
+    visit("work", 3);
+    visit("say \"hi\"", 1);
+    pthread_t thread;
+    pthread_create(&thread, NULL, visit_and_exit, NULL);
+    pthread_join(thread, NULL);
+
+    /* Windows of the interval snapshots add up to the totals. */
+    const char* work = "ema_region_visits_total{region=\"work\"";
+    for(int i = 0; i < 1000 && sample(work) != 7; ++i)
+    {
+        usleep(1000);
+        get_metrics();
+    }
+    failed |= check(sample(work) == 7, "visits sum the threads");
+    failed |= check(sample("ema_region_energy_joules_total{region=\"work\"")
+        >= 0 && sample("ema_region_time_seconds_total{region=\"work\"") >= 0,
+        "energy and time per region");
+    failed |= check(strstr(response, "{region=\"say \\\"hi\\\"\"") != NULL,
+        "labels are escaped");
+    size_t length = strlen(response);
+    failed |= check(length > 6
+        && strcmp(response + length - 6, "# EOF\n") == 0, "ends with # EOF");
+
+    /* Scrapes while a thread keeps visiting see growing counters. */
+    running = 1;
+    pthread_create(&thread, NULL, visit_until_stopped, NULL);
+    const char* busy = "ema_region_visits_total{region=\"busy\"";
+    double last = 0;
+    int monotonic = 1;
+    for(int i = 0; i < SCRAPES; ++i)
+    {
+        usleep(2000);
+        get_metrics();
+        double value = sample(busy);
+        monotonic &= value >= last || value == -1;
+        if( value > last )
+            last = value;
+    }
+    running = 0;
+    pthread_join(thread, NULL);
+    failed |= check(monotonic && last > 0, "counters grow while visited");
+
+    scrape("GET /other HTTP/1.1\r\n\r\n");
+    failed |= check(strncmp(response, "HTTP/1.1 404", 12) == 0,
+        "unknown path");
+    scrape("POST /metrics HTTP/1.1\r\n\r\n");
+    failed |= check(strncmp(response, "HTTP/1.1 405", 12) == 0, "only GET");
+
+    EMA_filter_finalize(filter);
+    failed |= check(EMA_finalize() == 0, "finalize");
+    struct stat st;
+    failed |= check(stat(socket_path, &st) != 0, "socket removed");
+
+    /* The counters would never advance without the exporter. */
+    failed |= check(EMA_metrics_start(address) != 0
+        && stat(socket_path, &st) != 0, "no server without the exporter");
+    return failed;
+}
@@ -21,7 +21,8 @@ int main(int argc, char **argv)
         .port = MQTT_PORT,
         .topic = MQTT_TOPIC,
         .read_devices_timeout_sec = 5,
-        .read_energy_timeout_sec = 1
+        .read_energy_timeout_sec = 1,
+        .max_value_age_ms = 1000
     };
 
     int err = register_mqtt_plugin(
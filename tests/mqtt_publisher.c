@@ -0,0 +1,109 @@
+/*
+ * Minimal MQTT meter for testing the MQTT plugin against a local broker
+ * (e.g. `mosquitto -p 1883`). Publishes a retained registration message and
+ * then energy readings for all devices at a fixed rate.
+ *
+ * Usage: mqtt_publisher [seconds] [period_ms]
+ */
+#include <endian.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include <mosquitto.h>
+
+/* !!! Keep in sync with tests/mqtt_basic.c !!! */
+#define MQTT_HOST "127.0.0.1"
+#define MQTT_PORT 1883
+#define MQTT_TOPIC "EMA/hhi-mqtt-adapter/0/publish"
+#define DEVICE_TOPIC_PREFIX "EMA/hhi-mqtt-adapter/0/devices/"
+
+#define VERSION 0x1
+#define NUM_DEVICES 2
+#define POWER_W 10
+
+static
+size_t put_uint64(uint8_t* buf, uint64_t value)
+{
+    value = htole64(value);
+    memcpy(buf, &value, sizeof(value));
+    return sizeof(value);
+}
+
+static
+size_t put_string(uint8_t* buf, const char* str)
+{
+    size_t len = strlen(str);
+    size_t offset = put_uint64(buf, len);
+    memcpy(buf + offset, str, len);
+    return offset + len;
+}
+
+static
+uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000ULL;
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 60;
+    int period_ms = argc > 2 ? atoi(argv[2]) : 100;
+
+    char names[NUM_DEVICES][32];
+    char topics[NUM_DEVICES][128];
+    uint8_t reg[1024];
+    size_t offset = 0;
+
+    reg[offset++] = VERSION;
+    uint16_t count = htole16(NUM_DEVICES);
+    memcpy(reg + offset, &count, sizeof(count));
+    offset += sizeof(count);
+
+    for(int i = 0; i < NUM_DEVICES; ++i)
+    {
+        snprintf(names[i], sizeof(names[i]), "meter-%d", i);
+        snprintf(topics[i], sizeof(topics[i]), DEVICE_TOPIC_PREFIX "%d", i);
+        offset += put_string(reg + offset, names[i]);
+        offset += put_string(reg + offset, topics[i]);
+        reg[offset++] = 0;
+    }
+
+    mosquitto_lib_init();
+    struct mosquitto *mqtt = mosquitto_new("EMA-test-publisher", 1, NULL);
+    if( !mqtt || mosquitto_connect(mqtt, MQTT_HOST, MQTT_PORT, 5) )
+    {
+        fprintf(stderr, "Failed to connect to %s:%d\n", MQTT_HOST, MQTT_PORT);
+        return 1;
+    }
+    mosquitto_loop_start(mqtt);
+
+    mosquitto_publish(mqtt, NULL, MQTT_TOPIC, offset, reg, 1, 1);
+
+    uint64_t start = now_us();
+    while( now_us() - start < seconds * 1000000ULL )
+    {
+        uint8_t msg[2 * sizeof(uint64_t)];
+        uint64_t t = now_us();
+        for(int i = 0; i < NUM_DEVICES; ++i)
+        {
+            put_uint64(msg, (t - start) * POWER_W * (i + 1));
+            put_uint64(msg + sizeof(uint64_t), t);
+            mosquitto_publish(mqtt, NULL, topics[i], sizeof(msg), msg, 0, 0);
+        }
+        usleep(period_ms * 1000);
+    }
+
+    mosquitto_disconnect(mqtt);
+    mosquitto_loop_stop(mqtt, false);
+    mosquitto_destroy(mqtt);
+    mosquitto_lib_cleanup();
+
+    return 0;
+}
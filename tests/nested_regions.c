@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include <EMA.h>
+#include <EMA/region/calltree.h>
+#include <EMA/region/region_store.h>
+
+/* 1 W ramp: energy in uJ equals time in us. */
+#define READ_LATENCY_US 2000
+#define MOCK_READ_LATENCY_US READ_LATENCY_US
+#define MOCK_LATENCY_MODE MOCK_LATENCY_SLEEP
+
+#include "test_utils.h"
+
+#define INTERLEAVED_VISITS 100
+
+static
+const CallNode* find_child(const CallNode* node, const char* idf)
+{
+    for(const CallNode* child = node->child; child; child = child->next)
+        if( strcmp(child->idf, idf) == 0 )
+            return child;
+    return NULL;
+}
+
+/* Inclusive time at least `min_us`; exclusive and inclusive values add up
+ * exactly since nested boundaries share their readings. */
+static
+int check_node(
+    const CallNode* node, const char* path, unsigned long long visits,
+    unsigned long long min_us)
+{
+    if( !node )
+    {
+        printf("FAILED: %s: missing\n", path);
+        return 1;
+    }
+
+    unsigned long long energy_excl, time_excl, children = 0;
+    EMA_calltree_node_exclusive(node, 0, &energy_excl, &time_excl);
+    for(const CallNode* child = node->child; child; child = child->next)
+        children += child->time[0];
+
+    int ok = node->visits == visits
+        && node->time[0] >= min_us
+        && node->time[0] == time_excl + children
+        && node->energy[0] == node->time[0]
+        && energy_excl == time_excl;
+    printf("%s: %s: visits %llu, incl %llu us, excl %llu us\n",
+        ok ? "ok" : "FAILED", path, node->visits, node->time[0], time_excl);
+    return !ok;
+}
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+
+    unsetenv("EMA_CALLTREE");
+    int err = EMA_init(register_mock);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+
+    Filter* filter = EMA_filter_exclude_plugin("RAPL");
+    Region *outer = NULL, *a = NULL, *b = NULL;
+    EMA_region_define(&outer, "outer", filter, "", 0, "");
+    EMA_region_define(&a, "a", filter, "", 0, "");
+    EMA_region_define(&b, "b", filter, "", 0, "");
+
+    /* outer { a {} b { a {} } } twice; nested begins reuse the readings. */
+    int reused = 0;
+    for(int i = 0; i < 2; ++i)
+    {
+        const CallTree* tree = EMA_thread_get_calltree();
+        EMA_region_begin(outer);
+        EMA_region_begin(a);
+        reused |= tree->stack[0]->time_start[0] == tree->stack[1]->time_start[0];
+        usleep(20000);
+        EMA_region_end(a);
+        EMA_region_begin(b);
+        usleep(10000);
+        EMA_region_begin(a);
+        usleep(10000);
+        EMA_region_end(a);
+        EMA_region_end(b);
+        usleep(10000);
+        EMA_region_end(outer);
+    }
+    printf("%s: nested begin reads once\n", reused ? "ok" : "FAILED");
+    failed |= !reused;
+
+    /* Overlapping regions end out of order without errors, and the stack
+     * and the tree do not grow. */
+    Region *c = NULL, *d = NULL;
+    EMA_region_define(&c, "c", filter, "", 0, "");
+    EMA_region_define(&d, "d", filter, "", 0, "");
+    int interleaved = 1;
+    for(int i = 0; i < INTERLEAVED_VISITS; ++i)
+    {
+        interleaved &= EMA_region_begin(c) == 0;
+        interleaved &= EMA_region_begin(d) == 0;
+        interleaved &= EMA_region_end(c) == 0;
+        interleaved &= EMA_region_end(d) == 0;
+    }
+    const CallTree* current = EMA_thread_get_calltree();
+    const CallNode* n_c = find_child(&current->root, "c");
+    const CallNode* n_d = n_c ? find_child(n_c, "d") : NULL;
+    interleaved &= current->depth == 0 && n_c && n_d
+        && n_c->visits == INTERLEAVED_VISITS
+        && n_d->visits == INTERLEAVED_VISITS
+        && n_d->next == NULL && n_d->child == NULL
+        && !find_child(&current->root, "d");
+    printf("%s: interleaved regions\n", interleaved ? "ok" : "FAILED");
+    failed |= !interleaved;
+
+    const CallTree* tree = EMA_thread_get_calltree();
+    const CallNode* n_outer = find_child(&tree->root, "outer");
+    const CallNode* n_b = n_outer ? find_child(n_outer, "b") : NULL;
+    failed |= check_node(n_outer, "outer", 2, 100000);
+    failed |= check_node(
+        n_outer ? find_child(n_outer, "a") : NULL, "outer/a", 2, 40000);
+    failed |= check_node(n_b, "outer/b", 2, 40000);
+    failed |= check_node(
+        n_b ? find_child(n_b, "a") : NULL, "outer/b/a", 2, 20000);
+
+    EMA_print_calltree(stdout);
+    EMA_filter_finalize(filter);
+    EMA_finalize();
+
+    /* calltree.EMA.<pid> is only written with EMA_CALLTREE=1. */
+    char filename[64];
+    snprintf(filename, sizeof(filename), "calltree.EMA.%u", getpid());
+    int opt_in = access(filename, F_OK) != 0;
+    printf("%s: calltree file is opt-in\n", opt_in ? "ok" : "FAILED");
+    failed |= !opt_in;
+
+    return failed;
+}
@@ -0,0 +1,111 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <EMA.h>
+
+/* File-backed stand-in of the MSR layout of a single cpu. */
+#define MSR_RAPL_POWER_UNIT 0x606
+#define MSR_PKG_ENERGY_STATUS 0x611
+#define MSR_DRAM_ENERGY_STATUS 0x619
+#define MSR_PP0_ENERGY_STATUS 0x639
+
+/* Energy unit 1/2^14 J = 61.03515625 uJ. */
+#define POWER_UNITS 0x000a0e03ULL
+
+static
+int write_msr(int fd, off_t msr, uint64_t value)
+{
+    return pwrite(fd, &value, sizeof(value), msr) != sizeof(value);
+}
+
+int main(int argc, char **argv)
+{
+    char dir[] = "/tmp/EMA_msr_XXXXXX";
+    if( !mkdtemp(dir) )
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    char cpu_dir[128], msr_file[128], tmpl[128];
+    snprintf(cpu_dir, sizeof(cpu_dir), "%s/0", dir);
+    snprintf(msr_file, sizeof(msr_file), "%s/0/msr", dir);
+    snprintf(tmpl, sizeof(tmpl), "%s/%%d/msr", dir);
+    mkdir(cpu_dir, 0700);
+
+    int fd = open(msr_file, O_RDWR | O_CREAT, 0600);
+    if( fd < 0 )
+    {
+        perror("open");
+        return 1;
+    }
+    write_msr(fd, MSR_RAPL_POWER_UNIT, POWER_UNITS);
+    write_msr(fd, MSR_PKG_ENERGY_STATUS, 0x10000);
+    write_msr(fd, MSR_DRAM_ENERGY_STATUS, 0x4000);
+    write_msr(fd, MSR_PP0_ENERGY_STATUS, 0x8000);
+
+    setenv("EMA_RAPL_BACKEND", "msr", 1);
+    setenv("EMA_RAPL_MSR_PATH", tmpl, 1);
+
+    printf("Initializing EMA...\n");
+    int err = EMA_init(NULL);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+
+    DevicePtrArray devices = EMA_get_devices();
+    printf("Number of devices: %lu\n", devices.size);
+
+    /* Expected values: raw * 10^6 >> 14. */
+    const char* names[] = { "CPU-0.package-0", "CPU-0.core", "CPU-0.dram" };
+    unsigned long long expected[] = { 4000000, 2000000, 1000000 };
+    int failed = devices.size != 3;
+    for(size_t i = 0; i < devices.size && i < 3; ++i)
+    {
+        const char* name = EMA_get_device_name(devices.array[i]);
+        unsigned long long energy = EMA_get_energy_uj(devices.array[i]);
+        printf("Device %lu: %s: %llu uJ\n", i, name, energy);
+        if( strcmp(name, names[i]) != 0 || energy != expected[i] )
+            failed = 1;
+    }
+
+    EMA_REGION_DECLARE(region);
+    EMA_REGION_DEFINE(&region, "msr");
+
+    EMA_REGION_BEGIN(region);
+    write_msr(fd, MSR_PKG_ENERGY_STATUS, 0x20000);
+    EMA_REGION_END(region);
+
+    printf("Output:\n");
+    EMA_print_all(stdout);
+
+    printf("Finalizing EMA...\n");
+    err = EMA_finalize();
+    if( err )
+    {
+        printf("Failed to finalize EMA: %d\n", err);
+        return 1;
+    }
+
+    close(fd);
+    unlink(msr_file);
+    rmdir(cpu_dir);
+    rmdir(dir);
+
+    if( failed )
+    {
+        printf("Unexpected MSR devices or values.\n");
+        return 1;
+    }
+
+    return 0;
+}
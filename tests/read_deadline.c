@@ -0,0 +1,197 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include <EMA.h>
+#include <EMA/core/guard.h>
+#include <EMA/core/overflow.h>
+#include <EMA/core/plugin.h>
+#include <EMA/core/registry.h>
+#include <EMA/region/region.h>
+
+#include "test_utils.h"
+
+/* External meter stand-in whose reads can be made to hang. */
+#define PLUGIN_NAME "METER"
+#define DEADLINE_US 20000
+#define HANG_US 500000
+#define NUM_DEVICES 2
+
+static Device meter_device[NUM_DEVICES];
+static DeviceArray meter_devices = {
+    .array = meter_device, .size = NUM_DEVICES };
+static atomic_uint hang_us;
+
+static
+unsigned long long meter_get_energy_uj(const Device* device)
+{
+    unsigned int us = atomic_load(&hang_us);
+    if( us )
+        usleep(us);
+    return EMA_get_time_in_us();
+}
+
+static
+unsigned long long meter_get_energy_max(const Device* device)
+{
+    return ~0ULL;
+}
+
+static
+unsigned long long meter_get_energy_update_interval(const Device* device)
+{
+    return 0;
+}
+
+static
+DeviceArray meter_get_devices(const Plugin* plugin)
+{
+    return meter_devices;
+}
+
+static
+int meter_init(Plugin* plugin)
+{
+    static const char* uids[NUM_DEVICES] = { "0", "1" };
+    for(int i = 0; i < NUM_DEVICES; ++i)
+    {
+        meter_device[i].plugin = plugin;
+        meter_device[i].name = "meter";
+        meter_device[i].type = "misc";
+        meter_device[i].uid = uids[i];
+        meter_device[i].data = NULL;
+        if( EMA_init_overflow(meter_device + i) )
+            return 1;
+    }
+    return 0;
+}
+
+static
+int meter_finalize(Plugin* plugin)
+{
+    for(int i = 0; i < NUM_DEVICES; ++i)
+        EMA_finalize_overflow(meter_device + i);
+    return 0;
+}
+
+static
+int register_meter_plugin(void)
+{
+    Plugin* plugin = calloc(1, sizeof(Plugin));
+    plugin->cbs.init = meter_init;
+    plugin->cbs.get_devices = meter_get_devices;
+    plugin->cbs.get_energy_update_interval = meter_get_energy_update_interval;
+    plugin->cbs.get_energy_max = meter_get_energy_max;
+    plugin->cbs.get_energy_uj = meter_get_energy_uj;
+    plugin->cbs.finalize = meter_finalize;
+    plugin->name = PLUGIN_NAME;
+    return EMA_register_plugin(plugin);
+}
+
+static
+DevicePtrArray only_meter(DevicePtrArray devices, Filter* filter)
+{
+    DevicePtrArray filtered = { .array = malloc(sizeof(Device*)), .size = 0 };
+    for(size_t i = 0; i < devices.size; ++i)
+        if( strcmp(devices.array[i]->plugin->name, PLUGIN_NAME) == 0 )
+            filtered.array[filtered.size++] = devices.array[i];
+    return filtered;
+}
+
+/* Measure one visit, returns the time the region boundaries took in us. */
+static
+unsigned long long visit(Region* region)
+{
+    unsigned long long start = EMA_get_time_in_us();
+    EMA_region_begin(region);
+    EMA_region_end(region);
+    return EMA_get_time_in_us() - start;
+}
+
+/* Failures counted by the guard of the meter. */
+static
+unsigned int failures(void)
+{
+    ReadGuard* guard = meter_device[0].guard;
+    pthread_mutex_lock(&guard->mutex);
+    unsigned int n = guard->failures;
+    pthread_mutex_unlock(&guard->mutex);
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+
+    setenv("EMA_READ_DEADLINE_US", PLUGIN_NAME ":20000", 1);
+    setenv("EMA_READ_FAILURES", "2", 1);
+    setenv("EMA_READ_PROBE_MS", "50", 1);
+
+    int err = EMA_init(register_meter_plugin);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+
+    Filter* filter = EMA_filter_create(only_meter, NULL);
+    Region *healthy, *hanging, *late, *missed, *open, *recovered;
+    EMA_region_create_and_init(&healthy, "healthy", filter, "", 0, "");
+    EMA_region_create_and_init(&hanging, "hanging", filter, "", 0, "");
+    EMA_region_create_and_init(&late, "late", filter, "", 0, "");
+    EMA_region_create_and_init(&missed, "missed", filter, "", 0, "");
+    EMA_region_create_and_init(&open, "open", filter, "", 0, "");
+    EMA_region_create_and_init(&recovered, "recovered", filter, "", 0, "");
+
+    failed |= check(meter_device[0].guard
+        && meter_device[0].guard == meter_device[1].guard,
+        "one guard per plugin");
+
+    visit(healthy);
+    failed |= check(!healthy->measurements.stale[0]
+        && !healthy->measurements.stale[1], "fresh reads");
+
+    /* Both devices hang in the same read: one deadline, one failure. */
+    atomic_store(&hang_us, HANG_US);
+    unsigned long long elapsed = visit(hanging);
+    failed |= check(hanging->measurements.stale[0]
+        && hanging->measurements.stale[1], "stale fallback");
+    failed |= check(elapsed < 2 * DEADLINE_US, "bounded by one deadline");
+    failed |= check(failures() == 1, "one failure per missed read");
+
+    elapsed = visit(late);
+    failed |= check(late->measurements.stale[0], "late read in flight");
+    failed |= check(elapsed < DEADLINE_US, "a late read is waited for once");
+
+    /* Let the late read finish, then miss a second one. */
+    atomic_store(&hang_us, 0);
+    usleep(NUM_DEVICES * HANG_US + 200000);
+    atomic_store(&hang_us, HANG_US);
+    visit(missed);
+    failed |= check(failures() == 2, "second missed read");
+
+    elapsed = visit(open);
+    failed |= check(open->measurements.stale[0], "breaker open");
+    failed |= check(elapsed < DEADLINE_US, "open breaker skips the read");
+
+    /* Let the pending read finish and a probe close the breaker. */
+    atomic_store(&hang_us, 0);
+    usleep(NUM_DEVICES * HANG_US + 200000);
+    visit(recovered);
+    failed |= check(
+        !recovered->measurements.stale[0], "probe closes breaker");
+
+    EMA_region_finalize(healthy);
+    EMA_region_finalize(hanging);
+    EMA_region_finalize(late);
+    EMA_region_finalize(missed);
+    EMA_region_finalize(open);
+    EMA_region_finalize(recovered);
+    EMA_filter_finalize(filter);
+    EMA_finalize();
+
+    return failed;
+}
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <EMA.h>
+#include <EMA/region/region.h>
+#include <EMA/region/sampling.h>
+
+#define READ_LATENCY_US 20
+#define MOCK_READ_LATENCY_US READ_LATENCY_US
+
+#include "test_utils.h"
+
+#define VISITS 200
+#define VISIT_US 500
+
+static Filter* filter;
+static const Device* device;
+
+static
+Region* run(
+    const char* idf, const SamplingPolicy* policy, unsigned long long us)
+{
+    Region* region;
+    EMA_region_create_and_init(
+        &region, idf, filter, __FILE__, __LINE__, __func__);
+    if( EMA_region_set_sampling(region, policy) != 0 )
+        return NULL;
+
+    for(int i = 0; i < VISITS; ++i)
+    {
+        EMA_region_begin(region);
+        busy_wait(us);
+        EMA_region_end(region);
+    }
+    return region;
+}
+
+/* At 1 W, the energy in uJ equals the time in us. */
+static
+int check_extrapolation(const Region* region)
+{
+    unsigned long long energy, error;
+    if( EMA_region_get_energy(region, device, &energy, &error) != 0 )
+        return 0;
+
+    double time = region->measurements.time_result[0];
+    printf("%s: %llu of %llu visits measured, %llu +/- %llu uJ in %.0f us\n",
+        region->idf, region->measured_visits, region->visits, energy, error,
+        time);
+    return energy > 0.95 * time && energy < 1.05 * time && error < 0.05 * time;
+}
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+
+    int err = EMA_init(register_mock);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+
+    filter = EMA_filter_exclude_plugin("RAPL");
+    DevicePtrArray devices = EMA_get_devices();
+    for(size_t i = 0; i < devices.size; ++i)
+        if( strcmp(EMA_get_device_name(devices.array[i]), "mock-0") == 0 )
+            device = devices.array[i];
+
+    SamplingPolicy nth = { .mode = EMA_SAMPLE_EVERY_NTH, .every_n = 10 };
+    Region* region = run("nth", &nth, VISIT_US);
+    failed |= check(region && region->visits == VISITS
+        && region->measured_visits == VISITS / 10, "every n-th visit");
+    failed |= check(region && check_extrapolation(region), "extrapolation");
+
+    SamplingPolicy interval = {
+        .mode = EMA_SAMPLE_INTERVAL, .interval_us = 10 * VISIT_US };
+    region = run("interval", &interval, VISIT_US);
+    failed |= check(region && region->measured_visits >= VISITS / 20
+        && region->measured_visits <= VISITS / 8, "minimum interval");
+    failed |= check(region && check_extrapolation(region), "extrapolation");
+
+    /* Reads cost about 8 times the region time: only every ~80th visit
+     * stays below 10% overhead. A long region keeps every visit. */
+    SamplingPolicy adaptive = {
+        .mode = EMA_SAMPLE_ADAPTIVE, .max_overhead = 0.1 };
+    region = run("adaptive_short", &adaptive, READ_LATENCY_US / 4);
+    failed |= check(region && region->sampler.stride >= 10
+        && region->measured_visits < VISITS / 2, "adaptive downgrade");
+    region = run("adaptive_long", &adaptive, 10 * VISIT_US);
+    failed |= check(region && region->measured_visits == VISITS,
+        "adaptive long region");
+    failed |= check(region && check_extrapolation(region), "extrapolation");
+
+    SamplingPolicy invalid = { .mode = EMA_SAMPLE_EVERY_NTH, .every_n = 0 };
+    failed |= check(region && EMA_region_set_sampling(region, &invalid) != 0,
+        "invalid policy");
+    failed |= check(EMA_sampling_configure_from_string("nth:4") == 0
+        && EMA_sampling_default.every_n == 4, "parse config");
+    failed |= check(EMA_sampling_configure_from_string("nth:x") != 0
+        && EMA_sampling_configure_from_string("often:1") != 0,
+        "reject config");
+
+    EMA_filter_finalize(filter);
+    EMA_finalize();
+
+    return failed;
+}
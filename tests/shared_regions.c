@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include <EMA.h>
+#include <EMA/region/shared.h>
+
+#include "test_utils.h"
+
+#define NUM_THREADS 8
+#define VISITS 10000
+
+static Filter* filter;
+static SharedRegion* defined[NUM_THREADS];
+static pthread_barrier_t barrier;
+
+static
+void* work(void* arg)
+{
+    long idx = (long) arg;
+
+    /* All threads define the region at once. */
+    pthread_barrier_wait(&barrier);
+    EMA_SHARED_REGION_DECLARE(loop);
+    EMA_SHARED_REGION_DEFINE_WITH_FILTER(&loop, "loop", filter);
+    defined[idx] = loop;
+    pthread_barrier_wait(&barrier);
+
+    for(int i = 0; i < VISITS; ++i)
+    {
+        EMA_shared_region_begin(loop);
+        EMA_shared_region_end(loop);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+
+    int err = EMA_init(register_mock);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+
+    filter = EMA_filter_exclude_plugin("RAPL");
+    pthread_barrier_init(&barrier, NULL, NUM_THREADS + 1);
+
+    pthread_t threads[NUM_THREADS];
+    for(long i = 0; i < NUM_THREADS; ++i)
+        pthread_create(threads + i, NULL, work, (void*) i);
+
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+    SharedRegion* loop = defined[0];
+    EMA_shared_region_phase_begin(loop);
+    for(long i = 0; i < NUM_THREADS; ++i)
+        pthread_join(threads[i], NULL);
+    EMA_shared_region_phase_end(loop);
+
+    int same = 1;
+    for(int i = 1; i < NUM_THREADS; ++i)
+        same &= defined[i] == loop;
+    failed |= check(same, "defined once");
+
+    unsigned long long visits, time_us;
+    EMA_shared_region_get_visits(loop, &visits, &time_us);
+    failed |= check(visits == NUM_THREADS * VISITS, "visits of all threads");
+    failed |= check(loop->region->visits == 1, "one reading per phase");
+
+    const Device* device = NULL;
+    DevicePtrArray devices = EMA_get_devices();
+    for(size_t i = 0; i < devices.size; ++i)
+        if( strcmp(EMA_get_device_name(devices.array[i]), "mock-0") == 0 )
+            device = devices.array[i];
+
+    /* At 1 W, the energy in uJ equals the time in us. */
+    unsigned long long energy;
+    double phase_us = loop->region->measurements.time_result[0];
+    failed |= check(
+        EMA_region_get_energy(loop->region, device, &energy, NULL) == 0
+        && energy > 0.95 * phase_us && energy < 1.05 * phase_us,
+        "phase energy");
+
+    EMA_shared_region_begin(loop);
+    failed |= check(
+        EMA_shared_region_phase_begin(loop) == 0
+        && EMA_shared_region_phase_begin(loop) != 0, "overlapping phases");
+    EMA_shared_region_phase_end(loop);
+    EMA_SHARED_REGION_DECLARE(other);
+    EMA_SHARED_REGION_DEFINE_WITH_FILTER(&other, "other", filter);
+    failed |= check(EMA_shared_region_end(other) != 0, "nesting checked");
+    EMA_shared_region_end(loop);
+
+    pthread_barrier_destroy(&barrier);
+    EMA_filter_finalize(filter);
+    EMA_finalize();
+
+    return failed;
+}
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <EMA.h>
+
+#define NUM_DEVICES 2
+#define MOCK_NUM_DEVICES NUM_DEVICES
+
+#include "test_utils.h"
+
+static Filter* filter;
+static pthread_t main_thread;
+static FILE* csv;
+
+/* Keeps what an in-memory sink of the application would look at. */
+typedef struct
+{
+    pthread_mutex_t mutex;
+    int outputs[3];  // by OutputKind
+    int ends, failed_ends, finalized;
+    int batches, bad_batches;
+    unsigned long long work_visits;  // of the results
+    unsigned long long snapshot_visits;  // of the last complete snapshot
+    unsigned long long pending_visits;
+    int snapshot_on_main, all_threads;
+    OutputKind kind;
+} MemorySink;
+
+static MemorySink memory = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+static MemorySink failing = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static
+int memory_begin(const OutputInfo* info, void* usr)
+{
+    MemorySink* sink = usr;
+    pthread_mutex_lock(&sink->mutex);
+    ++sink->outputs[info->kind];
+    sink->kind = info->kind;
+    if( info->kind == EMA_OUTPUT_SNAPSHOTS )
+    {
+        sink->pending_visits = 0;
+        sink->snapshot_on_main |= pthread_equal(pthread_self(), main_thread);
+    }
+    pthread_mutex_unlock(&sink->mutex);
+    return 0;
+}
+
+static
+int memory_records(const OutputRecord* records, size_t n, void* usr)
+{
+    MemorySink* sink = usr;
+    pthread_mutex_lock(&sink->mutex);
+    ++sink->batches;
+    int same = n == NUM_DEVICES;
+    for(size_t i = 1; i < n; ++i)
+        same &= records[i].idf == records[0].idf
+            && records[i].thread == records[0].thread
+            && records[i].device != records[0].device;
+    sink->bad_batches += !same;
+
+    if( strcmp(records[0].idf, "work") == 0 )
+    {
+        if( sink->kind == EMA_OUTPUT_RESULTS )
+            sink->work_visits += records[0].visits;
+        else
+        {
+            sink->pending_visits += records[0].visits;
+            sink->all_threads = records[0].thread == EMA_OUTPUT_ALL_THREADS;
+        }
+    }
+    pthread_mutex_unlock(&sink->mutex);
+    return 0;
+}
+
+static
+int failing_records(const OutputRecord* records, size_t n, void* usr)
+{
+    memory_records(records, n, usr);
+    return 1;
+}
+
+static
+int memory_end(int failed, void* usr)
+{
+    MemorySink* sink = usr;
+    pthread_mutex_lock(&sink->mutex);
+    ++sink->ends;
+    sink->failed_ends += failed;
+    if( sink->kind == EMA_OUTPUT_SNAPSHOTS )
+        sink->snapshot_visits = sink->pending_visits;
+    pthread_mutex_unlock(&sink->mutex);
+    return 0;
+}
+
+static
+void memory_finalize(void* usr)
+{
+    MemorySink* sink = usr;
+    ++sink->finalized;
+}
+
+static
+int register_sinks(void)
+{
+    int err = register_mock();
+
+    OutputSink sink = {
+        .kinds = EMA_OUTPUT_RESULTS | EMA_OUTPUT_SNAPSHOTS,
+        .begin = memory_begin,
+        .records = memory_records,
+        .end = memory_end,
+        .finalize = memory_finalize,
+        .usr = &memory,
+    };
+    err = err || EMA_register_output_sink(&sink);
+
+    sink.kinds = EMA_OUTPUT_RESULTS;
+    sink.records = failing_records;
+    sink.usr = &failing;
+    err = err || EMA_register_output_sink(&sink);
+
+    err = err || EMA_output_sink_csv(&sink, csv);
+    return err || EMA_register_output_sink(&sink);
+}
+
+static
+void visit(const char* idf, int n)
+{
+    Region* region = NULL;
+    EMA_region_define(&region, idf, filter, "tests/sinks.c", 0, "visit");
+    for(int i = 0; i < n; ++i)
+    {
+        EMA_region_begin(region);
+        EMA_region_end(region);
+    }
+}
+
+static
+void* visit_and_exit(void* arg)
+{
+    visit("work", 4);
+    return NULL;
+}
+
+static
+int snapshots_seen(void)
+{
+    pthread_mutex_lock(&memory.mutex);
+    int n = memory.outputs[EMA_OUTPUT_SNAPSHOTS];
+    pthread_mutex_unlock(&memory.mutex);
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+    main_thread = pthread_self();
+    csv = tmpfile();
+
+    int err = EMA_init(register_sinks);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+    filter = EMA_filter_exclude_plugin("RAPL");
+
+    visit("work", 3);
+    visit("other", 1);
+    pthread_t thread;
+    pthread_create(&thread, NULL, visit_and_exit, NULL);
+    pthread_join(thread, NULL);
+
+    /* Snapshots reach the sinks of their kind on the exporter thread. */
+    failed |= check(EMA_export_start(EMA_EXPORT_CUMULATIVE, 1) == 0,
+        "start the exporter");
+    for(int i = 0; i < 1000 && snapshots_seen() < 2; ++i)
+        usleep(1000);
+    failed |= check(snapshots_seen() >= 2, "snapshots reach the sink");
+
+    pthread_mutex_lock(&memory.mutex);
+    failed |= check(!memory.snapshot_on_main, "snapshots off the main thread");
+    failed |= check(memory.snapshot_visits == 7 && memory.all_threads,
+        "snapshot records sum the threads");
+    pthread_mutex_unlock(&memory.mutex);
+    failed |= check(failing.outputs[EMA_OUTPUT_SNAPSHOTS] == 0,
+        "sinks only get their kinds");
+
+    /* Results in EMA_finalize, after the last snapshot. */
+    EMA_filter_finalize(filter);
+    failed |= check(EMA_finalize() == 0, "a failing sink does not fail EMA");
+
+    failed |= check(memory.outputs[EMA_OUTPUT_RESULTS] == 1
+        && memory.kind == EMA_OUTPUT_RESULTS, "results reach the sink last");
+    failed |= check(memory.work_visits == 7,
+        "results of the running and the exited thread");
+    failed |= check(memory.bad_batches == 0,
+        "a batch per region with all its devices");
+    failed |= check(memory.ends == memory.outputs[EMA_OUTPUT_RESULTS]
+        + memory.outputs[EMA_OUTPUT_SNAPSHOTS] && memory.failed_ends == 0,
+        "end per output");
+
+    failed |= check(failing.batches == 1 && failing.ends == 1
+        && failing.failed_ends == 1, "a failing sink misses the rest");
+    failed |= check(memory.finalized == 1 && failing.finalized == 1,
+        "sinks finalized once");
+
+    /* The CSV sink holds the same rows as output.EMA.<pid>. */
+    char line[512];
+    int rows = 0;
+    rewind(csv);
+    failed |= check(fgets(line, sizeof(line), csv)
+        && strncmp(line, "thread,region_idf,", 18) == 0, "CSV header");
+    while( fgets(line, sizeof(line), csv) )
+        ++rows;
+    failed |= check(rows == 3 * NUM_DEVICES, "CSV sink rows");
+    fclose(csv);
+    return failed;
+}
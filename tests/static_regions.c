@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include <EMA.h>
+#include <EMA/region/region.h>
+
+#include "test_utils.h"
+
+#define NUM_THREADS 4
+
+static Filter* filter;
+static Region* defined[NUM_THREADS][4];
+
+/* Threads wait until their regions are checked; exited threads give their
+ * regions up. */
+static pthread_barrier_t visited, checked;
+
+/* The descriptors of this program got the ids 0 to n-1 before main. */
+static
+int check_ids(void)
+{
+    size_t n = __stop_ema_regions - __start_ema_regions;
+    int seen[n ? n : 1];
+    memset(seen, 0, sizeof(seen));
+
+    for(size_t i = 0; i < n; ++i)
+    {
+        int id = __start_ema_regions[i].id;
+        if( id < 0 || (size_t) id >= n || seen[id]++ )
+            return 0;
+    }
+    return n == 4;
+}
+
+static
+void* visit(void* arg)
+{
+    long idx = (long) arg;
+
+    EMA_REGION_DECLARE(first);
+    EMA_REGION_DEFINE_WITH_FILTER(&first, "first", filter);
+    EMA_REGION_BEGIN(first);
+    EMA_REGION_END(first);
+    defined[idx][0] = first;
+
+    /* A fresh pointer finds the thread's region of the same descriptor. */
+    for(int i = 0; i < 2; ++i)
+    {
+        Region* second = NULL;
+        EMA_REGION_DEFINE_WITH_FILTER(&second, "second", filter);
+        EMA_REGION_BEGIN(second);
+        EMA_REGION_END(second);
+        if( i > 0 && second != defined[idx][1] )
+            defined[idx][1] = NULL;
+        else
+            defined[idx][1] = second;
+    }
+
+    /* Identifiers only known at runtime are defined dynamically. */
+    char name[32];
+    snprintf(name, sizeof(name), "runtime-%ld", idx);
+    Region* runtime = NULL;
+    EMA_REGION_DEFINE_WITH_FILTER(&runtime, name, filter);
+    defined[idx][2] = runtime;
+
+    Region* third = NULL;
+    EMA_REGION_DEFINE_STATIC_WITH_FILTER(&third, "third", filter);
+    defined[idx][3] = third;
+
+    pthread_barrier_wait(&visited);
+    pthread_barrier_wait(&checked);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+
+    failed |= check(check_ids(), "ids assigned at load time");
+
+    int err = EMA_init(register_mock);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+
+    filter = EMA_filter_exclude_plugin("RAPL");
+    pthread_barrier_init(&visited, NULL, NUM_THREADS + 1);
+    pthread_barrier_init(&checked, NULL, NUM_THREADS + 1);
+    pthread_t threads[NUM_THREADS];
+    for(long i = 0; i < NUM_THREADS; ++i)
+        pthread_create(threads + i, NULL, visit, (void*) i);
+    pthread_barrier_wait(&visited);
+
+    int ok = 1;
+    for(int i = 0; i < NUM_THREADS; ++i)
+    {
+        ok &= defined[i][0] && defined[i][1];
+        ok &= defined[i][0] && defined[i][0]->descriptor
+            && strcmp(defined[i][0]->idf, "first") == 0
+            && defined[i][0]->visits == 1;
+        ok &= defined[i][1] && defined[i][1]->visits == 2;
+        for(int j = 0; j < i; ++j)
+            ok &= defined[i][0] != defined[j][0];
+    }
+    failed |= check(ok, "one region per descriptor and thread");
+
+    ok = 1;
+    for(long i = 0; i < NUM_THREADS; ++i)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "runtime-%ld", i);
+        ok &= defined[i][2] && !defined[i][2]->descriptor
+            && strcmp(defined[i][2]->idf, name) == 0;
+    }
+    failed |= check(ok, "runtime identifiers");
+    failed |= check(defined[0][3] && defined[0][3]->descriptor
+        && strcmp(defined[0][3]->idf, "third") == 0, "literal-only macro");
+
+    pthread_barrier_wait(&checked);
+    for(long i = 0; i < NUM_THREADS; ++i)
+        pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&visited);
+    pthread_barrier_destroy(&checked);
+
+    EMA_filter_finalize(filter);
+    EMA_finalize();
+
+    return failed;
+}
@@ -0,0 +1,52 @@
+#ifndef EMA_TESTS_TEST_UTILS_H
+#define EMA_TESTS_TEST_UTILS_H
+
+#include <stdio.h>
+
+#include <EMA.h>
+#include <EMA/plugins/plugin_mock.user.h>
+
+/* The devices of `register_mock`; a test defines these before including
+ * this file to change them. */
+#ifndef MOCK_NUM_DEVICES
+    #define MOCK_NUM_DEVICES 1
+#endif
+#ifndef MOCK_READ_LATENCY_US
+    #define MOCK_READ_LATENCY_US 0
+#endif
+#ifndef MOCK_LATENCY_MODE
+    #define MOCK_LATENCY_MODE MOCK_LATENCY_BUSY
+#endif
+
+/* Prints the outcome of a check and returns 1 if it failed. */
+static inline
+int check(int cond, const char* what)
+{
+    printf("%s: %s\n", cond ? "ok" : "FAILED", what);
+    return !cond;
+}
+
+/* Registers the mock plugin with 1 W devices, so the energy in uJ equals
+ * the time in us. */
+static inline
+int register_mock(void)
+{
+    MockPluginConfig config = {
+        .num_devices = MOCK_NUM_DEVICES,
+        .read_latency_us = MOCK_READ_LATENCY_US,
+        .latency_mode = MOCK_LATENCY_MODE,
+        .power_model = MOCK_POWER_RAMP,
+        .power_w = 1.0,
+    };
+    return register_mock_plugin("MOCK", &config);
+}
+
+static inline
+void busy_wait(unsigned long long us)
+{
+    unsigned long long end = EMA_get_time_in_us() + us;
+    while( EMA_get_time_in_us() < end )
+        ;
+}
+
+#endif
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include <EMA.h>
+#include <EMA/region/region.h>
+#include <EMA/region/region_store.h>
+
+#include "test_utils.h"
+
+/* More threads than the former fixed limit of 1024. */
+#define SEQUENTIAL_THREADS 1500
+#define CONCURRENT_THREADS 16
+#define ROUNDS 8
+#define TOTAL_THREADS (SEQUENTIAL_THREADS + CONCURRENT_THREADS * ROUNDS)
+
+static Filter* filter;
+
+static
+void* work(void* arg)
+{
+    EMA_REGION_DECLARE(worker);
+    EMA_REGION_DEFINE_WITH_FILTER(&worker, "worker", filter);
+    for(int i = 0; i < 2; ++i)
+    {
+        EMA_REGION_BEGIN(worker);
+        EMA_REGION_END(worker);
+    }
+
+    Region* dynamic = NULL;
+    EMA_region_define(&dynamic, "dynamic", filter, "thread_slots.c", 0, "");
+    EMA_REGION_BEGIN(dynamic);
+    EMA_REGION_END(dynamic);
+    return NULL;
+}
+
+typedef struct
+{
+    unsigned long long worker_visits;
+    unsigned long long dynamic_visits;
+    unsigned long long node_visits;
+    int live_stores;
+} Retired;
+
+static
+int count_region(Region* region, void* usr)
+{
+    Retired* retired = usr;
+    if( strcmp(region->idf, "worker") == 0 )
+        retired->worker_visits += region->visits;
+    else if( strcmp(region->idf, "dynamic") == 0 )
+        retired->dynamic_visits += region->visits;
+    return 0;
+}
+
+static
+int count_store(const RegionStore* store, int thread_idx, void* usr)
+{
+    Retired* retired = usr;
+    if( thread_idx != EMA_RETIRED_THREADS )
+    {
+        ++retired->live_stores;
+        return 0;
+    }
+
+    const CallTree* tree = EMA_region_store_get_calltree(store);
+    for(const CallNode* node = tree->root.child; node; node = node->next)
+        if( strcmp(node->idf, "worker") == 0 )
+            retired->node_visits += node->visits;
+    return EMA_region_store_iterate(store, count_region, usr);
+}
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+
+    int err = EMA_init(register_mock);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+
+    filter = EMA_filter_exclude_plugin("RAPL");
+    work(NULL);
+
+    pthread_t threads[CONCURRENT_THREADS];
+    for(int i = 0; i < SEQUENTIAL_THREADS; ++i)
+    {
+        pthread_create(threads, NULL, work, NULL);
+        pthread_join(threads[0], NULL);
+    }
+    failed |= check(EMA_thread_get_count() == 2, "slots reused");
+
+    for(int round = 0; round < ROUNDS; ++round)
+    {
+        for(int i = 0; i < CONCURRENT_THREADS; ++i)
+            pthread_create(threads + i, NULL, work, NULL);
+        for(int i = 0; i < CONCURRENT_THREADS; ++i)
+            pthread_join(threads[i], NULL);
+    }
+    failed |= check(
+        EMA_thread_get_count() <= CONCURRENT_THREADS + 1, "slots bounded");
+
+    Retired retired = { 0 };
+    EMA_region_stores_iterate(count_store, &retired);
+    printf("retired: %llu worker, %llu dynamic visits\n",
+        retired.worker_visits, retired.dynamic_visits);
+    failed |= check(retired.live_stores == 1, "only the main thread is live");
+    failed |= check(
+        retired.worker_visits == 2 * TOTAL_THREADS, "static regions merged");
+    failed |= check(
+        retired.dynamic_visits == TOTAL_THREADS, "runtime regions merged");
+    failed |= check(
+        retired.node_visits == 2 * TOTAL_THREADS, "call trees merged");
+
+    EMA_filter_finalize(filter);
+    EMA_finalize();
+
+    return failed;
+}
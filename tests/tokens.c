@@ -0,0 +1,200 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include <EMA.h>
+#include <EMA/region/region.h>
+#include <EMA/region/shared.h>
+
+#define MOCK_NUM_DEVICES (EMA_TOKEN_MAX_DEVICES + 1)
+
+#include "test_utils.h"
+
+#define NUM_THREADS 8
+#define OPEN_TOKENS 64
+#define TOKENS_PER_THREAD 2000
+#define VISIT_US 200
+#define MIXED_VISITS 2000
+#define SHORT_VISITS 1000
+#define SHORT_US 5
+
+static Region* region;
+static Filter* filter;
+static RegionToken open_tokens[OPEN_TOKENS];
+static RegionToken orphan_tokens[NUM_THREADS][2];
+static RegionToken mixed_tokens[MIXED_VISITS];
+
+static
+DevicePtrArray only_first(DevicePtrArray devices, Filter* filter)
+{
+    DevicePtrArray filtered = { .array = malloc(sizeof(Device*)), .size = 0 };
+    for(size_t i = 0; i < devices.size; ++i)
+        if( strcmp(EMA_get_device_name(devices.array[i]), "mock-0") == 0 )
+            filtered.array[filtered.size++] = devices.array[i];
+    return filtered;
+}
+
+/* End tokens begun on the main thread, then begin and end own ones. */
+static
+void* work(void* arg)
+{
+    long idx = (long) arg;
+    for(long i = idx; i < OPEN_TOKENS; i += NUM_THREADS)
+        EMA_region_end_token(open_tokens + i);
+
+    for(int i = 0; i < TOKENS_PER_THREAD; ++i)
+    {
+        RegionToken token = EMA_region_begin_token(region);
+        EMA_region_end_token(&token);
+    }
+    return NULL;
+}
+
+/* Begin tokens of a region of the thread, which is retired on exit. */
+static
+void* begin_and_exit(void* arg)
+{
+    RegionToken* tokens = arg;
+    Region* local = NULL;
+    EMA_region_define(&local, "orphan", filter, "tests/tokens.c", 0, "");
+    tokens[0] = EMA_region_begin_token(local);
+    tokens[1] = EMA_region_begin_token(local);
+    return NULL;
+}
+
+static
+void* end_tokens(void* arg)
+{
+    RegionToken* tokens = arg;
+    for(int i = 0; i < MIXED_VISITS; ++i)
+        EMA_region_end_token(tokens + i);
+    return NULL;
+}
+
+/* Ordinary visits of a region while its tokens end on another thread. */
+static
+void* visit_mixed(void* arg)
+{
+    RegionToken* tokens = arg;
+    Region* local = NULL;
+    EMA_region_define(&local, "mixed", filter, "tests/tokens.c", 0, "");
+    for(int i = 0; i < MIXED_VISITS; ++i)
+        tokens[i] = EMA_region_begin_token(local);
+
+    pthread_t ender;
+    pthread_create(&ender, NULL, end_tokens, tokens);
+    for(int i = 0; i < MIXED_VISITS; ++i)
+    {
+        EMA_region_begin(local);
+        EMA_region_end(local);
+    }
+    pthread_join(ender, NULL);
+    return (void*) (uintptr_t) (local->visits == MIXED_VISITS);
+}
+
+static
+unsigned long long token_visits(const RegionToken* token)
+{
+    unsigned long long visits = 0;
+    EMA_shared_region_get_visits(token->region, &visits, NULL);
+    return visits;
+}
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+
+    int err = EMA_init(register_mock);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+
+    filter = EMA_filter_create(only_first, NULL);
+    EMA_region_create_and_init(&region, "handler", filter, "", 0, "");
+
+    /* Overlapping visits of the same region. */
+    for(int i = 0; i < OPEN_TOKENS; ++i)
+    {
+        open_tokens[i] = EMA_region_begin_token(region);
+        busy_wait(VISIT_US / 10);
+    }
+    busy_wait(VISIT_US);
+
+    pthread_t threads[NUM_THREADS];
+    for(long i = 0; i < NUM_THREADS; ++i)
+        pthread_create(threads + i, NULL, work, (void*) i);
+    for(long i = 0; i < NUM_THREADS; ++i)
+        pthread_join(threads[i], NULL);
+
+    failed |= check(token_visits(open_tokens)
+        == OPEN_TOKENS + NUM_THREADS * TOKENS_PER_THREAD,
+        "visits of all tokens");
+    failed |= check(region->visits == 0, "tokens leave the region alone");
+
+    /* The tokens overlapped, so their times add up to more than the
+     * elapsed time; at 1 W the energy in uJ equals the time in us. */
+    const Measurements* tokens = &open_tokens[0].region->region->measurements;
+    double time = tokens->time_result[0];
+    double energy = tokens->energy_result[0];
+    failed |= check(time >= OPEN_TOKENS * VISIT_US, "overlapping times");
+    failed |= check(
+        energy > 0.95 * time && energy < 1.05 * time, "energy of tokens");
+
+    /* Tokens end after the threads that began them exited. */
+    for(long i = 0; i < NUM_THREADS; ++i)
+    {
+        pthread_create(threads + i, NULL, begin_and_exit, orphan_tokens[i]);
+        pthread_join(threads[i], NULL);
+    }
+    int same = 1;
+    for(long i = 0; i < NUM_THREADS; ++i)
+    {
+        same &= orphan_tokens[i][0].region == orphan_tokens[0][0].region;
+        EMA_region_end_token(orphan_tokens[i]);
+        EMA_region_end_token(orphan_tokens[i] + 1);
+    }
+    failed |= check(same, "one shared region per definition");
+    failed |= check(token_visits(orphan_tokens[0]) == 2 * NUM_THREADS,
+        "tokens outlive their thread");
+
+    /* A thread visits a region while its tokens end on another thread. */
+    void* visits_ok;
+    pthread_create(threads, NULL, visit_mixed, mixed_tokens);
+    pthread_join(threads[0], &visits_ok);
+    failed |= check(visits_ok && token_visits(mixed_tokens) == MIXED_VISITS,
+        "token and ordinary visits mix");
+
+    /* Visits shorter than the snapshot reuse window still measure. */
+    Region* short_region = NULL;
+    EMA_region_define(&short_region, "short", filter, "tests/tokens.c", 0, "");
+    int empty = 0;
+    for(int i = 0; i < SHORT_VISITS; ++i)
+    {
+        RegionToken token = EMA_region_begin_token(short_region);
+        const Measurements* measured = &token.region->region->measurements;
+        unsigned long long before = measured->time_result[0];
+        busy_wait(SHORT_US);
+        EMA_region_end_token(&token);
+        empty += measured->time_result[0] == before;
+    }
+    failed |= check(empty == 0, "short visits");
+
+    Region* all;
+    Filter* exclude_rapl = EMA_filter_exclude_plugin("RAPL");
+    EMA_region_create_and_init(&all, "all", exclude_rapl, "", 0, "");
+    RegionToken token = EMA_region_begin_token(all);
+    failed |= check(token.region == NULL, "too many devices");
+
+    EMA_region_finalize(all);
+    EMA_region_finalize(region);
+    EMA_filter_finalize(exclude_rapl);
+    EMA_filter_finalize(filter);
+    EMA_finalize();
+
+    return failed;
+}
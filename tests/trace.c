@@ -0,0 +1,157 @@
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <EMA.h>
+#include <EMA/region/trace.h>
+
+#define MOCK_NUM_DEVICES 2
+
+#include "test_utils.h"
+
+#define RING_EVENTS 64
+#define VISITS 10
+#define BURST 2000
+
+static atomic_int running;
+static Filter* filter;
+
+/* Per thread, events alternate between begin and end with growing time and
+ * energy. */
+static
+int check_events(const TraceFileHeader* header, const char* idf)
+{
+    const TraceRegion* region = NULL;
+    for(uint64_t i = 0; i < header->num_regions; ++i)
+        if( strcmp(EMA_trace_file_region(header, i)->idf, idf) == 0 )
+            region = EMA_trace_file_region(header, i);
+    if( !region || region->size != 2 )
+        return 0;
+
+    const TraceEvent* last = NULL;
+    uint64_t count = 0;
+    for(uint64_t i = 0; i < header->num_events; ++i)
+    {
+        const TraceEvent* event = EMA_trace_file_event(header, i);
+        if( event->region_id != region->id )
+            continue;
+        if( event->type != count % 2 || event->size != 2 )
+            return 0;
+        if( last && (event->time_ns < last->time_ns
+            || event->energy[0] < last->energy[0]) )
+            return 0;
+        last = event;
+        ++count;
+    }
+    return count == 2 * VISITS;
+}
+
+static
+void* visit_until_stopped(void* arg)
+{
+    Region* busy = NULL;
+    EMA_region_define(&busy, "busy", filter, "tests/trace.c", 0, "visit");
+    while( running )
+    {
+        EMA_region_begin(busy);
+        EMA_region_end(busy);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+
+    setenv("EMA_TRACE", "1", 1);
+    setenv("EMA_TRACE_RING", "64", 1);
+    int err = EMA_init(register_mock);
+    if( err )
+    {
+        printf("Failed to initialize EMA: %d\n", err);
+        return 1;
+    }
+
+    filter = EMA_filter_exclude_plugin("RAPL");
+
+    /* Stop the trace while threads hold their rings, then trace again into
+     * a new file; the rings of the first trace are retired by their
+     * threads. */
+    Region* busy = NULL;
+    EMA_region_define(&busy, "busy", filter, "tests/trace.c", 0, "main");
+    running = 1;
+    pthread_t thread;
+    pthread_create(&thread, NULL, visit_until_stopped, NULL);
+    for(int i = 0; i < BURST; ++i)
+    {
+        EMA_region_begin(busy);
+        EMA_region_end(busy);
+    }
+    failed |= check(EMA_trace_stop() == 0, "stop while recording");
+    EMA_region_begin(busy);
+    EMA_region_end(busy);
+    running = 0;
+    pthread_join(thread, NULL);
+    failed |= check(EMA_trace_start(RING_EVENTS) == 0, "trace again");
+
+    EMA_REGION_DECLARE(slow);
+    EMA_REGION_DEFINE_WITH_FILTER(&slow, "slow", filter);
+    EMA_REGION_DECLARE(burst);
+    EMA_REGION_DEFINE_WITH_FILTER(&burst, "burst", filter);
+
+    for(int i = 0; i < VISITS; ++i)
+    {
+        EMA_REGION_BEGIN(slow);
+        usleep(1000);
+        EMA_REGION_END(slow);
+    }
+    failed |= check(EMA_trace_get_dropped() == 0, "no drops while slow");
+
+    /* Faster than the flusher drains a ring of 64 events. */
+    for(int i = 0; i < BURST; ++i)
+    {
+        EMA_REGION_BEGIN(burst);
+        EMA_REGION_END(burst);
+    }
+    unsigned long long dropped = EMA_trace_get_dropped();
+    failed |= check(dropped > 0, "drops when the ring is full");
+
+    EMA_filter_finalize(filter);
+    EMA_finalize();
+
+    char filename[64];
+    snprintf(filename, sizeof(filename), "trace.EMA.%u", getpid());
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if( fd < 0 || fstat(fd, &st) != 0 )
+    {
+        printf("Failed to open %s\n", filename);
+        return 1;
+    }
+    const TraceFileHeader* header =
+        mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    failed |= check(header != MAP_FAILED
+        && memcmp(header->magic, EMA_TRACE_MAGIC, 8) == 0
+        && header->num_regions == 2, "header");
+    failed |= check(header->region_offset
+        + header->num_regions * header->region_size == st.st_size, "layout");
+    printf("events: %llu, dropped: %llu\n",
+        (unsigned long long) header->num_events,
+        (unsigned long long) header->dropped);
+    failed |= check(header->dropped >= dropped
+        && header->num_events + header->dropped == 2 * (VISITS + BURST),
+        "event count");
+    failed |= check(check_events(header, "slow"), "slow region events");
+
+    munmap((void*) header, st.st_size);
+    return failed;
+}
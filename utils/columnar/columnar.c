@@ -0,0 +1,186 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <EMA/region/columnar.user.h>
+
+#define printl(MSG) do { printf(MSG "\n"); } while(0)
+
+/* The columns the CSV needs, mapped in place. */
+typedef struct
+{
+    const int32_t* thread;
+    const uint32_t* region;
+    const uint32_t* device;
+    const uint8_t* stale;
+    const uint64_t* integers[EMA_COLUMNAR_COLUMNS];
+    const double* moments[EMA_COLUMNAR_COLUMNS];
+} Columns;
+
+static
+int map_columns(const void* file, const ColumnarIndex* index, Columns* cols)
+{
+    memset(cols, 0, sizeof(Columns));
+    cols->thread = EMA_columnar_file_column(file, index, EMA_COLUMN_THREAD);
+    cols->region = EMA_columnar_file_column(file, index, EMA_COLUMN_REGION);
+    cols->device = EMA_columnar_file_column(file, index, EMA_COLUMN_DEVICE);
+    cols->stale = EMA_columnar_file_column(file, index, EMA_COLUMN_STALE);
+    int missing = !cols->thread || !cols->region || !cols->device
+        || !cols->stale;
+
+    for(int i = EMA_COLUMN_VISITS; i < EMA_COLUMNAR_COLUMNS; ++i)
+    {
+        const void* column = EMA_columnar_file_column(file, index, i);
+        missing |= !column;
+        if( i >= EMA_COLUMN_ENERGY_MIN && i <= EMA_COLUMN_POWER_STD )
+            cols->moments[i] = column;
+        else if( i != EMA_COLUMN_STALE )
+            cols->integers[i] = column;
+    }
+    if( missing )
+        printl("The file lacks columns.");
+    return missing;
+}
+
+static
+void print_moments(const Columns* cols, int first, uint64_t row)
+{
+    if( isnan(cols->moments[first][row]) )
+    {
+        printf(",,,,");
+        return;
+    }
+    for(int i = first; i < first + 4; ++i)
+        printf(",%.6g", cols->moments[i][row]);
+}
+
+static
+void print_percentiles(const Columns* cols, int first, uint64_t row)
+{
+    for(int i = first; i < first + 3; ++i)
+    {
+        uint64_t value = cols->integers[i][row];
+        if( value == EMA_COLUMNAR_NO_PERCENTILE )
+            printf(",");
+        else
+            printf(",%llu", (unsigned long long) value);
+    }
+}
+
+static
+int print_rows(const void* file, const ColumnarIndex* index)
+{
+    Columns cols;
+    if( map_columns(file, index, &cols) )
+        return 1;
+
+    const ColumnarRegion* regions = (const ColumnarRegion*) (
+        (const char*) file + index->region_offset);
+    const ColumnarDevice* devices = (const ColumnarDevice*) (
+        (const char*) file + index->device_offset);
+    static const ColumnarRegion no_region;
+    static const ColumnarDevice no_device = {
+        .name = UINT32_MAX, .uid = UINT32_MAX, .type = UINT32_MAX };
+
+    printl("thread,region_idf,file,line,function,visits,"
+        "device_name,device_uid,device_type,energy,time,stale,"
+        "energy_min,energy_max,energy_mean,energy_std,"
+        "time_min,time_max,time_mean,time_std,"
+        "power_min,power_max,power_mean,power_std,"
+        "energy_p50,energy_p90,energy_p99,time_p50,time_p90,time_p99,"
+        "measured_visits,energy_error");
+    for(uint64_t row = 0; row < index->num_rows; ++row)
+    {
+        const ColumnarRegion* region = cols.region[row] < index->num_regions
+            ? regions + cols.region[row] : &no_region;
+        const ColumnarDevice* device = cols.device[row] < index->num_devices
+            ? devices + cols.device[row] : &no_device;
+
+        printf("%d,%s,%s,%u,%s,%llu,%s,%s,%s,%llu,%llu,%u",
+            cols.thread[row],
+            EMA_columnar_file_string(file, index, region->idf),
+            EMA_columnar_file_string(file, index, region->file),
+            region->line,
+            EMA_columnar_file_string(file, index, region->function),
+            (unsigned long long) cols.integers[EMA_COLUMN_VISITS][row],
+            EMA_columnar_file_string(file, index, device->name),
+            EMA_columnar_file_string(file, index, device->uid),
+            EMA_columnar_file_string(file, index, device->type),
+            (unsigned long long) cols.integers[EMA_COLUMN_ENERGY][row],
+            (unsigned long long) cols.integers[EMA_COLUMN_TIME][row],
+            cols.stale[row]);
+        print_moments(&cols, EMA_COLUMN_ENERGY_MIN, row);
+        print_moments(&cols, EMA_COLUMN_TIME_MIN, row);
+        print_moments(&cols, EMA_COLUMN_POWER_MIN, row);
+        print_percentiles(&cols, EMA_COLUMN_ENERGY_P50, row);
+        print_percentiles(&cols, EMA_COLUMN_TIME_P50, row);
+        printf(",%llu,%llu\n",
+            (unsigned long long) cols.integers[EMA_COLUMN_MEASURED_VISITS][row],
+            (unsigned long long) cols.integers[EMA_COLUMN_ENERGY_ERROR][row]);
+    }
+    return 0;
+}
+
+static
+void print_summary(const ColumnarIndex* index)
+{
+    printf("rows: %llu\n", (unsigned long long) index->num_rows);
+    printf("regions: %llu\n", (unsigned long long) index->num_regions);
+    printf("devices: %llu\n", (unsigned long long) index->num_devices);
+    printf("strings: %llu\n", (unsigned long long) index->num_strings);
+    printf("columns: %u\n", index->num_columns);
+}
+
+int main(int argc, char** argv)
+{
+    int summary = argc == 3 && strcmp(argv[1], "-s") == 0;
+    if( argc != 2 && !summary )
+    {
+        printl("USAGE: ema_columnar [-s] FILE");
+        return EXIT_FAILURE;
+    }
+
+    const char* filename = argv[argc - 1];
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if( fd < 0 || fstat(fd, &st) != 0 )
+    {
+        perror(filename);
+        return EXIT_FAILURE;
+    }
+
+    size_t size = st.st_size;
+    const void* file = NULL;
+    if( size )
+        file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if( file == MAP_FAILED )
+    {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+
+    const ColumnarIndex* index = file ? EMA_columnar_file_index(file, size)
+        : NULL;
+    if( !index )
+    {
+        printl("Not a complete EMA columnar output file.");
+        if( file )
+            munmap((void*) file, size);
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_SUCCESS;
+    if( summary )
+        print_summary(index);
+    else if( print_rows(file, index) )
+        status = EXIT_FAILURE;
+
+    munmap((void*) file, size);
+    return status;
+}
@@ -0,0 +1,168 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <EMA/region/trace.user.h>
+
+#define printl(MSG) do { printf(MSG "\n"); } while(0)
+
+static const char* EVENT_NAMES[] = { "begin", "end" };
+
+static
+int compare_regions(const void* a, const void* b)
+{
+    uint64_t id_a = (*(const TraceRegion* const*) a)->id;
+    uint64_t id_b = (*(const TraceRegion* const*) b)->id;
+    return id_a < id_b ? -1 : id_a > id_b;
+}
+
+static
+const TraceRegion* find_region(
+    const TraceRegion** regions, uint64_t num_regions, uint64_t id)
+{
+    TraceRegion key = { .id = id };
+    const TraceRegion* key_ptr = &key;
+    const TraceRegion** found = bsearch(
+        &key_ptr, regions, num_regions, sizeof(TraceRegion*), compare_regions);
+    return found ? *found : NULL;
+}
+
+/* Sizes and offsets must describe records within the file. */
+static
+int check_header(const TraceFileHeader* header, size_t size)
+{
+    if( size < sizeof(TraceFileHeader)
+        || memcmp(header->magic, EMA_TRACE_MAGIC, sizeof(header->magic)) != 0 )
+    {
+        printl("Not an EMA trace file.");
+        return 1;
+    }
+    if( header->version != EMA_TRACE_VERSION )
+    {
+        printf("Unsupported trace version %u.\n", header->version);
+        return 1;
+    }
+    if( header->event_size < sizeof(TraceEvent)
+        || header->region_size < sizeof(TraceRegion)
+        || header->device_offset + header->num_devices * sizeof(TraceDevice)
+            > size
+        || header->event_offset + header->num_events * header->event_size
+            > size
+        || header->region_offset + header->num_regions * header->region_size
+            > size )
+    {
+        printl("Truncated trace file; was the traced process finalized?");
+        return 1;
+    }
+    return 0;
+}
+
+static
+void print_summary(const TraceFileHeader* header, const TraceDevice* devices)
+{
+    printf("devices: %u\n", header->num_devices);
+    for(uint32_t i = 0; i < header->num_devices; ++i)
+        printf("  %u: %s (%s, %s)\n",
+            i, devices[i].name, devices[i].type, devices[i].uid);
+    printf("regions: %llu\n", (unsigned long long) header->num_regions);
+    printf("events: %llu\n", (unsigned long long) header->num_events);
+    printf("dropped: %llu\n", (unsigned long long) header->dropped);
+}
+
+static
+void print_events(
+    const TraceFileHeader* header, const TraceDevice* devices,
+    const TraceRegion** regions)
+{
+    printl("thread,region_id,region_idf,event,time_ns,device_name,energy");
+    for(uint64_t i = 0; i < header->num_events; ++i)
+    {
+        const TraceEvent* event = EMA_trace_file_event(header, i);
+        const TraceRegion* region =
+            find_region(regions, header->num_regions, event->region_id);
+
+        for(uint16_t j = 0; j < event->size; ++j)
+        {
+            const char* device = "";
+            if( region && j < region->size
+                && region->devices[j] < header->num_devices )
+                device = devices[region->devices[j]].name;
+
+            printf("%u,%llu,%s,%s,%llu,%s,%llu\n",
+                event->thread,
+                (unsigned long long) event->region_id,
+                region ? region->idf : "",
+                event->type <= EMA_TRACE_END ? EVENT_NAMES[event->type] : "",
+                (unsigned long long) event->time_ns,
+                device,
+                (unsigned long long) event->energy[j]);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int summary = argc == 3 && strcmp(argv[1], "-s") == 0;
+    if( argc != 2 && !summary )
+    {
+        printl("USAGE: ema_trace [-s] FILE");
+        return EXIT_FAILURE;
+    }
+
+    const char* filename = argv[argc - 1];
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if( fd < 0 || fstat(fd, &st) != 0 )
+    {
+        perror(filename);
+        return EXIT_FAILURE;
+    }
+
+    size_t size = st.st_size;
+    const TraceFileHeader* header = NULL;
+    if( size )
+        header = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if( header == MAP_FAILED )
+    {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+
+    static const TraceFileHeader empty;
+    if( check_header(header ? header : &empty, size) )
+        return EXIT_FAILURE;
+
+    const TraceDevice* devices = (const TraceDevice*) (
+        (const char*) header + header->device_offset);
+
+    int status = EXIT_SUCCESS;
+    if( summary )
+        print_summary(header, devices);
+    else
+    {
+        const TraceRegion** regions = malloc(
+            sizeof(TraceRegion*) * (header->num_regions + 1));
+        if( !regions )
+        {
+            perror("malloc");
+            status = EXIT_FAILURE;
+        }
+        else
+        {
+            for(uint64_t i = 0; i < header->num_regions; ++i)
+                regions[i] = EMA_trace_file_region(header, i);
+            qsort(regions, header->num_regions, sizeof(TraceRegion*),
+                compare_regions);
+            print_events(header, devices, regions);
+            free(regions);
+        }
+    }
+
+    munmap((void*) header, size);
+    return status;
+}